@@ -1,21 +1,37 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+
 // 16-bit mono background music streamed to aplay.
+typedef struct {
+    int fd;            // Pipe to aplay, -1 when stopped
+    pid_t pid;
+    double time;       // Position in the track in seconds
+    bool enabled;
+    float volume;
+} AudioState;
+
+// Stopped, at the default volume
+void audio_init(AudioState* audio);
 
 // Returns 0 on success, non-zero on failure.
-int audio_start(void);
+int audio_start(AudioState* audio);
 
 // Generate and stream audio for elapsed time (seconds). No-op if audio disabled.
-void audio_step(double dt);
+void audio_step(AudioState* audio, double dt);
 
 // Stop background music and clean up any child process.
-void audio_stop(void);
+void audio_stop(AudioState* audio);
 
 // Adjust volume by delta. Clamped to [0, 1].
-void audio_adjust_volume(float delta);
+void audio_adjust_volume(AudioState* audio, float delta);
+
+// True while music is streaming and needs periodic audio_step calls.
+bool audio_is_enabled(const AudioState* audio);
 
 // Get current master volume in [0, 1].
-float audio_get_volume(void);
+float audio_get_volume(const AudioState* audio);
 
 #endif // AUDIO_H
@@ -0,0 +1,83 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include "vec3.h"
+#include "matrix.h"
+#include "input.h"
+#include <stdbool.h>
+
+#define BODIES_MAX 4096
+#define BODIES_SUBSTEP (1.0f / 120.0f)  // Fixed physics step in seconds
+// World units per model unit. Rendered at this half-extent the bodies sit in
+// world units, and occlusion and shadows are sized to one cube.
+#define BODIES_UNIT 0.15f
+
+// A solid box. Static bodies (the ground platform) have zero inverse mass.
+typedef struct {
+    Vec3 position;
+    Vec3 velocity;
+    Vec3 angular_velocity;
+    Mat3 rotation;         // Columns are the box axes in world space
+    Vec3 half_extents;
+    float radius;          // Bounding sphere
+    float inv_mass;
+    Vec3 inv_inertia;      // Diagonal of the inverse inertia in body axes
+    float still_time;      // Seconds spent below the sleep speeds
+    bool asleep;
+} RigidBody;
+
+// Many boxes falling onto a platform. Physics advances in fixed substeps
+// however long the frames are; the spatial hash finds pairs in linear time.
+typedef struct BodyWorld {
+    RigidBody* bodies;     // Static bodies first
+    int count;
+    int static_count;
+    float accumulator;     // Frame time not yet simulated
+    unsigned long version; // Bumped whenever a body moves
+    unsigned int seed;
+
+    // Broadphase: dynamic bodies bucketed by the cell of their center
+    float hash_cell;
+    int hash_size;         // Power of two
+    int* hash_start;       // hash_size + 1 offsets into hash_bodies
+    int* hash_bodies;
+
+    // Distance queries: every body listed in each cell of a uniform grid
+    // that its box, grown by grid_margin, overlaps
+    Vec3 grid_origin;
+    float grid_cell;
+    float grid_margin;
+    int grid_dims[3];
+    int* grid_start;
+    int* grid_bodies;
+    int grid_capacity;
+    unsigned char* grid_clearance; // Cells to the nearest cell listing a body
+    float bound;           // Radius around the origin holding every body
+
+    // Contacts of this substep and of the last one, sorted by pair, whose
+    // impulses start the solver off where it finished
+    struct BodyContact* contacts;
+    int contact_capacity;
+    struct BodyContact* previous_contacts;
+    int previous_count;
+    int previous_capacity;
+} BodyWorld;
+
+// count cubes dropped in a loose column over the platform; NULL on failure
+BodyWorld* body_world_create(int count, unsigned int seed);
+void body_world_destroy(BodyWorld* world);
+
+// Advance by frame_dt in BODIES_SUBSTEP steps. W/A/S/D push the pile, M
+// throws every cube back up.
+void body_world_step(BodyWorld* world, InputState input, float frame_dt);
+
+// True while any body is awake
+bool body_world_is_animating(const BodyWorld* world);
+
+// Dynamic bodies still being simulated
+int body_world_awake_count(const BodyWorld* world);
+
+// Lower bound on the distance to the nearest body, exact within grid_margin
+float body_world_distance(const BodyWorld* world, Vec3 point);
+
+#endif // BODIES_H
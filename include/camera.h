@@ -0,0 +1,28 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "vec3.h"
+#include <stdbool.h>
+
+// Pinhole camera looking down -Z, mapping terminal cells to rays.
+// Cell coordinates are continuous: (x + 0.5, y + 0.5) is the center of cell (x, y).
+typedef struct {
+    Vec3 position;
+    float aspect;      // Horizontal scale correcting for ~2:1 terminal cells
+    float scale;       // tan(fov / 2)
+    float inv_width;
+    float inv_height;
+    int width;
+    int height;
+} Camera;
+
+Camera camera_create(int width, int height);
+
+// Normalized ray direction through continuous cell coordinates (fx, fy)
+Vec3 camera_ray(const Camera* cam, float fx, float fy);
+
+// Project a world point to continuous cell coordinates.
+// Returns false if the point is behind the camera.
+bool camera_project(const Camera* cam, Vec3 point, float* fx, float* fy);
+
+#endif // CAMERA_H
@@ -0,0 +1,28 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "render.h"
+#include <stddef.h>
+
+// Growable byte buffer holding encoded terminal output
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} ByteBuffer;
+
+void byte_buffer_init(ByteBuffer* buf);
+void byte_buffer_free(ByteBuffer* buf);
+
+// Make room for at least extra more bytes. Returns 0 on success.
+int byte_buffer_reserve(ByteBuffer* buf, size_t extra);
+
+// Append a whole frame (cursor home, every row, color reset) to out.
+// Returns 0 on success, -1 on allocation failure.
+int frame_encode_full(const Framebuffer* fb, ByteBuffer* out);
+
+// Append only the cells of cur that differ from prev, using cursor jumps.
+// Falls back to a full frame when prev is NULL or has other dimensions.
+int frame_encode_diff(const Framebuffer* prev, const Framebuffer* cur, ByteBuffer* out);
+
+#endif // ENCODE_H
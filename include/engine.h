@@ -0,0 +1,98 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "render.h"
+#include "physics.h"
+#include "input.h"
+#include "audio.h"
+#include "rain.h"
+#include "sdf_grid.h"
+#include "sdf_program.h"
+#include "bodies.h"
+#include <stdbool.h>
+
+typedef struct {
+    float cube_size;
+    float rotation_speed;
+    float light_x;
+    float light_y;
+    float light_z;
+    Light extra_lights[RENDER_MAX_LIGHTS - 1]; // From --light and --lights, after the key light
+    int extra_light_count;
+    int shadow_budget;      // Shadow rays marched per sample
+    int max_raymarch_steps; // Most distance evaluations per primary ray
+    bool rain;
+    int rain_drops;
+    bool audio;
+    bool orbit;             // Start with the motion path enabled
+    const char* serve_path; // Broadcast frames on this Unix socket instead of drawing locally
+    const char* shm_name;   // Publish frames to this POSIX shared-memory ring
+    RenderMode render_mode;
+    bool full_shading;      // Disable the convex-cube shadow/AO shortcuts
+    bool temporal_aa;       // Antialias cell mode by accumulating jittered frames
+    bool ascii;             // Draw with single-byte ASCII glyphs
+    RenderQuality quality;  // Shading preset, changed at runtime with P
+    HeatmapMetric heatmap;  // Start with this cost heatmap shown
+    const char* cost_dump_path; // Write the last frame's per-cell costs here on exit
+    const char* trace_path; // Write a Chrome trace-event timeline here on exit
+    const char* model_path; // OBJ model rendered in place of the cube
+    int model_resolution;   // Samples per axis of the model's distance grid
+    const char* scene_path; // CSG scene rendered in place of the cube
+    int body_count;         // Simulate this many falling cubes instead of the one cube
+    int benchmark_frames;   // Render this many frames headless, print timings and exit
+    const char* record_path; // Record the frames shown to this file
+    const char* play_path;  // Play this recording instead of rendering
+    double play_speed;      // Starting playback speed multiplier
+    bool stream;            // Show frames piped to stdin instead of rendering
+    int grid_width;         // Render size when there is no terminal to ask
+    int grid_height;
+} Config;
+
+// One session: the shape and its simulation, rain, lights, renderer, frame
+// and music. Engines share no state, so a process can run any number of
+// them, each driven from its own thread.
+typedef struct {
+    Config config;
+    SdfShape shape;          // What the frames show; owns one of the three below
+    SdfGrid* grid;           // --model
+    SdfProgram* program;     // --scene
+    BodyWorld* bodies;       // --bodies
+    CubeState cube;
+    PhysicsConfig physics;
+    Light lights[RENDER_MAX_LIGHTS];
+    int light_count;
+    RainSystem* rain;
+    Renderer* renderer;
+    Scene scene;
+    Framebuffer* fb;         // The engine's own frame, see engine_render
+    const Framebuffer* last_target;  // Holds the last frame, so only changes are drawn
+    AudioState audio;        // Stopped until audio_start(&engine->audio)
+} Engine;
+
+// The defaults every option starts from
+void engine_default_config(Config* config);
+
+// Load the model or scene named in config and set up a session rendering
+// width x height frames. Returns NULL (after printing why) on failure.
+Engine* engine_create(const Config* config, int width, int height);
+void engine_destroy(Engine* engine);
+
+// Replace the engine's frame with a width x height one. Returns 0 on success.
+int engine_resize(Engine* engine, int width, int height);
+
+// Advance the cube or the bodies by dt seconds, applying input
+void engine_step(Engine* engine, InputState input, float dt);
+
+// Advance the rain by dt seconds while it is switched on
+void engine_update_rain(Engine* engine, float dt);
+
+// True while frames would differ from the last one
+bool engine_is_animating(const Engine* engine);
+
+// Render the current state into target, a framebuffer owned by the caller,
+// or into engine->fb if target is NULL. Only the cells that changed are
+// written while target is the one rendered into last and was left alone
+// since; any other target is drawn in full.
+void engine_render(Engine* engine, Framebuffer* target, FrameStats stats);
+
+#endif // ENGINE_H
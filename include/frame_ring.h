@@ -0,0 +1,75 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include "render.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Shared-memory ring of completed frames for external consumers.
+//
+// Layout: FrameRingHeader, then slot_count slots spaced slot_stride bytes
+// apart. Each slot is a FrameRingSlot followed by slot_capacity cells.
+//
+// Readers map the object read-only and use two seqlocks without taking any
+// lock: `layout` (odd while the ring is being resized) and each slot's
+// `sequence` (odd while the slot is being written). Read the counter, read
+// the cells in place, then re-read the counter; if it changed, try again.
+
+#define FRAME_RING_MAGIC   0x474E5246u  // "FRNG"
+#define FRAME_RING_VERSION 2
+#define FRAME_RING_SLOTS   4
+
+typedef struct {
+    uint32_t codepoint;   // Unicode scalar value
+    uint8_t color;        // COLOR_* code
+    uint8_t reserved[3];
+} FrameRingCell;
+
+typedef struct {
+    _Atomic uint64_t sequence;  // Even when stable, odd while being written
+    uint64_t frame_number;
+    uint32_t width;
+    uint32_t height;
+} FrameRingSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint64_t layout;     // Even when stable, odd while resizing
+    _Atomic uint64_t published;  // Frames published so far; newest is (published - 1) % slot_count
+    uint32_t slot_count;
+    uint32_t slot_capacity;      // Cells per slot
+    uint64_t slot_stride;        // Bytes from one slot header to the next
+    uint64_t total_size;         // Bytes in the mapping
+    uint32_t producer_pid;       // Process publishing to the ring
+    uint32_t reserved;
+} FrameRingHeader;
+
+static inline FrameRingSlot* frame_ring_slot(FrameRingHeader* header, uint64_t index) {
+    return (FrameRingSlot*)((char*)header + sizeof(FrameRingHeader) +
+                            (index % header->slot_count) * header->slot_stride);
+}
+
+static inline FrameRingCell* frame_ring_cells(FrameRingSlot* slot) {
+    return (FrameRingCell*)(slot + 1);
+}
+
+typedef struct {
+    char name[64];
+    int fd;
+    FrameRingHeader* header;
+    size_t size;
+} FrameRing;
+
+// Create the POSIX shared-memory object `name` sized for width x height
+// frames. A ring left by a producer that has exited is replaced; a live
+// one, or an object that is not a ring, is not. Returns NULL on failure.
+FrameRing* frame_ring_create(const char* name, int width, int height);
+
+// Remove the shared-memory object and unmap it
+void frame_ring_destroy(FrameRing* ring);
+
+// Publish a completed frame. Grows the ring if fb no longer fits.
+int frame_ring_publish(FrameRing* ring, const Framebuffer* fb, uint64_t frame_number);
+
+#endif // FRAME_RING_H
@@ -3,21 +3,44 @@
 
 #include <stdbool.h>
 
+#define INPUT_PENDING_MAX 32
+
 typedef struct {
     bool w_pressed;
     bool a_pressed;
     bool s_pressed;
     bool d_pressed;
     bool m_pressed;
+    bool r_pressed;
+    bool h_pressed;
+    bool p_pressed;
     bool quit_requested;
+    bool focused;          // Terminal focus as reported by focus events
     int volume_delta;
+    double event_time;     // CLOCK_MONOTONIC seconds when the oldest unconsumed event was read; 0 if none
+    int cursor_reports;    // Cursor position reports read, replies to output probes
+
+    // Escape-sequence bytes split across reads, carried to the next read
+    unsigned char pending[INPUT_PENDING_MAX];
+    int pending_len;
 } InputState;
 
 // Initialize input system (non-blocking mode)
 int input_init(void);
 
-// Poll for input with timeout_ms (0 for non-blocking)
-void input_poll(InputState* state, int timeout_ms);
+// Read all bytes available on stdin and decode them into state.
+// Returns number of bytes decoded other than cursor position reports, 0 if
+// nothing else was available, -1 on EOF.
+int input_read(InputState* state);
+
+// True if an incomplete escape sequence is waiting for more bytes
+bool input_has_pending(const InputState* state);
+
+// Resolve an incomplete escape sequence after the ESC timeout (bare ESC quits)
+void input_flush(InputState* state);
+
+// Clear per-frame key state once it has been consumed by physics
+void input_consume(InputState* state);
 
 // Cleanup input system
 void input_cleanup(void);
@@ -0,0 +1,53 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+
+// Exact microsecond buckets below 32 us, then 16 buckets per power of two,
+// which keeps every bucket within about 6% of its value up to two minutes
+#define LATENCY_LINEAR_BUCKETS 32
+#define LATENCY_SUB_BUCKETS 16
+#define LATENCY_BUCKETS 384
+
+typedef struct {
+    unsigned long counts[LATENCY_BUCKETS];
+    unsigned long count;
+    double max;            // Largest sample in seconds
+} LatencyHistogram;
+
+// Where an input event's time goes between being read and reaching the screen
+typedef enum {
+    LATENCY_QUEUE,         // Read until the frame that consumes it starts
+    LATENCY_RENDER,        // Physics, rain and render_cube
+    LATENCY_WRITE,         // Frame export until the frame is shown: the terminal
+                           // answered the probe sent behind it or, without
+                           // probes, the frame left our output buffer
+    LATENCY_TOTAL,         // Read until the frame is shown
+    LATENCY_STAGE_COUNT
+} LatencyStage;
+
+extern const char* const LATENCY_STAGE_NAMES[LATENCY_STAGE_COUNT];
+
+typedef struct {
+    LatencyHistogram stages[LATENCY_STAGE_COUNT];
+} LatencyStats;
+
+void latency_record(LatencyHistogram* histogram, double seconds);
+
+// Value in seconds below which the fraction p (0-1) of samples fall; 0 if empty
+double latency_percentile(const LatencyHistogram* histogram, double p);
+
+// An input event on its way to the screen
+typedef struct {
+    double event_time;     // Read from the terminal; 0 for no event
+    double frame_start;    // The first frame to apply it started
+    double render_done;    // That frame finished rendering
+} LatencyEvent;
+
+// Record an event whose frame reached the screen at shown
+void latency_record_event(LatencyStats* stats, LatencyEvent event, double shown);
+
+// Table of p50/p99/max per stage; prints nothing if no event was recorded
+void latency_print_summary(const LatencyStats* stats, FILE* out);
+
+#endif // LATENCY_H
@@ -1,14 +1,7 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-typedef struct {
-    float cube_size;
-    float rotation_speed;
-    float light_x;
-    float light_y;
-    float light_z;
-    int max_raymarch_steps;
-} Config;
+#include "engine.h"
 
 // Parse command line arguments
 int parse_args(int argc, char** argv, Config* config);
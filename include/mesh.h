@@ -0,0 +1,20 @@
+#ifndef MESH_H
+#define MESH_H
+
+// Indexed triangle mesh
+typedef struct {
+    float* vertices;      // x, y, z per vertex
+    int vertex_count;
+    int* triangles;       // Three vertex indices per triangle
+    int triangle_count;
+} Mesh;
+
+// Load the v/f records of a Wavefront OBJ file; polygons are split into
+// triangle fans. Returns NULL on failure.
+Mesh* mesh_load_obj(const char* path);
+void mesh_destroy(Mesh* mesh);
+
+// Center the mesh on the origin and scale it to fit the [-1, 1] cube
+void mesh_normalize(Mesh* mesh);
+
+#endif // MESH_H
@@ -0,0 +1,98 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "render.h"
+#include "encode.h"
+#include "latency.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// Frames allowed on the way to the terminal before their replies come back
+#define OUTPUT_MAX_IN_FLIGHT 8
+// Queueing delay above the best round trip that counts as a backlog
+#define OUTPUT_LATENCY_BUDGET 0.1
+// Poll interval while waiting for the link to drain
+#define OUTPUT_RETRY_MS 10
+
+// A cursor position query sent behind a frame. The terminal answers once it
+// has parsed everything before it, so the reply marks the frame as shown.
+typedef struct {
+    double sent;
+    unsigned long bytes;   // Bytes submitted up to and including the frame
+    LatencyEvent event;    // Input the frame is the first to show, if any
+} OutputProbe;
+
+// Terminal writes that never block. Frames are only accepted while the link
+// keeps up: the previous frame must have left our buffer and the kernel's,
+// and the frames still on their way (over SSH, in the network) must stay
+// within a window that shrinks when round trips grow. While throttled,
+// frames are sent as diffs against what the terminal will show.
+typedef struct {
+    int fd;
+    int saved_flags;
+    ByteBuffer pending;    // Current frame, not yet accepted by fd
+    size_t offset;
+    Framebuffer* shown;    // Screen once pending drains; base for diffs
+    bool keyframe_due;     // Screen contents unknown, send a full frame
+    double congested_until;  // Diffs until the link has kept up this long
+    unsigned long bytes_submitted;
+    size_t last_frame_bytes;
+    int kernel_queue;      // TIOCOUTQ bytes at the last check
+
+    // Round trips
+    bool probing;          // Terminal answers cursor position queries
+    OutputProbe probes[OUTPUT_MAX_IN_FLIGHT];  // Oldest first
+    int in_flight;
+    double window;         // Frames allowed in flight
+    double last_decrease;
+    double min_rtt[2];     // Best round trip of this and the previous period
+    double min_rtt_period;
+    double max_rtt;
+    unsigned long acked_bytes;
+    double acked_time;
+    double rate;           // Bytes per second reaching the terminal, smoothed
+
+    // Input latency, recorded once frames carrying events are shown
+    LatencyStats* latency; // NULL to not record
+    LatencyEvent draining; // Event of the pending frame when no probe times it
+
+    unsigned long frames_sent;
+    unsigned long keyframes_sent;
+    unsigned long ticks_skipped;  // Frame ticks merged while throttled
+    unsigned long replies;
+} TerminalOutput;
+
+// Take over fd (made non-blocking). Returns NULL on allocation failure.
+TerminalOutput* terminal_output_create(int fd);
+
+// Finish the frame on the wire, waiting up to a second, and restore fd's
+// flags. Call before anything else writes to the terminal.
+void terminal_output_finish(TerminalOutput* output);
+void terminal_output_destroy(TerminalOutput* output);
+
+// Whether the link can take another frame now
+bool terminal_output_ready(TerminalOutput* output, double now);
+
+// Encode fb and start writing it. event, if not NULL, is input fb is the
+// first frame to show; it goes to output->latency once fb is shown.
+// Returns -1 if the terminal went away.
+int terminal_output_submit(TerminalOutput* output, const Framebuffer* fb, double now,
+                           const LatencyEvent* event);
+
+// Write as much of the pending frame as fd takes. Returns -1 if the
+// terminal went away.
+int terminal_output_flush(TerminalOutput* output);
+
+// True while part of a frame waits for fd to become writable
+bool terminal_output_pending(const TerminalOutput* output);
+
+// Account for count cursor position reports read from the terminal
+void terminal_output_acknowledge(TerminalOutput* output, int count, double now);
+
+// The screen was changed behind our back (resize); next frame is full
+void terminal_output_invalidate(TerminalOutput* output);
+
+// One line of link statistics; prints nothing if output was never throttled
+void terminal_output_print_summary(const TerminalOutput* output, FILE* out);
+
+#endif // OUTPUT_H
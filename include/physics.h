@@ -5,6 +5,8 @@
 #include "matrix.h"
 #include "input.h"
 
+#define PHYSICS_STEP (1.0f / 120.0f)  // Fixed simulation step in seconds
+
 typedef struct {
     float acceleration;
     float damping;
@@ -18,8 +20,26 @@ typedef struct {
     float size;
     bool motion_mode;      // Whether cube is flying in a pattern
     float motion_phase;    // Current phase of the motion (0 to 2*PI)
+    bool m_was_pressed;    // M was held on the last step; motion toggles on the press
+    int steps_since_orthonormalize;
+
+    // Frame time not yet simulated, and the placement one PHYSICS_STEP
+    // before the current one, which frames are drawn between
+    float accumulator;
+    bool has_previous;
+    Mat3 previous_rotation;
+    Vec3 previous_position;
 } CubeState;
 
-void physics_step(CubeState* state, InputState input, PhysicsConfig config, float dt);
+// Apply input once, then advance by frame_dt in PHYSICS_STEP steps. The
+// time left over carries to the next call.
+void physics_step(CubeState* state, InputState input, PhysicsConfig config, float frame_dt);
+
+// The placement to draw: the last two steps blended by how far into the
+// next one the accumulated time reaches
+CubeState physics_interpolate(const CubeState* state);
+
+// True while the cube is spinning or flying; false once it has come to rest
+bool physics_is_animating(const CubeState* state);
 
 #endif // PHYSICS_H
@@ -0,0 +1,42 @@
+#ifndef RAIN_H
+#define RAIN_H
+
+#include "camera.h"
+#include "render.h"
+
+// Persistent rain drops in world space, stored as structure-of-arrays so
+// the update and projection loops vectorize.
+typedef struct RainSystem {
+    int count;
+    float* x;
+    float* y;
+    float* z;
+    float* vx;
+    float* vy;
+    float* vz;
+    float* life;       // Seconds left before the drop respawns
+    // Per-frame projection scratch
+    float* screen_x;
+    float* screen_y;
+    float* tail_y;
+    float* depth;      // Squared distance to the camera
+    int* visible;      // Indices of drops that land on screen
+    // Nearest drop per cell: depth bits with the streak glyph in the low bits
+    unsigned int* cell_keys;
+    int cell_count;
+    unsigned int seed;
+} RainSystem;
+
+// Create count drops scattered through the rain volume. Returns NULL on failure.
+RainSystem* rain_create(int count);
+void rain_destroy(RainSystem* rain);
+
+// Advance every drop by dt seconds and respawn those that landed or expired
+void rain_update(RainSystem* rain, float dt);
+
+// Project drops through cam and draw them as streaks of glyphs->rain,
+// depth-tested against fb->depth so the cube occludes drops behind it.
+// Returns the region drawn into; cells outside it are left untouched.
+CellRect rain_render(RainSystem* rain, Framebuffer* fb, const Camera* cam, const GlyphSet* glyphs);
+
+#endif // RAIN_H
@@ -3,18 +3,21 @@
 
 #include "vec3.h"
 #include "matrix.h"
+#include "sdf.h"
 #include <stdbool.h>
 
 typedef struct {
     int max_steps;
-    float epsilon;
+    float epsilon;         // Hit tolerance near the ray origin
     float max_distance;
+    float relaxation;      // Step scale for over-relaxed sphere tracing (1 = plain steps)
+    float footprint;       // Extra hit tolerance per unit of ray distance (pixel cone radius)
 } RaymarchConfig;
 
-// Raymarch from origin in direction
-// Returns true if hit, populates hit_point and normal
-bool raymarch(Vec3 origin, Vec3 direction, RaymarchConfig config,
-              Vec3* hit_point, Vec3* normal, Vec3 cube_center,
-              float cube_size, Mat3 cube_rotation);
+// Raymarch from origin in direction against object, starting t_start along
+// the ray. Returns true if hit, populates hit_point and normal; steps
+// receives the number of distance evaluations spent.
+bool raymarch(Vec3 origin, Vec3 direction, float t_start, RaymarchConfig config,
+              Vec3* hit_point, Vec3* normal, int* steps, const SdfInstance* object);
 
 #endif // RAYMARCH_H
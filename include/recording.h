@@ -0,0 +1,130 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include "render.h"
+#include "encode.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Recorded session: the frames that were shown, replayed without rendering.
+//
+// Layout: RecordingHeader, then one record per frame, then the keyframe
+// index and a RecordingTrailer.
+//
+// A record is a kind byte ('K' keyframe, 'D' delta), varint milliseconds
+// since the recording started, for keyframes varint width and height, then
+// a varint payload length and the payload. The payload is ops over the cells
+// in row order, each starting with a varint (count << 2 | op):
+//   RECORDING_OP_SKIP     count cells keep the previous frame's contents
+//   RECORDING_OP_FILL     a varint palette index fills count cells
+//   RECORDING_OP_LITERAL  count varint palette indices, one per cell
+//   RECORDING_OP_DEFINE   count palette entries, each a color byte and a
+//                         varint codepoint, appended before their first use
+// The palette starts empty at every keyframe, so a keyframe decodes alone.
+//
+// The index lists every keyframe, so a seek decodes at most
+// RECORDING_KEYFRAME_SECONDS of deltas. A file whose recorder never finished
+// has no index; the player then finds the keyframes by walking the records.
+
+#define RECORDING_MAGIC         0x43524341u  // "ACRC"
+#define RECORDING_INDEX_MAGIC   0x49524341u  // "ACRI"
+#define RECORDING_VERSION       1
+#define RECORDING_KEYFRAME_SECONDS 10.0
+
+#define RECORDING_OP_SKIP    0
+#define RECORDING_OP_FILL    1
+#define RECORDING_OP_LITERAL 2
+#define RECORDING_OP_DEFINE  3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+} RecordingHeader;
+
+typedef struct {
+    uint64_t offset;     // File offset of the keyframe's record
+    uint32_t time_ms;
+    uint32_t frame;      // Frames before it in the recording
+} RecordingIndexEntry;
+
+typedef struct {
+    uint64_t index_offset;
+    uint32_t index_count;
+    uint32_t duration_ms;  // Time of the last frame
+    uint32_t frame_count;
+    uint32_t magic;        // RECORDING_INDEX_MAGIC
+} RecordingTrailer;
+
+// A glyph in a color, as palette entries name them
+typedef struct {
+    uint32_t codepoint;
+    unsigned char color;
+} RecordingCell;
+
+typedef struct {
+    FILE* file;
+    Framebuffer* previous;     // Last frame written, base for the next delta
+    ByteBuffer record;
+    uint32_t* indices;         // Palette index of each cell of the frame being written
+    int indices_capacity;
+
+    // Palette since the last keyframe: an open-addressed table from
+    // codepoint << 8 | color (plus one, so zero marks a free slot) to index
+    uint64_t* palette_keys;
+    uint32_t* palette_values;
+    int palette_slots;         // Power of two
+    uint32_t palette_count;
+
+    uint64_t offset;           // Bytes written so far
+    uint32_t last_keyframe_ms;
+    uint32_t last_ms;
+    RecordingIndexEntry* index;
+    int index_count;
+    int index_capacity;
+    unsigned long frames;
+} Recorder;
+
+// Start a recording at path. Returns NULL on failure.
+Recorder* recorder_create(const char* path);
+
+// Append fb, shown seconds after the recording started. Returns 0 on
+// success, -1 on a write or allocation failure.
+int recorder_write(Recorder* recorder, const Framebuffer* fb, double seconds);
+
+// Write the index and close the file. Returns 0 on success.
+int recorder_finish(Recorder* recorder);
+void recorder_destroy(Recorder* recorder);
+
+// A recording mapped read-only. frame holds the last decoded frame.
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t records_end;        // Where the index starts, or the usable end
+    size_t next;               // Offset of the next record to decode
+    RecordingIndexEntry* index;
+    int index_count;
+    uint32_t duration_ms;
+    uint32_t frame_count;
+    Framebuffer* frame;        // NULL until a keyframe has been decoded
+    uint32_t time_ms;          // Time of frame
+    RecordingCell* palette;    // Entries defined since frame's keyframe
+    uint32_t palette_count;
+    uint32_t palette_capacity;
+} RecordingPlayer;
+
+// Map the recording at path. Returns NULL (after printing why) on failure.
+RecordingPlayer* recording_player_open(const char* path);
+void recording_player_close(RecordingPlayer* player);
+
+// Time of the record after frame in milliseconds, or -1 at the end
+int64_t recording_player_next_time(const RecordingPlayer* player);
+
+// Decode the next record into frame. Returns 1 if a frame was decoded, 0 at
+// the end, -1 if the record is corrupt.
+int recording_player_step(RecordingPlayer* player);
+
+// Decode the last frame shown at or before ms. Returns 0 on success.
+int recording_player_seek(RecordingPlayer* player, uint32_t ms);
+
+#endif // RECORDING_H
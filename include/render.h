@@ -4,15 +4,45 @@
 #include "vec3.h"
 #include "matrix.h"
 #include "physics.h"
+#include "sdf.h"
+#include "shadow_map.h"
 #include <wchar.h>
+#include <stdint.h>
 
+// ANSI color codes
+#define COLOR_NONE      0
+#define COLOR_CUBE      1  // Cyan for cube
+#define COLOR_GROUND    2  // Dark gray for ground
+#define COLOR_MOUNTAIN  3  // Blue-gray for mountains
+#define COLOR_BUILDING  4  // Yellow for buildings
+#define COLOR_RAIN      5  // Bright cyan for rain
+#define COLOR_SUN       6  // Bright yellow for sun
+#define COLOR_FPS       7  // White for FPS
+#define COLOR_SHADOW    8  // Darker gray for shadowed ground
+#define COLOR_COUNT     9
+
+#define RENDER_MAX_LIGHTS 16
+#define RENDER_GROUND_Y  -4.0f  // World height of the plane the ground rows show
+
+// Point light. Ambient terms of all lights add up; diffuse and specular
+// fade with distance and reach zero at range.
 typedef struct {
     Vec3 position;
     float ambient;
     float diffuse;
     float specular;
+    float range;       // 0 for a light that never fades
 } Light;
 
+// World state drawn by render_cube
+typedef struct {
+    CubeState* cube;              // Placement of the shape
+    const SdfShape* shape;        // Shape drawn at the cube; NULL for the plain cube
+    const Light* lights;          // lights[0] is the key light, drawn as the sun
+    int light_count;
+    struct RainSystem* rain;   // Drawn when settings.rain is on; may be NULL
+} Scene;
+
 typedef struct {
     int width;
     int height;
@@ -21,10 +51,165 @@ typedef struct {
     unsigned char* colors;  // Color codes for each character
 } Framebuffer;
 
+#define GLYPH_SHADE_LEVELS 13
+#define GLYPH_SHAPE_COUNT  22  // Partial-coverage patterns of shape mode
+
+// Every character the renderer draws, each list ordered dark to bright or
+// far to near. GLYPHS_ASCII keeps each cell to a single output byte.
+typedef struct {
+    wchar_t shade[GLYPH_SHADE_LEVELS];  // Cube shading; shade[0] is blank
+    wchar_t edge[5];                    // Box edges
+    wchar_t ground[5];                  // Horizon to foreground
+    wchar_t mountain[5];                // Base to peak
+    wchar_t building[3];                // Dark window, lit window, outline
+    wchar_t sun[6];                     // Halo to center
+    wchar_t rain[5];                    // Streak head, upper, mid and lower trail, tail
+    wchar_t hud[6];                     // Vertical, horizontal, then corners ╭ ╮ ╰ ╯
+    wchar_t shape[GLYPH_SHAPE_COUNT];   // Cube silhouette, one per shape pattern
+} GlyphSet;
+
+extern const GlyphSet GLYPHS_UNICODE;
+extern const GlyphSet GLYPHS_ASCII;
+
+typedef enum {
+    RENDER_MODE_CELL,       // One sample per cell, shaded glyph ramp
+    RENDER_MODE_HALFBLOCK,  // 1x2 samples per cell, ▀ ▄ █
+    RENDER_MODE_BRAILLE,    // 2x4 samples per cell, U+2800 braille dots
+    RENDER_MODE_SHAPE       // 4x4 coverage per cell matched to GlyphSet.shape
+} RenderMode;
+
+// Per-cell work shown in place of the cube's shading
+typedef enum {
+    HEATMAP_OFF,
+    HEATMAP_PRIMARY,    // Primary ray march steps
+    HEATMAP_SHADOW,     // Soft shadow march steps
+    HEATMAP_AO,         // Ambient occlusion taps
+    HEATMAP_SDF_CALLS,  // Every distance evaluation, normals included
+    HEATMAP_COUNT
+} HeatmapMetric;
+
+// Shading presets, cheapest first; each has its own compiled tile shaders
+typedef enum {
+    RENDER_QUALITY_LOW,     // No AO, shadow rays, ground shadow or edge glyphs
+    RENDER_QUALITY_MEDIUM,  // 3 AO taps, 8-step shadows
+    RENDER_QUALITY_HIGH,    // 5 AO taps, 16-step shadows
+    RENDER_QUALITY_ULTRA,   // High with 4 samples per cell in cell mode
+    RENDER_QUALITY_COUNT
+} RenderQuality;
+
+// Work spent on one cell the last time the cube was traced
+typedef struct {
+    uint32_t primary_steps;
+    uint32_t shadow_steps;
+    uint32_t ao_taps;
+    uint32_t sdf_calls;
+} CellCost;
+
+typedef struct {
+    bool rain;          // Animated rain behind the cube
+    RenderMode mode;
+    bool full_shading;  // March shadow and AO for every hit, even where
+                        // convexity already decides the result
+    HeatmapMetric heatmap;
+    int shadow_budget;  // Most shadow rays marched per sample; lights past it
+                        // reuse the visibility of the nearest marched light
+    bool temporal_aa;   // Cell mode: jitter the sample each frame and
+                        // accumulate it in a reprojected history
+    RenderQuality quality;
+    bool ascii;         // Cell and shape modes: draw with GLYPHS_ASCII
+    int max_steps;      // Most distance evaluations per primary ray
+} RenderSettings;
+
+// One cell of cube shading accumulated over frames
+typedef struct {
+    float intensity;   // Mean shade of the hits, fog applied
+    float coverage;    // Share of samples that hit the cube
+    float edge;        // Share of hits on a marked edge
+    float depth;       // Depth of the latest hit
+    Vec3 local;        // Cube-space point the cell is reprojected through: on
+                       // its center ray at the hit depth, or for a miss where
+                       // the ray passes closest to the cube
+    int count;         // Frames accumulated; 0 for none
+} TemporalSample;
+
+// Half-open range of cells [x0, x1) x [y0, y1)
+typedef struct {
+    int x0, y0, x1, y1;
+} CellRect;
+
+// Layers composited back to front into the output framebuffer
+typedef enum {
+    LAYER_BACKGROUND,  // Sky, mountains, buildings and ground; fully opaque
+    LAYER_SHADOW,      // Ground cells darkened by the cube's shadow
+    LAYER_CUBE,
+    LAYER_RAIN,        // Already depth-tested against the cube layer
+    LAYER_SUN,         // Opaque overlay; no rays are traced under it
+    LAYER_HUD,         // Opaque overlay; no rays are traced under it
+    LAYER_COUNT
+} LayerId;
+
+#define LAYER_MAX_DIRTY 2
+
+// Retained plane of cells; chars[i] == 0 marks a transparent cell
+typedef struct {
+    Framebuffer* cells;
+    CellRect dirty[LAYER_MAX_DIRTY];  // Regions that changed this frame
+    int dirty_count;
+} Layer;
+
+typedef struct {
+    RenderSettings settings;
+    int width;                 // Size the buffers below were made for
+    int height;
+    uint16_t* coverage;        // Per-cell subcell masks, one bit per sample
+    float* intensity;          // Per-cell mean shade of the subcell hits
+    unsigned char* shape_match; // Shape mode: candidate index for each 4x4 coverage mask
+    CellCost* costs;           // Per-cell work of the last cube trace
+    uint32_t cost_max;         // Largest heatmap metric in costs
+    unsigned long rays_traced; // Primary rays fired by the last render_cube
+    unsigned long march_steps; // Distance evaluations spent by those rays
+    int max_march_steps;       // Most evaluations spent by any one of them
+
+    // Temporal accumulation (settings.temporal_aa in cell mode)
+    TemporalSample* taa_current;    // This frame's jittered samples
+    TemporalSample* taa_history[2]; // Accumulated shading, alternating each trace
+    CellRect taa_rect;              // Cells the latest history covers
+    bool taa_valid;                 // Latest history can be reprojected
+    unsigned taa_frame;             // Traces so far; picks jitter and history
+    int taa_still;                  // Traces since the cube last moved
+
+    // Retained layers and what they were last drawn from
+    Layer layers[LAYER_COUNT];
+    bool layers_valid;           // False redraws every layer on the next frame
+    const Framebuffer* target;   // Framebuffer the layers were composited into
+    CubeState cube_drawn;
+    const SdfShape* shape_drawn;
+    unsigned long shape_version_drawn;
+    Light lights_drawn[RENDER_MAX_LIGHTS];
+    int light_count_drawn;
+    RenderMode mode_drawn;
+    HeatmapMetric heatmap_drawn;
+    RenderQuality quality_drawn;
+    CellRect cube_rect;          // Cells traced for the cube
+    CellRect rain_rect;
+    CellRect sun_bounds;         // Unclipped square around the sun
+    CellRect hud_rect;
+    CellRect shadow_rect;
+    ShadowMap shadow_map;        // The key light's view of the cube
+    char hud_fps[32];            // HUD text as last laid out
+    char hud_volume[16];
+    char hud_legend[32];
+    char hud_latency[32];
+} Renderer;
+
 typedef struct {
     float frame_time_ms;
     float fps;
     unsigned long frame_count;
+    unsigned long latency_events;  // Input events measured so far
+    float latency_p50_ms;          // Input read to frame written
+    float latency_p99_ms;
+    float volume;                  // Music volume shown in the HUD, 0 to 1
 } FrameStats;
 
 // Create/destroy framebuffer
@@ -34,13 +219,41 @@ void framebuffer_destroy(Framebuffer* fb);
 // Clear framebuffer
 void framebuffer_clear(Framebuffer* fb);
 
-// Render cube to framebuffer
-void render_cube(Framebuffer* fb, CubeState* cube, Light light, FrameStats stats);
+// Copy contents of src into dst; both must have the same dimensions
+void framebuffer_copy(Framebuffer* dst, const Framebuffer* src);
+
+// Create/destroy renderer; scratch buffers follow the framebuffer size
+Renderer* renderer_create(RenderSettings settings);
+void renderer_destroy(Renderer* renderer);
+
+// Force every layer to redraw, e.g. after the target framebuffer was recreated
+void renderer_invalidate(Renderer* renderer);
+
+// True while temporal accumulation wants more frames of a cube at rest
+bool renderer_is_settling(const Renderer* renderer);
+
+// Start of a cost dump file; width * height CellCost records follow in row order
+typedef struct {
+    char magic[4];      // "COST"
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved;
+} CostDumpHeader;
+
+// Write the per-cell costs of the last cube trace. Returns 0 on success.
+int renderer_dump_costs(const Renderer* renderer, const char* path);
+
+// Render the scene into fb. Layers are retained between calls, so only the
+// regions that changed since the previous call into the same fb are rewritten.
+void render_cube(Renderer* renderer, Framebuffer* fb, const Scene* scene, FrameStats stats);
 
 // Display framebuffer to terminal
 void framebuffer_display(Framebuffer* fb);
 
-// Map intensity to Unicode character
-wchar_t intensity_to_char(float intensity, bool is_edge);
+// Map intensity to a shading or edge glyph of glyphs
+wchar_t intensity_to_char(const GlyphSet* glyphs, float intensity, bool is_edge);
+
+// First row of ground below the mountains in a frame height rows tall
+int ground_horizon(int height);
 
 #endif // RENDER_H
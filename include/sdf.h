@@ -4,8 +4,52 @@
 #include "vec3.h"
 #include "matrix.h"
 
+struct SdfGrid;
+struct SdfProgram;
+struct BodyWorld;
+
+typedef enum {
+    SDF_SHAPE_CUBE,      // Analytic box
+    SDF_SHAPE_GRID,      // Baked distance grid of a mesh
+    SDF_SHAPE_PROGRAM,   // Compiled CSG scene
+    SDF_SHAPE_BODIES     // Simulated rigid bodies, in units of BODIES_UNIT
+} SdfShapeKind;
+
+// Shape in its own model space, where the cube is the [-1, 1] box
+typedef struct {
+    SdfShapeKind kind;
+    const struct SdfGrid* grid;         // SDF_SHAPE_GRID only
+    const struct SdfProgram* program;   // SDF_SHAPE_PROGRAM only
+    const struct BodyWorld* bodies;     // SDF_SHAPE_BODIES only
+} SdfShape;
+
+// A shape placed in the world: rotated, moved to position and scaled so
+// its model box has the given half-extent
+typedef struct {
+    const SdfShape* shape;
+    Vec3 position;
+    float half_extent;
+    Mat3 rotation;
+    Mat3 inv_rotation;
+} SdfInstance;
+
 // Signed distance function for a cube
 // Returns negative inside, positive outside, zero on surface
 float sdf_cube(Vec3 point, Vec3 cube_center, float half_extent, Mat3 rotation);
 
+SdfInstance sdf_instance(const SdfShape* shape, Vec3 position, float half_extent, Mat3 rotation);
+
+// Radius around the model origin that contains the shape, in model units
+float sdf_shape_bound(const SdfShape* shape);
+
+// Changes whenever a shape that moves by itself has moved; 0 for fixed shapes
+unsigned long sdf_shape_version(const SdfShape* shape);
+
+// Signed distance from a world-space point to the instance
+float sdf_evaluate(const SdfInstance* instance, Vec3 point);
+
+// Distances for several independent points (count <= SDF_EVALUATE_BATCH)
+#define SDF_EVALUATE_BATCH 8
+void sdf_evaluate_batch(const SdfInstance* instance, const Vec3* points, float* out, int count);
+
 #endif // SDF_H
@@ -0,0 +1,36 @@
+#ifndef SDF_GRID_H
+#define SDF_GRID_H
+
+#include "vec3.h"
+#include "mesh.h"
+#include <stddef.h>
+
+#define SDF_GRID_DEFAULT_RESOLUTION 64
+#define SDF_GRID_MIN_RESOLUTION     16
+#define SDF_GRID_MAX_RESOLUTION     256
+
+// Signed distances of a normalized mesh sampled on a regular grid that
+// covers the [-1, 1] model box plus a few cells of padding
+typedef struct SdfGrid {
+    int resolution;          // Samples per axis
+    float bound;             // Grid spans [-bound, bound] on each axis
+    float inv_cell_size;
+    const float* values;     // resolution^3 samples, x fastest
+    float* owned;            // Heap samples when baked in this run
+    void* mapping;           // Cache file mapping when loaded from disk
+    size_t mapping_size;
+} SdfGrid;
+
+// Bake a grid for a mesh already fitted to the [-1, 1] cube. Returns NULL on failure.
+SdfGrid* sdf_grid_bake(const Mesh* mesh, int resolution);
+
+// Grid for an OBJ model: maps the "<obj_path>.sdf" cache when it matches
+// the model and resolution, otherwise bakes one and rewrites the cache.
+// Returns NULL if the model cannot be loaded.
+SdfGrid* sdf_grid_load(const char* obj_path, int resolution);
+void sdf_grid_destroy(SdfGrid* grid);
+
+// Trilinear distance at a point in model space
+float sdf_grid_sample(const SdfGrid* grid, Vec3 p);
+
+#endif // SDF_GRID_H
@@ -0,0 +1,62 @@
+#ifndef SDF_PROGRAM_H
+#define SDF_PROGRAM_H
+
+#include "vec3.h"
+#include <stddef.h>
+
+// Deepest distance or transform stack a program may use
+#define SDF_PROGRAM_MAX_STACK 32
+// Points evaluated together by sdf_program_eval_batch
+#define SDF_PROGRAM_BATCH 8
+
+typedef enum {
+    SDF_OP_BOX,            // Push box distance; constants: half-extents x, y, z
+    SDF_OP_SPHERE,         // Push sphere distance; constants: radius
+    SDF_OP_TORUS,          // Push torus distance around Y; constants: major, minor radius
+    SDF_OP_UNION,          // Pop b, a; push min(a, b)
+    SDF_OP_INTERSECT,      // Pop b, a; push max(a, b)
+    SDF_OP_SUBTRACT,       // Pop b, a; push max(a, -b)
+    SDF_OP_SMOOTH_UNION,   // Pop b, a; push polynomial smooth min; constants: k
+    SDF_OP_TRANSFORM,      // Save the point, then p = M * p + o; constants: M (row-major), o
+    SDF_OP_RESTORE         // Restore the saved point, scale the top distance; constants: scale
+} SdfOpcode;
+
+typedef struct {
+    SdfOpcode op;
+    int constant;          // Index of the first constant in the pool
+} SdfInstruction;
+
+// A scene compiled to postfix code over a distance stack. Evaluation is a
+// single pass over the instructions with no recursion.
+typedef struct SdfProgram {
+    SdfInstruction* code;
+    int length;
+    float* constants;
+    int constant_count;
+    float bound;           // Radius around the origin that contains the surface
+} SdfProgram;
+
+// Compile scene source text. On failure returns NULL and writes a message
+// with the line number to error.
+//
+//   # comment
+//   box X Y Z | sphere R | torus MAJOR MINOR
+//   union { ... } | intersect { ... } | subtract { A B ... }
+//   smooth_union K { ... }
+//   translate X Y Z { ... } | rotate x|y|z DEGREES { ... } | scale S { ... }
+//
+// Several shapes in a block, or at the top level, are joined by union.
+SdfProgram* sdf_program_compile(const char* source, char* error, size_t error_size);
+
+// Read and compile a scene file
+SdfProgram* sdf_program_load(const char* path, char* error, size_t error_size);
+void sdf_program_destroy(SdfProgram* program);
+
+// Signed distance at a point in scene space
+float sdf_program_eval(const SdfProgram* program, Vec3 p);
+
+// Distances for up to SDF_PROGRAM_BATCH points; each instruction is decoded
+// once for the whole batch
+void sdf_program_eval_batch(const SdfProgram* program, const Vec3* points, float* out, int count);
+
+#endif // SDF_PROGRAM_H
@@ -0,0 +1,56 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "render.h"
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SERVER_MAX_CLIENTS 64
+// Frames a client may have queued before it is treated as slow
+#define SERVER_CLIENT_QUEUE 4
+
+// One encoded frame, shared by reference between all clients that queue it
+typedef struct {
+    int refs;
+    bool keyframe;
+    size_t len;
+    char data[];
+} EncodedFrame;
+
+typedef struct {
+    int fd;
+    EncodedFrame* queue[SERVER_CLIENT_QUEUE];  // Ring of frames to send
+    int head;
+    int count;
+    size_t offset;         // Bytes of queue[head] already sent
+    bool needs_keyframe;   // Next frame must be a keyframe (new or lagging client)
+} ServerClient;
+
+typedef struct {
+    int listen_fd;
+    char path[108];
+    ServerClient clients[SERVER_MAX_CLIENTS];
+    int client_count;
+    Framebuffer* last;     // Last published frame, base for the next diff
+    EncodedFrame* last_keyframe;  // Keyframe of last, shared by viewers joining before the next publish
+    unsigned long frames_published;
+    unsigned long keyframes_encoded;
+} BroadcastServer;
+
+// Listen on a Unix domain socket at path. Returns NULL on failure.
+BroadcastServer* server_create(const char* path);
+void server_destroy(BroadcastServer* server);
+
+// Encode fb once (diff and, only if someone needs it, a keyframe) and queue
+// it for every client. Slow clients drop diffs and resync with a keyframe.
+void server_publish(BroadcastServer* server, const Framebuffer* fb);
+
+// Fill pollfds for the listening socket and all clients. Returns count used.
+int server_fill_pollfds(BroadcastServer* server, struct pollfd* fds, int max_fds);
+
+// Accept new viewers, drain client sockets and flush queued frames.
+// Returns true if a new viewer connected and needs the current frame.
+bool server_handle_events(BroadcastServer* server, const struct pollfd* fds, int count);
+
+#endif // SERVER_H
@@ -0,0 +1,36 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "vec3.h"
+#include "sdf.h"
+#include <stdbool.h>
+
+#define SHADOW_MAP_SIZE 48  // Texels along each side
+
+// What a point light sees of one object: a small perspective map around the
+// object's bounding sphere. The plain cube is filled from the outline of its
+// corners; other shapes are marched, a block of texels per cone until the
+// cone nears the surface. Any number of points can then be tested against
+// the map without marching.
+typedef struct {
+    bool valid;              // False when the light is inside the bound
+    Vec3 light;
+    Vec3 forward;            // Light to the bound's center
+    Vec3 right;
+    Vec3 up;
+    float tan_half;          // Half the map's field of view
+    float depth[SHADOW_MAP_SIZE * SHADOW_MAP_SIZE];  // Distance to the object, huge for none
+    int x0, y0, x1, y1;      // Texels the object covers, plus a texel around
+} ShadowMap;
+
+// Rasterize object as seen from light; bound is its radius around its position
+void shadow_map_build(ShadowMap* map, const SdfInstance* object, float bound, Vec3 light);
+
+// Where the rays through the corners of the occupied texels meet the plane
+// y = ground_y. False if any of them never comes down to it.
+bool shadow_map_footprint(const ShadowMap* map, float ground_y, Vec3 corners[4]);
+
+// Share of the light the object blocks at point, 0 (lit) to 1
+float shadow_map_lookup(const ShadowMap* map, Vec3 point);
+
+#endif // SHADOW_MAP_H
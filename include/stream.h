@@ -0,0 +1,79 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "render.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Raw frames piped in: binary PGM (P5) or PPM (P6) images back to back, or
+// a YUV4MPEG2 stream, of which only the luma plane is kept. Samples are
+// 8 bits; PNM maxval may be below 255.
+//
+// A reader thread fills the two slots in turn, so the next frame is read
+// while the last one is drawn. It stops when both are full until one is
+// released.
+
+#define STREAM_DEFAULT_FPS 30.0  // Rate of PNM sequences, which carry none
+
+typedef struct {
+    unsigned char* pixels;  // Rows of width * channels bytes
+    size_t capacity;
+    int width;
+    int height;
+    int channels;           // 1 for gray or luma, 3 for RGB
+    int maxval;             // Sample value of full brightness
+    bool full;              // Holds a frame not yet released
+} StreamFrame;
+
+typedef struct {
+    int fd;
+    int event_fd;           // Readable once a frame was read or the stream ended
+    int stop_fd;            // Written to make the reader give up
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+    StreamFrame slots[2];
+    int fill;               // Slot the reader writes next
+    int take;               // Slot the next frame is taken from
+    bool ended;             // No frames after the ones in the slots
+    bool stopping;
+    char error[128];        // Why the stream ended early; empty at a clean end
+
+    // Input buffer and format state, owned by the reader
+    bool stopped;           // The reader saw stop_fd
+    unsigned char buffer[65536];
+    size_t buffer_start;
+    size_t buffer_end;
+    bool y4m;
+    int y4m_width;
+    int y4m_height;
+    size_t y4m_chroma;      // Chroma bytes following each luma plane
+    double fps;             // Frame rate from the Y4M header; 0 until known
+    unsigned long frames_read;
+
+    // Drawing, on the caller's thread
+    uint32_t* sums;         // Per source column, over a cell row's pixels
+    int sums_capacity;
+    wchar_t levels[256];    // Glyph of each average brightness
+    const GlyphSet* levels_glyphs;
+    int levels_maxval;
+} FrameStream;
+
+// Start reading frames from fd. Returns NULL on failure.
+FrameStream* frame_stream_open(int fd);
+void frame_stream_close(FrameStream* stream);
+
+// Scale the oldest frame read into fb as glyphs of glyphs, fitted to ~2:1
+// cells and centered, and release its slot to the reader. Every source
+// pixel is averaged into the cell covering it. Returns 1 if a frame was
+// drawn, 0 if none is ready, -1 on allocation failure.
+int frame_stream_draw(FrameStream* stream, Framebuffer* fb, const GlyphSet* glyphs);
+
+// True once every frame has been drawn and no more will come
+bool frame_stream_finished(FrameStream* stream);
+
+// Frames per second to show the stream at
+double frame_stream_fps(FrameStream* stream);
+
+#endif // STREAM_H
@@ -0,0 +1,25 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline of begin/end spans, written as Chrome trace-event JSON for
+// chrome://tracing or Perfetto. Each thread appends to its own buffer
+// without locks; nothing is recorded until trace_start.
+
+void trace_start(void);
+
+// Open and close a span on the calling thread. Names must be string
+// literals (they are stored by pointer and written unescaped).
+void trace_begin(const char* name);
+void trace_end(const char* name);
+
+// Label the calling thread in the viewer
+void trace_thread_name(const char* name);
+
+// Write every thread's events to path. Other threads must have stopped
+// recording. Returns 0 on success, -1 on failure.
+int trace_write(const char* path);
+
+// Stop recording and free the buffers once no other thread records
+void trace_stop(void);
+
+#endif // TRACE_H
@@ -12,18 +12,14 @@
 #define AUDIO_SAMPLE_RATE 44100.0
 #define TWO_PI 6.28318530717958647692
 
-static int audio_fd = -1;
-static pid_t audio_pid = -1;
-static double audio_time = 0.0;
-static bool audio_enabled = false;
-static float audio_volume = 0.4f;
+#define AUDIO_DEFAULT_VOLUME 0.4f
 
 static float square_wave(double t, float freq) {
     double phase = fmod(t * freq, 1.0);
     return phase < 0.5 ? 1.0f : -1.0f;
 }
 
-static float lofi_track_sample(double t) {
+static float lofi_track_sample(double t, float volume) {
     // Looping 2-bar pattern at 120 BPM
     const double bpm = 120.0;
     const double beat_len = 60.0 / bpm;      // seconds per beat
@@ -63,11 +59,15 @@ static float lofi_track_sample(double t) {
     // Soft clipping
     if (sample > 0.9f) sample = 0.9f;
     if (sample < -0.9f) sample = -0.9f;
-    return sample * audio_volume;
+    return sample * volume;
 }
 
-int audio_start(void) {
-    if (audio_enabled) {
+void audio_init(AudioState* audio) {
+    *audio = (AudioState){.fd = -1, .pid = -1, .volume = AUDIO_DEFAULT_VOLUME};
+}
+
+int audio_start(AudioState* audio) {
+    if (audio->enabled) {
         return 0;
     }
 
@@ -104,15 +104,15 @@ int audio_start(void) {
 
     // Parent
     close(pipefd[0]);
-    audio_fd = pipefd[1];
-    audio_pid = pid;
-    audio_time = 0.0;
-    audio_enabled = true;
+    audio->fd = pipefd[1];
+    audio->pid = pid;
+    audio->time = 0.0;
+    audio->enabled = true;
     return 0;
 }
 
-void audio_step(double dt) {
-    if (!audio_enabled || audio_fd < 0) {
+void audio_step(AudioState* audio, double dt) {
+    if (!audio->enabled || audio->fd < 0) {
         return;
     }
 
@@ -134,58 +134,62 @@ void audio_step(double dt) {
     int16_t buffer[4096];
 
     for (int i = 0; i < total_samples; i++) {
-        double t = audio_time + (double)i / AUDIO_SAMPLE_RATE;
-        float s = lofi_track_sample(t);
+        double t = audio->time + (double)i / AUDIO_SAMPLE_RATE;
+        float s = lofi_track_sample(t, audio->volume);
         int16_t v = (int16_t)(s * 32767.0f);
         buffer[i] = v;
     }
 
-    ssize_t bytes = write(audio_fd, buffer, (size_t)(total_samples * (int)sizeof(int16_t)));
+    ssize_t bytes = write(audio->fd, buffer, (size_t)(total_samples * (int)sizeof(int16_t)));
     (void)bytes; // Ignore short writes; aplay will simply stop if pipe closes.
 
-    audio_time += (double)total_samples / AUDIO_SAMPLE_RATE;
+    audio->time += (double)total_samples / AUDIO_SAMPLE_RATE;
 
     // Keep time bounded to avoid floating point drift over very long runs
-    if (audio_time > 60.0) {
-        audio_time -= 60.0;
+    if (audio->time > 60.0) {
+        audio->time -= 60.0;
     }
 }
 
-void audio_stop(void) {
-    if (!audio_enabled) {
+void audio_stop(AudioState* audio) {
+    if (!audio->enabled) {
         return;
     }
 
-    if (audio_fd >= 0) {
-        close(audio_fd);
-        audio_fd = -1;
+    if (audio->fd >= 0) {
+        close(audio->fd);
+        audio->fd = -1;
     }
 
-    if (audio_pid > 0) {
+    if (audio->pid > 0) {
         // Reap child if it is still running.
         int status;
-        waitpid(audio_pid, &status, WNOHANG);
-        audio_pid = -1;
+        waitpid(audio->pid, &status, WNOHANG);
+        audio->pid = -1;
     }
 
-    audio_enabled = false;
+    audio->enabled = false;
 }
 
-void audio_adjust_volume(float delta) {
-    if (!audio_enabled && delta == 0.0f) {
+void audio_adjust_volume(AudioState* audio, float delta) {
+    if (!audio->enabled && delta == 0.0f) {
         return;
     }
 
-    audio_volume += delta;
-    if (audio_volume < 0.0f) {
-        audio_volume = 0.0f;
-    } else if (audio_volume > 1.0f) {
-        audio_volume = 1.0f;
+    audio->volume += delta;
+    if (audio->volume < 0.0f) {
+        audio->volume = 0.0f;
+    } else if (audio->volume > 1.0f) {
+        audio->volume = 1.0f;
     }
 }
 
-float audio_get_volume(void) {
-    if (audio_volume < 0.0f) return 0.0f;
-    if (audio_volume > 1.0f) return 1.0f;
-    return audio_volume;
+bool audio_is_enabled(const AudioState* audio) {
+    return audio->enabled;
+}
+
+float audio_get_volume(const AudioState* audio) {
+    if (audio->volume < 0.0f) return 0.0f;
+    if (audio->volume > 1.0f) return 1.0f;
+    return audio->volume;
 }
@@ -0,0 +1,986 @@
+#include "bodies.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRAVITY            9.8f
+#define SOLVER_ITERATIONS  8
+#define MAX_SUBSTEPS       8       // A longer frame drops the rest instead of falling behind
+#define CONTACT_BETA       0.2f    // Share of the penetration corrected per substep
+#define CONTACT_SLOP       0.005f  // Penetration left alone so resting contacts persist
+#define CONTACT_MAX_PUSH   2.0f    // Cap on the separation speed from penetration alone
+#define MAX_PAIR_CONTACTS  4
+#define MAX_CLIP_POINTS    8
+#define MATCH_DISTANCE     0.02f   // Contacts this close across substeps are the same contact
+#define FRICTION           0.6f
+#define RESTITUTION        0.1f
+#define LINEAR_DAMPING     0.999f  // Velocity kept per substep
+#define ANGULAR_DAMPING    0.99f
+#define SLEEP_LINEAR       0.08f   // Bodies slower than this ...
+#define SLEEP_ANGULAR      0.15f
+#define SLEEP_SECONDS      0.5f    // ... for this long stop being simulated
+#define WAKE_SPEED         0.5f    // Awake bodies hitting sleepers this fast wake them
+#define KILL_HEIGHT        -8.0f   // Bodies that fall off the platform drop in again from above
+#define CUBE_HALF_MIN      0.11f
+#define CUBE_HALF_MAX      0.17f
+#define SPAWN_SPACING      0.45f   // Lattice step, wider than the largest cube's diagonal
+#define SPAWN_SPREAD       0.6f    // Share of the platform the drop covers
+#define SPAWN_HEIGHT       -1.0f   // Bottom layer of the first drop
+#define GRID_CELL          0.4f
+#define GRID_MAX_DIM       96
+
+// The platform the cubes land on, just inside the bottom of the view
+static const Vec3 PLATFORM_CENTER = {0.0f, -2.0f, -0.8f};
+static const Vec3 PLATFORM_HALF = {3.2f, 0.15f, 2.2f};
+
+// One velocity constraint of a contact, with everything the solver
+// iterations need precomputed
+typedef struct {
+    Vec3 axis;
+    Vec3 arm_a, arm_b;       // Lever arm crossed with the axis
+    Vec3 turn_a, turn_b;     // Spin change per unit impulse
+    float mass;              // Effective mass along the axis
+    float impulse;           // Accumulated over the solver iterations
+} ContactRow;
+
+typedef struct BodyContact {
+    int a, b;
+    Vec3 normal;             // From a to b
+    Vec3 point;
+    float depth;
+    float bias;              // Target separating speed
+    float inv_mass_a, inv_mass_b;
+    ContactRow rows[3];      // Normal, then two friction directions
+} BodyContact;
+
+static float random_unit(unsigned int* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return (float)(*state >> 8) / 16777216.0f;
+}
+
+static float random_range(unsigned int* state, float lo, float hi) {
+    return lo + (hi - lo) * random_unit(state);
+}
+
+static Vec3 body_axis(const RigidBody* body, int i) {
+    const float* m = body->rotation.m;
+    return (Vec3){m[i], m[3 + i], m[6 + i]};
+}
+
+static float axis_component(Vec3 v, int i) {
+    return i == 0 ? v.x : (i == 1 ? v.y : v.z);
+}
+
+static Vec3 vec3_scale_axes(Vec3 a, Vec3 b) {
+    return (Vec3){a.x * b.x, a.y * b.y, a.z * b.z};
+}
+
+// Sleeping bodies hold still like static ones until something wakes them
+static float effective_inv_mass(const RigidBody* body) {
+    return body->asleep ? 0.0f : body->inv_mass;
+}
+
+static Vec3 apply_inv_inertia(const RigidBody* body, Vec3 v) {
+    if (body->asleep || body->inv_mass == 0.0f) {
+        return (Vec3){0, 0, 0};
+    }
+    Vec3 local = mat3_multiply_vec3(mat3_transpose(body->rotation), v);
+    return mat3_multiply_vec3(body->rotation, vec3_scale_axes(local, body->inv_inertia));
+}
+
+// Half-width of the box's projection onto a unit axis
+static float box_support(const RigidBody* body, Vec3 axis) {
+    float extent = 0.0f;
+    for (int i = 0; i < 3; i++) {
+        extent += axis_component(body->half_extents, i) * fabsf(vec3_dot(body_axis(body, i), axis));
+    }
+    return extent;
+}
+
+static float box_distance(const RigidBody* body, Vec3 p) {
+    Vec3 local = mat3_multiply_vec3(mat3_transpose(body->rotation), vec3_subtract(p, body->position));
+    Vec3 d = {fabsf(local.x) - body->half_extents.x,
+              fabsf(local.y) - body->half_extents.y,
+              fabsf(local.z) - body->half_extents.z};
+    float outside = vec3_length((Vec3){fmaxf(d.x, 0.0f), fmaxf(d.y, 0.0f), fmaxf(d.z, 0.0f)});
+    return outside + fminf(fmaxf(d.x, fmaxf(d.y, d.z)), 0.0f);
+}
+
+// World-space half-size of the box's axis-aligned bounds
+static Vec3 box_aabb_extent(const RigidBody* body) {
+    const float* m = body->rotation.m;
+    Vec3 h = body->half_extents;
+    return (Vec3){
+        fabsf(m[0]) * h.x + fabsf(m[1]) * h.y + fabsf(m[2]) * h.z,
+        fabsf(m[3]) * h.x + fabsf(m[4]) * h.y + fabsf(m[5]) * h.z,
+        fabsf(m[6]) * h.x + fabsf(m[7]) * h.y + fabsf(m[8]) * h.z
+    };
+}
+
+// Keep the part of a convex polygon where dot(p, normal) <= offset
+static int clip_polygon(const Vec3* in, int count, Vec3 normal, float offset, Vec3* out) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        Vec3 p = in[i];
+        Vec3 q = in[(i + 1) % count];
+        float dp = vec3_dot(p, normal) - offset;
+        float dq = vec3_dot(q, normal) - offset;
+        if (dp <= 0.0f) {
+            out[kept++] = p;
+        }
+        if ((dp < 0.0f) != (dq < 0.0f) && dp != dq) {
+            out[kept++] = vec3_add(p, vec3_multiply(vec3_subtract(q, p), dp / (dp - dq)));
+        }
+    }
+    return kept;
+}
+
+// Face contact: clip the face of the incident box turned most against the
+// reference face to that face's sides, and keep what lies below it
+static int face_contacts(const RigidBody* reference, int axis, Vec3 ref_normal, const RigidBody* incident,
+                         Vec3 points[MAX_PAIR_CONTACTS], float depths[MAX_PAIR_CONTACTS]) {
+    Vec3 face_center = vec3_add(reference->position,
+                                vec3_multiply(ref_normal, axis_component(reference->half_extents, axis)));
+    Vec3 side_u = body_axis(reference, (axis + 1) % 3);
+    Vec3 side_v = body_axis(reference, (axis + 2) % 3);
+    float extent_u = axis_component(reference->half_extents, (axis + 1) % 3);
+    float extent_v = axis_component(reference->half_extents, (axis + 2) % 3);
+
+    int incident_axis = 0;
+    float most = -1.0f;
+    for (int i = 0; i < 3; i++) {
+        float d = fabsf(vec3_dot(body_axis(incident, i), ref_normal));
+        if (d > most) {
+            most = d;
+            incident_axis = i;
+        }
+    }
+    Vec3 n = body_axis(incident, incident_axis);
+    float toward = vec3_dot(n, ref_normal) > 0.0f ? -1.0f : 1.0f;
+    Vec3 center = vec3_add(incident->position,
+                           vec3_multiply(n, toward * axis_component(incident->half_extents, incident_axis)));
+    Vec3 u = vec3_multiply(body_axis(incident, (incident_axis + 1) % 3),
+                           axis_component(incident->half_extents, (incident_axis + 1) % 3));
+    Vec3 v = vec3_multiply(body_axis(incident, (incident_axis + 2) % 3),
+                           axis_component(incident->half_extents, (incident_axis + 2) % 3));
+
+    Vec3 polygon[MAX_CLIP_POINTS] = {
+        vec3_add(center, vec3_add(u, v)),
+        vec3_add(center, vec3_subtract(v, u)),
+        vec3_subtract(center, vec3_add(u, v)),
+        vec3_add(center, vec3_subtract(u, v))
+    };
+    Vec3 clipped[MAX_CLIP_POINTS];
+    int count = 4;
+    float cu = vec3_dot(face_center, side_u), cv = vec3_dot(face_center, side_v);
+    count = clip_polygon(polygon, count, side_u, cu + extent_u, clipped);
+    count = clip_polygon(clipped, count, vec3_multiply(side_u, -1.0f), extent_u - cu, polygon);
+    count = clip_polygon(polygon, count, side_v, cv + extent_v, clipped);
+    count = clip_polygon(clipped, count, vec3_multiply(side_v, -1.0f), extent_v - cv, polygon);
+
+    // Of the points below the face keep the furthest out along each diagonal,
+    // which spans the contact area with at most four
+    int best[MAX_PAIR_CONTACTS] = {-1, -1, -1, -1};
+    float reach[MAX_PAIR_CONTACTS] = {-INFINITY, -INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < count; i++) {
+        if (vec3_dot(vec3_subtract(polygon[i], face_center), ref_normal) >= 0.0f) {
+            continue;
+        }
+        float du = vec3_dot(polygon[i], side_u), dv = vec3_dot(polygon[i], side_v);
+        float along[MAX_PAIR_CONTACTS] = {du + dv, dv - du, -du - dv, du - dv};
+        for (int d = 0; d < MAX_PAIR_CONTACTS; d++) {
+            if (along[d] > reach[d]) {
+                reach[d] = along[d];
+                best[d] = i;
+            }
+        }
+    }
+    int kept = 0;
+    for (int d = 0; d < MAX_PAIR_CONTACTS; d++) {
+        bool repeat = best[d] < 0;
+        for (int e = 0; e < d; e++) {
+            repeat |= best[e] == best[d];
+        }
+        if (repeat) {
+            continue;
+        }
+        float separation = vec3_dot(vec3_subtract(polygon[best[d]], face_center), ref_normal);
+        points[kept] = vec3_subtract(polygon[best[d]], vec3_multiply(ref_normal, 0.5f * separation));
+        depths[kept] = -separation;
+        kept++;
+    }
+    return kept;
+}
+
+// Edge of the box along the given axis that reaches furthest along direction
+static Vec3 support_edge_center(const RigidBody* body, int axis, Vec3 direction) {
+    Vec3 center = body->position;
+    for (int i = 0; i < 3; i++) {
+        if (i != axis) {
+            Vec3 a = body_axis(body, i);
+            float sign = vec3_dot(a, direction) > 0.0f ? 1.0f : -1.0f;
+            center = vec3_add(center, vec3_multiply(a, sign * axis_component(body->half_extents, i)));
+        }
+    }
+    return center;
+}
+
+// Edge contact: one point midway between the closest points of the two edges
+static Vec3 edge_contact(const RigidBody* a, int axis_a, const RigidBody* b, int axis_b, Vec3 n) {
+    Vec3 pa = support_edge_center(a, axis_a, n);
+    Vec3 pb = support_edge_center(b, axis_b, vec3_multiply(n, -1.0f));
+    Vec3 da = body_axis(a, axis_a);
+    Vec3 db = body_axis(b, axis_b);
+    float ea = axis_component(a->half_extents, axis_a);
+    float eb = axis_component(b->half_extents, axis_b);
+
+    Vec3 r = vec3_subtract(pa, pb);
+    float d = vec3_dot(da, db);
+    float denom = 1.0f - d * d;
+    float ta = 0.0f, tb = 0.0f;
+    if (denom > 1e-6f) {
+        ta = (d * vec3_dot(db, r) - vec3_dot(da, r)) / denom;
+        ta = fminf(fmaxf(ta, -ea), ea);
+    }
+    tb = fminf(fmaxf(vec3_dot(db, vec3_add(r, vec3_multiply(da, ta))), -eb), eb);
+    Vec3 ca = vec3_add(pa, vec3_multiply(da, ta));
+    Vec3 cb = vec3_add(pb, vec3_multiply(db, tb));
+    return vec3_multiply(vec3_add(ca, cb), 0.5f);
+}
+
+// Separating-axis test over the 15 candidate axes. On overlap returns the
+// contact normal from a to b along the axis of least penetration and the
+// contact points: a clipped face for face axes, one point for edge axes.
+static int collide_boxes(const RigidBody* a, const RigidBody* b, Vec3* normal,
+                         Vec3 points[MAX_PAIR_CONTACTS], float depths[MAX_PAIR_CONTACTS]) {
+    Vec3 offset = vec3_subtract(b->position, a->position);
+    Vec3 axes[15];
+    for (int i = 0; i < 3; i++) {
+        axes[i] = body_axis(a, i);
+        axes[3 + i] = body_axis(b, i);
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            axes[6 + i * 3 + j] = vec3_cross(axes[i], axes[3 + j]);
+        }
+    }
+
+    float face_overlap = INFINITY, edge_overlap = INFINITY;
+    Vec3 face_axis = {0, 1, 0}, edge_axis = {0, 1, 0};
+    int face_index = 0, edge_index = 6;
+    for (int k = 0; k < 15; k++) {
+        float length = vec3_length(axes[k]);
+        if (length < 1e-4f) {
+            continue;  // Parallel edges; the face axes cover them
+        }
+        Vec3 axis = vec3_multiply(axes[k], 1.0f / length);
+        float distance = vec3_dot(offset, axis);
+        float overlap = box_support(a, axis) + box_support(b, axis) - fabsf(distance);
+        if (overlap < 0.0f) {
+            return 0;
+        }
+        if (distance < 0.0f) {
+            axis = vec3_multiply(axis, -1.0f);
+        }
+        if (k < 6 && overlap < face_overlap) {
+            face_overlap = overlap;
+            face_axis = axis;
+            face_index = k;
+        } else if (k >= 6 && overlap < edge_overlap) {
+            edge_overlap = overlap;
+            edge_axis = axis;
+            edge_index = k;
+        }
+    }
+
+    // Face contacts are steadier, so an edge axis has to be clearly better
+    if (edge_overlap < face_overlap * 0.95f - 0.001f) {
+        *normal = edge_axis;
+        points[0] = edge_contact(a, (edge_index - 6) / 3, b, (edge_index - 6) % 3, edge_axis);
+        depths[0] = edge_overlap;
+        return 1;
+    }
+    *normal = face_axis;
+    if (face_index < 3) {
+        return face_contacts(a, face_index, face_axis, b, points, depths);
+    }
+    return face_contacts(b, face_index - 3, vec3_multiply(face_axis, -1.0f), a, points, depths);
+}
+
+static void wake(RigidBody* body) {
+    body->asleep = false;
+    body->still_time = 0.0f;
+}
+
+static void drop_body(RigidBody* body, unsigned int* seed, Vec3 position) {
+    body->position = position;
+    body->velocity = (Vec3){0.0f, random_range(seed, -1.0f, 0.0f), 0.0f};
+    body->angular_velocity = (Vec3){random_range(seed, -1.5f, 1.5f), random_range(seed, -1.5f, 1.5f),
+                                    random_range(seed, -1.5f, 1.5f)};
+    body->rotation = mat3_multiply(mat3_rotate_x(random_range(seed, 0.0f, 6.2832f)),
+                                   mat3_multiply(mat3_rotate_y(random_range(seed, 0.0f, 6.2832f)),
+                                                 mat3_rotate_z(random_range(seed, 0.0f, 6.2832f))));
+    wake(body);
+}
+
+static void build_grid(BodyWorld* world);
+
+BodyWorld* body_world_create(int count, unsigned int seed) {
+    if (count < 1 || count > BODIES_MAX) {
+        return NULL;
+    }
+    BodyWorld* world = calloc(1, sizeof(BodyWorld));
+    if (!world) {
+        return NULL;
+    }
+    world->static_count = 1;
+    world->count = count + world->static_count;
+    world->seed = seed;
+    world->bodies = calloc((size_t)world->count, sizeof(RigidBody));
+
+    int hash_size = 16;
+    while (hash_size < 2 * count) {
+        hash_size *= 2;
+    }
+    world->hash_size = hash_size;
+    world->hash_start = malloc((size_t)(hash_size + 1) * sizeof(int));
+    world->hash_bodies = malloc((size_t)count * sizeof(int));
+    if (!world->bodies || !world->hash_start || !world->hash_bodies) {
+        body_world_destroy(world);
+        return NULL;
+    }
+
+    world->bodies[0] = (RigidBody){
+        .position = PLATFORM_CENTER,
+        .rotation = mat3_identity(),
+        .half_extents = PLATFORM_HALF,
+        .radius = vec3_length(PLATFORM_HALF)
+    };
+
+    // A column of cubes over the platform, one per lattice slot so none start
+    // out overlapping
+    int columns = (int)(2.0f * SPAWN_SPREAD * PLATFORM_HALF.x / SPAWN_SPACING);
+    int rows = (int)(2.0f * SPAWN_SPREAD * PLATFORM_HALF.z / SPAWN_SPACING);
+    float largest = 0.0f;
+    for (int i = world->static_count; i < world->count; i++) {
+        RigidBody* body = &world->bodies[i];
+        float h = random_range(&world->seed, CUBE_HALF_MIN, CUBE_HALF_MAX);
+        float mass = 8.0f * h * h * h;
+        float inertia = mass * 2.0f * h * h / 3.0f;
+        *body = (RigidBody){
+            .half_extents = {h, h, h},
+            .radius = h * sqrtf(3.0f),
+            .inv_mass = 1.0f / mass,
+            .inv_inertia = {1.0f / inertia, 1.0f / inertia, 1.0f / inertia}
+        };
+        largest = fmaxf(largest, body->radius);
+        int slot = i - world->static_count;
+        int column = slot % columns, row = slot / columns % rows, layer = slot / (columns * rows);
+        Vec3 corner = {PLATFORM_CENTER.x - SPAWN_SPREAD * PLATFORM_HALF.x, 0.0f,
+                       PLATFORM_CENTER.z - SPAWN_SPREAD * PLATFORM_HALF.z};
+        drop_body(body, &world->seed, (Vec3){
+            corner.x + ((float)column + 0.5f + random_range(&world->seed, -0.1f, 0.1f)) * SPAWN_SPACING,
+            SPAWN_HEIGHT + (float)layer * SPAWN_SPACING,
+            corner.z + ((float)row + 0.5f + random_range(&world->seed, -0.1f, 0.1f)) * SPAWN_SPACING
+        });
+    }
+    world->hash_cell = 2.0f * largest;
+    world->grid_margin = GRID_CELL * 0.5f;
+    build_grid(world);
+    return world;
+}
+
+void body_world_destroy(BodyWorld* world) {
+    if (world) {
+        free(world->bodies);
+        free(world->hash_start);
+        free(world->hash_bodies);
+        free(world->grid_start);
+        free(world->grid_bodies);
+        free(world->grid_clearance);
+        free(world->contacts);
+        free(world->previous_contacts);
+        free(world);
+    }
+}
+
+static int hash_cell_index(const BodyWorld* world, int x, int y, int z) {
+    unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u;
+    return (int)(h & (unsigned int)(world->hash_size - 1));
+}
+
+static void hash_cell_coords(const BodyWorld* world, Vec3 p, int* x, int* y, int* z) {
+    *x = (int)floorf(p.x / world->hash_cell);
+    *y = (int)floorf(p.y / world->hash_cell);
+    *z = (int)floorf(p.z / world->hash_cell);
+}
+
+// Counting sort of the dynamic bodies by bucket: afterwards bucket h holds
+// hash_bodies[hash_start[h] .. hash_start[h + 1])
+static void build_hash(BodyWorld* world) {
+    int dynamic = world->count - world->static_count;
+    memset(world->hash_start, 0, (size_t)(world->hash_size + 1) * sizeof(int));
+    for (int i = world->static_count; i < world->count; i++) {
+        int x, y, z;
+        hash_cell_coords(world, world->bodies[i].position, &x, &y, &z);
+        world->hash_start[hash_cell_index(world, x, y, z)]++;
+    }
+    for (int h = 1; h < world->hash_size; h++) {
+        world->hash_start[h] += world->hash_start[h - 1];
+    }
+    world->hash_start[world->hash_size] = dynamic;
+    for (int i = world->static_count; i < world->count; i++) {
+        int x, y, z;
+        hash_cell_coords(world, world->bodies[i].position, &x, &y, &z);
+        world->hash_bodies[--world->hash_start[hash_cell_index(world, x, y, z)]] = i;
+    }
+}
+
+static int compare_contacts(const void* a, const void* b) {
+    const BodyContact* ca = a;
+    const BodyContact* cb = b;
+    if (ca->a != cb->a) return ca->a < cb->a ? -1 : 1;
+    return (ca->b > cb->b) - (ca->b < cb->b);
+}
+
+// Start a new contact from the impulses of the nearest same-pair contact
+// of the last substep
+static void inherit_impulses(const BodyWorld* world, BodyContact* contact) {
+    int lo = 0, hi = world->previous_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const BodyContact* c = &world->previous_contacts[mid];
+        if (c->a < contact->a || (c->a == contact->a && c->b < contact->b)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    float best = MATCH_DISTANCE * MATCH_DISTANCE;
+    for (int k = lo; k < world->previous_count; k++) {
+        const BodyContact* old = &world->previous_contacts[k];
+        if (old->a != contact->a || old->b != contact->b) {
+            break;
+        }
+        Vec3 d = vec3_subtract(old->point, contact->point);
+        float distance = vec3_dot(d, d);
+        if (distance < best) {
+            best = distance;
+            for (int r = 0; r < 3; r++) {
+                contact->rows[r].impulse = old->rows[r].impulse;
+            }
+        }
+    }
+}
+
+static bool add_contacts(BodyWorld* world, int* count, int a, int b) {
+    const RigidBody* ba = &world->bodies[a];
+    const RigidBody* bb = &world->bodies[b];
+    Vec3 normal;
+    Vec3 points[MAX_PAIR_CONTACTS];
+    float depths[MAX_PAIR_CONTACTS];
+    int found = collide_boxes(ba, bb, &normal, points, depths);
+    if (found == 0) {
+        return true;
+    }
+    if (*count + found > world->contact_capacity) {
+        int capacity = world->contact_capacity ? world->contact_capacity * 2 : 1024;
+        while (capacity < *count + found) {
+            capacity *= 2;
+        }
+        BodyContact* grown = realloc(world->contacts, (size_t)capacity * sizeof(BodyContact));
+        if (!grown) {
+            return false;
+        }
+        world->contacts = grown;
+        world->contact_capacity = capacity;
+    }
+    for (int i = 0; i < found; i++) {
+        BodyContact* contact = &world->contacts[(*count)++];
+        *contact = (BodyContact){.a = a, .b = b, .normal = normal, .point = points[i], .depth = depths[i]};
+        inherit_impulses(world, contact);
+    }
+    return true;
+}
+
+// Candidate pairs from the bucket of each body's cell and its 26 neighbours,
+// each pair once, plus every dynamic body against the static ones. Returns
+// the number of contacts, or -1 if they did not fit in memory.
+static int find_contacts(BodyWorld* world) {
+    int count = 0;
+    for (int i = world->static_count; i < world->count; i++) {
+        const RigidBody* body = &world->bodies[i];
+        for (int s = 0; s < world->static_count; s++) {
+            const RigidBody* fixed = &world->bodies[s];
+            if (body->asleep || vec3_length(vec3_subtract(body->position, fixed->position)) >
+                                    body->radius + fixed->radius) {
+                continue;
+            }
+            if (!add_contacts(world, &count, s, i)) {
+                return -1;
+            }
+        }
+
+        int cx, cy, cz;
+        hash_cell_coords(world, body->position, &cx, &cy, &cz);
+        int visited[27];
+        int visited_count = 0;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    int h = hash_cell_index(world, cx + dx, cy + dy, cz + dz);
+                    bool seen = false;
+                    for (int v = 0; v < visited_count; v++) {
+                        seen |= visited[v] == h;
+                    }
+                    if (seen) {
+                        continue;  // Another neighbour shares the bucket
+                    }
+                    visited[visited_count++] = h;
+                    for (int k = world->hash_start[h]; k < world->hash_start[h + 1]; k++) {
+                        int j = world->hash_bodies[k];
+                        const RigidBody* other = &world->bodies[j];
+                        if (j <= i || (body->asleep && other->asleep)) {
+                            continue;
+                        }
+                        float reach = body->radius + other->radius;
+                        Vec3 d = vec3_subtract(other->position, body->position);
+                        if (vec3_dot(d, d) > reach * reach) {
+                            continue;
+                        }
+                        if (!add_contacts(world, &count, i, j)) {
+                            return -1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return count;
+}
+
+// A sleeper is woken by an awake body striking it, not by one resting on it
+static void wake_struck(BodyWorld* world, int count) {
+    for (int c = 0; c < count; c++) {
+        RigidBody* a = &world->bodies[world->contacts[c].a];
+        RigidBody* b = &world->bodies[world->contacts[c].b];
+        if (a->inv_mass == 0.0f || a->asleep == b->asleep) {
+            continue;
+        }
+        RigidBody* moving = a->asleep ? b : a;
+        if (vec3_length(moving->velocity) > WAKE_SPEED) {
+            wake(a->asleep ? a : b);
+        }
+    }
+}
+
+static inline float dot3(Vec3 a, Vec3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Vec3 add_scaled(Vec3 a, Vec3 b, float s) {
+    return (Vec3){a.x + b.x * s, a.y + b.y * s, a.z + b.z * s};
+}
+
+// Relative velocity of b against a along the row's axis
+static inline float row_velocity(const RigidBody* a, const RigidBody* b, const ContactRow* row) {
+    return dot3(b->velocity, row->axis) + dot3(b->angular_velocity, row->arm_b) -
+           dot3(a->velocity, row->axis) - dot3(a->angular_velocity, row->arm_a);
+}
+
+static inline void apply_row(RigidBody* a, RigidBody* b, const BodyContact* contact, const ContactRow* row,
+                             float impulse) {
+    a->velocity = add_scaled(a->velocity, row->axis, -impulse * contact->inv_mass_a);
+    a->angular_velocity = add_scaled(a->angular_velocity, row->turn_a, -impulse);
+    b->velocity = add_scaled(b->velocity, row->axis, impulse * contact->inv_mass_b);
+    b->angular_velocity = add_scaled(b->angular_velocity, row->turn_b, impulse);
+}
+
+// Precompute the rows, then apply the impulses carried over from the last
+// substep so the iterations only solve for the change
+static void prepare_contacts(BodyWorld* world, int count, float h) {
+    for (int c = 0; c < count; c++) {
+        BodyContact* contact = &world->contacts[c];
+        RigidBody* a = &world->bodies[contact->a];
+        RigidBody* b = &world->bodies[contact->b];
+        Vec3 ra = vec3_subtract(contact->point, a->position);
+        Vec3 rb = vec3_subtract(contact->point, b->position);
+        Vec3 n = contact->normal;
+        contact->inv_mass_a = effective_inv_mass(a);
+        contact->inv_mass_b = effective_inv_mass(b);
+
+        Vec3 helper = fabsf(n.x) < 0.57f ? (Vec3){1, 0, 0} : (Vec3){0, 1, 0};
+        Vec3 tangent = vec3_normalize(vec3_cross(n, helper));
+        Vec3 axes[3] = {n, tangent, vec3_cross(n, tangent)};
+        for (int r = 0; r < 3; r++) {
+            ContactRow* row = &contact->rows[r];
+            row->axis = axes[r];
+            row->arm_a = vec3_cross(ra, axes[r]);
+            row->arm_b = vec3_cross(rb, axes[r]);
+            row->turn_a = apply_inv_inertia(a, row->arm_a);
+            row->turn_b = apply_inv_inertia(b, row->arm_b);
+            float k = contact->inv_mass_a + contact->inv_mass_b + dot3(row->arm_a, row->turn_a) +
+                      dot3(row->arm_b, row->turn_b);
+            row->mass = k > 0.0f ? 1.0f / k : 0.0f;
+        }
+
+        float approach = row_velocity(a, b, &contact->rows[0]);
+        contact->bias = fminf(CONTACT_BETA / h * fmaxf(contact->depth - CONTACT_SLOP, 0.0f), CONTACT_MAX_PUSH);
+        if (approach < -1.0f) {
+            contact->bias = fmaxf(contact->bias, -RESTITUTION * approach);
+        }
+    }
+    for (int c = 0; c < count; c++) {
+        BodyContact* contact = &world->contacts[c];
+        for (int r = 0; r < 3; r++) {
+            apply_row(&world->bodies[contact->a], &world->bodies[contact->b], contact, &contact->rows[r],
+                      contact->rows[r].impulse);
+        }
+    }
+}
+
+// Sequential impulses with accumulated clamping: push apart, then friction
+// bounded by the normal impulse
+static void solve_contacts(BodyWorld* world, int count) {
+    for (int iteration = 0; iteration < SOLVER_ITERATIONS; iteration++) {
+        for (int c = 0; c < count; c++) {
+            BodyContact* contact = &world->contacts[c];
+            RigidBody* a = &world->bodies[contact->a];
+            RigidBody* b = &world->bodies[contact->b];
+
+            ContactRow* row = &contact->rows[0];
+            float previous = row->impulse;
+            row->impulse = fmaxf(previous + row->mass * (contact->bias - row_velocity(a, b, row)), 0.0f);
+            apply_row(a, b, contact, row, row->impulse - previous);
+
+            float limit = FRICTION * row->impulse;
+            for (int r = 1; r < 3; r++) {
+                row = &contact->rows[r];
+                previous = row->impulse;
+                row->impulse = fminf(fmaxf(previous - row->mass * row_velocity(a, b, row), -limit), limit);
+                apply_row(a, b, contact, row, row->impulse - previous);
+            }
+        }
+    }
+}
+
+// Returns true while any body is awake. Allocation failure skips the step,
+// keeping the previous contacts, rather than letting bodies fall through
+// each other.
+static bool substep(BodyWorld* world, float h) {
+    for (int i = world->static_count; i < world->count; i++) {
+        RigidBody* body = &world->bodies[i];
+        if (body->position.y < KILL_HEIGHT) {
+            drop_body(body, &world->seed, (Vec3){
+                PLATFORM_CENTER.x + random_range(&world->seed, -SPAWN_SPREAD, SPAWN_SPREAD) * PLATFORM_HALF.x,
+                random_range(&world->seed, 4.0f, 6.0f),
+                PLATFORM_CENTER.z + random_range(&world->seed, -SPAWN_SPREAD, SPAWN_SPREAD) * PLATFORM_HALF.z
+            });
+        }
+    }
+
+    build_hash(world);
+    int count = find_contacts(world);
+    if (count < 0) {
+        return true;
+    }
+    for (int i = world->static_count; i < world->count; i++) {
+        RigidBody* body = &world->bodies[i];
+        if (!body->asleep) {
+            body->velocity.y -= GRAVITY * h;
+        }
+    }
+    wake_struck(world, count);
+    prepare_contacts(world, count, h);
+    solve_contacts(world, count);
+
+    // This substep's contacts seed the next one
+    BodyContact* contacts = world->contacts;
+    int capacity = world->contact_capacity;
+    world->contacts = world->previous_contacts;
+    world->contact_capacity = world->previous_capacity;
+    world->previous_contacts = contacts;
+    world->previous_capacity = capacity;
+    world->previous_count = count;
+    qsort(world->previous_contacts, (size_t)count, sizeof(BodyContact), compare_contacts);
+
+    bool awake = false;
+    for (int i = world->static_count; i < world->count; i++) {
+        RigidBody* body = &world->bodies[i];
+        if (body->asleep) {
+            continue;
+        }
+        body->velocity = vec3_multiply(body->velocity, LINEAR_DAMPING);
+        body->angular_velocity = vec3_multiply(body->angular_velocity, ANGULAR_DAMPING);
+        body->position = vec3_add(body->position, vec3_multiply(body->velocity, h));
+
+        // R += h * [w]x R, then back to a rotation
+        Vec3 w = vec3_multiply(body->angular_velocity, h);
+        Mat3 spin = {{0.0f, -w.z, w.y, w.z, 0.0f, -w.x, -w.y, w.x, 0.0f}};
+        Mat3 delta = mat3_multiply(spin, body->rotation);
+        for (int k = 0; k < 9; k++) {
+            body->rotation.m[k] += delta.m[k];
+        }
+        body->rotation = mat3_orthonormalize(body->rotation);
+
+        if (vec3_length(body->velocity) < SLEEP_LINEAR && vec3_length(body->angular_velocity) < SLEEP_ANGULAR) {
+            body->still_time += h;
+            if (body->still_time >= SLEEP_SECONDS) {
+                body->asleep = true;
+                body->velocity = (Vec3){0, 0, 0};
+                body->angular_velocity = (Vec3){0, 0, 0};
+                continue;
+            }
+        } else {
+            body->still_time = 0.0f;
+        }
+        awake = true;
+    }
+    return awake;
+}
+
+static void apply_input(BodyWorld* world, InputState input) {
+    Vec3 push = {0, 0, 0};
+    if (input.w_pressed) push.z -= 1.5f;
+    if (input.s_pressed) push.z += 1.5f;
+    if (input.a_pressed) push.x -= 1.5f;
+    if (input.d_pressed) push.x += 1.5f;
+    bool pushed = push.x != 0.0f || push.z != 0.0f;
+    if (!pushed && !input.m_pressed) {
+        return;
+    }
+    for (int i = world->static_count; i < world->count; i++) {
+        RigidBody* body = &world->bodies[i];
+        wake(body);
+        if (input.m_pressed) {
+            body->velocity = (Vec3){random_range(&world->seed, -1.5f, 1.5f), random_range(&world->seed, 4.0f, 7.0f),
+                                    random_range(&world->seed, -1.0f, 1.0f)};
+            body->angular_velocity = (Vec3){random_range(&world->seed, -6.0f, 6.0f),
+                                            random_range(&world->seed, -6.0f, 6.0f),
+                                            random_range(&world->seed, -6.0f, 6.0f)};
+        } else {
+            push.y = 1.0f;
+            body->velocity = vec3_add(body->velocity, push);
+        }
+    }
+}
+
+void body_world_step(BodyWorld* world, InputState input, float frame_dt) {
+    apply_input(world, input);
+    world->accumulator += frame_dt;
+    int steps = 0;
+    bool moved = false;
+    while (world->accumulator >= BODIES_SUBSTEP && steps < MAX_SUBSTEPS) {
+        moved |= substep(world, BODIES_SUBSTEP);
+        world->accumulator -= BODIES_SUBSTEP;
+        steps++;
+    }
+    if (steps == MAX_SUBSTEPS) {
+        world->accumulator = fminf(world->accumulator, BODIES_SUBSTEP);
+    }
+    if (moved) {
+        build_grid(world);
+        world->version++;
+    }
+}
+
+bool body_world_is_animating(const BodyWorld* world) {
+    for (int i = world->static_count; i < world->count; i++) {
+        if (!world->bodies[i].asleep) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int body_world_awake_count(const BodyWorld* world) {
+    int awake = 0;
+    for (int i = world->static_count; i < world->count; i++) {
+        awake += !world->bodies[i].asleep;
+    }
+    return awake;
+}
+
+// Clamped grid cell range covering [lo, hi] on one axis
+static void grid_span(const BodyWorld* world, int axis, float lo, float hi, int* first, int* last) {
+    float origin = axis_component(world->grid_origin, axis);
+    int dim = world->grid_dims[axis];
+    *first = (int)floorf((lo - origin) / world->grid_cell);
+    *last = (int)floorf((hi - origin) / world->grid_cell);
+    *first = *first < 0 ? 0 : (*first >= dim ? dim - 1 : *first);
+    *last = *last < 0 ? 0 : (*last >= dim ? dim - 1 : *last);
+}
+
+static int grid_index(const BodyWorld* world, int x, int y, int z) {
+    return (z * world->grid_dims[1] + y) * world->grid_dims[0] + x;
+}
+
+// Chessboard distance from each cell to the nearest cell listing a body, by
+// a forward and a backward sweep over the 26 neighbours
+static void build_clearance(BodyWorld* world) {
+    const int* dims = world->grid_dims;
+    int cells = dims[0] * dims[1] * dims[2];
+    unsigned char* clearance = world->grid_clearance;
+    for (int c = 0; c < cells; c++) {
+        clearance[c] = world->grid_start[c + 1] > world->grid_start[c] ? 0 : 255;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        int step = pass == 0 ? 1 : -1;
+        for (int z = pass == 0 ? 0 : dims[2] - 1; z >= 0 && z < dims[2]; z += step) {
+            for (int y = pass == 0 ? 0 : dims[1] - 1; y >= 0 && y < dims[1]; y += step) {
+                for (int x = pass == 0 ? 0 : dims[0] - 1; x >= 0 && x < dims[0]; x += step) {
+                    int index = grid_index(world, x, y, z);
+                    int best = clearance[index];
+                    // Neighbours already swept: the previous slab, row and cell
+                    for (int dz = -1; dz <= 0; dz++) {
+                        for (int dy = -1; dy <= 1; dy++) {
+                            for (int dx = -1; dx <= 1; dx++) {
+                                if (dz == 0 && (dy > 0 || (dy == 0 && dx >= 0))) {
+                                    continue;
+                                }
+                                int nx = x + dx * step, ny = y + dy * step, nz = z + dz * step;
+                                if (nx < 0 || ny < 0 || nz < 0 || nx >= dims[0] || ny >= dims[1] || nz >= dims[2]) {
+                                    continue;
+                                }
+                                int near = clearance[grid_index(world, nx, ny, nz)] + 1;
+                                best = near < best ? near : best;
+                            }
+                        }
+                    }
+                    clearance[index] = (unsigned char)best;
+                }
+            }
+        }
+    }
+}
+
+// Rebuild the distance grid over the bounds of every body. Allocation
+// failure leaves an empty grid, which renders nothing rather than crashing.
+static void build_grid(BodyWorld* world) {
+    float margin = world->grid_margin;
+    Vec3 lo = {INFINITY, INFINITY, INFINITY};
+    Vec3 hi = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < world->count; i++) {
+        const RigidBody* body = &world->bodies[i];
+        Vec3 e = box_aabb_extent(body);
+        Vec3 p = body->position;
+        lo = (Vec3){fminf(lo.x, p.x - e.x), fminf(lo.y, p.y - e.y), fminf(lo.z, p.z - e.z)};
+        hi = (Vec3){fmaxf(hi.x, p.x + e.x), fmaxf(hi.y, p.y + e.y), fmaxf(hi.z, p.z + e.z)};
+    }
+    lo = vec3_subtract(lo, (Vec3){margin, margin, margin});
+    hi = vec3_add(hi, (Vec3){margin, margin, margin});
+
+    float cell = GRID_CELL;
+    for (int a = 0; a < 3; a++) {
+        cell = fmaxf(cell, (axis_component(hi, a) - axis_component(lo, a)) / (float)GRID_MAX_DIM);
+    }
+    world->grid_cell = cell;
+    world->grid_origin = lo;
+    int cells = 1;
+    for (int a = 0; a < 3; a++) {
+        world->grid_dims[a] = (int)ceilf((axis_component(hi, a) - axis_component(lo, a)) / cell);
+        if (world->grid_dims[a] < 1) world->grid_dims[a] = 1;
+        cells *= world->grid_dims[a];
+    }
+
+    // Corner of the grid furthest from the origin bounds the whole shape
+    Vec3 far = {fmaxf(fabsf(lo.x), fabsf(hi.x)), fmaxf(fabsf(lo.y), fabsf(hi.y)), fmaxf(fabsf(lo.z), fabsf(hi.z))};
+    world->bound = vec3_length(far);
+
+    int* start = realloc(world->grid_start, (size_t)(cells + 1) * sizeof(int));
+    if (start) {
+        world->grid_start = start;
+    }
+    unsigned char* clearance = realloc(world->grid_clearance, (size_t)cells);
+    if (clearance) {
+        world->grid_clearance = clearance;
+    }
+    if (!start || !clearance) {
+        world->grid_dims[0] = world->grid_dims[1] = world->grid_dims[2] = 0;
+        return;
+    }
+    memset(start, 0, (size_t)(cells + 1) * sizeof(int));
+
+    // Count, prefix-sum, then fill backwards as in build_hash
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < world->count; i++) {
+            const RigidBody* body = &world->bodies[i];
+            Vec3 e = vec3_add(box_aabb_extent(body), (Vec3){margin, margin, margin});
+            int x0, x1, y0, y1, z0, z1;
+            grid_span(world, 0, body->position.x - e.x, body->position.x + e.x, &x0, &x1);
+            grid_span(world, 1, body->position.y - e.y, body->position.y + e.y, &y0, &y1);
+            grid_span(world, 2, body->position.z - e.z, body->position.z + e.z, &z0, &z1);
+            for (int z = z0; z <= z1; z++) {
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        int index = grid_index(world, x, y, z);
+                        if (pass == 0) {
+                            start[index]++;
+                        } else {
+                            world->grid_bodies[--start[index]] = i;
+                        }
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int c = 1; c < cells; c++) {
+                start[c] += start[c - 1];
+            }
+            int entries = start[cells - 1];
+            start[cells] = entries;
+            if (entries > world->grid_capacity) {
+                int* grown = realloc(world->grid_bodies, (size_t)entries * sizeof(int));
+                if (!grown) {
+                    world->grid_dims[0] = world->grid_dims[1] = world->grid_dims[2] = 0;
+                    return;
+                }
+                world->grid_bodies = grown;
+                world->grid_capacity = entries;
+            }
+        }
+    }
+    build_clearance(world);
+}
+
+float body_world_distance(const BodyWorld* world, Vec3 point) {
+    if (world->grid_dims[0] == 0) {
+        return 1e9f;
+    }
+    // Every body lies at least the margin inside the grid's bounds
+    float cell = world->grid_cell;
+    Vec3 lo = world->grid_origin;
+    Vec3 hi = {lo.x + cell * (float)world->grid_dims[0], lo.y + cell * (float)world->grid_dims[1],
+               lo.z + cell * (float)world->grid_dims[2]};
+    Vec3 outside = {fmaxf(fmaxf(lo.x - point.x, point.x - hi.x), 0.0f),
+                    fmaxf(fmaxf(lo.y - point.y, point.y - hi.y), 0.0f),
+                    fmaxf(fmaxf(lo.z - point.z, point.z - hi.z), 0.0f)};
+    if (outside.x > 0.0f || outside.y > 0.0f || outside.z > 0.0f) {
+        return vec3_length(outside) + world->grid_margin;
+    }
+
+    int x = (int)((point.x - lo.x) / cell);
+    int y = (int)((point.y - lo.y) / cell);
+    int z = (int)((point.z - lo.z) / cell);
+    x = x < world->grid_dims[0] ? x : world->grid_dims[0] - 1;
+    y = y < world->grid_dims[1] ? y : world->grid_dims[1] - 1;
+    z = z < world->grid_dims[2] ? z : world->grid_dims[2] - 1;
+
+    // Bodies not listed here are further than the margin beyond the cell,
+    // and beyond the empty cells around it
+    float cx = lo.x + cell * (float)x, cy = lo.y + cell * (float)y, cz = lo.z + cell * (float)z;
+    float exit = fminf(fminf(fminf(point.x - cx, cx + cell - point.x), fminf(point.y - cy, cy + cell - point.y)),
+                       fminf(point.z - cz, cz + cell - point.z));
+    int index = grid_index(world, x, y, z);
+    int empty_rings = world->grid_clearance[index] > 0 ? world->grid_clearance[index] - 1 : 0;
+    float best = fmaxf(exit, 0.0f) + world->grid_margin + (float)empty_rings * cell;
+
+    for (int k = world->grid_start[index]; k < world->grid_start[index + 1]; k++) {
+        const RigidBody* body = &world->bodies[world->grid_bodies[k]];
+        if (vec3_length(vec3_subtract(point, body->position)) - body->radius >= best) {
+            continue;
+        }
+        best = fminf(best, box_distance(body, point));
+    }
+    return best;
+}
@@ -0,0 +1,38 @@
+#include "camera.h"
+#include <math.h>
+
+Camera camera_create(int width, int height) {
+    float fov = 50.0f * 3.14159f / 180.0f;
+    Camera cam = {
+        .position = {0, 0, 6.0f},
+        .aspect = (float)width / (float)height * 0.5f,
+        .scale = tanf(fov * 0.5f),
+        .inv_width = 1.0f / (float)width,
+        .inv_height = 1.0f / (float)height,
+        .width = width,
+        .height = height
+    };
+    return cam;
+}
+
+Vec3 camera_ray(const Camera* cam, float fx, float fy) {
+    float px = (2.0f * (fx * cam->inv_width) - 1.0f) * cam->aspect;
+    float py = 1.0f - 2.0f * (fy * cam->inv_height);
+    return vec3_normalize((Vec3){
+        px * cam->scale,
+        py * cam->scale,
+        -1.0f
+    });
+}
+
+bool camera_project(const Camera* cam, Vec3 point, float* fx, float* fy) {
+    Vec3 v = vec3_subtract(point, cam->position);
+    if (v.z > -0.01f) {
+        return false;
+    }
+    float px = v.x / (-v.z * cam->scale);
+    float py = v.y / (-v.z * cam->scale);
+    *fx = (px / cam->aspect + 1.0f) * 0.5f * (float)cam->width;
+    *fy = (1.0f - py) * 0.5f * (float)cam->height;
+    return true;
+}
@@ -0,0 +1,197 @@
+#include "encode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Worst case bytes for one cell: longest color code plus a 4-byte glyph
+#define CELL_MAX_BYTES 16
+// Worst case bytes for a cursor jump "\033[row;colH"
+#define MOVE_MAX_BYTES 16
+// Unchanged cells shorter than this are re-sent instead of jumped over
+#define DIFF_MERGE_GAP 4
+
+static const char* const COLOR_CODES[COLOR_COUNT] = {
+    "\033[0m",          // COLOR_NONE - reset
+    "\033[96m",         // COLOR_CUBE - bright cyan
+    "\033[38;5;240m",   // COLOR_GROUND - dark gray
+    "\033[38;5;67m",    // COLOR_MOUNTAIN - blue-gray
+    "\033[93m",         // COLOR_BUILDING - bright yellow
+    "\033[36m",         // COLOR_RAIN - cyan
+    "\033[38;5;226m",   // COLOR_SUN - bright yellow/gold
+    "\033[97m",         // COLOR_FPS - bright white
+    "\033[38;5;236m"    // COLOR_SHADOW - darker gray
+};
+
+void byte_buffer_init(ByteBuffer* buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void byte_buffer_free(ByteBuffer* buf) {
+    free(buf->data);
+    byte_buffer_init(buf);
+}
+
+int byte_buffer_reserve(ByteBuffer* buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) {
+        return 0;
+    }
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra) {
+        cap *= 2;
+    }
+    char* data = realloc(buf->data, cap);
+    if (!data) {
+        return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+static char* put_str(char* p, const char* s) {
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char* put_utf8(char* p, wchar_t wc) {
+    uint32_t c = (uint32_t)wc;
+    if (c < 0x80) {
+        *p++ = (char)c;
+    } else if (c < 0x800) {
+        *p++ = (char)(0xC0 | (c >> 6));
+        *p++ = (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        *p++ = (char)(0xE0 | (c >> 12));
+        *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        *p++ = (char)(0x80 | (c & 0x3F));
+    } else {
+        *p++ = (char)(0xF0 | (c >> 18));
+        *p++ = (char)(0x80 | ((c >> 12) & 0x3F));
+        *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        *p++ = (char)(0x80 | (c & 0x3F));
+    }
+    return p;
+}
+
+// Single-byte glyphs are copied straight through; the narrowing loop over
+// an all-ASCII run vectorizes
+static char* put_glyphs(char* p, const wchar_t* chars, int count) {
+    int i = 0;
+    while (i < count) {
+        int ascii_end = i;
+        while (ascii_end < count && (uint32_t)chars[ascii_end] < 0x80) {
+            ascii_end++;
+        }
+        for (int k = i; k < ascii_end; k++) {
+            *p++ = (char)chars[k];
+        }
+        if (ascii_end < count) {
+            p = put_utf8(p, chars[ascii_end++]);
+        }
+        i = ascii_end;
+    }
+    return p;
+}
+
+// Cells [start, end) of one row, one color code per run of equal colors
+static char* put_cells(char* p, const Framebuffer* fb, int start, int end, unsigned char* current_color) {
+    int i = start;
+    while (i < end) {
+        unsigned char color = fb->colors[i];
+        // Only change color if needed
+        if (color != *current_color) {
+            p = put_str(p, COLOR_CODES[color < COLOR_COUNT ? color : COLOR_NONE]);
+            *current_color = color;
+        }
+        int run_end = i + 1;
+        while (run_end < end && fb->colors[run_end] == color) {
+            run_end++;
+        }
+        p = put_glyphs(p, fb->chars + i, run_end - i);
+        i = run_end;
+    }
+    return p;
+}
+
+int frame_encode_full(const Framebuffer* fb, ByteBuffer* out) {
+    size_t cells = (size_t)fb->width * (size_t)fb->height;
+    if (byte_buffer_reserve(out, cells * CELL_MAX_BYTES + (size_t)fb->height + 32) != 0) {
+        return -1;
+    }
+
+    char* p = out->data + out->len;
+    p = put_str(p, "\033[H");
+
+    unsigned char current_color = 255;  // Invalid initial color
+    for (int y = 0; y < fb->height; y++) {
+        p = put_cells(p, fb, y * fb->width, (y + 1) * fb->width, &current_color);
+        if (y < fb->height - 1) {
+            *p++ = '\n';
+        }
+    }
+
+    // Reset color at the end
+    p = put_str(p, "\033[0m");
+    out->len = (size_t)(p - out->data);
+    return 0;
+}
+
+static bool cell_changed(const Framebuffer* prev, const Framebuffer* cur, int idx) {
+    return prev->chars[idx] != cur->chars[idx] || prev->colors[idx] != cur->colors[idx];
+}
+
+int frame_encode_diff(const Framebuffer* prev, const Framebuffer* cur, ByteBuffer* out) {
+    if (!prev || prev->width != cur->width || prev->height != cur->height) {
+        return frame_encode_full(cur, out);
+    }
+
+    size_t cells = (size_t)cur->width * (size_t)cur->height;
+    if (byte_buffer_reserve(out, cells * (CELL_MAX_BYTES + MOVE_MAX_BYTES) + 32) != 0) {
+        return -1;
+    }
+
+    char* p = out->data + out->len;
+    unsigned char current_color = 255;
+    int width = cur->width;
+
+    for (int y = 0; y < cur->height; y++) {
+        const int row = y * width;
+        int cursor_x = -1;  // Column the terminal cursor sits at, -1 if unknown
+        int x = 0;
+        while (x < width) {
+            if (!cell_changed(prev, cur, row + x)) {
+                x++;
+                continue;
+            }
+
+            // Extend the run, absorbing short unchanged gaps
+            int end = x + 1;
+            int gap = 0;
+            for (int i = end; i < width && gap < DIFF_MERGE_GAP; i++) {
+                if (cell_changed(prev, cur, row + i)) {
+                    end = i + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+
+            if (cursor_x != x) {
+                p += sprintf(p, "\033[%d;%dH", y + 1, x + 1);
+            }
+            p = put_cells(p, cur, row + x, row + end, &current_color);
+            cursor_x = end;
+            x = end;
+        }
+    }
+
+    if (current_color != 255) {
+        p = put_str(p, "\033[0m");
+    }
+    out->len = (size_t)(p - out->data);
+    return 0;
+}
@@ -0,0 +1,202 @@
+#include "engine.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void engine_default_config(Config* config) {
+    *config = (Config){
+        .cube_size = 1.0f,
+        .rotation_speed = 1.0f,
+        // Default light in front, high and to the left
+        .light_x = -3.0f,
+        .light_y = 4.5f,
+        .light_z = 4.0f,
+        .shadow_budget = 2,
+        .quality = RENDER_QUALITY_HIGH,
+        .max_raymarch_steps = 100,
+        .rain = true,
+        .rain_drops = 1500,
+        .audio = true,
+        .render_mode = RENDER_MODE_CELL,
+        .heatmap = HEATMAP_OFF,
+        .model_resolution = SDF_GRID_DEFAULT_RESOLUTION,
+        .play_speed = 1.0,
+        .grid_width = 80,
+        .grid_height = 24
+    };
+}
+
+// The model is baked (or mapped from its cache) and the scene compiled once
+static bool load_shape(Engine* engine) {
+    const Config* config = &engine->config;
+    engine->shape = (SdfShape){.kind = SDF_SHAPE_CUBE};
+    if (config->model_path) {
+        engine->grid = sdf_grid_load(config->model_path, config->model_resolution);
+        if (!engine->grid) {
+            fprintf(stderr, "Failed to load model %s\n", config->model_path);
+            return false;
+        }
+        engine->shape = (SdfShape){.kind = SDF_SHAPE_GRID, .grid = engine->grid};
+    }
+    if (config->scene_path) {
+        char error[256];
+        engine->program = sdf_program_load(config->scene_path, error, sizeof(error));
+        if (!engine->program) {
+            fprintf(stderr, "Failed to load scene %s: %s\n", config->scene_path, error);
+            return false;
+        }
+        engine->shape = (SdfShape){.kind = SDF_SHAPE_PROGRAM, .program = engine->program};
+    }
+    if (config->body_count > 0) {
+        engine->bodies = body_world_create(config->body_count, 1u);
+        if (!engine->bodies) {
+            fprintf(stderr, "Failed to create %d bodies\n", config->body_count);
+            return false;
+        }
+        engine->shape = (SdfShape){.kind = SDF_SHAPE_BODIES, .bodies = engine->bodies};
+    }
+    return true;
+}
+
+static void scene_init(Engine* engine) {
+    const Config* config = &engine->config;
+
+    // Initialize cube state
+    engine->cube = (CubeState){
+        // Initial tilt
+        .rotation = mat3_multiply(mat3_rotate_y(0.6f), mat3_rotate_x(-0.4f)),
+        .angular_velocity = {0.25f, 0.35f, 0.10f},
+        .position = {0, 0, 0},
+        .size = config->cube_size,
+        .motion_mode = config->orbit,
+        .motion_phase = 0.0f
+    };
+
+    // Bodies are placed in world units around a still model origin
+    if (engine->bodies) {
+        engine->cube.rotation = mat3_identity();
+        engine->cube.angular_velocity = (Vec3){0, 0, 0};
+        engine->cube.size = BODIES_UNIT;
+        engine->cube.motion_mode = false;
+    }
+
+    // Physics configuration
+    engine->physics = (PhysicsConfig){
+        .acceleration = 9.0f * config->rotation_speed,
+        .damping = 0.97f,
+        .max_velocity = 20.0f * config->rotation_speed
+    };
+
+    // Light setup: the key light first
+    engine->lights[0] = (Light){
+        .position = {config->light_x, config->light_y, config->light_z},
+        .ambient = 0.2f,
+        .diffuse = 0.8f,
+        .specular = 0.5f
+    };
+    for (int i = 0; i < config->extra_light_count; i++) {
+        engine->lights[i + 1] = config->extra_lights[i];
+    }
+    engine->light_count = config->extra_light_count + 1;
+
+    engine->scene = (Scene){
+        .cube = &engine->cube,
+        .shape = &engine->shape,
+        .lights = engine->lights,
+        .light_count = engine->light_count,
+        .rain = engine->rain
+    };
+}
+
+Engine* engine_create(const Config* config, int width, int height) {
+    Engine* engine = calloc(1, sizeof(Engine));
+    if (!engine) return NULL;
+    engine->config = *config;
+    audio_init(&engine->audio);
+
+    if (!load_shape(engine)) {
+        engine_destroy(engine);
+        return NULL;
+    }
+
+    RenderSettings render_settings = {
+        .rain = config->rain,
+        .mode = config->render_mode,
+        .full_shading = config->full_shading,
+        .heatmap = config->heatmap,
+        .shadow_budget = config->shadow_budget,
+        .temporal_aa = config->temporal_aa,
+        .quality = config->quality,
+        .ascii = config->ascii,
+        .max_steps = config->max_raymarch_steps
+    };
+    engine->renderer = renderer_create(render_settings);
+    engine->rain = rain_create(config->rain_drops);
+    engine->fb = framebuffer_create(width, height);
+    if (!engine->renderer || !engine->rain || !engine->fb) {
+        fprintf(stderr, "Failed to create renderer\n");
+        engine_destroy(engine);
+        return NULL;
+    }
+    scene_init(engine);
+    return engine;
+}
+
+void engine_destroy(Engine* engine) {
+    if (!engine) return;
+    audio_stop(&engine->audio);
+    framebuffer_destroy(engine->fb);
+    renderer_destroy(engine->renderer);
+    rain_destroy(engine->rain);
+    sdf_grid_destroy(engine->grid);
+    sdf_program_destroy(engine->program);
+    body_world_destroy(engine->bodies);
+    free(engine);
+}
+
+int engine_resize(Engine* engine, int width, int height) {
+    Framebuffer* fb = framebuffer_create(width, height);
+    if (!fb) {
+        return -1;
+    }
+    framebuffer_destroy(engine->fb);
+    engine->fb = fb;
+    engine->last_target = NULL;
+    return 0;
+}
+
+void engine_step(Engine* engine, InputState input, float dt) {
+    trace_begin("physics_step");
+    if (engine->bodies) {
+        body_world_step(engine->bodies, input, dt);
+    } else {
+        physics_step(&engine->cube, input, engine->physics, dt);
+    }
+    trace_end("physics_step");
+}
+
+void engine_update_rain(Engine* engine, float dt) {
+    if (!engine->renderer->settings.rain) {
+        return;
+    }
+    trace_begin("rain_update");
+    rain_update(engine->rain, dt);
+    trace_end("rain_update");
+}
+
+bool engine_is_animating(const Engine* engine) {
+    bool moving = engine->bodies ? body_world_is_animating(engine->bodies) : physics_is_animating(&engine->cube);
+    return moving || engine->renderer->settings.rain || renderer_is_settling(engine->renderer);
+}
+
+void engine_render(Engine* engine, Framebuffer* target, FrameStats stats) {
+    if (!target) {
+        target = engine->fb;
+    }
+    if (target != engine->last_target) {
+        renderer_invalidate(engine->renderer);
+        engine->last_target = target;
+    }
+    stats.volume = audio_get_volume(&engine->audio);
+    render_cube(engine->renderer, target, &engine->scene, stats);
+}
@@ -0,0 +1,159 @@
+#define _DEFAULT_SOURCE
+
+#include "frame_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t slot_stride_for(size_t cells) {
+    size_t bytes = sizeof(FrameRingSlot) + cells * sizeof(FrameRingCell);
+    return (bytes + 63) & ~(size_t)63;  // Keep slots cache-line aligned
+}
+
+static int ring_map(FrameRing* ring, size_t cells) {
+    size_t stride = slot_stride_for(cells);
+    size_t size = sizeof(FrameRingHeader) + stride * FRAME_RING_SLOTS;
+
+    if (ftruncate(ring->fd, (off_t)size) != 0) {
+        return -1;
+    }
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+
+    FrameRingHeader* header = addr;
+    if (ring->header) {
+        // Growing: readers see an odd layout counter until the new geometry is in
+        atomic_fetch_add_explicit(&header->layout, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        munmap(ring->header, ring->size);
+    } else {
+        memset(header, 0, sizeof(FrameRingHeader));
+        header->magic = FRAME_RING_MAGIC;
+        header->version = FRAME_RING_VERSION;
+        header->slot_count = FRAME_RING_SLOTS;
+        header->producer_pid = (uint32_t)getpid();
+    }
+
+    header->slot_capacity = (uint32_t)cells;
+    header->slot_stride = stride;
+    header->total_size = size;
+    for (uint32_t i = 0; i < header->slot_count; i++) {
+        FrameRingSlot* slot = frame_ring_slot(header, i);
+        atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+        slot->width = 0;
+        slot->height = 0;
+    }
+
+    if (atomic_load_explicit(&header->layout, memory_order_relaxed) & 1) {
+        atomic_fetch_add_explicit(&header->layout, 1, memory_order_release);
+    }
+
+    ring->header = header;
+    ring->size = size;
+    return 0;
+}
+
+// True if the existing object `name` is a ring whose producer has exited.
+// Prints why not otherwise.
+static bool ring_abandoned(const char* name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        // Removed since; the next exclusive create decides
+        return errno == ENOENT;
+    }
+    struct stat st;
+    FrameRingHeader header;
+    bool is_ring = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(header) &&
+                   pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                   header.magic == FRAME_RING_MAGIC;
+    close(fd);
+    if (!is_ring) {
+        fprintf(stderr, "%s exists and is not a frame ring\n", name);
+        return false;
+    }
+    // Rings of older versions carry no producer; nothing can still use them
+    if (header.version >= 2 && header.producer_pid != 0 &&
+        (kill((pid_t)header.producer_pid, 0) == 0 || errno == EPERM)) {
+        fprintf(stderr, "%s is in use by process %u\n", name, header.producer_pid);
+        return false;
+    }
+    return true;
+}
+
+FrameRing* frame_ring_create(const char* name, int width, int height) {
+    if (strlen(name) >= sizeof(((FrameRing*)0)->name)) {
+        return NULL;
+    }
+
+    FrameRing* ring = calloc(1, sizeof(FrameRing));
+    if (!ring) return NULL;
+    strcpy(ring->name, name);
+
+    ring->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (ring->fd < 0 && errno == EEXIST) {
+        if (!ring_abandoned(name)) {
+            free(ring);
+            return NULL;
+        }
+        shm_unlink(name);
+        ring->fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (ring->fd < 0) {
+        perror(name);
+        free(ring);
+        return NULL;
+    }
+
+    if (ring_map(ring, (size_t)width * (size_t)height) != 0) {
+        perror(name);
+        close(ring->fd);
+        shm_unlink(name);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void frame_ring_destroy(FrameRing* ring) {
+    if (!ring) return;
+    munmap(ring->header, ring->size);
+    close(ring->fd);
+    shm_unlink(ring->name);
+    free(ring);
+}
+
+int frame_ring_publish(FrameRing* ring, const Framebuffer* fb, uint64_t frame_number) {
+    size_t cells = (size_t)fb->width * (size_t)fb->height;
+    if (cells > ring->header->slot_capacity && ring_map(ring, cells + cells / 2) != 0) {
+        return -1;
+    }
+
+    FrameRingHeader* header = ring->header;
+    uint64_t index = atomic_load_explicit(&header->published, memory_order_relaxed);
+    FrameRingSlot* slot = frame_ring_slot(header, index);
+
+    uint64_t seq = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->frame_number = frame_number;
+    slot->width = (uint32_t)fb->width;
+    slot->height = (uint32_t)fb->height;
+    FrameRingCell* out = frame_ring_cells(slot);
+    for (size_t i = 0; i < cells; i++) {
+        out[i].codepoint = (uint32_t)fb->chars[i];
+        out[i].color = fb->colors[i];
+    }
+
+    atomic_store_explicit(&slot->sequence, seq + 2, memory_order_release);
+    atomic_store_explicit(&header->published, index + 1, memory_order_release);
+    return 0;
+}
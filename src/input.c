@@ -1,8 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include "input.h"
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/select.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#define INPUT_READ_CHUNK 512
 
 static struct termios orig_termios;
 
@@ -29,107 +34,234 @@ int input_init(void) {
     return 0;
 }
 
-void input_poll(InputState* state, int timeout_ms) {
-    (void)timeout_ms;
-    char c;
+static void press_direction(InputState* state, char key) {
+    // Only the most recent direction key counts for this frame.
+    state->w_pressed = key == 'w';
+    state->a_pressed = key == 'a';
+    state->s_pressed = key == 's';
+    state->d_pressed = key == 'd';
+}
+
+// Apply a key press; false if the key is not bound to anything
+static bool handle_key(InputState* state, unsigned char c) {
+    switch (c) {
+        case 'w':
+        case 'W':
+            press_direction(state, 'w');
+            break;
+        case 'a':
+        case 'A':
+            press_direction(state, 'a');
+            break;
+        case 's':
+        case 'S':
+            press_direction(state, 's');
+            break;
+        case 'd':
+        case 'D':
+            press_direction(state, 'd');
+            break;
+        case '+':
+        case '=':
+            state->volume_delta += 1;
+            break;
+        case '-':
+        case '_':
+            state->volume_delta -= 1;
+            break;
+        case 'm':
+        case 'M':
+            state->m_pressed = true;
+            break;
+        case 'r':
+        case 'R':
+            state->r_pressed = true;
+            break;
+        case 'h':
+        case 'H':
+            state->h_pressed = true;
+            break;
+        case 'p':
+        case 'P':
+            state->p_pressed = true;
+            break;
+        case 'q':
+        case 'Q':
+            state->quit_requested = true;
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
 
-    // Reset per-frame state; inertia is handled in physics, not here.
+// Handle a complete CSI sequence: ESC [ params final. Returns true for
+// mouse and key sequences; focus reports are not user input.
+static bool handle_csi(InputState* state, const unsigned char* params, int len, unsigned char final) {
+    // SGR mouse: ESC [ < btn ; x ; y M
+    if ((final == 'M' || final == 'm') && len > 0 && params[0] == '<') {
+        int btn = 0;
+        for (int i = 1; i < len && params[i] >= '0' && params[i] <= '9'; i++) {
+            btn = btn * 10 + (params[i] - '0');
+        }
+        // 64: wheel up, 65: wheel down
+        if (btn == 64) {
+            state->volume_delta += 1;
+        } else if (btn == 65) {
+            state->volume_delta -= 1;
+        }
+        return true;
+    }
+
+    // Page Up / Page Down fallback: ESC[5~ / ESC[6~
+    if (final == '~' && len == 1) {
+        if (params[0] == '5') {
+            state->volume_delta += 1;
+        } else if (params[0] == '6') {
+            state->volume_delta -= 1;
+        }
+        return true;
+    }
+
+    // Cursor position report: ESC[row;colR. Shift+F3 sends the same shape and
+    // is taken as a report too.
+    if (final == 'R' && memchr(params, ';', (size_t)len)) {
+        state->cursor_reports++;
+        return false;
+    }
+
+    // Focus reporting: ESC[I (gained) / ESC[O (lost)
+    if (len == 0 && final == 'I') {
+        state->focused = true;
+    } else if (len == 0 && final == 'O') {
+        state->focused = false;
+    }
+    return false;
+}
+
+// Decode buf[0..len). Returns the number of bytes consumed; anything left is
+// an incomplete escape sequence that must wait for more input. Sets *event
+// if a key or mouse event was decoded and adds the length of cursor position
+// reports to *report_bytes.
+static int decode(InputState* state, const unsigned char* buf, int len, bool* event, int* report_bytes) {
+    int i = 0;
+    while (i < len) {
+        if (buf[i] != 27) {
+            *event |= handle_key(state, buf[i]);
+            i++;
+            continue;
+        }
+
+        if (i + 1 >= len) {
+            return i;  // Bare ESC or start of a sequence; decide later
+        }
+
+        if (buf[i + 1] == '[') {
+            // CSI: parameter bytes until a final byte in 0x40..0x7E
+            int j = i + 2;
+            while (j < len && (buf[j] < 0x40 || buf[j] > 0x7E)) {
+                j++;
+            }
+            if (j >= len) {
+                if (len - i >= INPUT_PENDING_MAX) {
+                    return len;  // Oversized garbage; drop it
+                }
+                return i;
+            }
+            int reports = state->cursor_reports;
+            *event |= handle_csi(state, buf + i + 2, j - (i + 2), buf[j]);
+            if (state->cursor_reports != reports) {
+                *report_bytes += j + 1 - i;
+            }
+            i = j + 1;
+        } else if (buf[i + 1] == 'O') {
+            // SS3 (application cursor keys): ESC O x
+            if (i + 2 >= len) {
+                return i;
+            }
+            i += 3;
+        } else {
+            // Alt+key; not bound to anything
+            i += 2;
+        }
+    }
+    return len;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int input_read(InputState* state) {
+    unsigned char buf[INPUT_PENDING_MAX + INPUT_READ_CHUNK];
+    int total = 0;
+    bool eof = false;
+
+    for (;;) {
+        int len = state->pending_len;
+        memcpy(buf, state->pending, (size_t)len);
+
+        ssize_t n = read(STDIN_FILENO, buf + len, INPUT_READ_CHUNK);
+        if (n == 0) {
+            eof = true;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;  // EAGAIN: drained
+        }
+        double read_time = monotonic_seconds();
+        len += (int)n;
+        total += (int)n;
+
+        bool event = false;
+        int report_bytes = 0;
+        int used = decode(state, buf, len, &event, &report_bytes);
+        total -= report_bytes;
+        if (event && state->event_time == 0.0) {
+            state->event_time = read_time;
+        }
+        state->pending_len = len - used;
+        memcpy(state->pending, buf + used, (size_t)state->pending_len);
+
+        if (n < INPUT_READ_CHUNK) {
+            break;
+        }
+    }
+
+    // A report split across reads was counted by the read that began it
+    if (eof && total <= 0) {
+        return -1;
+    }
+    return total > 0 ? total : 0;
+}
+
+bool input_has_pending(const InputState* state) {
+    return state->pending_len > 0;
+}
+
+void input_flush(InputState* state) {
+    // A lone ESC with nothing following it within the timeout is a quit key
+    if (state->pending_len == 1 && state->pending[0] == 27) {
+        state->quit_requested = true;
+    }
+    state->pending_len = 0;
+}
+
+void input_consume(InputState* state) {
+    // Inertia is handled in physics, not here.
     state->w_pressed = false;
     state->a_pressed = false;
     state->s_pressed = false;
     state->d_pressed = false;
     state->m_pressed = false;
+    state->r_pressed = false;
+    state->h_pressed = false;
+    state->p_pressed = false;
     state->volume_delta = 0;
-
-    // Read all available input
-    while (read(STDIN_FILENO, &c, 1) == 1) {
-        switch (c) {
-            case 'w':
-            case 'W':
-                state->w_pressed = true;
-                state->a_pressed = false;
-                state->s_pressed = false;
-                state->d_pressed = false;
-                break;
-            case 'a':
-            case 'A':
-                state->w_pressed = false;
-                state->a_pressed = true;
-                state->s_pressed = false;
-                state->d_pressed = false;
-                break;
-            case 's':
-            case 'S':
-                state->w_pressed = false;
-                state->a_pressed = false;
-                state->s_pressed = true;
-                state->d_pressed = false;
-                break;
-            case 'd':
-            case 'D':
-                state->w_pressed = false;
-                state->a_pressed = false;
-                state->s_pressed = false;
-                state->d_pressed = true;
-                break;
-            case '+':
-            case '=':
-                state->volume_delta += 1;
-                break;
-            case '-':
-            case '_':
-                state->volume_delta -= 1;
-                break;
-            case 'm':
-            case 'M':
-                state->m_pressed = true;
-                break;
-            case 'q':
-            case 'Q':
-                state->quit_requested = true;
-                break;
-            case 27: {  // ESC or escape sequence (e.g., mouse/scroll)
-                char buf[32];
-                int n = 0;
-                // Collect a small escape sequence chunk
-                while (n < (int)sizeof(buf) - 1) {
-                    char ch;
-                    ssize_t r = read(STDIN_FILENO, &ch, 1);
-                    if (r != 1) break;
-                    buf[n++] = ch;
-                    if (ch == 'M' || ch == 'm' || ch == '~') break;
-                }
-                buf[n] = '\0';
-
-                // SGR mouse: ESC [ < btn ; x ; y M
-                if (n >= 6 && buf[0] == '[' && buf[1] == '<') {
-                    int btn = 0;
-                    int i = 2;
-                    while (i < n && buf[i] >= '0' && buf[i] <= '9') {
-                        btn = btn * 10 + (buf[i] - '0');
-                        i++;
-                    }
-                    // 64: wheel up, 65: wheel down
-                    if (btn == 64) {
-                        state->volume_delta += 1;
-                    } else if (btn == 65) {
-                        state->volume_delta -= 1;
-                    }
-                } else if (n >= 3 && buf[0] == '[' && buf[2] == '~') {
-                    // Page Up / Page Down fallback: ESC[5~ / ESC[6~
-                    if (buf[1] == '5') {
-                        state->volume_delta += 1;
-                    } else if (buf[1] == '6') {
-                        state->volume_delta -= 1;
-                    }
-                } else if (n == 0) {
-                    // Bare ESC (no sequence): treat as quit
-                    state->quit_requested = true;
-                }
-                break;
-            }
-        }
-    }
+    state->event_time = 0.0;
 }
 
 void input_cleanup(void) {
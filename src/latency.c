@@ -0,0 +1,80 @@
+#include "latency.h"
+
+const char* const LATENCY_STAGE_NAMES[LATENCY_STAGE_COUNT] = {"queue", "render", "write", "total"};
+
+static int bucket_index(unsigned long long us) {
+    if (us < LATENCY_LINEAR_BUCKETS) {
+        return (int)us;
+    }
+    // Top bit picks the octave, the next four bits the bucket within it
+    int top = 0;
+    while ((us >> (top + 1)) != 0) {
+        top++;
+    }
+    int shift = top - 4;
+    int index = LATENCY_SUB_BUCKETS * (top - 3) + (int)(us >> shift) - LATENCY_SUB_BUCKETS;
+    return index < LATENCY_BUCKETS ? index : LATENCY_BUCKETS - 1;
+}
+
+// Midpoint of a bucket in microseconds
+static double bucket_value(int index) {
+    if (index < LATENCY_LINEAR_BUCKETS) {
+        return index + 0.5;
+    }
+    int top = index / LATENCY_SUB_BUCKETS + 3;
+    int shift = top - 4;
+    double low = (double)((unsigned long long)(index % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) << shift);
+    return low + (double)(1ULL << shift) * 0.5;
+}
+
+void latency_record(LatencyHistogram* histogram, double seconds) {
+    if (seconds < 0.0) {
+        seconds = 0.0;
+    }
+    histogram->counts[bucket_index((unsigned long long)(seconds * 1e6))]++;
+    histogram->count++;
+    if (seconds > histogram->max) {
+        histogram->max = seconds;
+    }
+}
+
+double latency_percentile(const LatencyHistogram* histogram, double p) {
+    if (histogram->count == 0) {
+        return 0.0;
+    }
+    unsigned long rank = (unsigned long)(p * (double)histogram->count);
+    if (rank >= histogram->count) {
+        rank = histogram->count - 1;
+    }
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen > rank) {
+            double value = bucket_value(i) * 1e-6;
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void latency_record_event(LatencyStats* stats, LatencyEvent event, double shown) {
+    latency_record(&stats->stages[LATENCY_QUEUE], event.frame_start - event.event_time);
+    latency_record(&stats->stages[LATENCY_RENDER], event.render_done - event.frame_start);
+    latency_record(&stats->stages[LATENCY_WRITE], shown - event.render_done);
+    latency_record(&stats->stages[LATENCY_TOTAL], shown - event.event_time);
+}
+
+void latency_print_summary(const LatencyStats* stats, FILE* out) {
+    const LatencyHistogram* total = &stats->stages[LATENCY_TOTAL];
+    if (total->count == 0) {
+        return;
+    }
+    fprintf(out, "Input latency over %lu events (ms):\n", total->count);
+    fprintf(out, "  %-8s %8s %8s %8s\n", "stage", "p50", "p99", "max");
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        const LatencyHistogram* h = &stats->stages[i];
+        fprintf(out, "  %-8s %8.2f %8.2f %8.2f\n", LATENCY_STAGE_NAMES[i],
+                latency_percentile(h, 0.5) * 1000.0, latency_percentile(h, 0.99) * 1000.0,
+                h->max * 1000.0);
+    }
+}
@@ -1,46 +1,104 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
 
 #include "main.h"
+#include "engine.h"
 #include "vec3.h"
 #include "matrix.h"
 #include "physics.h"
 #include "terminal.h"
 #include "render.h"
 #include "input.h"
+#include "latency.h"
+#include "trace.h"
 #include "audio.h"
+#include "server.h"
+#include "frame_ring.h"
+#include "encode.h"
+#include "rain.h"
+#include "sdf_grid.h"
+#include "sdf_program.h"
+#include "bodies.h"
+#include "output.h"
+#include "recording.h"
+#include "stream.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <locale.h>
 #include <time.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
-static volatile int resize_flag = 0;
-static TerminalState term_state;
+// Music is fed at this rate while no frames are being drawn
+#define AUDIO_TICK_SECONDS 0.05
+// How long a lone ESC waits for the rest of an escape sequence
+#define ESC_TIMEOUT_MS 30
+// Playback speeds W/S and --play-speed can reach
+#define PLAY_SPEED_MIN 0.0625
+#define PLAY_SPEED_MAX 64.0
+// How far A/D seek during playback
+#define PLAY_SEEK_MS 10000
 
-void sigwinch_handler(int sig) {
-    (void)sig;
-    resize_flag = 1;
+// --heatmap values in HeatmapMetric order
+static const char* const HEATMAP_OPTION_NAMES[HEATMAP_COUNT] = {"off", "primary", "shadow", "ao", "sdf"};
+// --quality values in RenderQuality order
+static const char* const QUALITY_OPTION_NAMES[RENDER_QUALITY_COUNT] = {"low", "medium", "high", "ultra"};
+
+// Append a light given as X Y Z [INTENSITY [RANGE]]; false if there is no room
+static bool add_light(Config* config, const float* values, int count) {
+    if (config->extra_light_count >= RENDER_MAX_LIGHTS - 1) {
+        return false;
+    }
+    float intensity = count > 3 ? values[3] : 1.0f;
+    config->extra_lights[config->extra_light_count++] = (Light){
+        .position = {values[0], values[1], values[2]},
+        .diffuse = 0.8f * intensity,
+        .specular = 0.5f * intensity,
+        .range = count > 4 ? values[4] : 0.0f
+    };
+    return true;
 }
 
-void sigint_handler(int sig) {
-    (void)sig;
-    terminal_restore(&term_state);
-    terminal_show_cursor();
-    input_cleanup();
-    exit(0);
+// Lights file: one "X Y Z [INTENSITY [RANGE]]" per line, # starts a comment
+static int load_lights(Config* config, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Failed to open lights file %s\n", path);
+        return 2;
+    }
+    char line[256];
+    int line_number = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\n")] = '\0';
+        float v[5];
+        int count = sscanf(line, "%f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4]);
+        if (count == EOF) {
+            continue;  // Blank or comment
+        }
+        if (count < 3) {
+            fprintf(stderr, "%s:%d: expected X Y Z [INTENSITY [RANGE]]\n", path, line_number);
+            status = 2;
+        } else if (!add_light(config, v, count)) {
+            fprintf(stderr, "%s:%d: at most %d lights\n", path, line_number, RENDER_MAX_LIGHTS);
+            status = 2;
+        }
+    }
+    fclose(file);
+    return status;
 }
 
 int parse_args(int argc, char** argv, Config* config) {
-    // Set defaults
-    config->cube_size = 1.0f;
-    config->rotation_speed = 1.0f;
-    // Default light in front, high and to the left
-    config->light_x = -3.0f;
-    config->light_y = 4.5f;
-    config->light_z = 4.0f;
-    config->max_raymarch_steps = 100;
+    engine_default_config(config);
 
     struct option long_options[] = {
         {"size", required_argument, 0, 's'},
@@ -48,7 +106,34 @@ int parse_args(int argc, char** argv, Config* config) {
         {"light-x", required_argument, 0, 'x'},
         {"light-y", required_argument, 0, 'y'},
         {"light-z", required_argument, 0, 'z'},
+        {"light", required_argument, 0, 'L'},
+        {"lights", required_argument, 0, 'I'},
+        {"shadow-budget", required_argument, 0, 'B'},
         {"max-steps", required_argument, 0, 'm'},
+        {"no-rain", no_argument, 0, 'R'},
+        {"rain-drops", required_argument, 0, 'D'},
+        {"no-audio", no_argument, 0, 'A'},
+        {"orbit", no_argument, 0, 'o'},
+        {"serve", required_argument, 0, 'S'},
+        {"grid", required_argument, 0, 'g'},
+        {"shm", required_argument, 0, 'P'},
+        {"subcell", required_argument, 0, 'c'},
+        {"full-shading", no_argument, 0, 'F'},
+        {"taa", no_argument, 0, 'T'},
+        {"ascii", no_argument, 0, 'a'},
+        {"quality", required_argument, 0, 'Q'},
+        {"heatmap", required_argument, 0, 'H'},
+        {"cost-dump", required_argument, 0, 'O'},
+        {"trace", required_argument, 0, 'E'},
+        {"model", required_argument, 0, 'M'},
+        {"model-res", required_argument, 0, 'G'},
+        {"scene", required_argument, 0, 'C'},
+        {"bodies", required_argument, 0, 'K'},
+        {"benchmark", required_argument, 0, 'b'},
+        {"record", required_argument, 0, 'W'},
+        {"play", required_argument, 0, 'Y'},
+        {"play-speed", required_argument, 0, 'Z'},
+        {"stream", no_argument, 0, 'V'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -71,8 +156,158 @@ int parse_args(int argc, char** argv, Config* config) {
             case 'z':
                 config->light_z = atof(optarg);
                 break;
+            case 'L': {
+                float v[5];
+                int count = sscanf(optarg, "%f,%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3], &v[4]);
+                if (count < 3) {
+                    fprintf(stderr, "Invalid --light '%s', expected X,Y,Z[,INTENSITY[,RANGE]]\n", optarg);
+                    return 2;
+                }
+                if (!add_light(config, v, count)) {
+                    fprintf(stderr, "Too many lights, at most %d\n", RENDER_MAX_LIGHTS);
+                    return 2;
+                }
+                break;
+            }
+            case 'I': {
+                int status = load_lights(config, optarg);
+                if (status != 0) {
+                    return status;
+                }
+                break;
+            }
+            case 'B':
+                config->shadow_budget = atoi(optarg);
+                if (config->shadow_budget < 0) config->shadow_budget = 0;
+                break;
             case 'm':
                 config->max_raymarch_steps = atoi(optarg);
+                if (config->max_raymarch_steps < 1) config->max_raymarch_steps = 1;
+                break;
+            case 'R':
+                config->rain = false;
+                break;
+            case 'D':
+                config->rain_drops = atoi(optarg);
+                if (config->rain_drops < 0) config->rain_drops = 0;
+                break;
+            case 'A':
+                config->audio = false;
+                break;
+            case 'o':
+                config->orbit = true;
+                break;
+            case 'S':
+                config->serve_path = optarg;
+                break;
+            case 'P':
+                config->shm_name = optarg;
+                break;
+            case 'c':
+                if (strcmp(optarg, "braille") == 0) {
+                    config->render_mode = RENDER_MODE_BRAILLE;
+                } else if (strcmp(optarg, "halfblock") == 0) {
+                    config->render_mode = RENDER_MODE_HALFBLOCK;
+                } else if (strcmp(optarg, "shape") == 0) {
+                    config->render_mode = RENDER_MODE_SHAPE;
+                } else if (strcmp(optarg, "off") == 0) {
+                    config->render_mode = RENDER_MODE_CELL;
+                } else {
+                    fprintf(stderr, "Invalid --subcell '%s', expected braille, halfblock, shape or off\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'F':
+                config->full_shading = true;
+                break;
+            case 'T':
+                config->temporal_aa = true;
+                break;
+            case 'a':
+                config->ascii = true;
+                break;
+            case 'Q': {
+                int quality = RENDER_QUALITY_COUNT;
+                for (int i = 0; i < RENDER_QUALITY_COUNT; i++) {
+                    if (strcmp(optarg, QUALITY_OPTION_NAMES[i]) == 0) {
+                        quality = i;
+                    }
+                }
+                if (quality == RENDER_QUALITY_COUNT) {
+                    fprintf(stderr, "Invalid --quality '%s', expected low, medium, high or ultra\n", optarg);
+                    return 2;
+                }
+                config->quality = (RenderQuality)quality;
+                break;
+            }
+            case 'H': {
+                int metric = HEATMAP_COUNT;
+                for (int i = 0; i < HEATMAP_COUNT; i++) {
+                    if (strcmp(optarg, HEATMAP_OPTION_NAMES[i]) == 0) {
+                        metric = i;
+                    }
+                }
+                if (metric == HEATMAP_COUNT) {
+                    fprintf(stderr, "Invalid --heatmap '%s', expected primary, shadow, ao, sdf or off\n", optarg);
+                    return 2;
+                }
+                config->heatmap = (HeatmapMetric)metric;
+                break;
+            }
+            case 'O':
+                config->cost_dump_path = optarg;
+                break;
+            case 'E':
+                config->trace_path = optarg;
+                break;
+            case 'M':
+                config->model_path = optarg;
+                break;
+            case 'C':
+                config->scene_path = optarg;
+                break;
+            case 'K':
+                config->body_count = atoi(optarg);
+                if (config->body_count < 1 || config->body_count > BODIES_MAX) {
+                    fprintf(stderr, "Invalid --bodies '%s', expected 1 to %d\n", optarg, BODIES_MAX);
+                    return 2;
+                }
+                break;
+            case 'G':
+                config->model_resolution = atoi(optarg);
+                if (config->model_resolution < SDF_GRID_MIN_RESOLUTION ||
+                    config->model_resolution > SDF_GRID_MAX_RESOLUTION) {
+                    fprintf(stderr, "Invalid --model-res '%s', expected %d to %d\n", optarg,
+                            SDF_GRID_MIN_RESOLUTION, SDF_GRID_MAX_RESOLUTION);
+                    return 2;
+                }
+                break;
+            case 'b':
+                config->benchmark_frames = atoi(optarg);
+                break;
+            case 'W':
+                config->record_path = optarg;
+                break;
+            case 'Y':
+                config->play_path = optarg;
+                break;
+            case 'Z':
+                config->play_speed = atof(optarg);
+                if (config->play_speed < PLAY_SPEED_MIN || config->play_speed > PLAY_SPEED_MAX) {
+                    fprintf(stderr, "Invalid --play-speed '%s', expected %g to %g\n", optarg,
+                            PLAY_SPEED_MIN, PLAY_SPEED_MAX);
+                    return 2;
+                }
+                break;
+            case 'V':
+                config->stream = true;
+                break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &config->grid_width, &config->grid_height) != 2 ||
+                    config->grid_width <= 0 || config->grid_height <= 0) {
+                    fprintf(stderr, "Invalid --grid '%s', expected WIDTHxHEIGHT\n", optarg);
+                    return 2;
+                }
                 break;
             case 'h':
                 print_usage(argv[0]);
@@ -83,6 +318,19 @@ int parse_args(int argc, char** argv, Config* config) {
         }
     }
 
+    if (config->model_path && config->scene_path) {
+        fprintf(stderr, "--model and --scene cannot be combined\n");
+        return 2;
+    }
+    if (config->body_count > 0 && (config->model_path || config->scene_path)) {
+        fprintf(stderr, "--bodies cannot be combined with --model or --scene\n");
+        return 2;
+    }
+    if (config->ascii && config->render_mode != RENDER_MODE_CELL && config->render_mode != RENDER_MODE_SHAPE) {
+        fprintf(stderr, "--ascii only works with cell rendering or --subcell shape\n");
+        return 2;
+    }
+
     return 0;
 }
 
@@ -93,6 +341,9 @@ void print_usage(const char* program_name) {
     printf("  W/S    - Rotate around X axis\n");
     printf("  A/D    - Rotate around Y axis\n");
     printf("  M      - Toggle motion mode (fly in circular path for depth effect)\n");
+    printf("  R      - Toggle rain\n");
+    printf("  H      - Cycle cost heatmaps (primary steps, shadow steps, AO taps, SDF calls)\n");
+    printf("  P      - Cycle quality presets\n");
     printf("  Q/ESC  - Quit\n\n");
     printf("Options:\n");
     printf("  --size FLOAT          Cube half-extent (default: 1.0)\n");
@@ -100,7 +351,35 @@ void print_usage(const char* program_name) {
     printf("  --light-x FLOAT       Light X position (default: -3.0)\n");
     printf("  --light-y FLOAT       Light Y position (default: 4.5)\n");
     printf("  --light-z FLOAT       Light Z position (default: 4.0)\n");
-    printf("  --max-steps INT       Maximum raymarching iterations (default: 100)\n");
+    printf("  --light X,Y,Z[,I[,R]] Add a point light with intensity I and range R (repeatable)\n");
+    printf("  --lights FILE         Add the lights in FILE, one 'X Y Z [I [R]]' per line\n");
+    printf("  --shadow-budget N     Shadow rays per sample; other lights share them (default: 2)\n");
+    printf("  --max-steps INT       Maximum raymarching steps per primary ray (default: 100)\n");
+    printf("  --no-rain             Start with rain disabled\n");
+    printf("  --rain-drops INT      Number of rain particles (default: 1500)\n");
+    printf("  --no-audio            Do not start background music\n");
+    printf("  --orbit               Start with the motion path enabled\n");
+    printf("  --serve PATH          Render once and stream frames to viewers on a Unix socket\n");
+    printf("  --grid WxH            Frame size in server and benchmark modes (default: 80x24)\n");
+    printf("  --shm NAME            Publish frames to a shared-memory ring (e.g. /ascii_cube)\n");
+    printf("  --subcell MODE        Subcell rendering: braille (2x4), halfblock (1x2), shape (4x4) or off\n");
+    printf("  --full-shading        March shadow and AO for every hit (no convexity shortcuts)\n");
+    printf("  --taa                 Accumulate jittered samples over frames to antialias cell mode\n");
+    printf("  --ascii               Draw with single-byte ASCII glyphs only\n");
+    printf("  --quality PRESET      Shading preset: low, medium, high or ultra (default: high)\n");
+    printf("  --heatmap METRIC      Start with a cost heatmap: primary, shadow, ao, sdf or off\n");
+    printf("  --cost-dump FILE      On exit, write the per-cell costs of the last frame to FILE\n");
+    printf("  --trace FILE          On exit, write a Chrome trace-event timeline of frame stages to FILE\n");
+    printf("  --model FILE          Render a Wavefront OBJ model instead of the cube\n");
+    printf("  --model-res N         Distance grid resolution for --model (default: %d)\n",
+           SDF_GRID_DEFAULT_RESOLUTION);
+    printf("  --scene FILE          Render a CSG scene file instead of the cube\n");
+    printf("  --bodies N            Simulate N cubes falling onto a platform (max %d)\n", BODIES_MAX);
+    printf("  --benchmark FRAMES    Render FRAMES frames headless at --grid size and print timings\n");
+    printf("  --record FILE         Record the frames shown (or served) to FILE\n");
+    printf("  --play FILE           Play a recording: A/D seek 10s, W/S speed, P pause, Q quit\n");
+    printf("  --play-speed FLOAT    Starting playback speed (default: 1.0)\n");
+    printf("  --stream              Show PGM/PPM or Y4M frames piped to stdin instead of rendering\n");
     printf("  --help                Show this help message\n");
 }
 
@@ -110,6 +389,679 @@ static double get_time_seconds(void) {
     return ts.tv_sec + ts.tv_nsec / 1000000000.0;
 }
 
+// Block the signals we care about and receive them through a descriptor
+// instead, so they wake poll() like any other event.
+static int create_signal_fd(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGWINCH);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        return -1;
+    }
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+// Arm the frame timer with a period in seconds; 0 disarms it.
+static void set_frame_timer(int fd, double interval) {
+    struct itimerspec spec = {0};
+    if (interval > 0.0) {
+        spec.it_interval.tv_sec = (time_t)interval;
+        spec.it_interval.tv_nsec = (long)((interval - (double)spec.it_interval.tv_sec) * 1000000000.0);
+        spec.it_value = spec.it_interval;
+    }
+    timerfd_settime(fd, 0, &spec, NULL);
+}
+
+// Write the per-cell costs if --cost-dump asked for them; false on failure
+static bool write_cost_dump(const Config* config, const Renderer* renderer) {
+    return !config->cost_dump_path || renderer_dump_costs(renderer, config->cost_dump_path) == 0;
+}
+
+// Write the timeline if --trace asked for one, then free the trace buffers
+static void finish_trace(const Config* config) {
+    if (!config->trace_path) {
+        return;
+    }
+    if (trace_write(config->trace_path) != 0) {
+        fprintf(stderr, "Failed to write trace %s\n", config->trace_path);
+    }
+    trace_stop();
+}
+
+// Open the --record file if one was asked for; false if it cannot be written
+static bool start_recording(const Config* config, Recorder** recorder) {
+    *recorder = NULL;
+    if (!config->record_path) {
+        return true;
+    }
+    *recorder = recorder_create(config->record_path);
+    return *recorder != NULL;
+}
+
+// Append fb to the recording. A failed write ends the recording, which is
+// reported at exit.
+static void record_frame(Recorder** recorder, bool* record_ok, const Framebuffer* fb, double seconds) {
+    if (!*recorder) {
+        return;
+    }
+    trace_begin("recorder_write");
+    if (recorder_write(*recorder, fb, seconds) != 0) {
+        recorder_destroy(*recorder);
+        *recorder = NULL;
+        *record_ok = false;
+    }
+    trace_end("recorder_write");
+}
+
+// Write the recording's index and close it; prints the outcome
+static void finish_recording(const Config* config, Recorder* recorder, bool record_ok) {
+    if (!config->record_path) {
+        return;
+    }
+    if (recorder) {
+        if (recorder_finish(recorder) == 0) {
+            fprintf(stderr, "Recorded %lu frames (%.1f KB) to %s\n", recorder->frames,
+                    (double)recorder->offset / 1000.0, config->record_path);
+        } else {
+            record_ok = false;
+        }
+        recorder_destroy(recorder);
+    }
+    if (!record_ok) {
+        fprintf(stderr, "Failed to write recording %s\n", config->record_path);
+    }
+}
+
+// Headless broadcast mode: render each frame once and stream the encoded
+// bytes to every connected viewer. Frames tick only while something animates
+// and somebody is watching.
+static int run_server(const Config* config, Engine* engine) {
+    signal(SIGPIPE, SIG_IGN);
+
+    int signal_fd = create_signal_fd();
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    BroadcastServer* server = server_create(config->serve_path);
+    Framebuffer* fb = engine->fb;
+    if (signal_fd < 0 || timer_fd < 0 || !server) {
+        fprintf(stderr, "Failed to start server on %s\n", config->serve_path);
+        server_destroy(server);
+        return 1;
+    }
+    FrameRing* ring = NULL;
+    if (config->shm_name) {
+        ring = frame_ring_create(config->shm_name, fb->width, fb->height);
+        if (!ring) {
+            fprintf(stderr, "Failed to create shared-memory ring %s\n", config->shm_name);
+            server_destroy(server);
+            return 1;
+        }
+    }
+    Recorder* recorder;
+    bool record_ok = true;
+    if (!start_recording(config, &recorder)) {
+        server_destroy(server);
+        frame_ring_destroy(ring);
+        return 1;
+    }
+    fprintf(stderr, "Serving %dx%d frames on %s\n",
+            config->grid_width, config->grid_height, config->serve_path);
+
+    InputState input = {0};
+
+    const double target_frame_time = 1.0 / 60.0;
+    double last_frame_time = get_time_seconds();
+    double record_start = last_frame_time;
+    double fps_smooth = 60.0;
+    unsigned long frame_count = 0;
+    bool frame_due = false;
+    bool was_animating = false;
+    bool quit = false;
+    double timer_interval = -1.0;
+
+    struct pollfd fds[2 + 1 + SERVER_MAX_CLIENTS];
+
+    while (!quit) {
+        bool watched = server->client_count > 0 || ring != NULL;
+        bool animating = watched && engine_is_animating(engine);
+        double interval = animating ? target_frame_time : 0.0;
+        if (interval != timer_interval) {
+            set_frame_timer(timer_fd, interval);
+            timer_interval = interval;
+        }
+
+        fds[0] = (struct pollfd){.fd = signal_fd, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = timer_fd, .events = POLLIN};
+        int server_fds = server_fill_pollfds(server, fds + 2, 1 + SERVER_MAX_CLIENTS);
+
+        int ready = poll(fds, (nfds_t)(2 + server_fds), frame_due ? 0 : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo != SIGWINCH) {
+                    quit = true;
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+            (void)r;
+            if (animating) {
+                frame_due = true;
+            }
+        }
+        if (server_handle_events(server, fds + 2, server_fds) && !server->last) {
+            frame_due = true;  // First viewer, nothing rendered yet
+        }
+
+        if (!frame_due || quit) {
+            continue;
+        }
+        frame_due = false;
+
+        double frame_start = get_time_seconds();
+        float dt = (float)(frame_start - last_frame_time);
+        dt = dt > 0.1f ? 0.1f : dt;
+        if (!was_animating) {
+            dt = (float)target_frame_time;
+        }
+        trace_begin("frame");
+        engine_step(engine, input, dt);
+        engine_update_rain(engine, dt);
+
+        FrameStats stats = {
+            .frame_time_ms = dt * 1000.0f,
+            .fps = (float)fps_smooth,
+            .frame_count = frame_count
+        };
+        engine_render(engine, fb, stats);
+        trace_begin("server_publish");
+        server_publish(server, fb);
+        trace_end("server_publish");
+        if (ring) {
+            trace_begin("frame_ring_publish");
+            frame_ring_publish(ring, fb, frame_count);
+            trace_end("frame_ring_publish");
+        }
+        record_frame(&recorder, &record_ok, fb, frame_start - record_start);
+        trace_end("frame");
+
+        if (was_animating && frame_start > last_frame_time) {
+            fps_smooth = fps_smooth * 0.9 + 0.1 / (frame_start - last_frame_time);
+        }
+        was_animating = animating;
+        last_frame_time = frame_start;
+        frame_count++;
+    }
+
+    fprintf(stderr, "Published %lu frames (%lu keyframes encoded)\n",
+            server->frames_published, server->keyframes_encoded);
+    server_destroy(server);
+    frame_ring_destroy(ring);
+    finish_recording(config, recorder, record_ok);
+    if (!write_cost_dump(config, engine->renderer)) {
+        fprintf(stderr, "Failed to write cost dump %s\n", config->cost_dump_path);
+    }
+    close(timer_fd);
+    close(signal_fd);
+    return 0;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+// Print mean/p50/p99 of per-frame timings given in milliseconds (sorts samples)
+static void print_timing(const char* label, double* samples, int count) {
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, (size_t)count, sizeof(double), compare_doubles);
+    printf("  %-8s mean %7.3f ms   p50 %7.3f ms   p99 %7.3f ms\n", label,
+           sum / count, samples[count / 2], samples[(count * 99) / 100]);
+}
+
+// Headless benchmark: render and encode a fixed number of frames of the
+// orbiting cube at a fixed timestep, then report per-stage timings.
+static int run_benchmark(const Config* config, Engine* engine) {
+    static const char* const MODE_NAMES[] = {"cell", "halfblock", "braille", "shape"};
+    int frames = config->benchmark_frames;
+
+    Framebuffer* fb = engine->fb;
+    Renderer* renderer = engine->renderer;
+    BodyWorld* bodies = engine->bodies;
+
+    double* render_ms = malloc((size_t)frames * sizeof(double));
+    double* encode_ms = malloc((size_t)frames * sizeof(double));
+    double* rain_ms = malloc((size_t)frames * sizeof(double));
+    double* physics_ms = malloc((size_t)frames * sizeof(double));
+    if (!render_ms || !encode_ms || !rain_ms || !physics_ms) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        free(render_ms);
+        free(encode_ms);
+        free(rain_ms);
+        free(physics_ms);
+        return 1;
+    }
+
+    engine->cube.motion_mode = !bodies;  // Keep the workload moving through depth
+
+    InputState input = {0};
+    ByteBuffer out;
+    byte_buffer_init(&out);
+    double total_bytes = 0.0;
+    double total_rays = 0.0;
+    double total_steps = 0.0;
+    int max_steps = 0;
+    const float dt = 1.0f / 60.0f;
+
+    for (int i = 0; i < frames; i++) {
+        trace_begin("frame");
+        double p0 = get_time_seconds();
+        engine_step(engine, input, dt);
+        double r0 = get_time_seconds();
+        physics_ms[i] = (r0 - p0) * 1000.0;
+        engine_update_rain(engine, dt);
+        rain_ms[i] = (get_time_seconds() - r0) * 1000.0;
+        FrameStats stats = {
+            .frame_time_ms = dt * 1000.0f,
+            .fps = 60.0f,
+            .frame_count = (unsigned long)i
+        };
+
+        double t0 = get_time_seconds();
+        engine_render(engine, fb, stats);
+        double t1 = get_time_seconds();
+        out.len = 0;
+        trace_begin("frame_encode_full");
+        frame_encode_full(fb, &out);
+        trace_end("frame_encode_full");
+        trace_end("frame");
+        double t2 = get_time_seconds();
+
+        render_ms[i] = (t1 - t0) * 1000.0;
+        encode_ms[i] = (t2 - t1) * 1000.0;
+        total_bytes += (double)out.len;
+        total_rays += (double)renderer->rays_traced;
+        total_steps += (double)renderer->march_steps;
+        if (renderer->max_march_steps > max_steps) {
+            max_steps = renderer->max_march_steps;
+        }
+    }
+
+    printf("Benchmark: %d frames at %dx%d, mode %s%s, quality %s, rain %s (%d drops)\n", frames,
+           fb->width, fb->height, MODE_NAMES[config->render_mode], config->ascii ? " (ascii)" : "",
+           QUALITY_OPTION_NAMES[config->quality], config->rain ? "on" : "off", config->rain_drops);
+    if (bodies) {
+        printf("  %d bodies, %d still at the end\n", bodies->count - bodies->static_count,
+               bodies->count - bodies->static_count - body_world_awake_count(bodies));
+    }
+    print_timing("physics", physics_ms, frames);
+    print_timing("rain", rain_ms, frames);
+    print_timing("render", render_ms, frames);
+    print_timing("encode", encode_ms, frames);
+    printf("  rays/frame %.0f   bytes/frame %.0f (%.2f per cell)\n", total_rays / frames, total_bytes / frames,
+           total_bytes / frames / ((double)fb->width * (double)fb->height));
+    printf("  steps/ray mean %.2f   max %d\n", total_rays > 0.0 ? total_steps / total_rays : 0.0, max_steps);
+
+    byte_buffer_free(&out);
+    free(render_ms);
+    free(encode_ms);
+    free(rain_ms);
+    free(physics_ms);
+    if (!write_cost_dump(config, renderer)) {
+        fprintf(stderr, "Failed to write cost dump %s\n", config->cost_dump_path);
+    }
+    return 0;
+}
+
+// Copy the recorded frame into the top of fb, cropped or padded to fit, and
+// write the playback clock into fb's last row
+static void draw_playback(Framebuffer* fb, const RecordingPlayer* player, double position_ms,
+                          double speed, bool paused) {
+    framebuffer_clear(fb);
+    const Framebuffer* frame = player->frame;
+    int rows = fb->height - 1;
+    for (int y = 0; y < rows && y < frame->height; y++) {
+        int cols = fb->width < frame->width ? fb->width : frame->width;
+        memcpy(fb->chars + y * fb->width, frame->chars + y * frame->width, (size_t)cols * sizeof(wchar_t));
+        memcpy(fb->colors + y * fb->width, frame->colors + y * frame->width, (size_t)cols);
+    }
+
+    char status[128];
+    int position_s = (int)(position_ms / 1000.0);
+    int duration_s = (int)(player->duration_ms / 1000);
+    const char* state = paused ? "paused" : recording_player_next_time(player) < 0 ? "end" : "playing";
+    snprintf(status, sizeof(status), " %02d:%02d / %02d:%02d  x%g  %s   A/D seek  W/S speed  P pause  Q quit",
+             position_s / 60, position_s % 60, duration_s / 60, duration_s % 60, speed, state);
+    wchar_t* row = fb->chars + rows * fb->width;
+    for (int x = 0; x < fb->width && status[x]; x++) {
+        row[x] = (wchar_t)status[x];
+        fb->colors[rows * fb->width + x] = COLOR_FPS;
+    }
+}
+
+// Play a recording through the same terminal output as live frames. The
+// loop sleeps until the next recorded frame is due, so playback costs little
+// more than decoding the cells that changed.
+static int run_player(const Config* config) {
+    RecordingPlayer* player = recording_player_open(config->play_path);
+    if (!player) {
+        return 1;
+    }
+    TerminalState term_state;
+    if (terminal_init(&term_state) != 0 || input_init() != 0) {
+        fprintf(stderr, "Failed to initialize terminal\n");
+        terminal_restore(&term_state);
+        recording_player_close(player);
+        return 1;
+    }
+
+    int term_width, term_height;
+    terminal_get_size(&term_width, &term_height);
+    int signal_fd = create_signal_fd();
+    Framebuffer* fb = framebuffer_create(term_width, term_height);
+    TerminalOutput* output = terminal_output_create(STDOUT_FILENO);
+    if (signal_fd < 0 || !fb || !output || recording_player_seek(player, 0) != 0) {
+        terminal_output_destroy(output);
+        framebuffer_destroy(fb);
+        terminal_restore(&term_state);
+        input_cleanup();
+        fprintf(stderr, "Failed to start playback of %s\n", config->play_path);
+        recording_player_close(player);
+        return 1;
+    }
+
+    InputState input = {0};
+    double speed = config->play_speed;
+    bool paused = false;
+    // The clock reads base_ms at base_time and runs at speed from there
+    double base_ms = 0.0;
+    double base_time = get_time_seconds();
+    bool frame_due = true;
+    bool resize_pending = false;
+    double escape_deadline = 0.0;
+    int status = 0;
+
+    while (!input.quit_requested) {
+        double now = get_time_seconds();
+        double position = paused ? base_ms : base_ms + (now - base_time) * 1000.0 * speed;
+        position = fmin(position, (double)player->duration_ms);
+        int64_t next = recording_player_next_time(player);
+
+        int timeout_ms = -1;
+        if (frame_due) {
+            timeout_ms = terminal_output_ready(output, now) ? 0 : OUTPUT_RETRY_MS;
+        } else if (input_has_pending(&input)) {
+            timeout_ms = escape_deadline > now ? (int)((escape_deadline - now) * 1000.0) + 1 : 0;
+        } else if (!paused && next >= 0) {
+            timeout_ms = (int)fmax(0.0, ((double)next - position) / speed) + 1;
+        }
+
+        struct pollfd fds[3] = {
+            {.fd = signal_fd, .events = POLLIN},
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = terminal_output_pending(output) ? STDOUT_FILENO : -1, .events = POLLOUT}
+        };
+        if (poll(fds, 3, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        now = get_time_seconds();
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo == SIGWINCH) {
+                    resize_pending = true;
+                    frame_due = true;
+                } else {
+                    input.quit_requested = true;
+                }
+            }
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            int reports = input.cursor_reports;
+            int n = input_read(&input);
+            terminal_output_acknowledge(output, input.cursor_reports - reports, now);
+            if (n < 0) {
+                input.quit_requested = true;
+            } else if (n > 0) {
+                escape_deadline = now + ESC_TIMEOUT_MS / 1000.0;
+            }
+        }
+        if (input_has_pending(&input) && now >= escape_deadline) {
+            input_flush(&input);
+        }
+        if ((fds[2].revents & (POLLOUT | POLLERR | POLLHUP)) && terminal_output_flush(output) != 0) {
+            break;
+        }
+
+        // Keys act on the clock as it reads now
+        position = paused ? base_ms : base_ms + (now - base_time) * 1000.0 * speed;
+        position = fmin(position, (double)player->duration_ms);
+        if (input.a_pressed || input.d_pressed) {
+            double target = position + (input.d_pressed ? PLAY_SEEK_MS : -PLAY_SEEK_MS);
+            position = fmax(0.0, fmin(target, (double)player->duration_ms));
+            if (recording_player_seek(player, (uint32_t)position) != 0) {
+                status = 1;
+                break;
+            }
+            frame_due = true;
+        }
+        if (input.w_pressed || input.s_pressed) {
+            speed = fmax(PLAY_SPEED_MIN, fmin(PLAY_SPEED_MAX, input.w_pressed ? speed * 2.0 : speed * 0.5));
+            frame_due = true;
+        }
+        if (input.p_pressed) {
+            paused = !paused;
+            frame_due = true;
+        }
+        base_ms = position;
+        base_time = now;
+        input_consume(&input);
+
+        // Frames that came due while the terminal was busy are decoded but
+        // only the newest is shown
+        if (!paused) {
+            for (next = recording_player_next_time(player); next >= 0 && (double)next <= position;
+                 next = recording_player_next_time(player)) {
+                if (recording_player_step(player) != 1) {
+                    status = 1;
+                    break;
+                }
+                frame_due = true;
+            }
+            if (status != 0) {
+                break;
+            }
+        }
+
+        if (!frame_due || input.quit_requested || !terminal_output_ready(output, now)) {
+            continue;
+        }
+        frame_due = false;
+        if (resize_pending) {
+            resize_pending = false;
+            terminal_get_size(&term_width, &term_height);
+            framebuffer_destroy(fb);
+            fb = framebuffer_create(term_width, term_height);
+            if (!fb) {
+                break;
+            }
+            terminal_output_invalidate(output);
+        }
+        draw_playback(fb, player, position, speed, paused);
+        if (terminal_output_submit(output, fb, now, NULL) != 0) {
+            break;
+        }
+    }
+
+    framebuffer_destroy(fb);
+    close(signal_fd);
+    terminal_output_finish(output);
+    terminal_restore(&term_state);
+    terminal_show_cursor();
+    input_cleanup();
+    terminal_output_destroy(output);
+    if (status != 0) {
+        fprintf(stderr, "%s is damaged after %.1f s\n", config->play_path, player->time_ms / 1000.0);
+    }
+    recording_player_close(player);
+    return status;
+}
+
+// Show the frames piped to stdin. A frame is taken every 1/fps seconds,
+// allowing one to catch up; while the terminal is busy only the newest of
+// them is shown. stdin is the pipe, so Ctrl-C (a signal) is the way out.
+static int run_stream(const Config* config) {
+    if (isatty(STDIN_FILENO)) {
+        fprintf(stderr, "--stream reads frames from a pipe on stdin\n");
+        return 2;
+    }
+    // The reader thread inherits the blocked signals
+    int signal_fd = create_signal_fd();
+    FrameStream* stream = signal_fd >= 0 ? frame_stream_open(STDIN_FILENO) : NULL;
+    int term_width, term_height;
+    terminal_get_size(&term_width, &term_height);
+    Framebuffer* fb = framebuffer_create(term_width, term_height);
+    if (!stream || !fb) {
+        fprintf(stderr, "Failed to start streaming\n");
+        framebuffer_destroy(fb);
+        frame_stream_close(stream);
+        if (signal_fd >= 0) close(signal_fd);
+        return 1;
+    }
+    terminal_hide_cursor();
+    terminal_clear();
+    TerminalOutput* output = terminal_output_create(STDOUT_FILENO);
+    if (!output) {
+        fprintf(stderr, "Failed to create terminal output\n");
+        terminal_show_cursor();
+        framebuffer_destroy(fb);
+        frame_stream_close(stream);
+        close(signal_fd);
+        return 1;
+    }
+
+    const GlyphSet* glyphs = config->ascii ? &GLYPHS_ASCII : &GLYPHS_UNICODE;
+    double next_due = get_time_seconds();  // When the next frame may be taken
+    bool frame_due = false;
+    bool resize_pending = false;
+    bool quit = false;
+    bool finished = false;
+    int status = 0;
+
+    while (!quit) {
+        double now = get_time_seconds();
+        int timeout_ms = -1;
+        if (frame_due) {
+            timeout_ms = terminal_output_ready(output, now) ? 0 : OUTPUT_RETRY_MS;
+        } else if (now < next_due) {
+            timeout_ms = (int)((next_due - now) * 1000.0) + 1;
+        }
+
+        struct pollfd fds[3] = {
+            {.fd = signal_fd, .events = POLLIN},
+            {.fd = stream->event_fd, .events = POLLIN},
+            {.fd = terminal_output_pending(output) ? STDOUT_FILENO : -1, .events = POLLOUT}
+        };
+        if (poll(fds, 3, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        now = get_time_seconds();
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo == SIGWINCH) {
+                    resize_pending = true;
+                } else {
+                    quit = true;
+                }
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            ssize_t r = read(stream->event_fd, &count, sizeof(count));
+            (void)r;
+        }
+        if ((fds[2].revents & (POLLOUT | POLLERR | POLLHUP)) && terminal_output_flush(output) != 0) {
+            break;
+        }
+
+        if (resize_pending) {
+            resize_pending = false;
+            terminal_get_size(&term_width, &term_height);
+            framebuffer_destroy(fb);
+            fb = framebuffer_create(term_width, term_height);
+            if (!fb) {
+                status = 1;
+                break;
+            }
+            terminal_output_invalidate(output);
+        }
+
+        // Frames that came due while the terminal was busy are drawn but
+        // only the newest is shown
+        if (now >= next_due) {
+            trace_begin("stream_draw");
+            int drawn = frame_stream_draw(stream, fb, glyphs);
+            trace_end("stream_draw");
+            if (drawn < 0) {
+                status = 1;
+                break;
+            }
+            if (drawn) {
+                double interval = 1.0 / frame_stream_fps(stream);
+                next_due = fmax(next_due, now - interval) + interval;
+                frame_due = true;
+            } else if (frame_stream_finished(stream)) {
+                finished = true;
+                quit = !frame_due;
+            }
+        }
+
+        if (!frame_due || quit || !terminal_output_ready(output, now)) {
+            continue;
+        }
+        frame_due = false;
+        trace_begin("terminal_output_submit");
+        int written = terminal_output_submit(output, fb, now, NULL);
+        trace_end("terminal_output_submit");
+        if (written != 0) {
+            break;
+        }
+        quit = finished;
+    }
+
+    // The last frame stays on screen
+    terminal_output_finish(output);
+    printf("\033[%d;1H\n", term_height);
+    terminal_show_cursor();
+    terminal_output_print_summary(output, stderr);
+    terminal_output_destroy(output);
+    if (finished && stream->error[0]) {
+        fprintf(stderr, "stdin: %s\n", stream->error);
+        status = 1;
+    }
+    frame_stream_close(stream);
+    framebuffer_destroy(fb);
+    close(signal_fd);
+    return status;
+}
+
 int main(int argc, char** argv) {
     setlocale(LC_ALL, "");
 
@@ -117,10 +1069,45 @@ int main(int argc, char** argv) {
     if (parse_args(argc, argv, &config) != 0) {
         return 2;
     }
+    if (config.trace_path) {
+        trace_start();
+        trace_thread_name("main");
+    }
+
+    if (config.play_path) {
+        int status = run_player(&config);
+        finish_trace(&config);
+        return status;
+    }
+    if (config.stream) {
+        int status = run_stream(&config);
+        finish_trace(&config);
+        return status;
+    }
+
+    // Headless modes render at --grid size, the terminal leaves a status line
+    int width = config.grid_width, height = config.grid_height;
+    if (config.benchmark_frames <= 0 && !config.serve_path) {
+        terminal_get_size(&width, &height);
+        height--;
+    }
+    Engine* engine = engine_create(&config, width, height);
+    if (!engine) {
+        return 1;
+    }
+
+    if (config.benchmark_frames > 0 || config.serve_path) {
+        int status = config.benchmark_frames > 0 ? run_benchmark(&config, engine) : run_server(&config, engine);
+        finish_trace(&config);
+        engine_destroy(engine);
+        return status;
+    }
 
     // Initialize terminal
+    TerminalState term_state;
     if (terminal_init(&term_state) != 0) {
         fprintf(stderr, "Failed to initialize terminal\n");
+        engine_destroy(engine);
         return 1;
     }
 
@@ -128,137 +1115,278 @@ int main(int argc, char** argv) {
     if (input_init() != 0) {
         fprintf(stderr, "Failed to initialize input\n");
         terminal_restore(&term_state);
+        engine_destroy(engine);
         return 1;
     }
 
     // Start background audio (best-effort; ignore failure)
-    audio_start();
+    if (config.audio) {
+        audio_start(&engine->audio);
+    }
 
-    // Setup signal handlers
-    signal(SIGINT, sigint_handler);
-    signal(SIGTERM, sigint_handler);
-    signal(SIGWINCH, sigwinch_handler);
+    // Signals and frame ticks arrive as descriptors for the event loop
+    int signal_fd = create_signal_fd();
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (signal_fd < 0 || timer_fd < 0) {
+        fprintf(stderr, "Failed to create event descriptors\n");
+        terminal_restore(&term_state);
+        input_cleanup();
+        engine_destroy(engine);
+        return 1;
+    }
 
-    // Get terminal size and create framebuffer
-    int term_width, term_height;
-    terminal_get_size(&term_width, &term_height);
+    FrameRing* ring = NULL;
+    if (config.shm_name) {
+        ring = frame_ring_create(config.shm_name, engine->fb->width, engine->fb->height);
+        if (!ring) {
+            fprintf(stderr, "Failed to create shared-memory ring %s\n", config.shm_name);
+            terminal_restore(&term_state);
+            input_cleanup();
+            engine_destroy(engine);
+            return 3;
+        }
+    }
 
-    Framebuffer* fb = framebuffer_create(term_width, term_height - 1);  // -1 for status line
-    if (!fb) {
-        fprintf(stderr, "Failed to create framebuffer\n");
+    Recorder* recorder;
+    bool record_ok = true;
+    if (!start_recording(&config, &recorder)) {
+        frame_ring_destroy(ring);
         terminal_restore(&term_state);
         input_cleanup();
+        engine_destroy(engine);
         return 3;
     }
 
-    // Initialize cube state
-    CubeState cube = {
-        // Initial tilt
-        .rotation = mat3_multiply(mat3_rotate_y(0.6f), mat3_rotate_x(-0.4f)),
-        .angular_velocity = {0.25f, 0.35f, 0.10f},
-        .position = {0, 0, 0},
-        .size = config.cube_size,
-        .motion_mode = false,
-        .motion_phase = 0.0f
-    };
-
-    // Physics configuration
-    PhysicsConfig physics_config = {
-        .acceleration = 9.0f * config.rotation_speed,
-        .damping = 0.97f,
-        .max_velocity = 20.0f * config.rotation_speed
-    };
-
-    // Light setup
-    Light light = {
-        .position = {config.light_x, config.light_y, config.light_z},
-        .ambient = 0.2f,
-        .diffuse = 0.8f,
-        .specular = 0.5f
-    };
+    TerminalOutput* output = terminal_output_create(STDOUT_FILENO);
+    if (!output) {
+        fprintf(stderr, "Failed to create terminal output\n");
+        recorder_destroy(recorder);
+        frame_ring_destroy(ring);
+        terminal_restore(&term_state);
+        input_cleanup();
+        engine_destroy(engine);
+        return 3;
+    }
+    Framebuffer* fb = engine->fb;
+    Renderer* renderer = engine->renderer;
 
     // Input state
     InputState input = {0};
+    input.focused = true;
 
     // Frame timing
     const double target_fps = 60.0;
     const double target_frame_time = 1.0 / target_fps;
     double last_frame_time = get_time_seconds();
+    double last_audio_time = last_frame_time;
+    double record_start = last_frame_time;
     double fps_smooth = 60.0;
     unsigned long frame_count = 0;
 
-    // Main loop
+    bool frame_due = true;       // Draw the first frame right away
+    bool was_animating = false;  // Whether the previous frame was part of an animation
+    bool resize_pending = false;
+    double timer_interval = -1.0;
+    double escape_deadline = 0.0;  // When an incomplete escape sequence is given up on
+    LatencyStats latency = {0};
+    output->latency = &latency;
+
+    // Main loop: sleep in poll() until a signal, input or a frame tick arrives.
+    // Frames only tick while something moves, so an idle scene costs nothing.
     while (!input.quit_requested) {
-        double frame_start = get_time_seconds();
+        bool animating = input.focused && engine_is_animating(engine);
+        double interval = 0.0;
+        if (animating) {
+            interval = target_frame_time;
+        } else if (audio_is_enabled(&engine->audio)) {
+            interval = AUDIO_TICK_SECONDS;
+        }
+        if (interval != timer_interval) {
+            set_frame_timer(timer_fd, interval);
+            timer_interval = interval;
+        }
+
+        // A due frame waits while the terminal link is backed up
+        int timeout_ms = -1;
+        if (frame_due) {
+            timeout_ms = terminal_output_ready(output, get_time_seconds()) ? 0 : OUTPUT_RETRY_MS;
+        } else if (input_has_pending(&input)) {
+            double remaining = escape_deadline - get_time_seconds();
+            timeout_ms = remaining > 0.0 ? (int)(remaining * 1000.0) + 1 : 0;
+        }
+
+        struct pollfd fds[4] = {
+            {.fd = signal_fd, .events = POLLIN},
+            {.fd = STDIN_FILENO, .events = POLLIN},
+            {.fd = timer_fd, .events = POLLIN},
+            {.fd = terminal_output_pending(output) ? STDOUT_FILENO : -1, .events = POLLOUT}
+        };
+        int ready = poll(fds, 4, timeout_ms);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo == SIGWINCH) {
+                    resize_pending = true;
+                    frame_due = true;
+                } else {
+                    input.quit_requested = true;
+                }
+            }
+        }
+
+        if (fds[1].revents & (POLLIN | POLLHUP)) {
+            trace_begin("input_read");
+            int reports = input.cursor_reports;
+            int n = input_read(&input);
+            trace_end("input_read");
+            terminal_output_acknowledge(output, input.cursor_reports - reports, get_time_seconds());
+            if (n < 0) {
+                input.quit_requested = true;
+            } else if (n > 0) {
+                frame_due = true;
+                escape_deadline = get_time_seconds() + ESC_TIMEOUT_MS / 1000.0;
+            }
+        }
+
+        if (input_has_pending(&input) && get_time_seconds() >= escape_deadline) {
+            input_flush(&input);
+            frame_due = true;
+        }
+
+        if (fds[2].revents & POLLIN) {
+            uint64_t expirations;
+            ssize_t r = read(timer_fd, &expirations, sizeof(expirations));
+            (void)r;
+            if (animating) {
+                if (frame_due) {
+                    output->ticks_skipped++;
+                }
+                frame_due = true;
+            }
+        }
+
+        if ((fds[3].revents & (POLLOUT | POLLERR | POLLHUP)) && terminal_output_flush(output) != 0) {
+            break;
+        }
+
+        // Keep the music fed whether or not a frame is drawn
+        double now = get_time_seconds();
+        trace_begin("audio_step");
+        audio_step(&engine->audio, now - last_audio_time);
+        trace_end("audio_step");
+        last_audio_time = now;
+
+        if (!frame_due || input.quit_requested || !terminal_output_ready(output, now)) {
+            continue;
+        }
+        frame_due = false;
+
+        double frame_start = now;
+        trace_begin("frame");
 
         // Handle resize
-        if (resize_flag) {
-            resize_flag = 0;
-            terminal_get_size(&term_width, &term_height);
-            framebuffer_destroy(fb);
-            fb = framebuffer_create(term_width, term_height - 1);
-            if (!fb) {
+        if (resize_pending) {
+            resize_pending = false;
+            terminal_get_size(&width, &height);
+            if (engine_resize(engine, width, height - 1) != 0) {
                 fprintf(stderr, "Failed to reallocate framebuffer\n");
                 break;
             }
+            fb = engine->fb;
+            terminal_output_invalidate(output);
         }
 
-        // Poll input
-        input_poll(&input, 0);
-
         // Apply audio volume changes (from scroll wheel or +/- keys)
         if (input.volume_delta != 0) {
-            audio_adjust_volume((float)input.volume_delta * 0.01f);
+            audio_adjust_volume(&engine->audio, (float)input.volume_delta * 0.01f);
+        }
+        if (input.r_pressed) {
+            renderer->settings.rain = !renderer->settings.rain;
+        }
+        if (input.h_pressed) {
+            renderer->settings.heatmap = (HeatmapMetric)((renderer->settings.heatmap + 1) % HEATMAP_COUNT);
+        }
+        if (input.p_pressed) {
+            renderer->settings.quality = (RenderQuality)((renderer->settings.quality + 1) % RENDER_QUALITY_COUNT);
         }
 
-        // Update physics
+        // Update physics; a frame that wakes from idle advances one nominal tick
         float dt = (float)(frame_start - last_frame_time);
         dt = dt > 0.1f ? 0.1f : dt;  // Clamp dt
-        physics_step(&cube, input, physics_config, dt);
-
-        // Advance background music in lock-step with frame time
-        audio_step(frame_start - last_frame_time);
+        if (!was_animating) {
+            dt = (float)target_frame_time;
+        }
+        double event_time = input.event_time;
+        engine_step(engine, input, dt);
+        input_consume(&input);
+        engine_update_rain(engine, dt);
 
         // Prepare frame stats
+        const LatencyHistogram* input_latency = &latency.stages[LATENCY_TOTAL];
         FrameStats stats = {
-            .frame_time_ms = (float)((frame_start - last_frame_time) * 1000.0),
+            .frame_time_ms = dt * 1000.0f,
             .fps = (float)fps_smooth,
-            .frame_count = frame_count
+            .frame_count = frame_count,
+            .latency_events = input_latency->count,
+            .latency_p50_ms = (float)(latency_percentile(input_latency, 0.5) * 1000.0),
+            .latency_p99_ms = (float)(latency_percentile(input_latency, 0.99) * 1000.0)
         };
 
         // Render
-        render_cube(fb, &cube, light, stats);
-        framebuffer_display(fb);
-
-        // Frame timing
-        double frame_end = get_time_seconds();
-        double frame_duration = frame_end - frame_start;
-
-        // Sleep to target 60 FPS
-        if (frame_duration < target_frame_time) {
-            struct timespec sleep_time;
-            double sleep_duration = target_frame_time - frame_duration;
-            sleep_time.tv_sec = (time_t)sleep_duration;
-            sleep_time.tv_nsec = (long)((sleep_duration - sleep_time.tv_sec) * 1000000000.0);
-            nanosleep(&sleep_time, NULL);
+        engine_render(engine, fb, stats);
+        double render_done = get_time_seconds();
+        if (ring) {
+            trace_begin("frame_ring_publish");
+            frame_ring_publish(ring, fb, frame_count);
+            trace_end("frame_ring_publish");
+        }
+        record_frame(&recorder, &record_ok, fb, frame_start - record_start);
+        // This frame is the first to reflect the events consumed above; the
+        // sample is closed once the terminal shows it
+        LatencyEvent event = {.event_time = event_time, .frame_start = frame_start, .render_done = render_done};
+        trace_begin("terminal_output_submit");
+        int written = terminal_output_submit(output, fb, get_time_seconds(),
+                                             event_time > 0.0 ? &event : NULL);
+        trace_end("terminal_output_submit");
+        trace_end("frame");
+        if (written != 0) {
+            break;  // The terminal went away
         }
 
-        double actual_frame_time = get_time_seconds() - frame_start;
-        double current_fps = 1.0 / actual_frame_time;
-
-        // Smooth FPS
-        fps_smooth = fps_smooth * 0.9 + current_fps * 0.1;
+        // Smooth FPS over consecutive animated frames only
+        if (was_animating && frame_start > last_frame_time) {
+            double current_fps = 1.0 / (frame_start - last_frame_time);
+            fps_smooth = fps_smooth * 0.9 + current_fps * 0.1;
+        }
 
+        was_animating = animating;
         last_frame_time = frame_start;
         frame_count++;
     }
 
     // Cleanup
-    framebuffer_destroy(fb);
+    frame_ring_destroy(ring);
+    bool dump_ok = write_cost_dump(&config, renderer);
+    engine_destroy(engine);
+    close(timer_fd);
+    close(signal_fd);
+    terminal_output_finish(output);
     terminal_restore(&term_state);
     terminal_show_cursor();
     input_cleanup();
-    audio_stop();
+    if (!dump_ok) {
+        fprintf(stderr, "Failed to write cost dump %s\n", config.cost_dump_path);
+    }
+    latency_print_summary(&latency, stderr);
+    terminal_output_print_summary(output, stderr);
+    finish_recording(&config, recorder, record_ok);
+    terminal_output_destroy(output);
+    finish_trace(&config);
 
     return 0;
 }
@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mesh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+
+#define OBJ_MAX_FACE_VERTICES 64
+
+// Array with room for needed items, doubling as it fills; NULL on failure
+static void* grow(void* data, int* capacity, int needed, size_t item_size) {
+    if (needed <= *capacity) {
+        return data;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 1024;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void* grown = realloc(data, (size_t)new_capacity * item_size);
+    if (grown) {
+        *capacity = new_capacity;
+    }
+    return grown;
+}
+
+// Vertex index of a face token ("7", "7/2", "7//3", "-1"); -1 if invalid
+static int parse_face_index(const char* token, int vertex_count) {
+    char* end;
+    long index = strtol(token, &end, 10);
+    if (end == token || index == 0) {
+        return -1;
+    }
+    // Negative indices count back from the latest vertex
+    long resolved = index > 0 ? index - 1 : vertex_count + index;
+    if (resolved < 0 || resolved >= vertex_count) {
+        return -1;
+    }
+    return (int)resolved;
+}
+
+Mesh* mesh_load_obj(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return NULL;
+    }
+
+    Mesh* mesh = calloc(1, sizeof(Mesh));
+    int vertex_capacity = 0;
+    int triangle_capacity = 0;
+    char* line = NULL;
+    size_t line_capacity = 0;
+    bool failed = mesh == NULL;
+
+    while (!failed && getline(&line, &line_capacity, file) != -1) {
+        if (line[0] == 'v' && line[1] == ' ') {
+            float x, y, z;
+            if (sscanf(line + 2, "%f %f %f", &x, &y, &z) != 3) {
+                continue;
+            }
+            float* vertices = grow(mesh->vertices, &vertex_capacity, (mesh->vertex_count + 1) * 3, sizeof(float));
+            if (!vertices) {
+                failed = true;
+                break;
+            }
+            mesh->vertices = vertices;
+            float* v = &mesh->vertices[mesh->vertex_count * 3];
+            v[0] = x;
+            v[1] = y;
+            v[2] = z;
+            mesh->vertex_count++;
+        } else if (line[0] == 'f' && line[1] == ' ') {
+            int face[OBJ_MAX_FACE_VERTICES];
+            int corners = 0;
+            char* save = NULL;
+            for (char* token = strtok_r(line + 2, " \t\r\n", &save);
+                 token && corners < OBJ_MAX_FACE_VERTICES;
+                 token = strtok_r(NULL, " \t\r\n", &save)) {
+                int index = parse_face_index(token, mesh->vertex_count);
+                if (index >= 0) {
+                    face[corners++] = index;
+                }
+            }
+            if (corners < 3) {
+                continue;
+            }
+            int added = corners - 2;
+            int* triangles = grow(mesh->triangles, &triangle_capacity,
+                                  (mesh->triangle_count + added) * 3, sizeof(int));
+            if (!triangles) {
+                failed = true;
+                break;
+            }
+            mesh->triangles = triangles;
+            for (int i = 1; i + 1 < corners; i++) {
+                int* t = &mesh->triangles[mesh->triangle_count * 3];
+                t[0] = face[0];
+                t[1] = face[i];
+                t[2] = face[i + 1];
+                mesh->triangle_count++;
+            }
+        }
+    }
+
+    free(line);
+    fclose(file);
+    if (failed || mesh->triangle_count == 0) {
+        mesh_destroy(mesh);
+        return NULL;
+    }
+    return mesh;
+}
+
+void mesh_destroy(Mesh* mesh) {
+    if (mesh) {
+        free(mesh->vertices);
+        free(mesh->triangles);
+        free(mesh);
+    }
+}
+
+void mesh_normalize(Mesh* mesh) {
+    float lo[3] = {INFINITY, INFINITY, INFINITY};
+    float hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (int i = 0; i < mesh->vertex_count; i++) {
+        for (int a = 0; a < 3; a++) {
+            float v = mesh->vertices[i * 3 + a];
+            lo[a] = fminf(lo[a], v);
+            hi[a] = fmaxf(hi[a], v);
+        }
+    }
+
+    float extent = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        extent = fmaxf(extent, 0.5f * (hi[a] - lo[a]));
+    }
+    float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+    for (int i = 0; i < mesh->vertex_count; i++) {
+        for (int a = 0; a < 3; a++) {
+            float center = 0.5f * (lo[a] + hi[a]);
+            mesh->vertices[i * 3 + a] = (mesh->vertices[i * 3 + a] - center) * scale;
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE
+
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+// Cursor position query; the terminal answers ESC[row;colR
+#define PROBE "\033[6n"
+#define PROBE_LEN 4
+// A probe unanswered this long is written off
+#define PROBE_TIMEOUT 3.0
+// Full frames resume once the link has kept up this long
+#define RECOVER_SECONDS 1.0
+// Best round trips are remembered for one to two periods
+#define MIN_RTT_PERIOD 10.0
+// Shortest span the delivery rate is measured over
+#define RATE_INTERVAL 0.25
+#define DRAIN_TIMEOUT_MS 1000
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+TerminalOutput* terminal_output_create(int fd) {
+    TerminalOutput* output = calloc(1, sizeof(TerminalOutput));
+    if (!output) return NULL;
+
+    output->fd = fd;
+    output->saved_flags = fcntl(fd, F_GETFL, 0);
+    if (output->saved_flags >= 0) {
+        fcntl(fd, F_SETFL, output->saved_flags | O_NONBLOCK);
+    }
+    byte_buffer_init(&output->pending);
+    output->keyframe_due = true;
+    // Replies come back on stdin, so both ends must be the terminal
+    output->probing = isatty(fd) && isatty(STDIN_FILENO);
+    output->window = 2.0;  // Opens up as replies show the link keeping up
+    output->min_rtt[0] = HUGE_VAL;
+    output->min_rtt[1] = HUGE_VAL;
+    return output;
+}
+
+void terminal_output_finish(TerminalOutput* output) {
+    // A frame cut short would leave the terminal mid escape sequence
+    int waited_ms = 0;
+    while (terminal_output_pending(output) && waited_ms < DRAIN_TIMEOUT_MS) {
+        struct pollfd pfd = {.fd = output->fd, .events = POLLOUT};
+        if (poll(&pfd, 1, OUTPUT_RETRY_MS) < 0 && errno != EINTR) break;
+        if (terminal_output_flush(output) != 0) break;
+        waited_ms += OUTPUT_RETRY_MS;
+    }
+    if (output->saved_flags >= 0) {
+        fcntl(output->fd, F_SETFL, output->saved_flags);
+    }
+}
+
+void terminal_output_destroy(TerminalOutput* output) {
+    if (!output) return;
+    byte_buffer_free(&output->pending);
+    framebuffer_destroy(output->shown);
+    free(output);
+}
+
+// Either the terminal does not answer at all or replies were lost
+static void expire_probes(TerminalOutput* output, double now) {
+    if (output->in_flight == 0 || now - output->probes[0].sent < PROBE_TIMEOUT) {
+        return;
+    }
+    if (output->replies == 0) {
+        output->probing = false;
+    }
+    output->in_flight = 0;
+    output->window = fmax(1.0, output->window * 0.5);
+}
+
+bool terminal_output_ready(TerminalOutput* output, double now) {
+    expire_probes(output, now);
+
+    int queued = 0;
+    output->kernel_queue = ioctl(output->fd, TIOCOUTQ, &queued) == 0 ? queued : 0;
+
+    // The window only holds once the terminal has shown that it answers
+    bool ready = !terminal_output_pending(output) && output->kernel_queue == 0 &&
+                 (!output->probing || output->replies == 0 || output->in_flight < (int)output->window);
+    if (!ready) {
+        output->congested_until = now + RECOVER_SECONDS;
+    }
+    return ready;
+}
+
+int terminal_output_submit(TerminalOutput* output, const Framebuffer* fb, double now,
+                           const LatencyEvent* event) {
+    ByteBuffer* out = &output->pending;
+    size_t start = out->len;
+
+    // Diffs are smaller but trust the screen to hold the last frame, so full
+    // frames are kept for a link that keeps up
+    bool keyframe = output->keyframe_due || now >= output->congested_until;
+    int rc = keyframe ? frame_encode_full(fb, out) : frame_encode_diff(output->shown, fb, out);
+    if (rc != 0) {
+        out->len = start;
+        return 0;  // Out of memory: skip the frame, the screen keeps the last one
+    }
+    output->last_frame_bytes = out->len - start;
+    output->bytes_submitted += output->last_frame_bytes;
+
+    LatencyEvent tracked = event && output->latency ? *event : (LatencyEvent){0};
+    if (output->probing && output->in_flight < OUTPUT_MAX_IN_FLIGHT &&
+        byte_buffer_reserve(out, PROBE_LEN) == 0) {
+        memcpy(out->data + out->len, PROBE, PROBE_LEN);
+        out->len += PROBE_LEN;
+        output->probes[output->in_flight++] = (OutputProbe){
+            .sent = now,
+            .bytes = output->bytes_submitted,
+            .event = tracked
+        };
+    } else if (tracked.event_time > 0.0) {
+        output->draining = tracked;
+    }
+
+    if (!output->shown || output->shown->width != fb->width || output->shown->height != fb->height) {
+        framebuffer_destroy(output->shown);
+        output->shown = framebuffer_create(fb->width, fb->height);
+    }
+    if (output->shown) {
+        framebuffer_copy(output->shown, fb);
+    }
+    output->keyframe_due = !output->shown;
+
+    output->frames_sent++;
+    if (keyframe) output->keyframes_sent++;
+    return terminal_output_flush(output);
+}
+
+int terminal_output_flush(TerminalOutput* output) {
+    ByteBuffer* out = &output->pending;
+    while (output->offset < out->len) {
+        ssize_t n = write(output->fd, out->data + output->offset, out->len - output->offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        output->offset += (size_t)n;
+    }
+    out->len = 0;
+    output->offset = 0;
+    if (output->draining.event_time > 0.0) {
+        latency_record_event(output->latency, output->draining, monotonic_seconds());
+        output->draining = (LatencyEvent){0};
+    }
+    return 0;
+}
+
+bool terminal_output_pending(const TerminalOutput* output) {
+    return output->offset < output->pending.len;
+}
+
+void terminal_output_acknowledge(TerminalOutput* output, int count, double now) {
+    for (; count > 0 && output->in_flight > 0; count--) {
+        OutputProbe probe = output->probes[0];
+        output->in_flight--;
+        memmove(output->probes, output->probes + 1, (size_t)output->in_flight * sizeof(OutputProbe));
+        output->replies++;
+        if (probe.event.event_time > 0.0) {
+            latency_record_event(output->latency, probe.event, now);
+        }
+
+        double rtt = now - probe.sent;
+        if (now - output->min_rtt_period >= MIN_RTT_PERIOD) {
+            output->min_rtt[1] = output->min_rtt[0];
+            output->min_rtt[0] = rtt;
+            output->min_rtt_period = now;
+        }
+        output->min_rtt[0] = fmin(output->min_rtt[0], rtt);
+        output->max_rtt = fmax(output->max_rtt, rtt);
+
+        if (output->acked_time == 0.0) {
+            output->acked_bytes = probe.bytes;
+            output->acked_time = now;
+        } else if (now - output->acked_time >= RATE_INTERVAL) {
+            double sample = (double)(probe.bytes - output->acked_bytes) / (now - output->acked_time);
+            output->rate = output->rate > 0.0 ? output->rate * 0.8 + sample * 0.2 : sample;
+            output->acked_bytes = probe.bytes;
+            output->acked_time = now;
+        }
+
+        // Time beyond the best round trip was spent queued somewhere on the
+        // way. Halve the window at most once a round trip while it is too
+        // long, otherwise open it by one frame a round trip.
+        double best = fmin(output->min_rtt[0], output->min_rtt[1]);
+        if (rtt - best > OUTPUT_LATENCY_BUDGET) {
+            if (now - output->last_decrease > rtt) {
+                output->window = fmax(1.0, output->window * 0.5);
+                output->last_decrease = now;
+            }
+        } else {
+            output->window = fmin((double)OUTPUT_MAX_IN_FLIGHT, output->window + 1.0 / output->window);
+        }
+    }
+}
+
+void terminal_output_invalidate(TerminalOutput* output) {
+    output->keyframe_due = true;
+}
+
+void terminal_output_print_summary(const TerminalOutput* output, FILE* out) {
+    if (output->ticks_skipped == 0) {
+        return;
+    }
+    fprintf(out, "Output: %lu frames (%lu full), %lu ticks skipped while the terminal caught up",
+            output->frames_sent, output->keyframes_sent, output->ticks_skipped);
+    if (output->replies > 0) {
+        fprintf(out, "; %.1f KB/s delivered, round trip %.1f to %.1f ms",
+                output->rate / 1000.0, fmin(output->min_rtt[0], output->min_rtt[1]) * 1000.0,
+                output->max_rtt * 1000.0);
+    }
+    fprintf(out, "\n");
+}
@@ -1,13 +1,36 @@
 #include "physics.h"
 #include <math.h>
 
-void physics_step(CubeState* state, InputState input, PhysicsConfig config, float dt) {
+// Below this angular speed (rad/s) the cube snaps to rest so idle frames stop
+#define REST_ANGULAR_SPEED 0.002f
+#define MAX_STEPS 12  // A longer frame drops the rest instead of falling behind
+
+// Keys act once per frame, scaled by its length
+static void apply_input(CubeState* state, InputState input, PhysicsConfig config, float dt) {
     // Toggle motion mode when M is pressed
-    static bool m_was_pressed = false;
-    if (input.m_pressed && !m_was_pressed) {
+    if (input.m_pressed && !state->m_was_pressed) {
         state->motion_mode = !state->motion_mode;
     }
-    m_was_pressed = input.m_pressed;
+    state->m_was_pressed = input.m_pressed;
+
+    // Apply input as angular acceleration
+    Vec3 input_accel = {0, 0, 0};
+
+    // W/S = rotate up/down, A/D = rotate left/right
+    if (input.w_pressed) input_accel.x -= config.acceleration;
+    if (input.s_pressed) input_accel.x += config.acceleration;
+    if (input.a_pressed) input_accel.y -= config.acceleration;
+    if (input.d_pressed) input_accel.y += config.acceleration;
+
+    // Update angular velocity with acceleration
+    state->angular_velocity = vec3_add(state->angular_velocity,
+                                       vec3_multiply(input_accel, dt));
+}
+
+static void step(CubeState* state, PhysicsConfig config, float dt) {
+    state->previous_rotation = state->rotation;
+    state->previous_position = state->position;
+    state->has_previous = true;
 
     // Update motion animation if active
     if (state->motion_mode) {
@@ -27,19 +50,6 @@ void physics_step(CubeState* state, InputState input, PhysicsConfig config, floa
         state->position.z = depth_offset + cosf(state->motion_phase) * depth_amp;
     }
 
-    // Apply input as angular acceleration
-    Vec3 input_accel = {0, 0, 0};
-
-    // W/S = rotate up/down, A/D = rotate left/right
-    if (input.w_pressed) input_accel.x -= config.acceleration;
-    if (input.s_pressed) input_accel.x += config.acceleration;
-    if (input.a_pressed) input_accel.y -= config.acceleration;
-    if (input.d_pressed) input_accel.y += config.acceleration;
-
-    // Update angular velocity with acceleration
-    state->angular_velocity = vec3_add(state->angular_velocity,
-                                       vec3_multiply(input_accel, dt));
-
     // Apply damping (exponential decay)
     float damping_factor = expf(logf(config.damping) * dt * 60.0f);
     state->angular_velocity = vec3_multiply(state->angular_velocity, damping_factor);
@@ -51,6 +61,9 @@ void physics_step(CubeState* state, InputState input, PhysicsConfig config, floa
             vec3_normalize(state->angular_velocity),
             config.max_velocity
         );
+    } else if (speed < REST_ANGULAR_SPEED) {
+        // Damping never reaches zero on its own; settle instead of creeping
+        state->angular_velocity = (Vec3){0, 0, 0};
     }
 
     // Integrate rotation
@@ -64,10 +77,53 @@ void physics_step(CubeState* state, InputState input, PhysicsConfig config, floa
     Mat3 combined = mat3_multiply(rot_z, mat3_multiply(rot_y, rot_x));
     state->rotation = mat3_multiply(combined, state->rotation);
 
-    // Orthonormalize every few frames to prevent drift
-    static int frame_count = 0;
-    if (++frame_count > 100) {
+    // Orthonormalize every few steps to prevent drift
+    if (++state->steps_since_orthonormalize > 100) {
         state->rotation = mat3_orthonormalize(state->rotation);
-        frame_count = 0;
+        state->steps_since_orthonormalize = 0;
+    }
+}
+
+void physics_step(CubeState* state, InputState input, PhysicsConfig config, float frame_dt) {
+    apply_input(state, input, config, frame_dt);
+    state->accumulator += frame_dt;
+    int steps = 0;
+    while (state->accumulator >= PHYSICS_STEP && steps < MAX_STEPS) {
+        step(state, config, PHYSICS_STEP);
+        state->accumulator -= PHYSICS_STEP;
+        steps++;
+    }
+    if (steps == MAX_STEPS) {
+        state->accumulator = fminf(state->accumulator, PHYSICS_STEP);
+    }
+
+    // Frames stop once the cube rests, so the last one must show it where it stopped
+    if (!physics_is_animating(state)) {
+        state->has_previous = false;
+    }
+}
+
+CubeState physics_interpolate(const CubeState* state) {
+    CubeState drawn = *state;
+    if (!state->has_previous) {
+        return drawn;
+    }
+    float t = state->accumulator / PHYSICS_STEP;
+    t = t > 1.0f ? 1.0f : t;
+    for (int i = 0; i < 9; i++) {
+        drawn.rotation.m[i] = state->previous_rotation.m[i] +
+                              (state->rotation.m[i] - state->previous_rotation.m[i]) * t;
     }
+    // One step turns ten degrees at most, so the blend only needs squaring up
+    drawn.rotation = mat3_orthonormalize(drawn.rotation);
+    drawn.position = vec3_add(state->previous_position,
+                              vec3_multiply(vec3_subtract(state->position, state->previous_position), t));
+    return drawn;
+}
+
+bool physics_is_animating(const CubeState* state) {
+    return state->motion_mode ||
+           state->angular_velocity.x != 0.0f ||
+           state->angular_velocity.y != 0.0f ||
+           state->angular_velocity.z != 0.0f;
 }
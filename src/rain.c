@@ -0,0 +1,244 @@
+#include "rain.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// World-space box drops live in; wide enough to cover the far view
+#define RAIN_MIN_X   -16.0f
+#define RAIN_MAX_X    16.0f
+#define RAIN_GROUND  RENDER_GROUND_Y
+#define RAIN_TOP      9.0f
+#define RAIN_MIN_Z  -14.0f
+#define RAIN_MAX_Z    3.0f
+
+#define RAIN_FALL_SPEED  7.0f   // Units per second
+#define RAIN_STREAK_TIME 0.09f  // Seconds of motion shown as a streak
+#define RAIN_MAX_TRAIL   8
+
+// Index into GlyphSet.rain per row of a streak, by trail length: head,
+// upper trail, mid trail, then lower trail and tail at the end. The index
+// is packed into cell keys.
+static const unsigned char RAIN_TRAIL_GLYPHS[RAIN_MAX_TRAIL + 1][RAIN_MAX_TRAIL] = {
+    {0},
+    {0},
+    {0, 1},
+    {0, 1, 4},
+    {0, 1, 3, 4},
+    {0, 1, 2, 3, 4},
+    {0, 1, 2, 2, 3, 4},
+    {0, 1, 2, 2, 2, 3, 4},
+    {0, 1, 2, 2, 2, 2, 3, 4}
+};
+#define RAIN_KEY_GLYPH_MASK 7u
+#define RAIN_KEY_EMPTY      0xFFFFFFFFu
+
+static float rain_random(RainSystem* rain) {
+    // xorshift32
+    unsigned int v = rain->seed;
+    v ^= v << 13;
+    v ^= v >> 17;
+    v ^= v << 5;
+    rain->seed = v;
+    return (float)(v >> 8) * (1.0f / 16777216.0f);
+}
+
+static void spawn_drop(RainSystem* rain, int i, float y) {
+    rain->x[i] = RAIN_MIN_X + (RAIN_MAX_X - RAIN_MIN_X) * rain_random(rain);
+    rain->y[i] = y;
+    rain->z[i] = RAIN_MIN_Z + (RAIN_MAX_Z - RAIN_MIN_Z) * rain_random(rain);
+    rain->vx[i] = 0.3f * (rain_random(rain) - 0.5f);
+    rain->vy[i] = -RAIN_FALL_SPEED * (0.6f + 0.8f * rain_random(rain));
+    rain->vz[i] = 0.0f;
+    rain->life[i] = 2.0f + 3.0f * rain_random(rain);
+}
+
+RainSystem* rain_create(int count) {
+    RainSystem* rain = calloc(1, sizeof(RainSystem));
+    if (!rain) return NULL;
+
+    // One block, split into arrays
+    size_t n = (size_t)(count > 0 ? count : 1);
+    float* block = malloc(n * 11 * sizeof(float));
+    rain->visible = malloc(n * sizeof(int));
+    if (!block || !rain->visible) {
+        free(block);
+        free(rain->visible);
+        free(rain);
+        return NULL;
+    }
+    rain->count = count;
+    rain->x = block;
+    rain->y = block + n;
+    rain->z = block + n * 2;
+    rain->vx = block + n * 3;
+    rain->vy = block + n * 4;
+    rain->vz = block + n * 5;
+    rain->life = block + n * 6;
+    rain->screen_x = block + n * 7;
+    rain->screen_y = block + n * 8;
+    rain->tail_y = block + n * 9;
+    rain->depth = block + n * 10;
+    rain->seed = 0x9E3779B9u;
+
+    // Start mid-fall so the first frame is not an empty sky
+    for (int i = 0; i < count; i++) {
+        spawn_drop(rain, i, 0.0f);
+        rain->y[i] = RAIN_GROUND + (RAIN_TOP - RAIN_GROUND) * rain_random(rain);
+    }
+    return rain;
+}
+
+void rain_destroy(RainSystem* rain) {
+    if (rain) {
+        free(rain->x);  // Start of the shared block
+        free(rain->visible);
+        free(rain->cell_keys);
+        free(rain);
+    }
+}
+
+static void integrate(float* restrict p, const float* restrict v, int n, float dt) {
+    for (int i = 0; i < n; i++) {
+        p[i] += v[i] * dt;
+    }
+}
+
+void rain_update(RainSystem* rain, float dt) {
+    int n = rain->count;
+    integrate(rain->x, rain->vx, n, dt);
+    integrate(rain->y, rain->vy, n, dt);
+    integrate(rain->z, rain->vz, n, dt);
+
+    float* restrict life = rain->life;
+    for (int i = 0; i < n; i++) {
+        life[i] -= dt;
+    }
+
+    // Respawn is rare per frame; keep the branchy part out of the loops above
+    for (int i = 0; i < n; i++) {
+        if (rain->y[i] < RAIN_GROUND || rain->life[i] <= 0.0f) {
+            spawn_drop(rain, i, RAIN_TOP);
+        }
+    }
+}
+
+// Same projection as camera_project, unrolled over the arrays. Kept as a
+// function so restrict on the parameters lets the loop vectorize.
+static void project_drops(const float* restrict x, const float* restrict y,
+                          const float* restrict z, const float* restrict vy,
+                          float* restrict screen_x, float* restrict screen_y,
+                          float* restrict tail_y, float* restrict depth,
+                          int n, const Camera* cam, int width, int height) {
+    const float cx = cam->position.x;
+    const float cy = cam->position.y;
+    const float cz = cam->position.z;
+    const float sx_scale = 0.5f * (float)width / (cam->scale * cam->aspect);
+    const float sy_scale = 0.5f * (float)height / cam->scale;
+    const float half_w = 0.5f * (float)width;
+    const float half_h = 0.5f * (float)height;
+
+    for (int i = 0; i < n; i++) {
+        float dx = x[i] - cx;
+        float dy = y[i] - cy;
+        float dz = z[i] - cz;
+        // Plain select rather than fmaxf, whose NaN rules block vectorizing
+        float ahead = -dz > 0.01f ? -dz : 0.01f;
+        float inv = 1.0f / ahead;
+        screen_x[i] = half_w + dx * inv * sx_scale;
+        screen_y[i] = half_h - dy * inv * sy_scale;
+        tail_y[i] = half_h - (dy - vy[i] * RAIN_STREAK_TIME) * inv * sy_scale;
+        // Squared distance keeps this loop free of sqrt; drops behind the
+        // camera get an infinite depth and fail the test
+        float dist_sq = dx * dx + dy * dy + dz * dz;
+        depth[i] = dz < -0.5f ? dist_sq : INFINITY;
+    }
+}
+
+CellRect rain_render(RainSystem* rain, Framebuffer* fb, const Camera* cam, const GlyphSet* glyphs) {
+    CellRect none = {0, 0, 0, 0};
+    int n = rain->count;
+    int width = fb->width;
+    int height = fb->height;
+    if (width <= 0 || height <= 1) {
+        return none;
+    }
+
+    project_drops(rain->x, rain->y, rain->z, rain->vy,
+                  rain->screen_x, rain->screen_y, rain->tail_y, rain->depth,
+                  n, cam, width, height);
+    const float* screen_x = rain->screen_x;
+    const float* screen_y = rain->screen_y;
+    const float* tail_y = rain->tail_y;
+    const float* depth = rain->depth;
+
+    // Keep the ground plane below the horizon readable; streaks are clipped
+    // to the sky, so only those rows need keys
+    int horizon = ground_horizon(height);
+    CellRect sky = {0, 1, width, horizon};
+
+    int cells = width * horizon;
+    if (rain->cell_count != cells) {
+        unsigned int* keys = realloc(rain->cell_keys, (size_t)cells * sizeof(unsigned int));
+        if (!keys) return none;
+        rain->cell_keys = keys;
+        rain->cell_count = cells;
+    }
+    unsigned int* restrict keys = rain->cell_keys;
+    memset(keys, 0xFF, (size_t)cells * sizeof(unsigned int));
+
+    // Compact the visible drops first; about half are culled, and folding
+    // the test into an index increment avoids a mispredicted branch per drop
+    int* restrict visible = rain->visible;
+    int visible_count = 0;
+    for (int i = 0; i < n; i++) {
+        visible[visible_count] = i;
+        // Bitwise & so the compiler does not reintroduce branches
+        visible_count += (depth[i] != INFINITY) & (screen_x[i] >= 0.0f) &
+                         (screen_x[i] < (float)width) & (screen_y[i] >= 1.0f);
+    }
+
+    // Splat every streak as keys; for positive floats the bit pattern orders
+    // like the value, so an integer min keeps the nearest drop per cell.
+    // Keys hold squared distance; the root is only taken for the winners.
+    for (int v = 0; v < visible_count; v++) {
+        int i = visible[v];
+        float d = depth[i];
+        int px = (int)screen_x[i];
+        int head = (int)screen_y[i];
+
+        int trail_length = (int)(screen_y[i] - tail_y[i]) + 1;
+        if (trail_length > RAIN_MAX_TRAIL) trail_length = RAIN_MAX_TRAIL;
+
+        unsigned int depth_bits;
+        memcpy(&depth_bits, &d, sizeof(depth_bits));
+        depth_bits &= ~RAIN_KEY_GLYPH_MASK;
+
+        // Rows covered by this streak, clipped to the sky
+        int t_first = head >= horizon ? head - horizon + 1 : 0;
+        int t_last = head < trail_length ? head : trail_length;
+        for (int t = t_first; t < t_last; t++) {
+            unsigned int key = depth_bits | RAIN_TRAIL_GLYPHS[trail_length][t];
+            int idx = (head - t) * width + px;
+            keys[idx] = key < keys[idx] ? key : keys[idx];
+        }
+    }
+
+    // Resolve: the nearest drop wins unless the cube is in front of it
+    for (int idx = 0; idx < cells; idx++) {
+        unsigned int key = keys[idx];
+        if (key == RAIN_KEY_EMPTY) {
+            continue;
+        }
+        unsigned int depth_bits = key & ~RAIN_KEY_GLYPH_MASK;
+        float dist_sq;
+        memcpy(&dist_sq, &depth_bits, sizeof(dist_sq));
+        float d = sqrtf(dist_sq);
+        if (d >= fb->depth[idx]) {
+            continue;
+        }
+        fb->chars[idx] = glyphs->rain[key & RAIN_KEY_GLYPH_MASK];
+        fb->depth[idx] = d;
+        fb->colors[idx] = COLOR_RAIN;
+    }
+    return sky;
+}
@@ -1,42 +1,59 @@
 #include "raymarch.h"
-#include "sdf.h"
 #include <stdbool.h>
+#include <math.h>
 
-static Vec3 estimate_normal(Vec3 point, Vec3 cube_center, float cube_size, Mat3 cube_rotation) {
+static Vec3 estimate_normal(Vec3 point, const SdfInstance* object) {
     const float h = 0.0001f;
-    Vec3 n;
-
-    n.x = sdf_cube(vec3_add(point, (Vec3){h, 0, 0}), cube_center, cube_size, cube_rotation) -
-          sdf_cube(vec3_subtract(point, (Vec3){h, 0, 0}), cube_center, cube_size, cube_rotation);
-
-    n.y = sdf_cube(vec3_add(point, (Vec3){0, h, 0}), cube_center, cube_size, cube_rotation) -
-          sdf_cube(vec3_subtract(point, (Vec3){0, h, 0}), cube_center, cube_size, cube_rotation);
-
-    n.z = sdf_cube(vec3_add(point, (Vec3){0, 0, h}), cube_center, cube_size, cube_rotation) -
-          sdf_cube(vec3_subtract(point, (Vec3){0, 0, h}), cube_center, cube_size, cube_rotation);
+    // All six central-difference samples in one batch
+    Vec3 samples[6] = {
+        vec3_add(point, (Vec3){h, 0, 0}), vec3_subtract(point, (Vec3){h, 0, 0}),
+        vec3_add(point, (Vec3){0, h, 0}), vec3_subtract(point, (Vec3){0, h, 0}),
+        vec3_add(point, (Vec3){0, 0, h}), vec3_subtract(point, (Vec3){0, 0, h})
+    };
+    float d[6];
+    sdf_evaluate_batch(object, samples, d, 6);
 
+    Vec3 n = {d[0] - d[1], d[2] - d[3], d[4] - d[5]};
     return vec3_normalize(n);
 }
 
-bool raymarch(Vec3 origin, Vec3 direction, RaymarchConfig config,
-              Vec3* hit_point, Vec3* normal, Vec3 cube_center,
-              float cube_size, Mat3 cube_rotation) {
+// Over-relaxed sphere tracing (Keinert et al., "Enhanced Sphere Tracing").
+// Steps are stretched by the relaxation factor while the unbounding spheres
+// of consecutive points still overlap; once they do not, the step may have
+// skipped the surface, so the ray backs up and continues with plain steps.
+bool raymarch(Vec3 origin, Vec3 direction, float t_start, RaymarchConfig config,
+              Vec3* hit_point, Vec3* normal, int* steps, const SdfInstance* object) {
 
-    float t = 0.0f;
-    Vec3 current_point;
+    float t = t_start;
+    float omega = config.relaxation;
+    float previous_radius = 0.0f;
+    float step = 0.0f;
+    *steps = 0;
 
     for (int i = 0; i < config.max_steps; i++) {
-        current_point = vec3_add(origin, vec3_multiply(direction, t));
-        float dist = sdf_cube(current_point, cube_center, cube_size, cube_rotation);
-
-        if (dist < config.epsilon) {
-            // Hit!
-            *hit_point = current_point;
-            *normal = estimate_normal(current_point, cube_center, cube_size, cube_rotation);
-            return true;
+        *steps = i + 1;
+        Vec3 current_point = vec3_add(origin, vec3_multiply(direction, t));
+        float dist = sdf_evaluate(object, current_point);
+        float radius = fabsf(dist);
+
+        bool overshoot = omega > 1.0f && radius + previous_radius < step;
+        if (overshoot) {
+            step -= omega * step;
+            omega = 1.0f;
+        } else {
+            step = dist * omega;
+
+            // Closer than the pixel cone is wide: nothing more is resolvable
+            if (radius < fmaxf(config.epsilon, config.footprint * t)) {
+                // Shade on the surface itself, not up to a footprint away
+                *normal = estimate_normal(current_point, object);
+                *hit_point = vec3_subtract(current_point, vec3_multiply(*normal, dist));
+                return true;
+            }
         }
+        previous_radius = radius;
 
-        t += dist;
+        t += step;
 
         if (t > config.max_distance) {
             return false;  // Miss
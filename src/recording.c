@@ -0,0 +1,584 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "recording.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Worst case payload bytes for one cell: a definition (op, color and
+// codepoint), then an op of its own and its palette index
+#define CELL_MAX_BYTES 17
+// Unchanged cells shorter than this are listed again instead of skipped
+#define MERGE_GAP 3
+// Kind, time, width, height and payload length
+#define RECORD_HEADER_MAX_BYTES 21
+
+static unsigned char* put_varint(unsigned char* p, uint32_t value) {
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+// Read a varint from data[*pos, end); false if it runs past end or overflows
+static bool get_varint(const unsigned char* data, size_t* pos, size_t end, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*pos >= end) {
+            return false;
+        }
+        unsigned char byte = data[(*pos)++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool cell_unchanged(const Framebuffer* prev, const Framebuffer* cur, int idx) {
+    return prev->chars[idx] == cur->chars[idx] && prev->colors[idx] == cur->colors[idx];
+}
+
+// Palette index of cell, appending a DEFINE op at *p for a new entry.
+// Returns UINT32_MAX if the table cannot grow.
+static uint32_t palette_index(Recorder* recorder, uint32_t codepoint, unsigned char color, unsigned char** p) {
+    if ((recorder->palette_count + 1) * 2 > (uint32_t)recorder->palette_slots) {
+        int slots = recorder->palette_slots ? recorder->palette_slots * 2 : 256;
+        uint64_t* keys = calloc((size_t)slots, sizeof(uint64_t));
+        uint32_t* values = malloc((size_t)slots * sizeof(uint32_t));
+        if (!keys || !values) {
+            free(keys);
+            free(values);
+            return UINT32_MAX;
+        }
+        for (int i = 0; i < recorder->palette_slots; i++) {
+            uint64_t key = recorder->palette_keys[i];
+            if (key) {
+                int slot = (int)(key * 0x9E3779B97F4A7C15ull >> 40) & (slots - 1);
+                while (keys[slot]) slot = (slot + 1) & (slots - 1);
+                keys[slot] = key;
+                values[slot] = recorder->palette_values[i];
+            }
+        }
+        free(recorder->palette_keys);
+        free(recorder->palette_values);
+        recorder->palette_keys = keys;
+        recorder->palette_values = values;
+        recorder->palette_slots = slots;
+    }
+
+    uint64_t key = ((uint64_t)codepoint << 8 | color) + 1;
+    int mask = recorder->palette_slots - 1;
+    int slot = (int)(key * 0x9E3779B97F4A7C15ull >> 40) & mask;
+    while (recorder->palette_keys[slot]) {
+        if (recorder->palette_keys[slot] == key) {
+            return recorder->palette_values[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    recorder->palette_keys[slot] = key;
+    recorder->palette_values[slot] = recorder->palette_count;
+    *p = put_varint(*p, 1u << 2 | RECORDING_OP_DEFINE);
+    *(*p)++ = color;
+    *p = put_varint(*p, codepoint);
+    return recorder->palette_count++;
+}
+
+static void palette_reset(Recorder* recorder) {
+    if (recorder->palette_keys) {
+        memset(recorder->palette_keys, 0, (size_t)recorder->palette_slots * sizeof(uint64_t));
+    }
+    recorder->palette_count = 0;
+}
+
+// Ops for every cell of fb, or against prev only for the changed ones.
+// Returns the end of the payload, NULL if the palette could not grow, and
+// counts the cells written in *changed.
+static unsigned char* encode_cells(Recorder* recorder, unsigned char* p, const Framebuffer* prev,
+                                   const Framebuffer* fb, int* changed) {
+    *changed = 0;
+    int cells = fb->width * fb->height;
+    uint32_t* indices = recorder->indices;
+    int i = 0;
+    while (i < cells) {
+        int end = i + 1;
+        if (prev && cell_unchanged(prev, fb, i)) {
+            while (end < cells && cell_unchanged(prev, fb, end)) {
+                end++;
+            }
+            p = put_varint(p, (uint32_t)(end - i) << 2 | RECORDING_OP_SKIP);
+            i = end;
+            continue;
+        }
+
+        // A stretch of changed cells, absorbing unchanged gaps too short to
+        // be worth a skip: define what the palette lacks first, then fill
+        // repeats and list the rest
+        for (int gap = 0; end + gap < cells && gap < MERGE_GAP;) {
+            if (prev && cell_unchanged(prev, fb, end + gap)) {
+                gap++;
+            } else {
+                end += gap + 1;
+                gap = 0;
+            }
+        }
+        for (int k = i; k < end; k++) {
+            unsigned char color = fb->colors[k] < COLOR_COUNT ? fb->colors[k] : COLOR_NONE;
+            indices[k] = palette_index(recorder, (uint32_t)fb->chars[k], color, &p);
+            if (indices[k] == UINT32_MAX) {
+                return NULL;
+            }
+        }
+        *changed += end - i;
+        int literal = i;  // Start of cells not yet written
+        for (int k = i; k <= end; k++) {
+            int repeat = k + 1;
+            while (k < end && repeat < end && indices[repeat] == indices[k]) {
+                repeat++;
+            }
+            if (k < end && repeat - k < 3) {
+                continue;  // Left for a literal
+            }
+            if (k > literal) {
+                p = put_varint(p, (uint32_t)(k - literal) << 2 | RECORDING_OP_LITERAL);
+                for (int j = literal; j < k; j++) {
+                    p = put_varint(p, indices[j]);
+                }
+            }
+            if (k < end) {
+                p = put_varint(p, (uint32_t)(repeat - k) << 2 | RECORDING_OP_FILL);
+                p = put_varint(p, indices[k]);
+                k = repeat - 1;
+            }
+            literal = k + 1;
+        }
+        i = end;
+    }
+    return p;
+}
+
+Recorder* recorder_create(const char* path) {
+    Recorder* recorder = calloc(1, sizeof(Recorder));
+    if (!recorder) return NULL;
+
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        perror(path);
+        free(recorder);
+        return NULL;
+    }
+    byte_buffer_init(&recorder->record);
+
+    RecordingHeader header = {.magic = RECORDING_MAGIC, .version = RECORDING_VERSION};
+    if (fwrite(&header, sizeof(header), 1, recorder->file) != 1) {
+        perror(path);
+        fclose(recorder->file);
+        free(recorder);
+        return NULL;
+    }
+    recorder->offset = sizeof(header);
+    return recorder;
+}
+
+// Keep fb as the base for the next delta
+static int remember_frame(Recorder* recorder, const Framebuffer* fb) {
+    Framebuffer* prev = recorder->previous;
+    if (!prev || prev->width != fb->width || prev->height != fb->height) {
+        framebuffer_destroy(prev);
+        prev = recorder->previous = framebuffer_create(fb->width, fb->height);
+        if (!prev) {
+            return -1;
+        }
+    }
+    size_t cells = (size_t)fb->width * (size_t)fb->height;
+    memcpy(prev->chars, fb->chars, cells * sizeof(wchar_t));
+    memcpy(prev->colors, fb->colors, cells);
+    return 0;
+}
+
+int recorder_write(Recorder* recorder, const Framebuffer* fb, double seconds) {
+    uint32_t ms = seconds > 0.0 ? (uint32_t)(seconds * 1000.0 + 0.5) : 0;
+    if (ms < recorder->last_ms) {
+        ms = recorder->last_ms;
+    }
+
+    const Framebuffer* prev = recorder->previous;
+    bool keyframe = !prev || prev->width != fb->width || prev->height != fb->height ||
+                    ms - recorder->last_keyframe_ms >= (uint32_t)(RECORDING_KEYFRAME_SECONDS * 1000.0);
+
+    ByteBuffer* out = &recorder->record;
+    size_t cells = (size_t)fb->width * (size_t)fb->height;
+    out->len = 0;
+    if (byte_buffer_reserve(out, cells * CELL_MAX_BYTES) != 0) {
+        return -1;
+    }
+    if ((size_t)recorder->indices_capacity < cells) {
+        free(recorder->indices);
+        recorder->indices = malloc(cells * sizeof(uint32_t));
+        recorder->indices_capacity = recorder->indices ? (int)cells : 0;
+        if (!recorder->indices) {
+            return -1;
+        }
+    }
+    if (keyframe) {
+        palette_reset(recorder);
+    }
+    int changed;
+    unsigned char* payload = (unsigned char*)out->data;
+    unsigned char* payload_end = encode_cells(recorder, payload, keyframe ? NULL : prev, fb, &changed);
+    if (!payload_end) {
+        return -1;
+    }
+    uint32_t payload_len = (uint32_t)(payload_end - payload);
+    if (changed == 0) {
+        return 0;  // Same as the previous frame, which stays on screen anyway
+    }
+
+    unsigned char header[RECORD_HEADER_MAX_BYTES];
+    unsigned char* p = header;
+    *p++ = keyframe ? 'K' : 'D';
+    p = put_varint(p, ms);
+    if (keyframe) {
+        p = put_varint(p, (uint32_t)fb->width);
+        p = put_varint(p, (uint32_t)fb->height);
+    }
+    p = put_varint(p, payload_len);
+    size_t header_len = (size_t)(p - header);
+
+    if (keyframe) {
+        if (recorder->index_count == recorder->index_capacity) {
+            int capacity = recorder->index_capacity ? recorder->index_capacity * 2 : 64;
+            RecordingIndexEntry* index = realloc(recorder->index, (size_t)capacity * sizeof(RecordingIndexEntry));
+            if (!index) {
+                return -1;
+            }
+            recorder->index = index;
+            recorder->index_capacity = capacity;
+        }
+        recorder->index[recorder->index_count++] = (RecordingIndexEntry){
+            .offset = recorder->offset,
+            .time_ms = ms,
+            .frame = (uint32_t)recorder->frames
+        };
+        recorder->last_keyframe_ms = ms;
+    }
+
+    if (fwrite(header, 1, header_len, recorder->file) != header_len ||
+        fwrite(payload, 1, payload_len, recorder->file) != payload_len) {
+        return -1;
+    }
+    recorder->offset += header_len + payload_len;
+    recorder->last_ms = ms;
+    recorder->frames++;
+    return remember_frame(recorder, fb);
+}
+
+int recorder_finish(Recorder* recorder) {
+    if (!recorder->file) {
+        return 0;
+    }
+    RecordingTrailer trailer = {
+        .index_offset = recorder->offset,
+        .index_count = (uint32_t)recorder->index_count,
+        .duration_ms = recorder->last_ms,
+        .frame_count = (uint32_t)recorder->frames,
+        .magic = RECORDING_INDEX_MAGIC
+    };
+    int status = 0;
+    if (fwrite(recorder->index, sizeof(RecordingIndexEntry), (size_t)recorder->index_count,
+               recorder->file) != (size_t)recorder->index_count ||
+        fwrite(&trailer, sizeof(trailer), 1, recorder->file) != 1) {
+        status = -1;
+    }
+    if (fclose(recorder->file) != 0) {
+        status = -1;
+    }
+    recorder->file = NULL;
+    return status;
+}
+
+void recorder_destroy(Recorder* recorder) {
+    if (!recorder) return;
+    if (recorder->file) {
+        fclose(recorder->file);  // Unfinished: playable, but without an index
+    }
+    framebuffer_destroy(recorder->previous);
+    byte_buffer_free(&recorder->record);
+    free(recorder->indices);
+    free(recorder->palette_keys);
+    free(recorder->palette_values);
+    free(recorder->index);
+    free(recorder);
+}
+
+typedef struct {
+    char kind;
+    uint32_t time_ms;
+    uint32_t width;
+    uint32_t height;
+    size_t payload;    // Offset of the runs
+    size_t end;        // Offset of the next record
+} RecordInfo;
+
+static bool read_record(const RecordingPlayer* player, size_t offset, RecordInfo* info) {
+    const unsigned char* data = player->data;
+    size_t end = player->records_end;
+    size_t pos = offset;
+    if (pos >= end || (data[pos] != 'K' && data[pos] != 'D')) {
+        return false;
+    }
+    info->kind = (char)data[pos++];
+    info->width = info->height = 0;
+    uint32_t payload_len;
+    if (!get_varint(data, &pos, end, &info->time_ms) ||
+        (info->kind == 'K' && (!get_varint(data, &pos, end, &info->width) ||
+                               !get_varint(data, &pos, end, &info->height))) ||
+        !get_varint(data, &pos, end, &payload_len) || payload_len > end - pos) {
+        return false;
+    }
+    if (info->kind == 'K' && (info->width == 0 || info->height == 0 ||
+                              (uint64_t)info->width * info->height > (1u << 24))) {
+        return false;
+    }
+    info->payload = pos;
+    info->end = pos + payload_len;
+    return true;
+}
+
+// The index from the trailer if the recorder finished, otherwise one found
+// by walking the records up to the first one cut short
+static int load_index(RecordingPlayer* player) {
+    size_t size = player->size;
+    RecordingTrailer trailer;
+    if (size >= sizeof(RecordingHeader) + sizeof(trailer)) {
+        memcpy(&trailer, player->data + size - sizeof(trailer), sizeof(trailer));
+        size_t index_bytes = (size_t)trailer.index_count * sizeof(RecordingIndexEntry);
+        if (trailer.magic == RECORDING_INDEX_MAGIC && trailer.index_offset >= sizeof(RecordingHeader) &&
+            trailer.index_offset + index_bytes + sizeof(trailer) == size) {
+            player->index = malloc(index_bytes ? index_bytes : 1);
+            if (!player->index) {
+                return -1;
+            }
+            memcpy(player->index, player->data + trailer.index_offset, index_bytes);
+            player->index_count = (int)trailer.index_count;
+            player->records_end = (size_t)trailer.index_offset;
+            player->duration_ms = trailer.duration_ms;
+            player->frame_count = trailer.frame_count;
+            return 0;
+        }
+    }
+
+    player->records_end = size;
+    int capacity = 0;
+    size_t offset = sizeof(RecordingHeader);
+    RecordInfo info;
+    while (read_record(player, offset, &info)) {
+        if (info.kind == 'K') {
+            if (player->index_count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                RecordingIndexEntry* index = realloc(player->index, (size_t)capacity * sizeof(RecordingIndexEntry));
+                if (!index) {
+                    return -1;
+                }
+                player->index = index;
+            }
+            player->index[player->index_count++] = (RecordingIndexEntry){
+                .offset = offset,
+                .time_ms = info.time_ms,
+                .frame = player->frame_count
+            };
+        }
+        player->duration_ms = info.time_ms;
+        player->frame_count++;
+        offset = info.end;
+    }
+    player->records_end = offset;
+    return 0;
+}
+
+RecordingPlayer* recording_player_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RecordingHeader)) {
+        fprintf(stderr, "%s is not a recording\n", path);
+        close(fd);
+        return NULL;
+    }
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    RecordingHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (header.magic != RECORDING_MAGIC || header.version != RECORDING_VERSION) {
+        fprintf(stderr, "%s is not a recording\n", path);
+        munmap(mapping, (size_t)st.st_size);
+        return NULL;
+    }
+    // Playback reads forward; seeks jump to a keyframe and read forward again
+    posix_madvise(mapping, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    RecordingPlayer* player = calloc(1, sizeof(RecordingPlayer));
+    if (!player) {
+        munmap(mapping, (size_t)st.st_size);
+        return NULL;
+    }
+    player->data = mapping;
+    player->size = (size_t)st.st_size;
+    player->next = sizeof(RecordingHeader);
+    if (load_index(player) != 0 || player->index_count == 0) {
+        fprintf(stderr, "%s holds no frames\n", path);
+        recording_player_close(player);
+        return NULL;
+    }
+    return player;
+}
+
+void recording_player_close(RecordingPlayer* player) {
+    if (!player) return;
+    munmap((void*)player->data, player->size);
+    free(player->index);
+    free(player->palette);
+    framebuffer_destroy(player->frame);
+    free(player);
+}
+
+int64_t recording_player_next_time(const RecordingPlayer* player) {
+    RecordInfo info;
+    return read_record(player, player->next, &info) ? (int64_t)info.time_ms : -1;
+}
+
+int recording_player_step(RecordingPlayer* player) {
+    if (player->next >= player->records_end) {
+        return 0;
+    }
+    RecordInfo info;
+    if (!read_record(player, player->next, &info)) {
+        return -1;
+    }
+
+    Framebuffer* fb = player->frame;
+    if (info.kind == 'K') {
+        if (!fb || fb->width != (int)info.width || fb->height != (int)info.height) {
+            framebuffer_destroy(fb);
+            fb = player->frame = framebuffer_create((int)info.width, (int)info.height);
+            if (!fb) {
+                return -1;
+            }
+        }
+    } else if (!fb) {
+        return -1;  // A delta with nothing to apply it to
+    }
+
+    if (info.kind == 'K') {
+        player->palette_count = 0;
+    }
+    const unsigned char* data = player->data;
+    size_t pos = info.payload;
+    uint32_t cells = (uint32_t)(fb->width * fb->height);
+    uint32_t i = 0;
+    while (pos < info.end) {
+        uint32_t op, index;
+        if (!get_varint(data, &pos, info.end, &op)) {
+            return -1;
+        }
+        uint32_t count = op >> 2;
+        switch (op & 3) {
+            case RECORDING_OP_DEFINE:
+                for (uint32_t k = 0; k < count; k++) {
+                    if (player->palette_count == player->palette_capacity) {
+                        uint32_t capacity = player->palette_capacity ? player->palette_capacity * 2 : 256;
+                        RecordingCell* palette = realloc(player->palette, capacity * sizeof(RecordingCell));
+                        if (!palette) {
+                            return -1;
+                        }
+                        player->palette = palette;
+                        player->palette_capacity = capacity;
+                    }
+                    RecordingCell* entry = &player->palette[player->palette_count];
+                    if (pos >= info.end || data[pos] >= COLOR_COUNT) {
+                        return -1;
+                    }
+                    entry->color = data[pos++];
+                    if (!get_varint(data, &pos, info.end, &entry->codepoint)) {
+                        return -1;
+                    }
+                    player->palette_count++;
+                }
+                break;
+            case RECORDING_OP_SKIP:
+                if (count > cells - i) {
+                    return -1;
+                }
+                i += count;
+                break;
+            case RECORDING_OP_FILL:
+                if (count > cells - i || !get_varint(data, &pos, info.end, &index) ||
+                    index >= player->palette_count) {
+                    return -1;
+                }
+                for (uint32_t end = i + count; i < end; i++) {
+                    fb->chars[i] = (wchar_t)player->palette[index].codepoint;
+                    fb->colors[i] = player->palette[index].color;
+                }
+                break;
+            case RECORDING_OP_LITERAL:
+                if (count > cells - i) {
+                    return -1;
+                }
+                for (uint32_t end = i + count; i < end; i++) {
+                    if (!get_varint(data, &pos, info.end, &index) || index >= player->palette_count) {
+                        return -1;
+                    }
+                    fb->chars[i] = (wchar_t)player->palette[index].codepoint;
+                    fb->colors[i] = player->palette[index].color;
+                }
+                break;
+        }
+    }
+    if (i != cells) {
+        return -1;
+    }
+
+    player->time_ms = info.time_ms;
+    player->next = info.end;
+    return 1;
+}
+
+int recording_player_seek(RecordingPlayer* player, uint32_t ms) {
+    // Last keyframe at or before ms
+    int lo = 0, hi = player->index_count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (player->index[mid].time_ms <= ms) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    player->next = (size_t)player->index[lo].offset;
+    if (recording_player_step(player) != 1) {
+        return -1;
+    }
+    for (int64_t next = recording_player_next_time(player); next >= 0 && next <= (int64_t)ms;
+         next = recording_player_next_time(player)) {
+        if (recording_player_step(player) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -1,7 +1,10 @@
 #include "render.h"
 #include "raymarch.h"
 #include "sdf.h"
-#include "audio.h"
+#include "encode.h"
+#include "camera.h"
+#include "rain.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
@@ -9,33 +12,128 @@
 #include <stdio.h>
 #include <math.h>
 
-// Shading ramp from dark to bright
-static const wchar_t SHADE_CHARS[] = L" ·⋅∙•∘○◌◍◎●◉⬤";
-static const int SHADE_LEVELS = (int)(sizeof(SHADE_CHARS) / sizeof(wchar_t)) - 1;
+const GlyphSet GLYPHS_UNICODE = {
+    .shade = {L' ', L'·', L'⋅', L'∙', L'•', L'∘', L'○', L'◌', L'◍', L'◎', L'●', L'◉', L'⬤'},
+    .edge = {L'◌', L'◊', L'◈', L'◇', L'◆'},
+    .ground = {L'⋅', L'∙', L'•', L'◦', L'○'},
+    .mountain = {L'˄', L'∧', L'⋀', L'△', L'▲'},
+    .building = {L'·', L'▪', L'█'},
+    .sun = {L'◦', L'○', L'◎', L'◉', L'●', L'⬤'},
+    .rain = {L'╿', L'│', L'┆', L'╎', L'˙'},
+    .hud = {L'│', L'─', L'╭', L'╮', L'╰', L'╯'},
+    .shape = {L'▘', L'▝', L'▖', L'▗', L'▀', L'▄', L'▌', L'▐', L'▚', L'▞', L'▙',
+              L'▛', L'▜', L'▟', L'◢', L'◣', L'◤', L'◥', L'▔', L'▂', L'▎', L'▕'}
+};
+
+// Ramps picked by ink coverage to match the density of the Unicode ones
+const GlyphSet GLYPHS_ASCII = {
+    .shade = {' ', '.', ',', ':', ';', '-', '=', '+', '*', 'o', '#', '%', '@'},
+    .edge = {'\'', '~', 'x', 'X', '$'},
+    .ground = {'.', ',', ':', ';', 'o'},
+    .mountain = {'.', ':', '^', 'A', 'M'},
+    .building = {'.', 'o', '#'},
+    .sun = {'.', ':', 'o', 'O', '0', '@'},
+    .rain = {'!', '|', ':', '\'', '.'},
+    .hud = {'|', '-', '+', '+', '+', '+'},
+    // Lines along the edge each pattern leaves
+    .shape = {'\'', '`', ',', '.', '-', '-', '|', '|', '\\', '/', 'L',
+              'F', '7', 'J', '/', '\\', '/', '\\', '"', '_', '|', '|'}
+};
+
+// Coverage GlyphSet.shape[i] stands for: 4x4 samples, rows top to bottom,
+// '#' where the cube is. Quadrants, halves, diagonals, three quadrants,
+// triangles, then quarter strips.
+static const char* const SHAPE_PATTERNS[GLYPH_SHAPE_COUNT] = {
+    "##..##..........", "..##..##........", "........##..##..", "..........##..##",
+    "########........", "........########", "##..##..##..##..", "..##..##..##..##",
+    "##..##....##..##", "..##..####..##..",
+    "##..##..########", "##########..##..", "########..##..##", "..##..##########",
+    "...#..##.#######", "#...##..###.####", "#######.##..#...", "####.###..##...#",
+    "####............", "............####", "#...#...#...#...", "...#...#...#...#"
+};
+#define SHAPE_FULL  GLYPH_SHAPE_COUNT        // Match for a covered cell, shaded by the ramp
+#define SHAPE_EMPTY (GLYPH_SHAPE_COUNT + 1)  // Match for a cell left to the background
+// Column of the sample shaded in each row of a shape mode cell: a rotated grid
+static const int SHAPE_SHADED_COLUMN[4] = {1, 3, 0, 2};
+
+static const GlyphSet* renderer_glyphs(const Renderer* renderer) {
+    return renderer->settings.ascii ? &GLYPHS_ASCII : &GLYPHS_UNICODE;
+}
 
-// Subpixel sampling pattern (currently single sample at pixel center)
-static const float SUBPIXEL_OFFSETS[][2] = {
+// Cell-mode sample positions: the center, or a rotated grid of four
+static const float SUBPIXEL_CENTER[1][2] = {
     {0.5f, 0.5f}
 };
-static const int SUBPIXEL_SAMPLES = 1;
-
-static unsigned int hash_u32(unsigned int v);
-static float compute_soft_shadow(Vec3 point, Vec3 light_dir, float light_distance, CubeState* cube);
-static float compute_ambient_occlusion(Vec3 point, Vec3 normal, CubeState* cube);
-static bool detect_edge(Vec3 hit_point, CubeState* cube, Mat3 inv_rot);
-static float sample_shading(Vec3 hit_point, Vec3 normal, Vec3 camera_pos, CubeState* cube, Light light);
-static void render_environment_background(Framebuffer* fb, FrameStats stats);
-static void render_rain_background(Framebuffer* fb, FrameStats stats);
-
-// ANSI color codes
-#define COLOR_NONE      0
-#define COLOR_CUBE      1  // Cyan for cube
-#define COLOR_GROUND    2  // Dark gray for ground
-#define COLOR_MOUNTAIN  3  // Blue-gray for mountains
-#define COLOR_BUILDING  4  // Yellow for buildings
-#define COLOR_RAIN      5  // Bright cyan for rain
-#define COLOR_SUN       6  // Bright yellow for sun
-#define COLOR_FPS       7  // White for FPS
+static const float SUBPIXEL_GRID_4[4][2] = {
+    {0.375f, 0.125f}, {0.875f, 0.375f}, {0.125f, 0.625f}, {0.625f, 0.875f}
+};
+
+// Shading quality presets: enum suffix, kernel name, samples per cell in
+// cell mode, AO taps, shadow march steps and whether box edges get their
+// own glyphs. Each preset gets its own copy of the tile shaders with these
+// as constants, so loops unroll and disabled work is compiled out.
+#define SHADING_VARIANTS(X)              \
+    X(LOW,    low,    1, 0, 0,  false)   \
+    X(MEDIUM, medium, 1, 3, 8,  true)    \
+    X(HIGH,   high,   1, 5, 16, true)    \
+    X(ULTRA,  ultra,  4, 5, 16, true)
+
+#define AO_MAX_STEPS 5
+
+// Kernels are only fast once the preset's constants are folded into them
+#if defined(__GNUC__)
+#define KERNEL_INLINE inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE inline
+#endif
+
+typedef struct {
+    int cell_samples;
+    int ao_steps;
+    int shadow_steps;
+    bool edges;
+} ShadingQuality;
+
+// Temporal anti-aliasing: one jittered sample per cell and frame, blended
+// into a history that follows the cube's motion
+#define TAA_HISTORY      8     // Frames a converged cell averages over
+#define TAA_REJECT_CELLS 2.0f  // History further than this many cell heights from
+                               // the sample's surface point saw another surface
+
+// Standard 8x MSAA sample positions in 1/16ths of a cell around its center:
+// one sample per row and column, centered on the cell
+static const float TAA_JITTER[TAA_HISTORY][2] = {
+    { 1.0f / 16.0f, -3.0f / 16.0f},
+    {-1.0f / 16.0f,  3.0f / 16.0f},
+    { 5.0f / 16.0f,  1.0f / 16.0f},
+    {-3.0f / 16.0f, -5.0f / 16.0f},
+    {-5.0f / 16.0f,  5.0f / 16.0f},
+    {-7.0f / 16.0f, -1.0f / 16.0f},
+    { 3.0f / 16.0f,  7.0f / 16.0f},
+    { 7.0f / 16.0f, -7.0f / 16.0f}
+};
+
+// Braille dot bit for subsample [row][col] of a 2x4 cell, in U+2800 order
+static const unsigned char BRAILLE_BITS[4][2] = {
+    {0x01, 0x08},
+    {0x02, 0x10},
+    {0x04, 0x20},
+    {0x40, 0x80}
+};
+
+// Half-block glyph for a 1x2 mask (bit 0 = top, bit 1 = bottom)
+static const wchar_t HALF_BLOCK_CHARS[4] = {L' ', L'▀', L'▄', L'█'};
+
+// Ordered dither thresholds turning shade into lit-subsample density
+static const float DITHER_4X4[4][4] = {
+    { 0.5f / 16.0f,  8.5f / 16.0f,  2.5f / 16.0f, 10.5f / 16.0f},
+    {12.5f / 16.0f,  4.5f / 16.0f, 14.5f / 16.0f,  6.5f / 16.0f},
+    { 3.5f / 16.0f, 11.5f / 16.0f,  1.5f / 16.0f,  9.5f / 16.0f},
+    {15.5f / 16.0f,  7.5f / 16.0f, 13.5f / 16.0f,  5.5f / 16.0f}
+};
+
+static bool detect_edge(Vec3 hit_point, const SdfInstance* object);
+static void render_environment_background(Framebuffer* fb, const GlyphSet* glyphs, FrameStats stats);
 
 Framebuffer* framebuffer_create(int width, int height) {
     Framebuffer* fb = malloc(sizeof(Framebuffer));
@@ -58,15 +156,6 @@ Framebuffer* framebuffer_create(int width, int height) {
     return fb;
 }
 
-static unsigned int hash_u32(unsigned int v) {
-    v ^= v >> 16;
-    v *= 0x7feb352dU;
-    v ^= v >> 15;
-    v *= 0x846ca68bU;
-    v ^= v >> 16;
-    return v;
-}
-
 void framebuffer_destroy(Framebuffer* fb) {
     if (fb) {
         free(fb->chars);
@@ -84,25 +173,43 @@ void framebuffer_clear(Framebuffer* fb) {
     }
 }
 
-wchar_t intensity_to_char(float intensity, bool is_edge) {
+wchar_t intensity_to_char(const GlyphSet* glyphs, float intensity, bool is_edge) {
     if (is_edge) {
         // Edge characters by intensity
-        if (intensity > 0.8f) return L'◆';
-        if (intensity > 0.6f) return L'◇';
-        if (intensity > 0.4f) return L'◈';
-        if (intensity > 0.2f) return L'◊';
-        return L'◌';
+        if (intensity > 0.8f) return glyphs->edge[4];
+        if (intensity > 0.6f) return glyphs->edge[3];
+        if (intensity > 0.4f) return glyphs->edge[2];
+        if (intensity > 0.2f) return glyphs->edge[1];
+        return glyphs->edge[0];
     }
 
     // Map intensity to character index
     intensity = fmaxf(0.0f, fminf(1.0f, intensity));
-    int idx = (int)(intensity * (SHADE_LEVELS - 1) + 0.5f);
-    if (idx >= SHADE_LEVELS) idx = SHADE_LEVELS - 1;
+    int idx = (int)(intensity * (GLYPH_SHADE_LEVELS - 1) + 0.5f);
+    if (idx >= GLYPH_SHADE_LEVELS) idx = GLYPH_SHADE_LEVELS - 1;
     if (idx < 0) idx = 0;
-    return SHADE_CHARS[idx];
+    return glyphs->shade[idx];
+}
+
+int ground_horizon(int height) {
+    int horizon = (height * 2) / 3;
+    if (horizon < 4) {
+        horizon = height / 2;
+    }
+    return horizon;
+}
+
+// Index into GlyphSet.ground for a ground row, horizon to foreground
+static int ground_level(int y, int horizon, int height) {
+    float t = (float)(y - horizon) / (float)(height - horizon + 1);
+    if (t < 0.2f) return 0;
+    if (t < 0.4f) return 1;
+    if (t < 0.6f) return 2;
+    if (t < 0.8f) return 3;
+    return 4;
 }
 
-static void render_environment_background(Framebuffer* fb, FrameStats stats) {
+static void render_environment_background(Framebuffer* fb, const GlyphSet* glyphs, FrameStats stats) {
     (void)stats;
     int width = fb->width;
     int height = fb->height;
@@ -111,26 +218,11 @@ static void render_environment_background(Framebuffer* fb, FrameStats stats) {
         return;
     }
 
-    int horizon = (height * 2) / 3;
-    if (horizon < 4) {
-        horizon = height / 2;
-    }
+    int horizon = ground_horizon(height);
 
     // Ground plane below horizon with gradient pattern
     for (int y = horizon; y < height; y++) {
-        float t = (float)(y - horizon) / (float)(height - horizon + 1);
-        wchar_t ch;
-        if (t < 0.2f) {
-            ch = L'⋅';
-        } else if (t < 0.4f) {
-            ch = L'∙';
-        } else if (t < 0.6f) {
-            ch = L'•';
-        } else if (t < 0.8f) {
-            ch = L'◦';
-        } else {
-            ch = L'○';
-        }
+        wchar_t ch = glyphs->ground[ground_level(y, horizon, height)];
 
         for (int x = 0; x < width; x++) {
             int idx = y * width + x;
@@ -158,15 +250,15 @@ static void render_environment_background(Framebuffer* fb, FrameStats stats) {
             float band = (float)(horizon - y) / (float)peak;
             wchar_t ch;
             if (band > 0.8f) {
-                ch = L'▲';  // Sharp peak
+                ch = glyphs->mountain[4];  // Sharp peak
             } else if (band > 0.6f) {
-                ch = L'△';  // Upper slopes
+                ch = glyphs->mountain[3];  // Upper slopes
             } else if (band > 0.4f) {
-                ch = L'⋀';  // Mid slopes
+                ch = glyphs->mountain[2];  // Mid slopes
             } else if (band > 0.2f) {
-                ch = L'∧';  // Lower slopes
+                ch = glyphs->mountain[1];  // Lower slopes
             } else {
-                ch = L'˄';  // Base
+                ch = glyphs->mountain[0];  // Base
             }
 
             int idx = y * width + x;
@@ -197,11 +289,11 @@ static void render_environment_background(Framebuffer* fb, FrameStats stats) {
                     int idx = y * width + x;
                     wchar_t ch;
                     if (y == top || y == base_y || x == left || x == right) {
-                        ch = L'█'; // solid outline
+                        ch = glyphs->building[2]; // solid outline
                     } else if (((x + y) & 1) == 0) {
-                        ch = L'▪'; // lit window
+                        ch = glyphs->building[1]; // lit window
                     } else {
-                        ch = L'·'; // dark area
+                        ch = glyphs->building[0]; // dark area
                     }
                     fb->chars[idx] = ch;
                     fb->depth[idx] = 1000.0f;
@@ -212,81 +304,15 @@ static void render_environment_background(Framebuffer* fb, FrameStats stats) {
     }
 }
 
-static void render_rain_background(Framebuffer* fb, FrameStats stats) {
-    int width = fb->width;
-    int height = fb->height;
-
-    if (width <= 0 || height <= 1) {
-        return;
-    }
-
-    unsigned long t = stats.frame_count;
-    unsigned long slow_t = t / 3; // bigger divisor => slower rain
-
-    for (int x = 0; x < width; x++) {
-        // Leave space on the right for the FPS overlay
-        if (x > width - 16) {
-            continue;
-        }
-
-        unsigned int h = hash_u32((unsigned int)x * 2654435761U);
-
-        // Roughly 70% of columns have rain at all
-        if ((h & 0x3U) == 0U) {
-            continue;
-        }
-
-        int speed = 1 + (int)(h % 3U);                  // 1..3
-        int trail_length = 3 + (int)((h >> 3) % 6U);    // 3..8
-        int gap = 4 + (int)((h >> 6) % 8U);             // vertical gap between streaks
-
-        unsigned long phase = (unsigned long)(h >> 16);
-        unsigned long cycle = (unsigned long)(height + trail_length + gap);
-        int head = (int)((slow_t * (unsigned long)speed + phase) % cycle);
-
-        // Only draw when the head is actually on-screen
-        if (head >= height + trail_length) {
-            continue;
-        }
-
-        int horizon = (height * 2) / 3;
-        for (int i = 0; i < trail_length; i++) {
-            int y = head - i;
-            if (y <= 0 || y >= height) {
-                continue;
-            }
-            // Do not draw rain on the ground plane to keep it readable
-            if (y >= horizon) {
-                continue;
-            }
-
-            int idx = y * width + x;
-            wchar_t ch;
-            if (i == 0) {
-                ch = L'╿';  // Rain head
-            } else if (i == 1) {
-                ch = L'│';  // Upper trail
-            } else if (i < trail_length - 2) {
-                ch = L'┆';  // Mid trail
-            } else if (i == trail_length - 2) {
-                ch = L'╎';  // Lower trail
-            } else {
-                ch = L'˙';  // Tail
-            }
-
-            fb->chars[idx] = ch;
-            fb->depth[idx] = 1000.0f;
-            fb->colors[idx] = COLOR_RAIN;
-        }
-    }
-}
-
-static float compute_soft_shadow(Vec3 point, Vec3 light_dir, float light_distance, CubeState* cube) {
+static KERNEL_INLINE float compute_soft_shadow(Vec3 point, Vec3 light_dir, float light_distance,
+                                               const SdfInstance* object, int max_steps, int* steps) {
     float shadow = 1.0f;
     float t = 0.02f;
-    for (int i = 0; i < 16 && t < light_distance; i++) {
+    *steps = 0;
+    for (int i = 0; i < max_steps && t < light_distance; i++) {
+        *steps = i + 1;
         Vec3 sample = vec3_add(point, vec3_multiply(light_dir, t));
-        float dist = sdf_cube(sample, cube->position, cube->size, cube->rotation);
+        float dist = sdf_evaluate(object, sample);
         if (dist < 0.0005f) {
             return 0.0f;
         }
@@ -296,17 +322,25 @@ static float compute_soft_shadow(Vec3 point, Vec3 light_dir, float light_distanc
     return fmaxf(shadow, 0.0f);
 }
 
-static float compute_ambient_occlusion(Vec3 point, Vec3 normal, CubeState* cube) {
-    const int AO_STEPS = 5;
-    const float AO_STEP = fmaxf(0.03f, cube->size * 0.12f);
+// Fewer taps are spread over the same distance from the surface
+static KERNEL_INLINE float compute_ambient_occlusion(Vec3 point, Vec3 normal, const SdfInstance* object,
+                                                     int steps) {
+    const float AO_STEP = fmaxf(0.03f, object->half_extent * 0.12f) * (float)AO_MAX_STEPS / (float)steps;
 
     float occlusion = 0.0f;
     float max_component = 0.0f;
 
-    for (int i = 1; i <= AO_STEPS; i++) {
+    // The AO samples are independent, so they are evaluated as one batch
+    Vec3 sample_points[AO_MAX_STEPS];
+    float dists[AO_MAX_STEPS];
+    for (int i = 1; i <= steps; i++) {
+        sample_points[i - 1] = vec3_add(point, vec3_multiply(normal, AO_STEP * i));
+    }
+    sdf_evaluate_batch(object, sample_points, dists, steps);
+
+    for (int i = 1; i <= steps; i++) {
         float sample_dist = AO_STEP * i;
-        Vec3 sample_point = vec3_add(point, vec3_multiply(normal, sample_dist));
-        float dist = sdf_cube(sample_point, cube->position, cube->size, cube->rotation);
+        float dist = dists[i - 1];
         float contribution = fmaxf(0.0f, sample_dist - dist) / (float)i;
         occlusion += contribution;
         max_component += AO_STEP / (float)i;
@@ -320,46 +354,208 @@ static float compute_ambient_occlusion(Vec3 point, Vec3 normal, CubeState* cube)
     return ao;
 }
 
-static bool detect_edge(Vec3 hit_point, CubeState* cube, Mat3 inv_rot) {
-    Vec3 local_point = vec3_subtract(hit_point, cube->position);
-    local_point = mat3_multiply_vec3(inv_rot, local_point);
+// Box edges get their own glyphs; other shapes have no marked edges
+static bool detect_edge(Vec3 hit_point, const SdfInstance* object) {
+    if (object->shape->kind != SDF_SHAPE_CUBE) {
+        return false;
+    }
+    Vec3 local_point = vec3_subtract(hit_point, object->position);
+    local_point = mat3_multiply_vec3(object->inv_rotation, local_point);
 
-    float edge_dist = fmaxf(0.02f, cube->size * 0.08f);
+    float size = object->half_extent;
+    float edge_dist = fmaxf(0.02f, size * 0.08f);
     int near_boundary = 0;
 
-    if (fabsf(fabsf(local_point.x) - cube->size) < edge_dist) near_boundary++;
-    if (fabsf(fabsf(local_point.y) - cube->size) < edge_dist) near_boundary++;
-    if (fabsf(fabsf(local_point.z) - cube->size) < edge_dist) near_boundary++;
+    if (fabsf(fabsf(local_point.x) - size) < edge_dist) near_boundary++;
+    if (fabsf(fabsf(local_point.y) - size) < edge_dist) near_boundary++;
+    if (fabsf(fabsf(local_point.z) - size) < edge_dist) near_boundary++;
 
     return near_boundary >= 2;
 }
 
-static float sample_shading(Vec3 hit_point, Vec3 normal, Vec3 camera_pos, CubeState* cube, Light light) {
-    Vec3 to_light = vec3_subtract(light.position, hit_point);
-    float light_distance = vec3_length(to_light);
-    if (light_distance < 0.0001f) {
-        light_distance = 0.0001f;
+// Face of the cube a surface point sits on
+typedef struct {
+    Vec3 normal;       // World-space outward face normal
+    float height;      // Signed height of the point above the face plane
+    float edge_dist;   // Distance from the point to the nearest face edge
+} CubeFace;
+
+static CubeFace classify_cube_face(Vec3 point, const SdfInstance* cube) {
+    Vec3 local = mat3_multiply_vec3(cube->inv_rotation, vec3_subtract(point, cube->position));
+    float ax = fabsf(local.x);
+    float ay = fabsf(local.y);
+    float az = fabsf(local.z);
+
+    CubeFace face;
+    Vec3 axis;
+    float lateral;
+    if (ax >= ay && ax >= az) {
+        axis = (Vec3){local.x < 0.0f ? -1.0f : 1.0f, 0.0f, 0.0f};
+        face.height = ax - cube->half_extent;
+        lateral = fmaxf(ay, az);
+    } else if (ay >= az) {
+        axis = (Vec3){0.0f, local.y < 0.0f ? -1.0f : 1.0f, 0.0f};
+        face.height = ay - cube->half_extent;
+        lateral = fmaxf(ax, az);
+    } else {
+        axis = (Vec3){0.0f, 0.0f, local.z < 0.0f ? -1.0f : 1.0f};
+        face.height = az - cube->half_extent;
+        lateral = fmaxf(ax, ay);
     }
-    Vec3 light_dir = vec3_multiply(to_light, 1.0f / light_distance);
+    face.normal = mat3_multiply_vec3(cube->rotation, axis);
+    face.edge_dist = cube->half_extent - lateral;
+    return face;
+}
 
-    float diffuse = fmaxf(0.0f, vec3_dot(normal, light_dir));
+// A single cube is convex, so shadow and AO are often known without marching:
+//  - Where the surface faces away from the light the direct term is zero and
+//    the shadow value is never used.
+//  - The face plane supports the cube, so along the shadow ray
+//    sdf >= h + t * cos(light, face) for a start height h above it. Once
+//    4 * cos >= 1 every penumbra sample 4 * sdf / t is >= 1: fully lit.
+//  - AO samples stepping out along the face normal stay exactly their step
+//    plus h away from the cube, so AO is 1 unless the point sits in an edge
+//    band, where the estimated normal bends and samples see the other face.
+#define SHADOW_LIT_COS   0.26f  // 1/4 plus margin for SDF rounding
+#define AO_EDGE_BAND     0.08f  // Relative to the half-extent, as in detect_edge
+#define AO_NORMAL_MATCH  0.999f
+
+// Lights whose directions from a point are this close share one shadow ray
+#define SHADOW_SHARE_COS 0.98f
+
+// Lights available to the samples of one tile
+typedef struct {
+    const Light* lights;
+    const int* active;      // Indices of the lights not culled for the tile
+    int active_count;
+    float ambient;          // Ambient terms of every light
+    bool convex_shortcuts;
+    int shadow_budget;
+} ShadingContext;
+
+// Fades from 1 at the light to exactly 0 at its range, so a light can be
+// culled wherever everything is out of range without a visible seam
+static float light_falloff(const Light* light, float distance) {
+    if (light->range <= 0.0f) {
+        return 1.0f;
+    }
+    float x = distance / light->range;
+    float window = fmaxf(0.0f, 1.0f - x * x);
+    return window * window;
+}
 
+// Direct light from one light before shadowing
+typedef struct {
+    Vec3 dir;
+    float distance;
+    float contribution;  // Diffuse plus specular, after falloff
+    bool needs_march;    // Visibility is not already known
+    float visibility;
+} LightSample;
+
+static KERNEL_INLINE float sample_shading(Vec3 hit_point, Vec3 normal, Vec3 camera_pos,
+                                          const SdfInstance* object, const ShadingContext* ctx,
+                                          ShadingQuality quality, CellCost* cost) {
     Vec3 view_dir = vec3_normalize(vec3_subtract(camera_pos, hit_point));
-    float specular_term = 0.0f;
-    if (diffuse > 0.0f && light.specular > 0.0f) {
-        Vec3 reflect_dir = vec3_reflect(vec3_multiply(light_dir, -1.0f), normal);
-        specular_term = powf(fmaxf(vec3_dot(reflect_dir, view_dir), 0.0f), 32.0f);
+    Vec3 shadow_origin = vec3_add(hit_point, vec3_multiply(normal, 0.015f));
+
+    bool convex = ctx->convex_shortcuts && object->shape->kind == SDF_SHAPE_CUBE &&
+                  (quality.ao_steps > 0 || quality.shadow_steps > 0);
+    CubeFace face = {0};
+    float start_height = 0.0f;
+    bool march_ao = quality.ao_steps > 0;
+    if (convex) {
+        face = classify_cube_face(hit_point, object);
+        start_height = face.height + 0.015f * vec3_dot(normal, face.normal);
+        march_ao = march_ao && (face.edge_dist < object->half_extent * AO_EDGE_BAND ||
+                                vec3_dot(normal, face.normal) < AO_NORMAL_MATCH);
     }
 
-    Vec3 shadow_origin = vec3_add(hit_point, vec3_multiply(normal, 0.015f));
-    float shadow = compute_soft_shadow(shadow_origin, light_dir, light_distance, cube);
-    float ambient_occlusion = compute_ambient_occlusion(hit_point, normal, cube);
+    // Lights that reach the point, brightest first
+    LightSample lit[RENDER_MAX_LIGHTS];
+    int lit_count = 0;
+    for (int i = 0; i < ctx->active_count; i++) {
+        const Light* light = &ctx->lights[ctx->active[i]];
+        Vec3 to_light = vec3_subtract(light->position, hit_point);
+        float light_distance = vec3_length(to_light);
+        if (light_distance < 0.0001f) {
+            light_distance = 0.0001f;
+        }
+        Vec3 light_dir = vec3_multiply(to_light, 1.0f / light_distance);
+
+        float diffuse = fmaxf(0.0f, vec3_dot(normal, light_dir));
+        float specular_term = 0.0f;
+        if (diffuse > 0.0f && light->specular > 0.0f) {
+            Vec3 reflect_dir = vec3_reflect(vec3_multiply(light_dir, -1.0f), normal);
+            specular_term = powf(fmaxf(vec3_dot(reflect_dir, view_dir), 0.0f), 32.0f);
+        }
+        float contribution = light_falloff(light, light_distance) *
+                             (light->diffuse * diffuse + light->specular * specular_term);
+        if (contribution <= 0.0f) {
+            continue;  // Faces away or out of range: nothing to shadow
+        }
+
+        LightSample sample = {
+            .dir = light_dir,
+            .distance = light_distance,
+            .contribution = contribution,
+            .needs_march = quality.shadow_steps > 0 &&
+                           !(convex && start_height > 0.001f &&
+                             vec3_dot(face.normal, light_dir) >= SHADOW_LIT_COS),
+            .visibility = 1.0f
+        };
+        // Order only matters to the shadow budget
+        int at = lit_count++;
+        while (quality.shadow_steps > 0 && at > 0 && lit[at - 1].contribution < contribution) {
+            lit[at] = lit[at - 1];
+            at--;
+        }
+        lit[at] = sample;
+    }
+
+    // March shadows for the brightest lights up to the budget. A light close
+    // in direction to one already marched, or past the budget, takes the
+    // visibility of the nearest marched light instead of its own ray.
+    int marched[RENDER_MAX_LIGHTS];
+    int marched_count = 0;
+    for (int i = 0; i < lit_count; i++) {
+        if (!lit[i].needs_march) {
+            continue;
+        }
+        int nearest = -1;
+        float nearest_cos = -2.0f;
+        for (int m = 0; m < marched_count; m++) {
+            float c = vec3_dot(lit[i].dir, lit[marched[m]].dir);
+            if (c > nearest_cos) {
+                nearest_cos = c;
+                nearest = marched[m];
+            }
+        }
+        if (nearest >= 0 && (nearest_cos >= SHADOW_SHARE_COS || marched_count >= ctx->shadow_budget)) {
+            lit[i].visibility = lit[nearest].visibility;
+        } else if (marched_count < ctx->shadow_budget) {
+            int steps;
+            lit[i].visibility = compute_soft_shadow(shadow_origin, lit[i].dir, lit[i].distance, object,
+                                                    quality.shadow_steps, &steps);
+            cost->shadow_steps += (uint32_t)steps;
+            cost->sdf_calls += (uint32_t)steps;
+            marched[marched_count++] = i;
+        }
+    }
 
-    float effective_ambient = light.ambient * 0.8f;
-    float diffuse_spec = light.diffuse * diffuse + light.specular * specular_term;
+    float ambient_occlusion = 1.0f;
+    if (march_ao) {
+        ambient_occlusion = compute_ambient_occlusion(hit_point, normal, object, quality.ao_steps);
+        cost->ao_taps += (uint32_t)quality.ao_steps;
+        cost->sdf_calls += (uint32_t)quality.ao_steps;
+    }
 
+    float effective_ambient = ctx->ambient * 0.8f;
     float ambient_term = effective_ambient * (0.3f + 0.7f * ambient_occlusion);
-    float direct_term = shadow * ambient_occlusion * diffuse_spec;
+    float direct_term = 0.0f;
+    for (int i = 0; i < lit_count; i++) {
+        direct_term += lit[i].visibility * ambient_occlusion * lit[i].contribution;
+    }
 
     float intensity = ambient_term + direct_term;
 
@@ -367,294 +563,1438 @@ static float sample_shading(Vec3 hit_point, Vec3 normal, Vec3 camera_pos, CubeSt
     return powf(intensity, 1.1f);
 }
 
-void render_cube(Framebuffer* fb, CubeState* cube, Light light, FrameStats stats) {
-    framebuffer_clear(fb);
+static float depth_fog(float depth) {
+    // Depth-based falloff: farther points get dimmer
+    float depth_near = 3.5f;
+    float depth_far = 9.5f;
+    float depth_n = (depth - depth_near) / (depth_far - depth_near);
+    if (depth_n < 0.0f) depth_n = 0.0f;
+    if (depth_n > 1.0f) depth_n = 1.0f;
+    return 1.0f - 0.35f * depth_n;
+}
 
-    render_environment_background(fb, stats);
-    render_rain_background(fb, stats);
+// Distance along dir at which the ray enters the sphere, 0 if it starts
+// inside. Returns false if the ray misses the sphere entirely.
+static bool ray_enter_sphere(Vec3 origin, Vec3 dir, Vec3 center, float radius, float* t_enter) {
+    Vec3 oc = vec3_subtract(origin, center);
+    float b = vec3_dot(oc, dir);
+    float c = vec3_dot(oc, oc) - radius * radius;
+    float disc = b * b - c;
+    if (disc < 0.0f) {
+        return false;
+    }
+    float root = sqrtf(disc);
+    if (-b + root < 0.0f) {
+        return false;  // Sphere is behind the ray
+    }
+    *t_enter = fmaxf(0.0f, -b - root);
+    return true;
+}
 
-    Vec3 camera_pos = {0, 0, 6.0f};
-    float aspect = (float)fb->width / (float)fb->height * 0.5f;
-    float fov = 50.0f * 3.14159f / 180.0f;
-    float half_fov = fov * 0.5f;
-    float scale = tanf(half_fov);
-    float inv_width = 1.0f / (float)fb->width;
-    float inv_height = 1.0f / (float)fb->height;
+static float cube_bound_radius(const SdfInstance* cube) {
+    return cube->half_extent * sdf_shape_bound(cube->shape);
+}
 
-    RaymarchConfig raymarch_config = {
-        .max_steps = 100,
-        .epsilon = 0.001f,
-        .max_distance = 100.0f
+// Cells whose rays can possibly reach the cube: the projection of the
+// bounding sphere's enclosing box, padded by a cell.
+static CellRect cube_screen_rect(const Camera* cam, const SdfInstance* cube) {
+    CellRect full = {0, 0, cam->width, cam->height};
+    float r = cube_bound_radius(cube);
+    float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+
+    for (int corner = 0; corner < 8; corner++) {
+        Vec3 p = {
+            cube->position.x + ((corner & 1) ? r : -r),
+            cube->position.y + ((corner & 2) ? r : -r),
+            cube->position.z + ((corner & 4) ? r : -r)
+        };
+        float fx, fy;
+        if (!camera_project(cam, p, &fx, &fy)) {
+            return full;  // Bound straddles the camera plane
+        }
+        min_x = fminf(min_x, fx);
+        min_y = fminf(min_y, fy);
+        max_x = fmaxf(max_x, fx);
+        max_y = fmaxf(max_y, fy);
+    }
+
+    CellRect rect = {
+        (int)floorf(min_x) - 1,
+        (int)floorf(min_y) - 1,
+        (int)ceilf(max_x) + 1,
+        (int)ceilf(max_y) + 1
     };
+    if (rect.x0 < 0) rect.x0 = 0;
+    if (rect.y0 < 0) rect.y0 = 0;
+    if (rect.x1 > cam->width) rect.x1 = cam->width;
+    if (rect.y1 > cam->height) rect.y1 = cam->height;
+    return rect;
+}
+
+#define NORMAL_SDF_CALLS    6      // Central differences in raymarch's normal estimate
+#define RAYMARCH_RELAXATION 1.2f   // Step scale for primary rays (1 = plain sphere tracing)
+#define RAYMARCH_FOOTPRINT  0.25f  // Hit tolerance as a fraction of a sample's half-height
+
+// Primary ray through continuous cell coordinates. Rays that miss the
+// bounding sphere are rejected without marching; the rest start at it.
+static bool trace_cube(Renderer* renderer, const Camera* cam, const SdfInstance* cube,
+                       RaymarchConfig config, float fx, float fy,
+                       Vec3* hit_point, Vec3* normal, CellCost* cost) {
+    renderer->rays_traced++;
+    Vec3 ray_dir = camera_ray(cam, fx, fy);
+    float t_enter;
+    if (!ray_enter_sphere(cam->position, ray_dir, cube->position, cube_bound_radius(cube), &t_enter)) {
+        return false;
+    }
+    int steps;
+    bool hit = raymarch(cam->position, ray_dir, t_enter, config, hit_point, normal, &steps, cube);
+    renderer->march_steps += (unsigned long)steps;
+    cost->primary_steps += (uint32_t)steps;
+    cost->sdf_calls += (uint32_t)steps + (hit ? NORMAL_SDF_CALLS : 0);
+    if (steps > renderer->max_march_steps) {
+        renderer->max_march_steps = steps;
+    }
+    return hit;
+}
+
+// Cells under an opaque overlay are never seen, so no rays are traced there
+static bool cell_is_masked(const Renderer* renderer, int idx) {
+    return renderer->layers[LAYER_SUN].cells->chars[idx] != 0 ||
+           renderer->layers[LAYER_HUD].cells->chars[idx] != 0;
+}
+
+static void subcell_grid(RenderMode mode, int* cols, int* rows) {
+    if (mode == RENDER_MODE_SHAPE) {
+        *cols = 4;
+        *rows = 4;
+    } else if (mode == RENDER_MODE_BRAILLE) {
+        *cols = 2;
+        *rows = 4;
+    } else {
+        *cols = 1;
+        *rows = 2;
+    }
+}
+
+// Mask bit for subsample (col, row); braille bits follow U+2800 dot order
+// so the mask is the low byte of the code point. Shape masks go row by row
+// like SHAPE_PATTERNS.
+static uint16_t subcell_bit(RenderMode mode, int col, int row) {
+    if (mode == RENDER_MODE_SHAPE) {
+        return (uint16_t)(1u << (row * 4 + col));
+    }
+    if (mode == RENDER_MODE_BRAILLE) {
+        return BRAILLE_BITS[row][col];
+    }
+    return (uint16_t)(1u << row);
+}
+
+// Glyph for a subcell mask and the mean shade of its hits; 0 leaves the
+// background
+static wchar_t subcell_glyph(const Renderer* renderer, uint16_t mask, float intensity) {
+    RenderMode mode = renderer->settings.mode;
+    if (mode == RENDER_MODE_SHAPE) {
+        int match = renderer->shape_match[mask];
+        if (match == SHAPE_EMPTY) return 0;
+        if (match == SHAPE_FULL) return intensity_to_char(renderer_glyphs(renderer), intensity, false);
+        return renderer_glyphs(renderer)->shape[match];
+    }
+    if (mode == RENDER_MODE_BRAILLE) {
+        return (wchar_t)(0x2800 + mask);
+    }
+    return HALF_BLOCK_CHARS[mask & 3];
+}
+
+static int popcount16(uint32_t v) {
+    v = v - ((v >> 1) & 0x5555u);
+    v = (v & 0x3333u) + ((v >> 2) & 0x3333u);
+    v = (v + (v >> 4)) & 0x0F0Fu;
+    return (int)((v + (v >> 8)) & 0x1Fu);
+}
+
+// For every 4x4 coverage mask, the pattern that differs from it in the
+// fewest samples. Built once, so a cell costs one lookup.
+static unsigned char* build_shape_match(void) {
+    uint32_t patterns[GLYPH_SHAPE_COUNT + 2];
+    for (int i = 0; i < GLYPH_SHAPE_COUNT; i++) {
+        patterns[i] = 0;
+        for (int bit = 0; bit < 16; bit++) {
+            patterns[i] |= (uint32_t)(SHAPE_PATTERNS[i][bit] == '#') << bit;
+        }
+    }
+    patterns[SHAPE_FULL] = 0xFFFFu;
+    patterns[SHAPE_EMPTY] = 0;
+
+    unsigned char* match = malloc(1u << 16);
+    if (!match) return NULL;
+    for (uint32_t mask = 0; mask < (1u << 16); mask++) {
+        // Full and empty win ties, so only clearly partial cells get a shape
+        int best = SHAPE_FULL;
+        int best_distance = popcount16(mask ^ patterns[SHAPE_FULL]);
+        for (int i = SHAPE_EMPTY; i >= 0; i--) {
+            int distance = popcount16(mask ^ patterns[i]);
+            if (distance < best_distance) {
+                best = i;
+                best_distance = distance;
+            }
+        }
+        match[mask] = (unsigned char)best;
+    }
+    return match;
+}
+
+static int samples_per_cell(RenderMode mode, int cell_samples) {
+    if (mode == RENDER_MODE_CELL) {
+        return cell_samples;
+    }
+    int cols, rows;
+    subcell_grid(mode, &cols, &rows);
+    return cols * rows;
+}
+
+static bool temporal_active(const Renderer* renderer) {
+    return renderer->settings.temporal_aa && renderer->settings.mode == RENDER_MODE_CELL;
+}
+
+// Position of sample out of samples inside its cell; subcell samples go row by row
+static void sample_offset(const Renderer* renderer, int samples, int sample, float* offset_x, float* offset_y) {
+    RenderMode mode = renderer->settings.mode;
+    if (mode == RENDER_MODE_CELL) {
+        const float (*pattern)[2] = samples == 4 ? SUBPIXEL_GRID_4 : SUBPIXEL_CENTER;
+        *offset_x = pattern[sample][0];
+        *offset_y = pattern[sample][1];
+        if (temporal_active(renderer)) {
+            // Shift the pattern by this frame's jitter, wrapping in the cell
+            const float* jitter = TAA_JITTER[renderer->taa_frame % TAA_HISTORY];
+            *offset_x = fmodf(*offset_x + jitter[0] + 1.0f, 1.0f);
+            *offset_y = fmodf(*offset_y + jitter[1] + 1.0f, 1.0f);
+        }
+        return;
+    }
+    int cols, rows;
+    subcell_grid(mode, &cols, &rows);
+    *offset_x = ((float)(sample % cols) + 0.5f) / (float)cols;
+    *offset_y = ((float)(sample / cols) + 0.5f) / (float)rows;
+}
+
+// Primary hits are gathered a tile at a time, so lights are culled against
+// the bounds of what the tile actually sees before anything is shaded
+#define LIGHT_TILE_WIDTH  8
+#define LIGHT_TILE_HEIGHT 4
+#define MAX_CELL_SAMPLES  16  // Shape mode's 4x4
+
+typedef struct {
+    Vec3 point;
+    Vec3 normal;
+    bool hit;
+} TileSample;
+
+typedef struct {
+    CellRect rect;
+    int samples_per_cell;
+    TileSample samples[LIGHT_TILE_WIDTH * LIGHT_TILE_HEIGHT * MAX_CELL_SAMPLES];
+    Vec3 lo, hi;                    // Bounds of the hit points
+    int hit_count;
+    int lights[RENDER_MAX_LIGHTS];  // Lights that can visibly reach a hit
+    int light_count;
+} LightTile;
+
+static TileSample* tile_sample(LightTile* tile, int x, int y, int sample) {
+    int cell = (y - tile->rect.y0) * LIGHT_TILE_WIDTH + (x - tile->rect.x0);
+    return &tile->samples[cell * tile->samples_per_cell + sample];
+}
 
-    Mat3 inv_rot = mat3_transpose(cube->rotation);
+static void trace_tile(Renderer* renderer, LightTile* tile, const Camera* cam, const SdfInstance* cube,
+                       RaymarchConfig raymarch_config, CellRect rect, int cell_samples) {
+    RenderMode mode = renderer->settings.mode;
+    int width = renderer->layers[LAYER_CUBE].cells->width;
+    tile->rect = rect;
+    tile->samples_per_cell = samples_per_cell(mode, cell_samples);
+    tile->lo = (Vec3){INFINITY, INFINITY, INFINITY};
+    tile->hi = (Vec3){-INFINITY, -INFINITY, -INFINITY};
+    tile->hit_count = 0;
+
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
+            bool masked = cell_is_masked(renderer, y * width + x);
+            CellCost* cost = &renderer->costs[y * width + x];
+            for (int s = 0; s < tile->samples_per_cell; s++) {
+                TileSample* sample = tile_sample(tile, x, y, s);
+                float offset_x, offset_y;
+                sample_offset(renderer, tile->samples_per_cell, s, &offset_x, &offset_y);
+                sample->hit = !masked &&
+                              trace_cube(renderer, cam, cube, raymarch_config,
+                                         (float)x + offset_x, (float)y + offset_y,
+                                         &sample->point, &sample->normal, cost);
+                if (sample->hit) {
+                    Vec3 p = sample->point;
+                    tile->lo = (Vec3){fminf(tile->lo.x, p.x), fminf(tile->lo.y, p.y), fminf(tile->lo.z, p.z)};
+                    tile->hi = (Vec3){fmaxf(tile->hi.x, p.x), fmaxf(tile->hi.y, p.y), fmaxf(tile->hi.z, p.z)};
+                    tile->hit_count++;
+                }
+            }
+        }
+    }
+}
 
-    for (int y = 0; y < fb->height; y++) {
-        for (int x = 0; x < fb->width; x++) {
+// Keep the lights whose best case at the nearest hit, full diffuse plus
+// full specular after falloff, is at least half a step of the shade ramp
+static void cull_tile_lights(LightTile* tile, const Light* lights, int light_count) {
+    tile->light_count = 0;
+    if (tile->hit_count == 0) {
+        return;
+    }
+    float threshold = 0.5f / (float)GLYPH_SHADE_LEVELS;
+    for (int i = 0; i < light_count; i++) {
+        const Light* light = &lights[i];
+        Vec3 nearest = {
+            fminf(fmaxf(light->position.x, tile->lo.x), tile->hi.x),
+            fminf(fmaxf(light->position.y, tile->lo.y), tile->hi.y),
+            fminf(fmaxf(light->position.z, tile->lo.z), tile->hi.z)
+        };
+        float distance = vec3_length(vec3_subtract(light->position, nearest));
+        if ((light->diffuse + light->specular) * light_falloff(light, distance) >= threshold) {
+            tile->lights[tile->light_count++] = i;
+        }
+    }
+}
+
+static KERNEL_INLINE void shade_tile_cells(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube,
+                                           LightTile* tile, const ShadingContext* ctx, const Camera* cam,
+                                           ShadingQuality quality) {
+    CellRect rect = tile->rect;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
             float accumulated_intensity = 0.0f;
             int samples_hit = 0;
             int edge_votes = 0;
             float nearest_depth = 1000.0f;
+            CellCost* cost = &renderer->costs[y * fb->width + x];
 
-            for (int sample = 0; sample < SUBPIXEL_SAMPLES; sample++) {
-                float offset_x = SUBPIXEL_OFFSETS[sample][0];
-                float offset_y = SUBPIXEL_OFFSETS[sample][1];
-
-                float px = (2.0f * ((x + offset_x) * inv_width) - 1.0f) * aspect;
-                float py = 1.0f - 2.0f * ((y + offset_y) * inv_height);
-
-                Vec3 ray_dir = vec3_normalize((Vec3){
-                    px * scale,
-                    py * scale,
-                    -1.0f
-                });
-
-                Vec3 hit_point, normal;
-                if (raymarch(camera_pos, ray_dir, raymarch_config,
-                             &hit_point, &normal, cube->position,
-                             cube->size, cube->rotation)) {
-                    float sample_intensity = sample_shading(hit_point, normal, camera_pos, cube, light);
-                    accumulated_intensity += sample_intensity;
-                    samples_hit++;
-
-                    if (detect_edge(hit_point, cube, inv_rot)) {
-                        edge_votes++;
-                    }
+            for (int s = 0; s < quality.cell_samples; s++) {
+                const TileSample* sample = tile_sample(tile, x, y, s);
+                if (!sample->hit) {
+                    continue;
+                }
+                accumulated_intensity += sample_shading(sample->point, sample->normal, cam->position, cube,
+                                                        ctx, quality, cost);
+                samples_hit++;
 
-                    float depth = vec3_length(vec3_subtract(hit_point, camera_pos));
-                    if (depth < nearest_depth) {
-                        nearest_depth = depth;
-                    }
+                if (quality.edges && detect_edge(sample->point, cube)) {
+                    edge_votes++;
+                }
+
+                float depth = vec3_length(vec3_subtract(sample->point, cam->position));
+                if (depth < nearest_depth) {
+                    nearest_depth = depth;
                 }
             }
 
             int idx = y * fb->width + x;
-            if (samples_hit > 0) {
+            if (temporal_active(renderer)) {
+                // Kept for resolve_temporal instead of drawn
+                TemporalSample* current = &renderer->taa_current[idx];
+                current->count = cell_is_masked(renderer, idx) ? 0 : 1;
+                current->coverage = (float)samples_hit / (float)quality.cell_samples;
+                current->depth = nearest_depth;
+                current->intensity = 0.0f;
+                current->edge = 0.0f;
+                Vec3 ray = camera_ray(cam, (float)x + 0.5f, (float)y + 0.5f);
+                float t = vec3_dot(vec3_subtract(cube->position, cam->position), ray);
+                if (samples_hit > 0) {
+                    current->intensity = accumulated_intensity / (float)samples_hit * depth_fog(nearest_depth);
+                    current->edge = (float)edge_votes / (float)samples_hit;
+                    t = nearest_depth;
+                }
+                Vec3 point = vec3_add(cam->position, vec3_multiply(ray, t));
+                current->local = mat3_multiply_vec3(cube->inv_rotation, vec3_subtract(point, cube->position));
+            } else if (samples_hit > 0) {
                 float final_intensity = accumulated_intensity / (float)samples_hit;
-                // Depth-based falloff: farther points get dimmer
-                float depth_near = 3.5f;
-                float depth_far = 9.5f;
-                float depth_n = (nearest_depth - depth_near) / (depth_far - depth_near);
-                if (depth_n < 0.0f) depth_n = 0.0f;
-                if (depth_n > 1.0f) depth_n = 1.0f;
-                float fog = 1.0f - 0.35f * depth_n;
-                final_intensity *= fog;
+                final_intensity *= depth_fog(nearest_depth);
 
                 bool is_edge = edge_votes >= (samples_hit + 1) / 2;
-                fb->chars[idx] = intensity_to_char(final_intensity, is_edge);
+                fb->chars[idx] = intensity_to_char(renderer_glyphs(renderer), final_intensity, is_edge);
+                fb->depth[idx] = nearest_depth;
+                fb->colors[idx] = COLOR_CUBE;
+            }
+        }
+    }
+}
+
+// Shades history may take at (x, y): within one standard deviation of the
+// mean of this frame's hits in the 3x3 cells around it, and within their range
+static void neighbourhood_range(const Renderer* renderer, CellRect rect, int x, int y, float* lo, float* hi) {
+    *lo = INFINITY;
+    *hi = -INFINITY;
+    float sum = 0.0f;
+    float sum_squares = 0.0f;
+    int hits = 0;
+    for (int ny = y - 1; ny <= y + 1; ny++) {
+        for (int nx = x - 1; nx <= x + 1; nx++) {
+            if (nx < rect.x0 || nx >= rect.x1 || ny < rect.y0 || ny >= rect.y1) {
+                continue;
+            }
+            const TemporalSample* n = &renderer->taa_current[ny * renderer->width + nx];
+            if (n->count > 0 && n->coverage > 0.0f) {
+                *lo = fminf(*lo, n->intensity);
+                *hi = fmaxf(*hi, n->intensity);
+                sum += n->intensity;
+                sum_squares += n->intensity * n->intensity;
+                hits++;
+            }
+        }
+    }
+    if (hits > 0) {
+        float mean = sum / (float)hits;
+        float deviation = sqrtf(fmaxf(0.0f, sum_squares / (float)hits - mean * mean));
+        *lo = fmaxf(*lo, mean - deviation);
+        *hi = fminf(*hi, mean + deviation);
+    }
+}
+
+// History resampled where the cell's point was at the previous trace.
+// Taps are bilinear so a silhouette moving by a fraction of a cell moves
+// its coverage with it; taps that followed another surface are dropped.
+// Returns false when no tap is usable.
+static bool reproject_history(const Renderer* renderer, const TemporalSample* current, const Camera* cam,
+                              TemporalSample* previous) {
+    if (!renderer->taa_valid) {
+        return false;
+    }
+    const CubeState* drawn = &renderer->cube_drawn;
+    Vec3 was = vec3_add(mat3_multiply_vec3(drawn->rotation, current->local), drawn->position);
+    float fx, fy;
+    if (!camera_project(cam, was, &fx, &fy)) {
+        return false;
+    }
+    float u = fx - 0.5f;
+    float v = fy - 0.5f;
+    int x0 = (int)floorf(u);
+    int y0 = (int)floorf(v);
+    float tx = u - (float)x0;
+    float ty = v - (float)y0;
+
+    const TemporalSample* history = renderer->taa_history[renderer->taa_frame & 1];
+    CellRect rect = renderer->taa_rect;
+    float tolerance = TAA_REJECT_CELLS * 2.0f * cam->scale * current->depth / (float)cam->height;
+    float weight_sum = 0.0f;
+    float shade_weight = 0.0f;
+    float best_weight = -1.0f;
+    *previous = (TemporalSample){.count = TAA_HISTORY};
+
+    for (int tap = 0; tap < 4; tap++) {
+        int px = x0 + (tap & 1);
+        int py = y0 + (tap >> 1);
+        float weight = ((tap & 1) ? tx : 1.0f - tx) * ((tap >> 1) ? ty : 1.0f - ty);
+        if (px < 0 || py < 0 || px >= renderer->width || py >= renderer->height) {
+            continue;
+        }
+        if (px < rect.x0 || px >= rect.x1 || py < rect.y0 || py >= rect.y1) {
+            weight_sum += weight;  // Not traced, so the cube was not there
+            continue;
+        }
+        const TemporalSample* h = &history[py * renderer->width + px];
+        if (h->count == 0) {
+            continue;  // Under an overlay
+        }
+        // Disocclusion: the tap followed a surface point far from this one
+        if (current->coverage > 0.0f && h->coverage > 0.0f &&
+            vec3_length(vec3_subtract(h->local, current->local)) > tolerance) {
+            continue;
+        }
+        weight_sum += weight;
+        previous->coverage += weight * h->coverage;
+        if (h->count < previous->count) {
+            previous->count = h->count;
+        }
+        // Shade is a mean over hits, so it is weighted by coverage too
+        float shade = weight * h->coverage;
+        previous->intensity += shade * h->intensity;
+        previous->edge += shade * h->edge;
+        shade_weight += shade;
+        if (shade > best_weight) {
+            best_weight = shade;
+            previous->depth = h->depth;
+            previous->local = h->local;
+        }
+    }
+
+    if (weight_sum <= 0.0f) {
+        return false;
+    }
+    previous->coverage /= weight_sum;
+    if (shade_weight > 0.0f) {
+        previous->intensity /= shade_weight;
+        previous->edge /= shade_weight;
+    }
+    return true;
+}
+
+// Blend this frame's samples into the reprojected history and draw the cells
+// that most of the accumulated samples cover
+static void resolve_temporal(Renderer* renderer, Framebuffer* fb, const Camera* cam, CellRect rect) {
+    TemporalSample* accumulated = renderer->taa_history[(renderer->taa_frame + 1) & 1];
+
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
+            int idx = y * fb->width + x;
+            const TemporalSample* current = &renderer->taa_current[idx];
+            TemporalSample* out = &accumulated[idx];
+            *out = *current;
+            if (current->count == 0) {
+                continue;  // Under an overlay
+            }
+
+            TemporalSample history;
+            const TemporalSample* previous = reproject_history(renderer, current, cam, &history) ? &history : NULL;
+            if (previous) {
+                int count = previous->count + 1 < TAA_HISTORY ? previous->count + 1 : TAA_HISTORY;
+                float alpha = 1.0f / (float)count;
+                out->count = count;
+                out->coverage = previous->coverage + (current->coverage - previous->coverage) * alpha;
+                if (current->coverage <= 0.0f) {
+                    out->intensity = previous->intensity;
+                    out->edge = previous->edge;
+                    out->depth = previous->depth;
+                    out->local = previous->local;
+                } else if (previous->coverage > 0.0f) {
+                    // The light stays put while the cube turns, so shading
+                    // drifts; clamping history to this frame's nearby shades
+                    // keeps it from trailing behind
+                    float lo, hi;
+                    neighbourhood_range(renderer, rect, x, y, &lo, &hi);
+                    float past = fminf(fmaxf(previous->intensity, lo), hi);
+                    out->intensity = past + (current->intensity - past) * alpha;
+                    out->edge = previous->edge + (current->edge - previous->edge) * alpha;
+                }
+            }
+
+            // Partly covered cells fade toward the background like a
+            // supersampled silhouette would
+            if (out->coverage >= 0.5f) {
+                fb->chars[idx] = intensity_to_char(renderer_glyphs(renderer), out->intensity * out->coverage, out->edge >= 0.5f);
+                fb->depth[idx] = out->depth;
+                fb->colors[idx] = COLOR_CUBE;
+            }
+        }
+    }
+
+    renderer->taa_rect = rect;
+    renderer->taa_valid = true;
+    renderer->taa_frame++;
+}
+
+// Each lit subsample sets one bit of the cell's coverage mask and the glyph
+// is looked up straight from the mask. Shading survives as dot density
+// through an ordered dither. Shape mode sets a bit for every hit instead
+// and leaves shading to the cells its mask covers fully.
+static KERNEL_INLINE void shade_tile_subcells(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube,
+                                              LightTile* tile, const ShadingContext* ctx, const Camera* cam,
+                                              ShadingQuality quality) {
+    RenderMode mode = renderer->settings.mode;
+    int cols, rows;
+    subcell_grid(mode, &cols, &rows);
+    CellRect rect = tile->rect;
+
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
+            uint16_t mask = 0;
+            int hits = 0;
+            int shaded = 0;
+            float intensity_sum = 0.0f;
+            float nearest_depth = 1000.0f;
+            const TileSample* first_hit = NULL;
+            CellCost* cost = &renderer->costs[y * fb->width + x];
+
+            for (int row = 0; row < rows; row++) {
+                for (int col = 0; col < cols; col++) {
+                    const TileSample* sample = tile_sample(tile, x, y, row * cols + col);
+                    if (!sample->hit) {
+                        continue;
+                    }
+                    float depth = vec3_length(vec3_subtract(sample->point, cam->position));
+                    nearest_depth = fminf(nearest_depth, depth);
+                    hits++;
+                    if (mode == RENDER_MODE_SHAPE) {
+                        // Coverage alone picks the glyph; four of the
+                        // samples, one per row and column, give the shade
+                        mask |= subcell_bit(mode, col, row);
+                        first_hit = first_hit ? first_hit : sample;
+                        if (col != SHAPE_SHADED_COLUMN[row]) {
+                            continue;
+                        }
+                    }
+                    float intensity = sample_shading(sample->point, sample->normal, cam->position, cube,
+                                                     ctx, quality, cost) *
+                                      depth_fog(depth);
+                    float threshold = DITHER_4X4[(y * rows + row) & 3][(x * cols + col) & 3];
+                    if (mode != RENDER_MODE_SHAPE && intensity > threshold) {
+                        mask |= subcell_bit(mode, col, row);
+                    }
+                    intensity_sum += intensity;
+                    shaded++;
+                }
+            }
+            if (hits > 0 && shaded == 0) {
+                float depth = vec3_length(vec3_subtract(first_hit->point, cam->position));
+                intensity_sum = sample_shading(first_hit->point, first_hit->normal, cam->position, cube,
+                                               ctx, quality, cost) *
+                                depth_fog(depth);
+                shaded = 1;
+            }
+
+            int idx = y * fb->width + x;
+            renderer->coverage[idx] = mask;
+            renderer->intensity[idx] = shaded > 0 ? intensity_sum / (float)shaded : -1.0f;
+            wchar_t glyph = hits > 0 ? subcell_glyph(renderer, mask, renderer->intensity[idx]) : 0;
+            if (glyph != 0) {
+                // Cells no sample touched keep the background
+                fb->chars[idx] = glyph;
                 fb->depth[idx] = nearest_depth;
                 fb->colors[idx] = COLOR_CUBE;
             }
         }
     }
-    // Draw sun to indicate light direction
-    if (fb->width > 8 && fb->height > 4) {
+}
+
+typedef void (*ShadeTileFn)(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube, LightTile* tile,
+                            const ShadingContext* ctx, const Camera* cam);
+
+typedef struct {
+    ShadingQuality quality;
+    ShadeTileFn shade_cells;
+    ShadeTileFn shade_subcells;
+} ShadingKernel;
+
+#define DEFINE_SHADING_KERNEL(QUALITY, name, samples, ao, shadow, edges)                                 \
+    static void shade_cells_##name(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube,          \
+                                   LightTile* tile, const ShadingContext* ctx, const Camera* cam) {       \
+        shade_tile_cells(renderer, fb, cube, tile, ctx, cam, (ShadingQuality){samples, ao, shadow, edges}); \
+    }                                                                                                     \
+    static void shade_subcells_##name(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube,       \
+                                      LightTile* tile, const ShadingContext* ctx, const Camera* cam) {    \
+        shade_tile_subcells(renderer, fb, cube, tile, ctx, cam,                                           \
+                            (ShadingQuality){samples, ao, shadow, edges});                                \
+    }
+SHADING_VARIANTS(DEFINE_SHADING_KERNEL)
+
+#define SHADING_KERNEL_ENTRY(QUALITY, name, samples, ao, shadow, edges) \
+    [RENDER_QUALITY_##QUALITY] = {{samples, ao, shadow, edges}, shade_cells_##name, shade_subcells_##name},
+
+static const ShadingKernel SHADING_KERNELS[RENDER_QUALITY_COUNT] = {
+    SHADING_VARIANTS(SHADING_KERNEL_ENTRY)
+};
+
+// Trace, cull and shade the cube tile by tile. Shading cost follows the
+// lights that survive culling, and shadow rays per sample stay under the
+// budget however many lights there are.
+static void render_cube_tiles(Renderer* renderer, Framebuffer* fb, const SdfInstance* cube, const Scene* scene,
+                              const Camera* cam, RaymarchConfig raymarch_config, CellRect rect) {
+    ShadingContext ctx = {
+        .lights = scene->lights,
+        .ambient = 0.0f,
+        .convex_shortcuts = !renderer->settings.full_shading,
+        .shadow_budget = renderer->settings.shadow_budget
+    };
+    for (int i = 0; i < scene->light_count; i++) {
+        ctx.ambient += scene->lights[i].ambient;
+    }
+
+    // The kernel follows the quality setting from frame to frame
+    const ShadingKernel* kernel = &SHADING_KERNELS[renderer->settings.quality];
+    ShadeTileFn shade = renderer->settings.mode != RENDER_MODE_CELL ? kernel->shade_subcells
+                                                                     : kernel->shade_cells;
+
+    LightTile tile;
+    for (int y = rect.y0; y < rect.y1; y += LIGHT_TILE_HEIGHT) {
+        for (int x = rect.x0; x < rect.x1; x += LIGHT_TILE_WIDTH) {
+            CellRect tile_rect = {x, y, x + LIGHT_TILE_WIDTH, y + LIGHT_TILE_HEIGHT};
+            if (tile_rect.x1 > rect.x1) tile_rect.x1 = rect.x1;
+            if (tile_rect.y1 > rect.y1) tile_rect.y1 = rect.y1;
+
+            trace_tile(renderer, &tile, cam, cube, raymarch_config, tile_rect, kernel->quality.cell_samples);
+            cull_tile_lights(&tile, scene->lights, scene->light_count);
+            ctx.active = tile.lights;
+            ctx.active_count = tile.light_count;
+            shade(renderer, fb, cube, &tile, &ctx, cam);
+        }
+    }
+}
+
+Renderer* renderer_create(RenderSettings settings) {
+    Renderer* renderer = calloc(1, sizeof(Renderer));
+    if (!renderer) return NULL;
+    renderer->settings = settings;
+    if (settings.mode == RENDER_MODE_SHAPE) {
+        renderer->shape_match = build_shape_match();
+        if (!renderer->shape_match) {
+            free(renderer);
+            return NULL;
+        }
+    }
+    return renderer;
+}
+
+void renderer_destroy(Renderer* renderer) {
+    if (renderer) {
+        for (int i = 0; i < LAYER_COUNT; i++) {
+            framebuffer_destroy(renderer->layers[i].cells);
+        }
+        free(renderer->coverage);
+        free(renderer->intensity);
+        free(renderer->shape_match);
+        free(renderer->costs);
+        free(renderer->taa_current);
+        free(renderer->taa_history[0]);
+        free(renderer->taa_history[1]);
+        free(renderer);
+    }
+}
+
+void renderer_invalidate(Renderer* renderer) {
+    renderer->layers_valid = false;
+}
+
+bool renderer_is_settling(const Renderer* renderer) {
+    return temporal_active(renderer) && renderer->taa_still < TAA_HISTORY;
+}
+
+// (Re)allocate layers and scratch buffers when the framebuffer size changes
+static int renderer_prepare(Renderer* renderer, int width, int height) {
+    if (renderer->width == width && renderer->height == height && renderer->coverage) {
+        return 0;
+    }
+    renderer->layers_valid = false;
+    renderer->width = 0;
+    renderer->height = 0;
+
+    size_t cells = (size_t)width * (size_t)height;
+    uint16_t* coverage = realloc(renderer->coverage, cells * sizeof(uint16_t));
+    if (coverage) renderer->coverage = coverage;
+    float* intensity = realloc(renderer->intensity, cells * sizeof(float));
+    if (intensity) renderer->intensity = intensity;
+    CellCost* costs = realloc(renderer->costs, cells * sizeof(CellCost));
+    if (costs) renderer->costs = costs;
+    bool temporal_ok = true;
+    TemporalSample** temporal[] = {&renderer->taa_current, &renderer->taa_history[0], &renderer->taa_history[1]};
+    for (int i = 0; i < 3; i++) {
+        TemporalSample* buffer = realloc(*temporal[i], cells * sizeof(TemporalSample));
+        if (buffer) *temporal[i] = buffer;
+        temporal_ok &= buffer != NULL;
+    }
+    if (!coverage || !intensity || !costs || !temporal_ok) {
+        return -1;
+    }
+    memset(costs, 0, cells * sizeof(CellCost));
+    renderer->taa_valid = false;
+
+    for (int i = 0; i < LAYER_COUNT; i++) {
+        framebuffer_destroy(renderer->layers[i].cells);
+        renderer->layers[i].cells = framebuffer_create(width, height);
+        if (!renderer->layers[i].cells) {
+            return -1;
+        }
+    }
+    renderer->width = width;
+    renderer->height = height;
+    return 0;
+}
+
+static bool rect_is_empty(CellRect r) {
+    return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+
+static bool rect_overlaps(CellRect a, CellRect b) {
+    return !rect_is_empty(a) && !rect_is_empty(b) &&
+           a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+static CellRect rect_union(CellRect a, CellRect b) {
+    if (rect_is_empty(a)) return b;
+    if (rect_is_empty(b)) return a;
+    CellRect r = {
+        a.x0 < b.x0 ? a.x0 : b.x0,
+        a.y0 < b.y0 ? a.y0 : b.y0,
+        a.x1 > b.x1 ? a.x1 : b.x1,
+        a.y1 > b.y1 ? a.y1 : b.y1
+    };
+    return r;
+}
+
+static CellRect rect_clip(CellRect r, int width, int height) {
+    if (r.x0 < 0) r.x0 = 0;
+    if (r.y0 < 0) r.y0 = 0;
+    if (r.x1 > width) r.x1 = width;
+    if (r.y1 > height) r.y1 = height;
+    return r;
+}
+
+static void layer_mark_dirty(Layer* layer, CellRect rect) {
+    if (rect_is_empty(rect)) {
+        return;
+    }
+    if (layer->dirty_count == LAYER_MAX_DIRTY) {
+        CellRect* last = &layer->dirty[LAYER_MAX_DIRTY - 1];
+        *last = rect_union(*last, rect);
+        return;
+    }
+    layer->dirty[layer->dirty_count++] = rect;
+}
+
+// Make every cell in rect transparent
+static void layer_clear_rect(Layer* layer, CellRect rect) {
+    Framebuffer* cells = layer->cells;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        int row = y * cells->width;
+        for (int x = rect.x0; x < rect.x1; x++) {
+            cells->chars[row + x] = 0;
+            cells->depth[row + x] = 1000.0f;
+            cells->colors[row + x] = COLOR_NONE;
+        }
+    }
+}
+
+static void layer_put(Layer* layer, int x, int y, wchar_t ch, unsigned char color) {
+    int idx = y * layer->cells->width + x;
+    layer->cells->chars[idx] = ch;
+    layer->cells->depth[idx] = 1000.0f;
+    layer->cells->colors[idx] = color;
+}
+
+// The sun marks the light direction as seen from the cube
+static void update_sun_layer(Renderer* renderer, const Scene* scene) {
+    Layer* layer = &renderer->layers[LAYER_SUN];
+    int width = layer->cells->width;
+    int height = layer->cells->height;
+
+    CellRect bounds = {0, 0, 0, 0};
+    int cx = 0, cy = 0, radius = 0;
+    if (width > 8 && height > 4) {
         // Direction from cube center to light
-        Vec3 to_light_dir = vec3_normalize(vec3_subtract(light.position, cube->position));
+        Vec3 to_light_dir = vec3_normalize(vec3_subtract(scene->lights[0].position, scene->cube->position));
 
         // Map light direction (x,y) to a point around the cube on screen
         float ux = to_light_dir.x;
         float uy = to_light_dir.y;
 
-        float max_offset_x = (float)fb->width * 0.8f;
-        float max_offset_y = (float)fb->height * 0.8f;
+        float max_offset_x = (float)width * 0.8f;
+        float max_offset_y = (float)height * 0.8f;
 
-        int cx = fb->width / 2 + (int)(ux * max_offset_x);
-        int cy = fb->height / 2 - (int)(uy * max_offset_y);
+        cx = width / 2 + (int)(ux * max_offset_x);
+        cy = height / 2 - (int)(uy * max_offset_y);
 
         // Clamp inside screen
         if (cx < 2) cx = 2;
-        if (cx > fb->width - 3) cx = fb->width - 3;
+        if (cx > width - 3) cx = width - 3;
         if (cy < 1) cy = 1;
-        if (cy > fb->height - 2) cy = fb->height - 2;
+        if (cy > height - 2) cy = height - 2;
 
-        int min_dim = fb->height < fb->width ? fb->height : fb->width;
-        int radius = min_dim / 10;
+        int min_dim = height < width ? height : width;
+        radius = min_dim / 10;
         if (radius < 3) radius = 3;
         if (radius > 8) radius = 8;
 
-        for (int y = cy - radius; y <= cy + radius; y++) {
-            if (y < 0 || y >= fb->height) continue;
-            for (int x = cx - radius; x <= cx + radius; x++) {
-                if (x < 0 || x >= fb->width) continue;
+        bounds = (CellRect){cx - radius, cy - radius, cx + radius + 1, cy + radius + 1};
+    }
 
-                float dx = (float)(x - cx);
-                float dy = (float)(y - cy);
-                float dist = sqrtf(dx * dx + dy * dy);
-                if (dist > (float)radius) {
-                    continue;
-                }
+    // The unclipped square pins down center and radius
+    CellRect old = renderer->sun_bounds;
+    if (renderer->layers_valid && memcmp(&bounds, &old, sizeof(bounds)) == 0) {
+        return;
+    }
+    old = rect_clip(old, width, height);
+    layer_clear_rect(layer, old);
+    layer_mark_dirty(layer, old);
+    renderer->sun_bounds = bounds;
+
+    CellRect rect = rect_clip(bounds, width, height);
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
+            float dx = (float)(x - cx);
+            float dy = (float)(y - cy);
+            float dist = sqrtf(dx * dx + dy * dy);
+            if (dist > (float)radius) {
+                continue;
+            }
 
-                float r = dist / (float)radius;
-                wchar_t ch;
-                if (r < 0.15f) {
-                    ch = L'⬤';  // Bright center
-                } else if (r < 0.35f) {
-                    ch = L'●';  // Inner glow
-                } else if (r < 0.55f) {
-                    ch = L'◉';  // Mid glow
-                } else if (r < 0.75f) {
-                    ch = L'◎';  // Outer glow
-                } else if (r < 0.9f) {
-                    ch = L'○';  // Edge
-                } else {
-                    ch = L'◦';  // Halo
-                }
+            float r = dist / (float)radius;
+            const wchar_t* sun = renderer_glyphs(renderer)->sun;
+            wchar_t ch;
+            if (r < 0.15f) {
+                ch = sun[5];  // Bright center
+            } else if (r < 0.35f) {
+                ch = sun[4];  // Inner glow
+            } else if (r < 0.55f) {
+                ch = sun[3];  // Mid glow
+            } else if (r < 0.75f) {
+                ch = sun[2];  // Outer glow
+            } else if (r < 0.9f) {
+                ch = sun[1];  // Edge
+            } else {
+                ch = sun[0];  // Halo
+            }
+            layer_put(layer, x, y, ch, COLOR_SUN);
+        }
+    }
+    layer_mark_dirty(layer, rect);
+}
+
+static const char* const HEATMAP_NAMES[HEATMAP_COUNT] = {
+    "off", "primary steps", "shadow steps", "AO taps", "SDF calls"
+};
+
+// Heat bands from cool to hot, reusing the scene palette
+static const unsigned char HEAT_COLORS[] = {COLOR_MOUNTAIN, COLOR_CUBE, COLOR_BUILDING, COLOR_FPS};
+#define HEAT_BANDS ((int)sizeof(HEAT_COLORS))
+
+static uint32_t cost_metric(const CellCost* cost, HeatmapMetric metric) {
+    switch (metric) {
+        case HEATMAP_PRIMARY:   return cost->primary_steps;
+        case HEATMAP_SHADOW:    return cost->shadow_steps;
+        case HEATMAP_AO:        return cost->ao_taps;
+        case HEATMAP_SDF_CALLS: return cost->sdf_calls;
+        default:                return 0;
+    }
+}
+
+// Ramp level 1..GLYPH_SHADE_LEVELS - 1; zero work still gets a visible dot
+static int heat_level(uint32_t value, uint32_t max) {
+    if (max == 0) {
+        return 1;
+    }
+    return 1 + (int)(((uint64_t)value * (uint64_t)(GLYPH_SHADE_LEVELS - 2) + max / 2) / max);
+}
+
+// Same range on a log scale reaching the top at limit, for step counts,
+// which are a few per ray on most of the cube and up to the limit at grazing
+// silhouettes
+static int heat_level_log(uint32_t value, uint32_t limit) {
+    if (limit == 0) {
+        return 1;
+    }
+    float t = logf(1.0f + (float)value) / logf(1.0f + (float)limit);
+    return 1 + (int)(fminf(t, 1.0f) * (float)(GLYPH_SHADE_LEVELS - 2) + 0.5f);
+}
+
+static unsigned char heat_color(int level) {
+    return HEAT_COLORS[(level - 1) * HEAT_BANDS / GLYPH_SHADE_LEVELS];
+}
+
+// Replace the traced cells with the selected cost. Primary steps are
+// scaled to the step limit of the cell's rays, so only cells whose rays ran
+// out of steps are the hottest; the other costs have no limit and are
+// scaled to the largest value in the rectangle. Rays that missed are shown
+// too: they did work.
+static void draw_heatmap(Renderer* renderer, Framebuffer* fb, CellRect rect) {
+    HeatmapMetric metric = renderer->settings.heatmap;
+    uint32_t max = 0;
+    if (metric == HEATMAP_PRIMARY) {
+        int samples = samples_per_cell(renderer->settings.mode,
+                                       SHADING_KERNELS[renderer->settings.quality].quality.cell_samples);
+        max = (uint32_t)renderer->settings.max_steps * (uint32_t)samples;
+    } else {
+        for (int y = rect.y0; y < rect.y1; y++) {
+            for (int x = rect.x0; x < rect.x1; x++) {
+                uint32_t value = cost_metric(&renderer->costs[y * fb->width + x], metric);
+                max = value > max ? value : max;
+            }
+        }
+    }
+    renderer->cost_max = max;
 
-                int idx = y * fb->width + x;
-                fb->chars[idx] = ch;
-                fb->depth[idx] = 1000.0f;
-                fb->colors[idx] = COLOR_SUN;
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
+            int idx = y * fb->width + x;
+            const CellCost* cost = &renderer->costs[idx];
+            if (cost->primary_steps == 0) {
+                continue;  // Masked by an overlay; nothing was traced
             }
+            uint32_t value = cost_metric(cost, metric);
+            int level = metric == HEATMAP_PRIMARY ? heat_level_log(value, max) : heat_level(value, max);
+            fb->chars[idx] = renderer_glyphs(renderer)->shade[level];
+            fb->colors[idx] = heat_color(level);
+        }
+    }
+}
+
+static void clear_costs(Renderer* renderer, CellRect rect) {
+    for (int y = rect.y0; y < rect.y1; y++) {
+        memset(&renderer->costs[y * renderer->width + rect.x0], 0,
+               (size_t)(rect.x1 - rect.x0) * sizeof(CellCost));
+    }
+}
+
+// One boxed HUD line: borders plus text padded with spaces
+static void hud_line(Layer* layer, const GlyphSet* glyphs, int x, int y, int box_width, const char* text) {
+    int len = (int)strlen(text);
+    layer_put(layer, x, y, glyphs->hud[0], COLOR_FPS);
+    for (int i = 0; i < box_width - 2; i++) {
+        layer_put(layer, x + 1 + i, y, i < len ? (wchar_t)text[i] : L' ', COLOR_FPS);
+    }
+    layer_put(layer, x + box_width - 1, y, glyphs->hud[0], COLOR_FPS);
+}
+
+// Heatmap legend: the glyph ramp in its heat colors, cool to hot
+static void hud_ramp(Layer* layer, const GlyphSet* glyphs, int x, int y, int box_width) {
+    layer_put(layer, x, y, glyphs->hud[0], COLOR_FPS);
+    for (int i = 0; i < box_width - 2; i++) {
+        int level = i;
+        if (level >= 1 && level < GLYPH_SHADE_LEVELS) {
+            layer_put(layer, x + 1 + i, y, glyphs->shade[level], heat_color(level));
+        } else {
+            layer_put(layer, x + 1 + i, y, L' ', COLOR_FPS);
         }
     }
+    layer_put(layer, x + box_width - 1, y, glyphs->hud[0], COLOR_FPS);
+}
+
+static void hud_border(Layer* layer, const GlyphSet* glyphs, int x, int y, int box_width, wchar_t left,
+                       wchar_t right) {
+    layer_put(layer, x, y, left, COLOR_FPS);
+    for (int i = 1; i < box_width - 1; i++) {
+        layer_put(layer, x + i, y, glyphs->hud[1], COLOR_FPS);
+    }
+    layer_put(layer, x + box_width - 1, y, right, COLOR_FPS);
+}
+
+// FPS counter with box frame, volume and input latency; laid out again only when the text changes
+static void update_hud_layer(Renderer* renderer, FrameStats stats) {
+    Layer* layer = &renderer->layers[LAYER_HUD];
+    int width = layer->cells->width;
+    int height = layer->cells->height;
 
-    // FPS counter with box frame and volume
     char fps_str[32];
     snprintf(fps_str, sizeof(fps_str), "%.1f", stats.fps);
-    int fps_len = strlen(fps_str);
 
+    char vol_str[16];
+    int vol_percent = (int)(stats.volume * 100.0f + 0.5f);
+    if (vol_percent < 0) vol_percent = 0;
+    if (vol_percent > 100) vol_percent = 100;
+    snprintf(vol_str, sizeof(vol_str), "VOL:%3d%%", vol_percent);
+
+    // The scale is from the previous trace; the HUD is laid out before it
+    char legend[32] = "";
+    HeatmapMetric metric = renderer->settings.heatmap;
+    if (metric != HEATMAP_OFF) {
+        snprintf(legend, sizeof(legend), " %s 0-%u", HEATMAP_NAMES[metric], (unsigned)renderer->cost_max);
+    }
+
+    char latency[32] = "";
+    if (stats.latency_events > 0) {
+        snprintf(latency, sizeof(latency), " IN p50/p99: %.1f/%.1f ms",
+                 stats.latency_p50_ms, stats.latency_p99_ms);
+    }
+
+    if (renderer->layers_valid && strcmp(fps_str, renderer->hud_fps) == 0 &&
+        strcmp(vol_str, renderer->hud_volume) == 0 && strcmp(legend, renderer->hud_legend) == 0 &&
+        strcmp(latency, renderer->hud_latency) == 0) {
+        return;
+    }
+    memcpy(renderer->hud_fps, fps_str, sizeof(fps_str));
+    memcpy(renderer->hud_volume, vol_str, sizeof(vol_str));
+    memcpy(renderer->hud_legend, legend, sizeof(legend));
+    memcpy(renderer->hud_latency, latency, sizeof(latency));
+
+    layer_clear_rect(layer, renderer->hud_rect);
+    layer_mark_dirty(layer, renderer->hud_rect);
+    renderer->hud_rect = (CellRect){0, 0, 0, 0};
+
+    int fps_len = (int)strlen(fps_str);
     int box_width = fps_len + 6;  // "FPS: " + value + padding
     if (box_width < 30) {
         box_width = 30;           // Ensure enough room for controls text
     }
-    int fps_x = fb->width - box_width - 1;
-    int fps_y = 0;
-
-    if (fps_x >= 0 && box_width < fb->width && fb->height >= 7) {
-        // Top border
-        fb->chars[fps_y * fb->width + fps_x] = L'╭';
-        fb->colors[fps_y * fb->width + fps_x] = COLOR_FPS;
-        for (int i = 1; i < box_width - 1; i++) {
-            fb->chars[fps_y * fb->width + fps_x + i] = L'─';
-            fb->colors[fps_y * fb->width + fps_x + i] = COLOR_FPS;
-        }
-        fb->chars[fps_y * fb->width + fps_x + box_width - 1] = L'╮';
-        fb->colors[fps_y * fb->width + fps_x + box_width - 1] = COLOR_FPS;
-
-        // FPS content line
-        fps_y = 1;
-        fb->chars[fps_y * fb->width + fps_x] = L'│';
-        fb->colors[fps_y * fb->width + fps_x] = COLOR_FPS;
-        fb->chars[fps_y * fb->width + fps_x + 1] = L' ';
-        fb->colors[fps_y * fb->width + fps_x + 1] = COLOR_FPS;
-
-        // "FPS: XX.X"
-        const char* fps_label = "FPS:";
-        for (int i = 0; fps_label[i]; i++) {
-            fb->chars[fps_y * fb->width + fps_x + 2 + i] = fps_label[i];
-            fb->colors[fps_y * fb->width + fps_x + 2 + i] = COLOR_FPS;
-        }
-        for (int i = 0; fps_str[i]; i++) {
-            fb->chars[fps_y * fb->width + fps_x + 6 + i] = fps_str[i];
-            fb->colors[fps_y * fb->width + fps_x + 6 + i] = COLOR_FPS;
-        }
-        fb->chars[fps_y * fb->width + fps_x + box_width - 1] = L'│';
-        fb->colors[fps_y * fb->width + fps_x + box_width - 1] = COLOR_FPS;
-
-        // Volume content line directly under FPS
-        int vol_y = 2;
-        fb->chars[vol_y * fb->width + fps_x] = L'│';
-        fb->colors[vol_y * fb->width + fps_x] = COLOR_FPS;
-
-        char vol_str[16];
-        int vol_percent = (int)(audio_get_volume() * 100.0f + 0.5f);
-        if (vol_percent < 0) vol_percent = 0;
-        if (vol_percent > 100) vol_percent = 100;
-        snprintf(vol_str, sizeof(vol_str), "VOL:%3d%%", vol_percent);
-
-        for (int i = 0; i < box_width - 2; i++) {
-            wchar_t ch = L' ';
-            if (i < (int)strlen(vol_str)) {
-                ch = (wchar_t)vol_str[i];
-            }
-            fb->chars[vol_y * fb->width + fps_x + 1 + i] = ch;
-            fb->colors[vol_y * fb->width + fps_x + 1 + i] = COLOR_FPS;
-        }
-        fb->chars[vol_y * fb->width + fps_x + box_width - 1] = L'│';
-        fb->colors[vol_y * fb->width + fps_x + box_width - 1] = COLOR_FPS;
-
-        // Controls line 1
-        int ctl_y1 = 3;
-        const char* ctl1 = "WASD: rotate   M: orbit";
-        fb->chars[ctl_y1 * fb->width + fps_x] = L'│';
-        fb->colors[ctl_y1 * fb->width + fps_x] = COLOR_FPS;
-        for (int i = 0; i < box_width - 2; i++) {
-            wchar_t ch = L' ';
-            if (i < (int)strlen(ctl1)) {
-                ch = (wchar_t)ctl1[i];
-            }
-            fb->chars[ctl_y1 * fb->width + fps_x + 1 + i] = ch;
-            fb->colors[ctl_y1 * fb->width + fps_x + 1 + i] = COLOR_FPS;
-        }
-        fb->chars[ctl_y1 * fb->width + fps_x + box_width - 1] = L'│';
-        fb->colors[ctl_y1 * fb->width + fps_x + box_width - 1] = COLOR_FPS;
-
-        // Controls line 2
-        int ctl_y2 = 4;
-        const char* ctl2 = "Scroll/+/-: volume   Q: quit";
-        fb->chars[ctl_y2 * fb->width + fps_x] = L'│';
-        fb->colors[ctl_y2 * fb->width + fps_x] = COLOR_FPS;
-        for (int i = 0; i < box_width - 2; i++) {
-            wchar_t ch = L' ';
-            if (i < (int)strlen(ctl2)) {
-                ch = (wchar_t)ctl2[i];
+    int box_x = width - box_width - 1;
+    int box_height = 6 + (latency[0] ? 1 : 0) + (metric != HEATMAP_OFF ? 2 : 0);
+    if (box_x < 0 || box_width >= width || height < box_height + 1) {
+        return;
+    }
+
+    char fps_line[40];
+    snprintf(fps_line, sizeof(fps_line), " FPS:%s", fps_str);
+
+    const GlyphSet* glyphs = renderer_glyphs(renderer);
+    hud_border(layer, glyphs, box_x, 0, box_width, glyphs->hud[2], glyphs->hud[3]);
+    hud_line(layer, glyphs, box_x, 1, box_width, fps_line);
+    hud_line(layer, glyphs, box_x, 2, box_width, vol_str);
+    int row = 3;
+    if (latency[0]) {
+        hud_line(layer, glyphs, box_x, row++, box_width, latency);
+    }
+    hud_line(layer, glyphs, box_x, row++, box_width, "WASD: rotate   M: orbit");
+    hud_line(layer, glyphs, box_x, row++, box_width, "Scroll/+/-: volume   Q: quit");
+    if (metric != HEATMAP_OFF) {
+        hud_line(layer, glyphs, box_x, row++, box_width, legend);
+        hud_ramp(layer, glyphs, box_x, row++, box_width);
+    }
+    hud_border(layer, glyphs, box_x, box_height - 1, box_width, glyphs->hud[4], glyphs->hud[5]);
+
+    renderer->hud_rect = (CellRect){box_x, 0, box_x + box_width, box_height};
+    layer_mark_dirty(layer, renderer->hud_rect);
+}
+
+static const SdfShape* scene_shape(const Scene* scene) {
+    static const SdfShape plain_cube = {.kind = SDF_SHAPE_CUBE};
+    return scene->shape ? scene->shape : &plain_cube;
+}
+
+static bool cube_unchanged(const Renderer* renderer, const Scene* scene) {
+    const CubeState* cube = scene->cube;
+    const CubeState* drawn = &renderer->cube_drawn;
+    return renderer->mode_drawn == renderer->settings.mode &&
+           renderer->heatmap_drawn == renderer->settings.heatmap &&
+           renderer->quality_drawn == renderer->settings.quality &&
+           renderer->shape_drawn == scene_shape(scene) &&
+           renderer->shape_version_drawn == sdf_shape_version(scene_shape(scene)) &&
+           memcmp(&cube->rotation, &drawn->rotation, sizeof(Mat3)) == 0 &&
+           memcmp(&cube->position, &drawn->position, sizeof(Vec3)) == 0 &&
+           cube->size == drawn->size &&
+           scene->light_count == renderer->light_count_drawn &&
+           memcmp(scene->lights, renderer->lights_drawn, (size_t)scene->light_count * sizeof(Light)) == 0;
+}
+
+// Where the ray through continuous cell coordinates meets the ground plane
+static bool ground_point(const Camera* cam, float fx, float fy, Vec3* point) {
+    Vec3 dir = camera_ray(cam, fx, fy);
+    if (dir.y >= 0.0f) {
+        return false;
+    }
+    *point = vec3_add(cam->position, vec3_multiply(dir, (RENDER_GROUND_Y - cam->position.y) / dir.y));
+    return true;
+}
+
+#define GROUND_SHADOW_MIN 0.25f  // Blocked share below which the ground stays lit
+
+// Darken the ground where the cube blocks the key light. The cube is
+// rasterized once into a small map from the light, so each ground cell is
+// one lookup rather than a shadow march. Must run before the cube layer
+// records what it drew.
+static void update_shadow_layer(Renderer* renderer, const Scene* scene, const Camera* cam) {
+    Layer* layer = &renderer->layers[LAYER_SHADOW];
+    if (renderer->layers_valid && cube_unchanged(renderer, scene)) {
+        return;
+    }
+    layer_clear_rect(layer, renderer->shadow_rect);
+    layer_mark_dirty(layer, renderer->shadow_rect);
+    renderer->shadow_rect = (CellRect){0, 0, 0, 0};
+    if (renderer->settings.quality == RENDER_QUALITY_LOW || scene->light_count == 0) {
+        return;
+    }
+
+    const Light* light = &scene->lights[0];
+    CubeState* cube = scene->cube;
+    SdfInstance object = sdf_instance(scene_shape(scene), cube->position, cube->size, cube->rotation);
+    ShadowMap* map = &renderer->shadow_map;
+    shadow_map_build(map, &object, cube_bound_radius(&object), light->position);
+    if (!map->valid || light->position.y <= RENDER_GROUND_Y) {
+        return;
+    }
+
+    // Only ground cells under the map's footprint can be shadowed
+    int horizon = ground_horizon(cam->height);
+    CellRect search = {0, horizon, cam->width, cam->height};
+    Vec3 corners[4];
+    if (shadow_map_footprint(map, RENDER_GROUND_Y, corners)) {
+        float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+        bool projected = true;
+        for (int i = 0; i < 4; i++) {
+            float fx, fy;
+            if (!camera_project(cam, corners[i], &fx, &fy)) {
+                projected = false;  // Footprint reaches behind the camera
+                break;
             }
-            fb->chars[ctl_y2 * fb->width + fps_x + 1 + i] = ch;
-            fb->colors[ctl_y2 * fb->width + fps_x + 1 + i] = COLOR_FPS;
+            min_x = fminf(min_x, fx);
+            min_y = fminf(min_y, fy);
+            max_x = fmaxf(max_x, fx);
+            max_y = fmaxf(max_y, fy);
+        }
+        if (projected) {
+            search = (CellRect){
+                (int)floorf(fmaxf(min_x, 0.0f)),
+                (int)floorf(fmaxf(min_y, (float)horizon)),
+                (int)ceilf(fminf(max_x, (float)cam->width)),
+                (int)ceilf(fminf(max_y, (float)cam->height))
+            };
         }
-        fb->chars[ctl_y2 * fb->width + fps_x + box_width - 1] = L'│';
-        fb->colors[ctl_y2 * fb->width + fps_x + box_width - 1] = COLOR_FPS;
+    }
 
-        // Bottom border
-        fps_y = 5;
-        fb->chars[fps_y * fb->width + fps_x] = L'╰';
-        fb->colors[fps_y * fb->width + fps_x] = COLOR_FPS;
-        for (int i = 1; i < box_width - 1; i++) {
-            fb->chars[fps_y * fb->width + fps_x + i] = L'─';
-            fb->colors[fps_y * fb->width + fps_x + i] = COLOR_FPS;
+    // Each ground row is where the camera's rays meet the ground plane; the
+    // rays of a row sweep a plane, so the points along it are evenly spaced
+    const GlyphSet* glyphs = renderer_glyphs(renderer);
+    CellRect rect = {cam->width, cam->height, 0, 0};
+    for (int y = search.y0; y < search.y1; y++) {
+        Vec3 first, next;
+        if (!ground_point(cam, (float)search.x0 + 0.5f, (float)y + 0.5f, &first) ||
+            !ground_point(cam, (float)search.x0 + 1.5f, (float)y + 0.5f, &next)) {
+            continue;
         }
-        fb->chars[fps_y * fb->width + fps_x + box_width - 1] = L'╯';
-        fb->colors[fps_y * fb->width + fps_x + box_width - 1] = COLOR_FPS;
+        Vec3 step = vec3_subtract(next, first);
+        int level = ground_level(y, horizon, cam->height);
+        for (int x = search.x0; x < search.x1; x++) {
+            Vec3 ground = vec3_add(first, vec3_multiply(step, (float)(x - search.x0)));
+            float shadow = shadow_map_lookup(map, ground);
+            if (shadow < GROUND_SHADOW_MIN) {
+                continue;
+            }
+            shadow *= light_falloff(light, vec3_length(vec3_subtract(light->position, ground)));
+            if (shadow < GROUND_SHADOW_MIN) {
+                continue;
+            }
+            // Penumbra one step down the ground ramp, umbra two
+            int darker = level - (int)(shadow * 2.0f + 0.5f);
+            layer_put(layer, x, y, glyphs->ground[darker > 0 ? darker : 0], COLOR_SHADOW);
+            rect.x0 = x < rect.x0 ? x : rect.x0;
+            rect.y0 = y < rect.y0 ? y : rect.y0;
+            rect.x1 = x + 1 > rect.x1 ? x + 1 : rect.x1;
+            rect.y1 = y + 1;
+        }
+    }
+    if (!rect_is_empty(rect)) {
+        renderer->shadow_rect = rect;
+        layer_mark_dirty(layer, rect);
     }
 }
 
-void framebuffer_display(Framebuffer* fb) {
-    static const char* color_codes[] = {
-        "\033[0m",          // COLOR_NONE - reset
-        "\033[96m",         // COLOR_CUBE - bright cyan
-        "\033[38;5;240m",   // COLOR_GROUND - dark gray
-        "\033[38;5;67m",    // COLOR_MOUNTAIN - blue-gray
-        "\033[93m",         // COLOR_BUILDING - bright yellow
-        "\033[36m",         // COLOR_RAIN - cyan
-        "\033[38;5;226m",   // COLOR_SUN - bright yellow/gold
-        "\033[97m"          // COLOR_FPS - bright white
+// Raymarch the cube into its layer; skipped while the cube and light hold
+// still and no overlay has uncovered part of it
+static void update_cube_layer(Renderer* renderer, const Scene* scene, const Camera* cam,
+                              bool overlays_moved) {
+    // A cube at rest is traced again until its temporal history converges
+    bool unchanged = cube_unchanged(renderer, scene);
+    bool settled = !temporal_active(renderer) || renderer->taa_still >= TAA_HISTORY;
+    if (renderer->layers_valid && !overlays_moved && unchanged && settled) {
+        return;
+    }
+    renderer->taa_still = unchanged ? renderer->taa_still + 1 : 0;
+    Layer* layer = &renderer->layers[LAYER_CUBE];
+    CubeState* cube = scene->cube;
+    SdfInstance object = sdf_instance(scene_shape(scene), cube->position, cube->size, cube->rotation);
+    // History shows something else, or bodies that moved on their own
+    if (object.shape != renderer->shape_drawn || renderer->settings.mode != renderer->mode_drawn ||
+        sdf_shape_version(object.shape) != renderer->shape_version_drawn) {
+        renderer->taa_valid = false;
+    }
+
+    layer_clear_rect(layer, renderer->cube_rect);
+    layer_mark_dirty(layer, renderer->cube_rect);
+
+    // Hits may stop once the surface is within a fraction of the angular
+    // size of one sample, which is all the detail a sample can show
+    int cols = 1, rows = 1;
+    if (renderer->settings.mode != RENDER_MODE_CELL) {
+        subcell_grid(renderer->settings.mode, &cols, &rows);
+    }
+    RaymarchConfig raymarch_config = {
+        .max_steps = renderer->settings.max_steps,
+        .epsilon = 0.001f,
+        .max_distance = 100.0f,
+        .relaxation = RAYMARCH_RELAXATION,
+        .footprint = RAYMARCH_FOOTPRINT * cam->scale / (float)(cam->height * rows)
     };
 
-    // Move to home position
-    printf("\033[H");
+    CellRect rect = cube_screen_rect(cam, &object);
+    clear_costs(renderer, renderer->cube_rect);
+    clear_costs(renderer, rect);
+    render_cube_tiles(renderer, layer->cells, &object, scene, cam, raymarch_config, rect);
+    if (temporal_active(renderer)) {
+        resolve_temporal(renderer, layer->cells, cam, rect);
+    }
+    if (renderer->settings.heatmap != HEATMAP_OFF) {
+        draw_heatmap(renderer, layer->cells, rect);
+    }
+    layer_mark_dirty(layer, rect);
+
+    renderer->cube_rect = rect;
+    renderer->cube_drawn = *cube;
+    renderer->shape_drawn = object.shape;
+    renderer->shape_version_drawn = sdf_shape_version(object.shape);
+    memcpy(renderer->lights_drawn, scene->lights, (size_t)scene->light_count * sizeof(Light));
+    renderer->light_count_drawn = scene->light_count;
+    renderer->mode_drawn = renderer->settings.mode;
+    renderer->heatmap_drawn = renderer->settings.heatmap;
+    renderer->quality_drawn = renderer->settings.quality;
+}
+
+static void update_rain_layer(Renderer* renderer, const Scene* scene, const Camera* cam) {
+    Layer* layer = &renderer->layers[LAYER_RAIN];
+    bool enabled = renderer->settings.rain && scene->rain;
+    if (!enabled && rect_is_empty(renderer->rain_rect)) {
+        return;
+    }
+    layer_clear_rect(layer, renderer->rain_rect);
+    layer_mark_dirty(layer, renderer->rain_rect);
+    renderer->rain_rect = (CellRect){0, 0, 0, 0};
+    if (!enabled) {
+        return;
+    }
+
+    // Seed the layer with the cube's depth so drops behind it fail the test
+    const Framebuffer* cube = renderer->layers[LAYER_CUBE].cells;
+    CellRect occluder = renderer->cube_rect;
+    for (int y = occluder.y0; y < occluder.y1; y++) {
+        int row = y * cube->width;
+        memcpy(&layer->cells->depth[row + occluder.x0], &cube->depth[row + occluder.x0],
+               (size_t)(occluder.x1 - occluder.x0) * sizeof(float));
+    }
+
+    renderer->rain_rect = rain_render(scene->rain, layer->cells, cam, renderer_glyphs(renderer));
+    layer_mark_dirty(layer, renderer->rain_rect);
+}
 
-    // Output entire framebuffer with colors in one pass
-    unsigned char current_color = 255;  // Invalid initial color
-    for (int y = 0; y < fb->height; y++) {
-        for (int x = 0; x < fb->width; x++) {
+// Top-most opaque cell wins; rain was already depth-tested against the cube
+static void composite_rect(const Renderer* renderer, Framebuffer* fb, CellRect rect) {
+    for (int y = rect.y0; y < rect.y1; y++) {
+        for (int x = rect.x0; x < rect.x1; x++) {
             int idx = y * fb->width + x;
-            unsigned char color = fb->colors[idx];
-            wchar_t c = fb->chars[idx];
+            int layer = LAYER_COUNT - 1;
+            while (layer > LAYER_BACKGROUND && renderer->layers[layer].cells->chars[idx] == 0) {
+                layer--;
+            }
+            const Framebuffer* src = renderer->layers[layer].cells;
+            fb->chars[idx] = src->chars[idx];
+            fb->depth[idx] = src->depth[idx];
+            fb->colors[idx] = src->colors[idx];
+        }
+    }
+}
+
+// Merge the dirty rectangles of every layer and composite each region once
+static void composite_dirty(Renderer* renderer, Framebuffer* fb) {
+    CellRect regions[LAYER_COUNT * LAYER_MAX_DIRTY];
+    int count = 0;
+    for (int i = 0; i < LAYER_COUNT; i++) {
+        Layer* layer = &renderer->layers[i];
+        for (int d = 0; d < layer->dirty_count; d++) {
+            regions[count++] = layer->dirty[d];
+        }
+        layer->dirty_count = 0;
+    }
 
-            // Only change color if needed
-            if (color != current_color) {
-                printf("%s", color_codes[color]);
-                current_color = color;
+    // Fold overlapping regions together so no cell is composited twice
+    for (int i = 0; i < count; i++) {
+        for (int j = i + 1; j < count; j++) {
+            if (rect_overlaps(regions[i], regions[j])) {
+                regions[i] = rect_union(regions[i], regions[j]);
+                regions[j] = regions[--count];
+                j = i;  // Recheck the rest against the grown region
             }
-            printf("%lc", c);
         }
-        if (y < fb->height - 1) {
-            printf("\n");
+    }
+
+    for (int i = 0; i < count; i++) {
+        composite_rect(renderer, fb, regions[i]);
+    }
+}
+
+void render_cube(Renderer* renderer, Framebuffer* fb, const Scene* scene, FrameStats stats) {
+    renderer->rays_traced = 0;
+    renderer->march_steps = 0;
+    renderer->max_march_steps = 0;
+    if (fb->width <= 0 || fb->height <= 0) {
+        return;
+    }
+    trace_begin("render_cube");
+    if (renderer_prepare(renderer, fb->width, fb->height) != 0) {
+        framebuffer_clear(fb);
+        trace_end("render_cube");
+        return;
+    }
+    if (renderer->target != fb) {
+        renderer->layers_valid = false;
+    }
+
+    CellRect full = {0, 0, fb->width, fb->height};
+    if (!renderer->layers_valid) {
+        // Start from transparent layers and an opaque background
+        for (int i = 0; i < LAYER_COUNT; i++) {
+            layer_clear_rect(&renderer->layers[i], full);
+            renderer->layers[i].dirty_count = 0;
+        }
+        framebuffer_clear(renderer->layers[LAYER_BACKGROUND].cells);
+        render_environment_background(renderer->layers[LAYER_BACKGROUND].cells, renderer_glyphs(renderer), stats);
+        layer_mark_dirty(&renderer->layers[LAYER_BACKGROUND], full);
+        renderer->cube_rect = (CellRect){0, 0, 0, 0};
+        renderer->rain_rect = (CellRect){0, 0, 0, 0};
+        renderer->sun_bounds = (CellRect){0, 0, 0, 0};
+        renderer->hud_rect = (CellRect){0, 0, 0, 0};
+        renderer->shadow_rect = (CellRect){0, 0, 0, 0};
+    }
+
+    Camera cam = camera_create(fb->width, fb->height);
+
+    // The cube is drawn between its last two physics steps
+    CubeState drawn_cube = physics_interpolate(scene->cube);
+    Scene drawn_scene = *scene;
+    drawn_scene.cube = &drawn_cube;
+    scene = &drawn_scene;
+
+    // Overlays first: they decide which cells the cube needs rays for
+    trace_begin("update_hud_layer");
+    update_hud_layer(renderer, stats);
+    trace_end("update_hud_layer");
+    trace_begin("update_sun_layer");
+    update_sun_layer(renderer, scene);
+    trace_end("update_sun_layer");
+
+    bool overlays_moved = false;
+    for (int i = LAYER_SUN; i <= LAYER_HUD; i++) {
+        const Layer* overlay = &renderer->layers[i];
+        for (int d = 0; d < overlay->dirty_count; d++) {
+            overlays_moved |= rect_overlaps(overlay->dirty[d], renderer->cube_rect);
         }
     }
 
-    // Reset color at the end
-    printf("\033[0m");
+    trace_begin("update_shadow_layer");
+    update_shadow_layer(renderer, scene, &cam);
+    trace_end("update_shadow_layer");
+    trace_begin("update_cube_layer");
+    update_cube_layer(renderer, scene, &cam, overlays_moved);
+    trace_end("update_cube_layer");
+    trace_begin("update_rain_layer");
+    update_rain_layer(renderer, scene, &cam);
+    trace_end("update_rain_layer");
+
+    trace_begin("composite_dirty");
+    composite_dirty(renderer, fb);
+    trace_end("composite_dirty");
+    renderer->layers_valid = true;
+    renderer->target = fb;
+    trace_end("render_cube");
+}
+
+int renderer_dump_costs(const Renderer* renderer, const char* path) {
+    if (!renderer->costs) {
+        return -1;
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return -1;
+    }
+    CostDumpHeader header = {
+        .magic = {'C', 'O', 'S', 'T'},
+        .width = (uint32_t)renderer->width,
+        .height = (uint32_t)renderer->height
+    };
+    size_t cells = (size_t)renderer->width * (size_t)renderer->height;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(renderer->costs, sizeof(CellCost), cells, file) == cells;
+    ok = fclose(file) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+void framebuffer_copy(Framebuffer* dst, const Framebuffer* src) {
+    size_t cells = (size_t)src->width * (size_t)src->height;
+    memcpy(dst->chars, src->chars, cells * sizeof(wchar_t));
+    memcpy(dst->depth, src->depth, cells * sizeof(float));
+    memcpy(dst->colors, src->colors, cells * sizeof(unsigned char));
+}
+
+void framebuffer_display(Framebuffer* fb) {
+    ByteBuffer out;
+    byte_buffer_init(&out);
+    if (frame_encode_full(fb, &out) == 0) {
+        fwrite(out.data, 1, out.len, stdout);
+    }
     fflush(stdout);
+    byte_buffer_free(&out);
 }
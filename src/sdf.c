@@ -1,19 +1,20 @@
 #include "sdf.h"
+#include "sdf_grid.h"
+#include "sdf_program.h"
+#include "bodies.h"
 #include <math.h>
 
+// Bounding sphere radius of the [-1, 1] box (sqrt(3) plus margin)
+#define SDF_BOX_BOUND 1.75f
+
+_Static_assert(SDF_EVALUATE_BATCH <= SDF_PROGRAM_BATCH, "batch sizes");
+
 static float fmaxf3(float a, float b, float c) {
     return fmaxf(fmaxf(a, b), c);
 }
 
-float sdf_cube(Vec3 point, Vec3 cube_center, float half_extent, Mat3 rotation) {
-    // Transform point to cube's local space
-    Vec3 local_point = vec3_subtract(point, cube_center);
-
-    // Apply inverse rotation (transpose for orthonormal matrix)
-    Mat3 inv_rot = mat3_transpose(rotation);
-    local_point = mat3_multiply_vec3(inv_rot, local_point);
-
-    // Box SDF
+// Box SDF in the box's local space
+static float sdf_box_local(Vec3 local_point, float half_extent) {
     Vec3 d = {fabsf(local_point.x) - half_extent,
               fabsf(local_point.y) - half_extent,
               fabsf(local_point.z) - half_extent};
@@ -29,3 +30,80 @@ float sdf_cube(Vec3 point, Vec3 cube_center, float half_extent, Mat3 rotation) {
 
     return outside + inside;
 }
+
+float sdf_cube(Vec3 point, Vec3 cube_center, float half_extent, Mat3 rotation) {
+    // Transform point to cube's local space
+    Vec3 local_point = vec3_subtract(point, cube_center);
+
+    // Apply inverse rotation (transpose for orthonormal matrix)
+    Mat3 inv_rot = mat3_transpose(rotation);
+    local_point = mat3_multiply_vec3(inv_rot, local_point);
+
+    return sdf_box_local(local_point, half_extent);
+}
+
+SdfInstance sdf_instance(const SdfShape* shape, Vec3 position, float half_extent, Mat3 rotation) {
+    SdfInstance instance = {
+        .shape = shape,
+        .position = position,
+        .half_extent = half_extent,
+        .rotation = rotation,
+        .inv_rotation = mat3_transpose(rotation)
+    };
+    return instance;
+}
+
+float sdf_shape_bound(const SdfShape* shape) {
+    if (shape->kind == SDF_SHAPE_PROGRAM) {
+        return shape->program->bound;
+    }
+    if (shape->kind == SDF_SHAPE_BODIES) {
+        return shape->bodies->bound / BODIES_UNIT;
+    }
+    // Meshes are fitted into the same box as the cube
+    return SDF_BOX_BOUND;
+}
+
+unsigned long sdf_shape_version(const SdfShape* shape) {
+    return shape->kind == SDF_SHAPE_BODIES ? shape->bodies->version : 0;
+}
+
+static Vec3 to_local(const SdfInstance* instance, Vec3 point) {
+    return mat3_multiply_vec3(instance->inv_rotation, vec3_subtract(point, instance->position));
+}
+
+float sdf_evaluate(const SdfInstance* instance, Vec3 point) {
+    Vec3 local_point = to_local(instance, point);
+    // Model-space shapes are scaled by the half-extent; distances scale with them
+    float scale = instance->half_extent;
+    switch (instance->shape->kind) {
+        case SDF_SHAPE_GRID:
+            return sdf_grid_sample(instance->shape->grid, vec3_multiply(local_point, 1.0f / scale)) * scale;
+        case SDF_SHAPE_PROGRAM:
+            return sdf_program_eval(instance->shape->program, vec3_multiply(local_point, 1.0f / scale)) * scale;
+        case SDF_SHAPE_BODIES:
+            return body_world_distance(instance->shape->bodies, vec3_multiply(local_point, BODIES_UNIT / scale)) *
+                   (scale / BODIES_UNIT);
+        case SDF_SHAPE_CUBE:
+        default:
+            return sdf_box_local(local_point, instance->half_extent);
+    }
+}
+
+void sdf_evaluate_batch(const SdfInstance* instance, const Vec3* points, float* out, int count) {
+    if (instance->shape->kind != SDF_SHAPE_PROGRAM) {
+        for (int i = 0; i < count; i++) {
+            out[i] = sdf_evaluate(instance, points[i]);
+        }
+        return;
+    }
+    float scale = instance->half_extent;
+    Vec3 local[SDF_EVALUATE_BATCH] = {{0, 0, 0}};
+    for (int i = 0; i < count; i++) {
+        local[i] = vec3_multiply(to_local(instance, points[i]), 1.0f / scale);
+    }
+    sdf_program_eval_batch(instance->shape->program, local, out, count);
+    for (int i = 0; i < count; i++) {
+        out[i] *= scale;
+    }
+}
@@ -0,0 +1,453 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sdf_grid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SDF_CACHE_MAGIC   0x47464453u  // "SDFG"
+#define SDF_CACHE_VERSION 1
+
+// Cells of padding around the model box, so outside distances are sampled
+#define SDF_GRID_PADDING 3
+
+// Cells around each triangle that get exact distances before the sweep
+#define SDF_EXACT_BAND 1
+
+// Cache file header; the samples follow it
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t resolution;
+    float bound;
+    uint64_t source_size;   // Size and mtime of the OBJ it was baked from
+    int64_t source_mtime;
+    uint8_t reserved[32];
+} SdfCacheHeader;
+
+_Static_assert(sizeof(SdfCacheHeader) == 64, "cache header layout");
+
+// Closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+static double point_triangle_distance(const double p[3], const float* a, const float* b, const float* c) {
+    double ab[3], ac[3], ap[3], q[3];
+    for (int i = 0; i < 3; i++) {
+        ab[i] = (double)b[i] - a[i];
+        ac[i] = (double)c[i] - a[i];
+        ap[i] = p[i] - a[i];
+    }
+    double d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+    double d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+    double v, w;
+    if (d1 <= 0.0 && d2 <= 0.0) {
+        v = 0.0, w = 0.0;                        // Vertex a
+    } else {
+        double bp[3], cp[3];
+        for (int i = 0; i < 3; i++) {
+            bp[i] = p[i] - b[i];
+            cp[i] = p[i] - c[i];
+        }
+        double d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+        double d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+        double d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+        double d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+        double va = d3 * d6 - d5 * d4;
+        double vb = d5 * d2 - d1 * d6;
+        double vc = d1 * d4 - d3 * d2;
+        if (d3 >= 0.0 && d4 <= d3) {
+            v = 1.0, w = 0.0;                    // Vertex b
+        } else if (d6 >= 0.0 && d5 <= d6) {
+            v = 0.0, w = 1.0;                    // Vertex c
+        } else if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+            v = d1 / (d1 - d3), w = 0.0;         // Edge ab
+        } else if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+            v = 0.0, w = d2 / (d2 - d6);         // Edge ac
+        } else if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+            w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            v = 1.0 - w;                         // Edge bc
+        } else {
+            double denom = 1.0 / (va + vb + vc);
+            v = vb * denom, w = vc * denom;      // Face interior
+        }
+    }
+    double dist_sq = 0.0;
+    for (int i = 0; i < 3; i++) {
+        q[i] = a[i] + v * ab[i] + w * ac[i];
+        dist_sq += (p[i] - q[i]) * (p[i] - q[i]);
+    }
+    return sqrt(dist_sq);
+}
+
+// Sign of the 2D cross product with exact ties broken consistently, so a
+// ray through a shared edge or vertex is counted by exactly one triangle
+static int orientation(double x1, double y1, double x2, double y2, double* twice_area) {
+    *twice_area = y1 * x2 - x1 * y2;
+    if (*twice_area > 0.0) return 1;
+    if (*twice_area < 0.0) return -1;
+    if (y2 > y1) return 1;
+    if (y2 < y1) return -1;
+    if (x1 > x2) return 1;
+    if (x1 < x2) return -1;
+    return 0;
+}
+
+// Is (x0, y0) inside triangle (x1, y1)(x2, y2)(x3, y3)? Gives barycentrics.
+static bool point_in_triangle_2d(double x0, double y0,
+                                 double x1, double y1, double x2, double y2, double x3, double y3,
+                                 double* a, double* b, double* c) {
+    x1 -= x0; x2 -= x0; x3 -= x0;
+    y1 -= y0; y2 -= y0; y3 -= y0;
+    int sign_a = orientation(x2, y2, x3, y3, a);
+    if (sign_a == 0) return false;
+    int sign_b = orientation(x3, y3, x1, y1, b);
+    if (sign_b != sign_a) return false;
+    int sign_c = orientation(x1, y1, x2, y2, c);
+    if (sign_c != sign_a) return false;
+    double sum = *a + *b + *c;
+    *a /= sum;
+    *b /= sum;
+    *c /= sum;
+    return true;
+}
+
+typedef struct {
+    const Mesh* mesh;
+    int n;
+    float bound;
+    float cell;
+    float* phi;      // Unsigned distance while baking
+    int* closest;    // Triangle that gave phi, -1 if none yet
+} Bake;
+
+static size_t bake_index(const Bake* bake, int i, int j, int k) {
+    return ((size_t)k * bake->n + (size_t)j) * bake->n + (size_t)i;
+}
+
+static void node_position(const Bake* bake, int i, int j, int k, double p[3]) {
+    p[0] = -bake->bound + i * bake->cell;
+    p[1] = -bake->bound + j * bake->cell;
+    p[2] = -bake->bound + k * bake->cell;
+}
+
+static const float* mesh_vertex(const Mesh* mesh, int triangle, int corner) {
+    return &mesh->vertices[mesh->triangles[triangle * 3 + corner] * 3];
+}
+
+static void try_triangle(Bake* bake, size_t idx, const double p[3], int triangle) {
+    const Mesh* mesh = bake->mesh;
+    double d = point_triangle_distance(p, mesh_vertex(mesh, triangle, 0),
+                                       mesh_vertex(mesh, triangle, 1), mesh_vertex(mesh, triangle, 2));
+    if (d < bake->phi[idx]) {
+        bake->phi[idx] = (float)d;
+        bake->closest[idx] = triangle;
+    }
+}
+
+// Propagate closest triangles in one octant direction: each node tries
+// the triangles its already-visited neighbours found
+static void sweep(Bake* bake, int di, int dj, int dk) {
+    int n = bake->n;
+    int i0 = di > 0 ? 1 : n - 2, i1 = di > 0 ? n : -1;
+    int j0 = dj > 0 ? 1 : n - 2, j1 = dj > 0 ? n : -1;
+    int k0 = dk > 0 ? 1 : n - 2, k1 = dk > 0 ? n : -1;
+    static const int NEIGHBOURS[7][3] = {
+        {1, 0, 0}, {0, 1, 0}, {1, 1, 0}, {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}
+    };
+
+    for (int k = k0; k != k1; k += dk) {
+        for (int j = j0; j != j1; j += dj) {
+            for (int i = i0; i != i1; i += di) {
+                double p[3];
+                node_position(bake, i, j, k, p);
+                size_t idx = bake_index(bake, i, j, k);
+                for (int nb = 0; nb < 7; nb++) {
+                    size_t from = bake_index(bake, i - NEIGHBOURS[nb][0] * di,
+                                             j - NEIGHBOURS[nb][1] * dj,
+                                             k - NEIGHBOURS[nb][2] * dk);
+                    int triangle = bake->closest[from];
+                    if (triangle >= 0 && triangle != bake->closest[idx]) {
+                        try_triangle(bake, idx, p, triangle);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+SdfGrid* sdf_grid_bake(const Mesh* mesh, int resolution) {
+    int n = clamp_int(resolution, SDF_GRID_MIN_RESOLUTION, SDF_GRID_MAX_RESOLUTION);
+    size_t count = (size_t)n * n * n;
+
+    SdfGrid* grid = calloc(1, sizeof(SdfGrid));
+    float* phi = malloc(count * sizeof(float));
+    int* closest = malloc(count * sizeof(int));
+    int* crossings = calloc(count, sizeof(int));
+    if (!grid || !phi || !closest || !crossings) {
+        free(grid);
+        free(phi);
+        free(closest);
+        free(crossings);
+        return NULL;
+    }
+
+    // Pad the [-1, 1] box so that bound = 1 + PADDING cells
+    float bound = 1.0f / (1.0f - 2.0f * SDF_GRID_PADDING / (float)(n - 1));
+    Bake bake = {mesh, n, bound, 2.0f * bound / (float)(n - 1), phi, closest};
+    float inv_cell = 1.0f / bake.cell;
+    for (size_t i = 0; i < count; i++) {
+        phi[i] = 4.0f * bound;
+        closest[i] = -1;
+    }
+
+    for (int t = 0; t < mesh->triangle_count; t++) {
+        // Triangle in grid coordinates
+        double g[3][3];
+        for (int corner = 0; corner < 3; corner++) {
+            const float* v = mesh_vertex(mesh, t, corner);
+            for (int a = 0; a < 3; a++) {
+                g[corner][a] = ((double)v[a] + bound) * inv_cell;
+            }
+        }
+
+        // Exact distances in a narrow band around the triangle
+        int lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            double mn = fmin(g[0][a], fmin(g[1][a], g[2][a]));
+            double mx = fmax(g[0][a], fmax(g[1][a], g[2][a]));
+            lo[a] = clamp_int((int)floor(mn) - SDF_EXACT_BAND, 0, n - 1);
+            hi[a] = clamp_int((int)ceil(mx) + SDF_EXACT_BAND, 0, n - 1);
+        }
+        for (int k = lo[2]; k <= hi[2]; k++) {
+            for (int j = lo[1]; j <= hi[1]; j++) {
+                for (int i = lo[0]; i <= hi[0]; i++) {
+                    double p[3];
+                    node_position(&bake, i, j, k, p);
+                    try_triangle(&bake, bake_index(&bake, i, j, k), p, t);
+                }
+            }
+        }
+
+        // Count where rays along +x through each (j, k) node cross the mesh
+        int j_lo = clamp_int((int)ceil(fmin(g[0][1], fmin(g[1][1], g[2][1]))), 0, n - 1);
+        int j_hi = clamp_int((int)floor(fmax(g[0][1], fmax(g[1][1], g[2][1]))), 0, n - 1);
+        int k_lo = clamp_int((int)ceil(fmin(g[0][2], fmin(g[1][2], g[2][2]))), 0, n - 1);
+        int k_hi = clamp_int((int)floor(fmax(g[0][2], fmax(g[1][2], g[2][2]))), 0, n - 1);
+        for (int k = k_lo; k <= k_hi; k++) {
+            for (int j = j_lo; j <= j_hi; j++) {
+                double a, b, c;
+                if (!point_in_triangle_2d(j, k, g[0][1], g[0][2], g[1][1], g[1][2], g[2][1], g[2][2],
+                                          &a, &b, &c)) {
+                    continue;
+                }
+                double x = a * g[0][0] + b * g[1][0] + c * g[2][0];
+                int i = (int)ceil(x);
+                if (i < n) {
+                    crossings[bake_index(&bake, i < 0 ? 0 : i, j, k)]++;
+                }
+            }
+        }
+    }
+
+    // Carry closest triangles to the rest of the grid
+    for (int pass = 0; pass < 2; pass++) {
+        sweep(&bake, +1, +1, +1);
+        sweep(&bake, -1, -1, -1);
+        sweep(&bake, +1, +1, -1);
+        sweep(&bake, -1, -1, +1);
+        sweep(&bake, +1, -1, +1);
+        sweep(&bake, -1, +1, -1);
+        sweep(&bake, +1, -1, -1);
+        sweep(&bake, -1, +1, +1);
+    }
+
+    // Odd crossing parity along the ray means inside
+    for (int k = 0; k < n; k++) {
+        for (int j = 0; j < n; j++) {
+            int total = 0;
+            for (int i = 0; i < n; i++) {
+                size_t idx = bake_index(&bake, i, j, k);
+                total += crossings[idx];
+                if (total & 1) {
+                    phi[idx] = -phi[idx];
+                }
+            }
+        }
+    }
+
+    free(closest);
+    free(crossings);
+
+    grid->resolution = n;
+    grid->bound = bound;
+    grid->inv_cell_size = inv_cell;
+    grid->owned = phi;
+    grid->values = phi;
+    return grid;
+}
+
+static char* cache_path_for(const char* obj_path) {
+    size_t len = strlen(obj_path);
+    char* path = malloc(len + 5);
+    if (path) {
+        memcpy(path, obj_path, len);
+        memcpy(path + len, ".sdf", 5);
+    }
+    return path;
+}
+
+static SdfGrid* map_cache(const char* path, int resolution, const struct stat* source) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    size_t count = (size_t)resolution * resolution * resolution;
+    size_t expected = sizeof(SdfCacheHeader) + count * sizeof(float);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != expected) {
+        close(fd);
+        return NULL;
+    }
+    void* mapping = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const SdfCacheHeader* header = mapping;
+    SdfGrid* grid = NULL;
+    if (header->magic == SDF_CACHE_MAGIC && header->version == SDF_CACHE_VERSION &&
+        header->resolution == (uint32_t)resolution &&
+        header->source_size == (uint64_t)source->st_size &&
+        header->source_mtime == (int64_t)source->st_mtime) {
+        grid = calloc(1, sizeof(SdfGrid));
+    }
+    if (!grid) {
+        munmap(mapping, expected);
+        return NULL;
+    }
+    grid->resolution = resolution;
+    grid->bound = header->bound;
+    grid->inv_cell_size = (float)(resolution - 1) / (2.0f * header->bound);
+    grid->values = (const float*)((const char*)mapping + sizeof(SdfCacheHeader));
+    grid->mapping = mapping;
+    grid->mapping_size = expected;
+    return grid;
+}
+
+// Write through a temporary file so readers never map a partial cache
+static void write_cache(const char* path, const SdfGrid* grid, const struct stat* source) {
+    size_t tmp_len = strlen(path) + 5;
+    char* tmp = malloc(tmp_len);
+    if (!tmp) {
+        return;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    SdfCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SDF_CACHE_MAGIC;
+    header.version = SDF_CACHE_VERSION;
+    header.resolution = (uint32_t)grid->resolution;
+    header.bound = grid->bound;
+    header.source_size = (uint64_t)source->st_size;
+    header.source_mtime = (int64_t)source->st_mtime;
+
+    size_t count = (size_t)grid->resolution * grid->resolution * grid->resolution;
+    FILE* file = fopen(tmp, "wb");
+    bool ok = file != NULL;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(grid->values, sizeof(float), count, file) == count;
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+SdfGrid* sdf_grid_load(const char* obj_path, int resolution) {
+    resolution = clamp_int(resolution, SDF_GRID_MIN_RESOLUTION, SDF_GRID_MAX_RESOLUTION);
+    struct stat source;
+    if (stat(obj_path, &source) != 0) {
+        return NULL;
+    }
+
+    char* cache_path = cache_path_for(obj_path);
+    SdfGrid* grid = cache_path ? map_cache(cache_path, resolution, &source) : NULL;
+    if (!grid) {
+        Mesh* mesh = mesh_load_obj(obj_path);
+        if (mesh) {
+            mesh_normalize(mesh);
+            grid = sdf_grid_bake(mesh, resolution);
+            mesh_destroy(mesh);
+        }
+        // The cache is only an optimization; a read-only directory is fine
+        if (grid && cache_path) {
+            write_cache(cache_path, grid, &source);
+        }
+    }
+    free(cache_path);
+    return grid;
+}
+
+void sdf_grid_destroy(SdfGrid* grid) {
+    if (grid) {
+        if (grid->mapping) {
+            munmap(grid->mapping, grid->mapping_size);
+        }
+        free(grid->owned);
+        free(grid);
+    }
+}
+
+float sdf_grid_sample(const SdfGrid* grid, Vec3 p) {
+    float b = grid->bound;
+    Vec3 c = {
+        fminf(fmaxf(p.x, -b), b),
+        fminf(fmaxf(p.y, -b), b),
+        fminf(fmaxf(p.z, -b), b)
+    };
+
+    int n = grid->resolution;
+    float gx = (c.x + b) * grid->inv_cell_size;
+    float gy = (c.y + b) * grid->inv_cell_size;
+    float gz = (c.z + b) * grid->inv_cell_size;
+    int ix = clamp_int((int)gx, 0, n - 2);
+    int iy = clamp_int((int)gy, 0, n - 2);
+    int iz = clamp_int((int)gz, 0, n - 2);
+    float fx = gx - (float)ix;
+    float fy = gy - (float)iy;
+    float fz = gz - (float)iz;
+
+    const float* v = grid->values + ((size_t)iz * n + (size_t)iy) * n + (size_t)ix;
+    size_t row = (size_t)n;
+    size_t slice = (size_t)n * n;
+    float x00 = v[0] + (v[1] - v[0]) * fx;
+    float x10 = v[row] + (v[row + 1] - v[row]) * fx;
+    float x01 = v[slice] + (v[slice + 1] - v[slice]) * fx;
+    float x11 = v[slice + row] + (v[slice + row + 1] - v[slice + row]) * fx;
+    float y0 = x00 + (x10 - x00) * fy;
+    float y1 = x01 + (x11 - x01) * fy;
+    float d = y0 + (y1 - y0) * fz;
+
+    // Outside the grid: the surface lies inside it, so the clamped point is
+    // the nearest box point and the two legs bound the distance from below
+    float ox = p.x - c.x;
+    float oy = p.y - c.y;
+    float oz = p.z - c.z;
+    float outside_sq = ox * ox + oy * oy + oz * oz;
+    if (outside_sq > 0.0f) {
+        return sqrtf(outside_sq + d * d);
+    }
+    return d;
+}
@@ -0,0 +1,570 @@
+#include "sdf_program.h"
+#include "matrix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <math.h>
+
+#define SDF_TOKEN_MAX   64
+#define SDF_MAX_NESTING 64
+#define SDF_PI          3.14159265358979f
+
+// Constants each opcode reads from the pool
+static const int OP_CONSTANTS[] = {
+    [SDF_OP_BOX] = 3,
+    [SDF_OP_SPHERE] = 1,
+    [SDF_OP_TORUS] = 2,
+    [SDF_OP_UNION] = 0,
+    [SDF_OP_INTERSECT] = 0,
+    [SDF_OP_SUBTRACT] = 0,
+    [SDF_OP_SMOOTH_UNION] = 1,
+    [SDF_OP_TRANSFORM] = 12,
+    [SDF_OP_RESTORE] = 1
+};
+
+typedef struct {
+    const char* pos;
+    int line;
+    char token[SDF_TOKEN_MAX];
+    bool have_token;       // token holds the next unconsumed token
+    bool at_end;
+
+    SdfInstruction* code;
+    int length;
+    int code_capacity;
+    float* constants;
+    int constant_count;
+    int constant_capacity;
+
+    int depth;             // Distance stack depth after the code so far
+    int saved_points;      // Open transforms
+    int nesting;
+
+    char* error;
+    size_t error_size;
+    bool failed;
+} Compiler;
+
+static void fail(Compiler* c, const char* format, ...) {
+    if (c->failed) {
+        return;
+    }
+    c->failed = true;
+    if (c->error && c->error_size > 0) {
+        int n = snprintf(c->error, c->error_size, "line %d: ", c->line);
+        if (n >= 0 && (size_t)n < c->error_size) {
+            va_list args;
+            va_start(args, format);
+            vsnprintf(c->error + n, c->error_size - (size_t)n, format, args);
+            va_end(args);
+        }
+    }
+}
+
+// Load the next token if none is buffered; braces are tokens of their own
+static const char* peek(Compiler* c) {
+    if (c->have_token || c->failed) {
+        return c->at_end ? NULL : c->token;
+    }
+    for (;;) {
+        while (isspace((unsigned char)*c->pos)) {
+            if (*c->pos == '\n') c->line++;
+            c->pos++;
+        }
+        if (*c->pos != '#') break;
+        while (*c->pos && *c->pos != '\n') c->pos++;
+    }
+
+    c->have_token = true;
+    c->at_end = *c->pos == '\0';
+    if (c->at_end) {
+        return NULL;
+    }
+    size_t len = 0;
+    if (*c->pos == '{' || *c->pos == '}') {
+        c->token[len++] = *c->pos++;
+    } else {
+        while (*c->pos && !isspace((unsigned char)*c->pos) &&
+               *c->pos != '{' && *c->pos != '}' && *c->pos != '#') {
+            if (len + 1 >= SDF_TOKEN_MAX) {
+                fail(c, "token too long");
+                c->at_end = true;
+                return NULL;
+            }
+            c->token[len++] = *c->pos++;
+        }
+    }
+    c->token[len] = '\0';
+    return c->token;
+}
+
+static const char* next(Compiler* c) {
+    const char* token = peek(c);
+    c->have_token = false;
+    return token;
+}
+
+static bool expect(Compiler* c, const char* what) {
+    const char* token = next(c);
+    if (!token || strcmp(token, what) != 0) {
+        fail(c, "expected '%s' but found '%s'", what, token ? token : "end of file");
+        return false;
+    }
+    return true;
+}
+
+static bool parse_number(Compiler* c, float* out) {
+    const char* token = next(c);
+    char* end = NULL;
+    float value = token ? strtof(token, &end) : 0.0f;
+    if (!token || end == token || *end != '\0' || !isfinite(value)) {
+        fail(c, "expected a number but found '%s'", token ? token : "end of file");
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+static bool parse_positive(Compiler* c, float* out) {
+    if (!parse_number(c, out)) {
+        return false;
+    }
+    if (*out <= 0.0f) {
+        fail(c, "size must be positive");
+        return false;
+    }
+    return true;
+}
+
+static void emit(Compiler* c, SdfOpcode op, const float* values) {
+    if (c->failed) {
+        return;
+    }
+    int count = OP_CONSTANTS[op];
+    if (c->length == c->code_capacity) {
+        int capacity = c->code_capacity ? c->code_capacity * 2 : 32;
+        SdfInstruction* code = realloc(c->code, (size_t)capacity * sizeof(SdfInstruction));
+        if (!code) {
+            fail(c, "out of memory");
+            return;
+        }
+        c->code = code;
+        c->code_capacity = capacity;
+    }
+    if (c->constant_count + count > c->constant_capacity) {
+        int capacity = c->constant_capacity ? c->constant_capacity * 2 : 64;
+        while (capacity < c->constant_count + count) capacity *= 2;
+        float* constants = realloc(c->constants, (size_t)capacity * sizeof(float));
+        if (!constants) {
+            fail(c, "out of memory");
+            return;
+        }
+        c->constants = constants;
+        c->constant_capacity = capacity;
+    }
+
+    c->code[c->length++] = (SdfInstruction){op, c->constant_count};
+    memcpy(c->constants + c->constant_count, values, (size_t)count * sizeof(float));
+    c->constant_count += count;
+
+    switch (op) {
+        case SDF_OP_BOX:
+        case SDF_OP_SPHERE:
+        case SDF_OP_TORUS:
+            if (++c->depth > SDF_PROGRAM_MAX_STACK) fail(c, "scene is nested too deeply");
+            break;
+        case SDF_OP_TRANSFORM:
+            if (++c->saved_points > SDF_PROGRAM_MAX_STACK) fail(c, "too many nested transforms");
+            break;
+        case SDF_OP_RESTORE:
+            c->saved_points--;
+            break;
+        default:
+            c->depth--;
+            break;
+    }
+}
+
+static bool parse_node(Compiler* c, float* bound);
+
+// Shapes up to the closing brace, folded left to right with op
+static bool parse_children(Compiler* c, SdfOpcode op, float k, float* bound) {
+    if (!parse_node(c, bound)) {
+        return false;
+    }
+    const char* token;
+    while ((token = peek(c)) && strcmp(token, "}") != 0) {
+        float child;
+        if (!parse_node(c, &child)) {
+            return false;
+        }
+        emit(c, op, &k);
+        if (op == SDF_OP_UNION || op == SDF_OP_SMOOTH_UNION) {
+            *bound = fmaxf(*bound, child);
+        } else if (op == SDF_OP_INTERSECT) {
+            *bound = fminf(*bound, child);
+        }
+    }
+    // The polynomial smooth minimum dips at most k / 4 below the plain one
+    if (op == SDF_OP_SMOOTH_UNION) {
+        *bound += 0.25f * k;
+    }
+    return !c->failed;
+}
+
+static bool parse_block(Compiler* c, SdfOpcode op, float k, float* bound) {
+    if (!expect(c, "{")) {
+        return false;
+    }
+    if (++c->nesting > SDF_MAX_NESTING) {
+        fail(c, "scene is nested too deeply");
+        return false;
+    }
+    const char* token = peek(c);
+    if (token && strcmp(token, "}") == 0) {
+        fail(c, "empty block");
+        return false;
+    }
+    if (!parse_children(c, op, k, bound) || !expect(c, "}")) {
+        return false;
+    }
+    c->nesting--;
+    return true;
+}
+
+// Transform block: the children see p' = M * p + o and their distance is
+// multiplied by scale on the way out
+static bool parse_transformed(Compiler* c, Mat3 m, Vec3 offset, float scale, float* bound) {
+    float values[12];
+    memcpy(values, m.m, sizeof(m.m));
+    values[9] = offset.x;
+    values[10] = offset.y;
+    values[11] = offset.z;
+    emit(c, SDF_OP_TRANSFORM, values);
+    if (!parse_block(c, SDF_OP_UNION, 0.0f, bound)) {
+        return false;
+    }
+    emit(c, SDF_OP_RESTORE, &scale);
+    return !c->failed;
+}
+
+static bool parse_node(Compiler* c, float* bound) {
+    const char* token = next(c);
+    if (!token) {
+        fail(c, "expected a shape but found end of file");
+        return false;
+    }
+    char keyword[SDF_TOKEN_MAX];
+    memcpy(keyword, token, sizeof(keyword));
+
+    float v[3];
+    if (strcmp(keyword, "box") == 0) {
+        if (!parse_positive(c, &v[0]) || !parse_positive(c, &v[1]) || !parse_positive(c, &v[2])) {
+            return false;
+        }
+        emit(c, SDF_OP_BOX, v);
+        *bound = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    } else if (strcmp(keyword, "sphere") == 0) {
+        if (!parse_positive(c, &v[0])) {
+            return false;
+        }
+        emit(c, SDF_OP_SPHERE, v);
+        *bound = v[0];
+    } else if (strcmp(keyword, "torus") == 0) {
+        if (!parse_positive(c, &v[0]) || !parse_positive(c, &v[1])) {
+            return false;
+        }
+        emit(c, SDF_OP_TORUS, v);
+        *bound = v[0] + v[1];
+    } else if (strcmp(keyword, "union") == 0) {
+        return parse_block(c, SDF_OP_UNION, 0.0f, bound);
+    } else if (strcmp(keyword, "intersect") == 0) {
+        return parse_block(c, SDF_OP_INTERSECT, 0.0f, bound);
+    } else if (strcmp(keyword, "subtract") == 0) {
+        return parse_block(c, SDF_OP_SUBTRACT, 0.0f, bound);
+    } else if (strcmp(keyword, "smooth_union") == 0) {
+        if (!parse_number(c, &v[0])) {
+            return false;
+        }
+        if (v[0] < 0.0f) {
+            fail(c, "smoothing must not be negative");
+            return false;
+        }
+        // A zero radius is a plain union and would divide by zero
+        return parse_block(c, v[0] > 0.0f ? SDF_OP_SMOOTH_UNION : SDF_OP_UNION, v[0], bound);
+    } else if (strcmp(keyword, "translate") == 0) {
+        if (!parse_number(c, &v[0]) || !parse_number(c, &v[1]) || !parse_number(c, &v[2])) {
+            return false;
+        }
+        Vec3 t = {v[0], v[1], v[2]};
+        if (!parse_transformed(c, mat3_identity(), vec3_multiply(t, -1.0f), 1.0f, bound)) {
+            return false;
+        }
+        *bound += vec3_length(t);
+    } else if (strcmp(keyword, "rotate") == 0) {
+        const char* axis_token = next(c);
+        char axis = axis_token && axis_token[1] == '\0' ? axis_token[0] : '\0';
+        if (axis != 'x' && axis != 'y' && axis != 'z') {
+            fail(c, "expected rotation axis x, y or z");
+            return false;
+        }
+        if (!parse_number(c, &v[0])) {
+            return false;
+        }
+        float angle = v[0] * SDF_PI / 180.0f;
+        Mat3 r = axis == 'x' ? mat3_rotate_x(angle) : axis == 'y' ? mat3_rotate_y(angle) : mat3_rotate_z(angle);
+        return parse_transformed(c, mat3_transpose(r), (Vec3){0, 0, 0}, 1.0f, bound);
+    } else if (strcmp(keyword, "scale") == 0) {
+        if (!parse_positive(c, &v[0])) {
+            return false;
+        }
+        Mat3 m = mat3_identity();
+        m.m[0] = m.m[4] = m.m[8] = 1.0f / v[0];
+        if (!parse_transformed(c, m, (Vec3){0, 0, 0}, v[0], bound)) {
+            return false;
+        }
+        *bound *= v[0];
+    } else {
+        fail(c, "unknown shape '%s'", keyword);
+        return false;
+    }
+    return !c->failed;
+}
+
+SdfProgram* sdf_program_compile(const char* source, char* error, size_t error_size) {
+    Compiler c = {
+        .pos = source,
+        .line = 1,
+        .error = error,
+        .error_size = error_size
+    };
+
+    float bound = 0.0f;
+    if (!peek(&c)) {
+        fail(&c, "scene is empty");
+    } else if (parse_children(&c, SDF_OP_UNION, 0.0f, &bound) && peek(&c)) {
+        fail(&c, "unexpected '%s'", c.token);
+    }
+
+    SdfProgram* program = c.failed ? NULL : malloc(sizeof(SdfProgram));
+    if (!program) {
+        if (!c.failed) fail(&c, "out of memory");
+        free(c.code);
+        free(c.constants);
+        return NULL;
+    }
+    program->code = c.code;
+    program->length = c.length;
+    program->constants = c.constants;
+    program->constant_count = c.constant_count;
+    program->bound = bound;
+    return program;
+}
+
+SdfProgram* sdf_program_load(const char* path, char* error, size_t error_size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        snprintf(error, error_size, "cannot open %s", path);
+        return NULL;
+    }
+    char* source = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    bool ok = true;
+    for (;;) {
+        if (length + 4096 + 1 > capacity) {
+            capacity = capacity ? capacity * 2 : 8192;
+            char* grown = realloc(source, capacity);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            source = grown;
+        }
+        size_t n = fread(source + length, 1, 4096, file);
+        length += n;
+        if (n < 4096) {
+            ok = !ferror(file);
+            break;
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        snprintf(error, error_size, "cannot read %s", path);
+        free(source);
+        return NULL;
+    }
+    source[length] = '\0';
+
+    SdfProgram* program = sdf_program_compile(source, error, error_size);
+    free(source);
+    return program;
+}
+
+void sdf_program_destroy(SdfProgram* program) {
+    if (program) {
+        free(program->code);
+        free(program->constants);
+        free(program);
+    }
+}
+
+// Branch-free min/max so the batched lanes vectorize
+static inline float min2(float a, float b) { return a < b ? a : b; }
+static inline float max2(float a, float b) { return a > b ? a : b; }
+
+static inline float box_distance(float x, float y, float z, const float* h) {
+    float qx = fabsf(x) - h[0];
+    float qy = fabsf(y) - h[1];
+    float qz = fabsf(z) - h[2];
+    float ox = max2(qx, 0.0f);
+    float oy = max2(qy, 0.0f);
+    float oz = max2(qz, 0.0f);
+    return sqrtf(ox * ox + oy * oy + oz * oz) + min2(max2(qx, max2(qy, qz)), 0.0f);
+}
+
+static inline float sphere_distance(float x, float y, float z, const float* r) {
+    return sqrtf(x * x + y * y + z * z) - r[0];
+}
+
+static inline float torus_distance(float x, float y, float z, const float* r) {
+    float q = sqrtf(x * x + z * z) - r[0];
+    return sqrtf(q * q + y * y) - r[1];
+}
+
+static inline float smooth_union(float a, float b, float k) {
+    float h = 0.5f + 0.5f * (b - a) / k;
+    h = min2(max2(h, 0.0f), 1.0f);
+    return b + (a - b) * h - k * h * (1.0f - h);
+}
+
+float sdf_program_eval(const SdfProgram* program, Vec3 p) {
+    float stack[SDF_PROGRAM_MAX_STACK];
+    Vec3 saved[SDF_PROGRAM_MAX_STACK];
+    int top = 0;
+    int saved_top = 0;
+
+    const SdfInstruction* end = program->code + program->length;
+    for (const SdfInstruction* in = program->code; in < end; in++) {
+        const float* k = program->constants + in->constant;
+        switch (in->op) {
+            case SDF_OP_BOX:
+                stack[top++] = box_distance(p.x, p.y, p.z, k);
+                break;
+            case SDF_OP_SPHERE:
+                stack[top++] = sphere_distance(p.x, p.y, p.z, k);
+                break;
+            case SDF_OP_TORUS:
+                stack[top++] = torus_distance(p.x, p.y, p.z, k);
+                break;
+            case SDF_OP_UNION:
+                top--;
+                stack[top - 1] = min2(stack[top - 1], stack[top]);
+                break;
+            case SDF_OP_INTERSECT:
+                top--;
+                stack[top - 1] = max2(stack[top - 1], stack[top]);
+                break;
+            case SDF_OP_SUBTRACT:
+                top--;
+                stack[top - 1] = max2(stack[top - 1], -stack[top]);
+                break;
+            case SDF_OP_SMOOTH_UNION:
+                top--;
+                stack[top - 1] = smooth_union(stack[top - 1], stack[top], k[0]);
+                break;
+            case SDF_OP_TRANSFORM:
+                saved[saved_top++] = p;
+                p = (Vec3){
+                    k[0] * p.x + k[1] * p.y + k[2] * p.z + k[9],
+                    k[3] * p.x + k[4] * p.y + k[5] * p.z + k[10],
+                    k[6] * p.x + k[7] * p.y + k[8] * p.z + k[11]
+                };
+                break;
+            case SDF_OP_RESTORE:
+                p = saved[--saved_top];
+                stack[top - 1] *= k[0];
+                break;
+        }
+    }
+    return stack[0];
+}
+
+void sdf_program_eval_batch(const SdfProgram* program, const Vec3* points, float* out, int count) {
+    enum { N = SDF_PROGRAM_BATCH };
+    float stack[SDF_PROGRAM_MAX_STACK][N];
+    float saved[SDF_PROGRAM_MAX_STACK][3][N];
+    float x[N], y[N], z[N];
+    int top = 0;
+    int saved_top = 0;
+
+    // Idle lanes repeat the first point so they stay finite
+    for (int l = 0; l < N; l++) {
+        Vec3 p = points[l < count ? l : 0];
+        x[l] = p.x;
+        y[l] = p.y;
+        z[l] = p.z;
+    }
+
+    const SdfInstruction* end = program->code + program->length;
+    for (const SdfInstruction* in = program->code; in < end; in++) {
+        const float* k = program->constants + in->constant;
+        float* d = stack[top];
+        float* a = top >= 2 ? stack[top - 2] : NULL;
+        float* b = top >= 1 ? stack[top - 1] : NULL;
+        switch (in->op) {
+            case SDF_OP_BOX:
+                for (int l = 0; l < N; l++) d[l] = box_distance(x[l], y[l], z[l], k);
+                top++;
+                break;
+            case SDF_OP_SPHERE:
+                for (int l = 0; l < N; l++) d[l] = sphere_distance(x[l], y[l], z[l], k);
+                top++;
+                break;
+            case SDF_OP_TORUS:
+                for (int l = 0; l < N; l++) d[l] = torus_distance(x[l], y[l], z[l], k);
+                top++;
+                break;
+            case SDF_OP_UNION:
+                for (int l = 0; l < N; l++) a[l] = min2(a[l], b[l]);
+                top--;
+                break;
+            case SDF_OP_INTERSECT:
+                for (int l = 0; l < N; l++) a[l] = max2(a[l], b[l]);
+                top--;
+                break;
+            case SDF_OP_SUBTRACT:
+                for (int l = 0; l < N; l++) a[l] = max2(a[l], -b[l]);
+                top--;
+                break;
+            case SDF_OP_SMOOTH_UNION:
+                for (int l = 0; l < N; l++) a[l] = smooth_union(a[l], b[l], k[0]);
+                top--;
+                break;
+            case SDF_OP_TRANSFORM: {
+                float (*s)[N] = saved[saved_top++];
+                memcpy(s[0], x, sizeof(x));
+                memcpy(s[1], y, sizeof(y));
+                memcpy(s[2], z, sizeof(z));
+                for (int l = 0; l < N; l++) {
+                    x[l] = k[0] * s[0][l] + k[1] * s[1][l] + k[2] * s[2][l] + k[9];
+                    y[l] = k[3] * s[0][l] + k[4] * s[1][l] + k[5] * s[2][l] + k[10];
+                    z[l] = k[6] * s[0][l] + k[7] * s[1][l] + k[8] * s[2][l] + k[11];
+                }
+                break;
+            }
+            case SDF_OP_RESTORE: {
+                float (*s)[N] = saved[--saved_top];
+                memcpy(x, s[0], sizeof(x));
+                memcpy(y, s[1], sizeof(y));
+                memcpy(z, s[2], sizeof(z));
+                for (int l = 0; l < N; l++) b[l] *= k[0];
+                break;
+            }
+        }
+    }
+    memcpy(out, stack[0], (size_t)count * sizeof(float));
+}
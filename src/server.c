@@ -0,0 +1,331 @@
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "encode.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static EncodedFrame* frame_from_buffer(const ByteBuffer* buf, bool keyframe) {
+    EncodedFrame* frame = malloc(sizeof(EncodedFrame) + buf->len);
+    if (!frame) return NULL;
+    frame->refs = 1;
+    frame->keyframe = keyframe;
+    frame->len = buf->len;
+    memcpy(frame->data, buf->data, buf->len);
+    return frame;
+}
+
+static EncodedFrame* encode_frame(const Framebuffer* prev, const Framebuffer* cur, bool keyframe) {
+    ByteBuffer buf;
+    byte_buffer_init(&buf);
+    int rc = keyframe ? frame_encode_full(cur, &buf) : frame_encode_diff(prev, cur, &buf);
+    EncodedFrame* frame = rc == 0 ? frame_from_buffer(&buf, keyframe) : NULL;
+    byte_buffer_free(&buf);
+    return frame;
+}
+
+static void frame_unref(EncodedFrame* frame) {
+    if (frame && --frame->refs == 0) {
+        free(frame);
+    }
+}
+
+static void client_enqueue(ServerClient* client, EncodedFrame* frame) {
+    int slot = (client->head + client->count) % SERVER_CLIENT_QUEUE;
+    client->queue[slot] = frame;
+    client->count++;
+    frame->refs++;
+}
+
+static void client_pop(ServerClient* client) {
+    frame_unref(client->queue[client->head]);
+    client->queue[client->head] = NULL;
+    client->head = (client->head + 1) % SERVER_CLIENT_QUEUE;
+    client->count--;
+    client->offset = 0;
+}
+
+// Drop everything the client has not started sending. A frame that is
+// partially on the wire must finish, or the terminal stream would tear.
+static void client_drop_backlog(ServerClient* client) {
+    int keep = client->offset > 0 ? 1 : 0;
+    while (client->count > keep) {
+        int last = (client->head + client->count - 1) % SERVER_CLIENT_QUEUE;
+        frame_unref(client->queue[last]);
+        client->queue[last] = NULL;
+        client->count--;
+    }
+    client->needs_keyframe = true;
+}
+
+static void client_close(ServerClient* client) {
+    while (client->count > 0) {
+        client_pop(client);
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+    }
+    client->fd = -1;
+}
+
+// Send as much queued data as the socket takes without blocking.
+// Returns -1 if the client went away.
+static int client_flush(ServerClient* client) {
+    while (client->count > 0) {
+        EncodedFrame* frame = client->queue[client->head];
+        ssize_t n = send(client->fd, frame->data + client->offset,
+                         frame->len - client->offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        client->offset += (size_t)n;
+        if (client->offset == frame->len) {
+            client_pop(client);
+        }
+    }
+    return 0;
+}
+
+// Remove closed clients, keeping the array dense.
+static void compact_clients(BroadcastServer* server) {
+    int out = 0;
+    for (int i = 0; i < server->client_count; i++) {
+        if (server->clients[i].fd >= 0) {
+            server->clients[out++] = server->clients[i];
+        }
+    }
+    server->client_count = out;
+}
+
+// Remove a socket left behind by a previous run. Anything that is not a
+// socket, or a socket a live server still answers on, is left alone.
+// Returns 0 once path is free to bind.
+static int claim_socket_path(const struct sockaddr_un* addr) {
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0) {
+        if (errno == ENOENT) return 0;
+        perror(addr->sun_path);
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "Not serving on %s: file exists and is not a socket\n", addr->sun_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("server");
+        return -1;
+    }
+    int rc = connect(fd, (const struct sockaddr*)addr, sizeof(*addr));
+    int err = errno;
+    close(fd);
+    if (rc == 0 || err == EAGAIN) {
+        fprintf(stderr, "Not serving on %s: another server is listening\n", addr->sun_path);
+        return -1;
+    }
+    if (err != ECONNREFUSED) {
+        fprintf(stderr, "Not serving on %s: %s\n", addr->sun_path, strerror(err));
+        return -1;
+    }
+    if (unlink(addr->sun_path) != 0) {
+        perror(addr->sun_path);
+        return -1;
+    }
+    return 0;
+}
+
+BroadcastServer* server_create(const char* path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return NULL;
+    }
+
+    BroadcastServer* server = calloc(1, sizeof(BroadcastServer));
+    if (!server) return NULL;
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        free(server);
+        return NULL;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(server->path, path);
+
+    if (claim_socket_path(&addr) != 0) {
+        close(server->listen_fd);
+        free(server);
+        return NULL;
+    }
+    if (bind(server->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, 16) != 0) {
+        perror("server");
+        close(server->listen_fd);
+        free(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+void server_destroy(BroadcastServer* server) {
+    if (!server) return;
+    for (int i = 0; i < server->client_count; i++) {
+        client_close(&server->clients[i]);
+    }
+    frame_unref(server->last_keyframe);
+    server->last_keyframe = NULL;
+    framebuffer_destroy(server->last);
+    close(server->listen_fd);
+    unlink(server->path);
+    free(server);
+}
+
+void server_publish(BroadcastServer* server, const Framebuffer* fb) {
+    bool want_key = false;
+    bool want_diff = false;
+
+    for (int i = 0; i < server->client_count; i++) {
+        ServerClient* client = &server->clients[i];
+        if (client->count == SERVER_CLIENT_QUEUE) {
+            client_drop_backlog(client);
+        }
+        if (client->needs_keyframe) {
+            want_key = true;
+        } else {
+            want_diff = true;
+        }
+    }
+
+    // Encode at most once per kind, regardless of how many viewers there are
+    EncodedFrame* key = want_key ? encode_frame(NULL, fb, true) : NULL;
+    EncodedFrame* diff = want_diff ? encode_frame(server->last, fb, false) : NULL;
+    if (key) server->keyframes_encoded++;
+
+    for (int i = 0; i < server->client_count; i++) {
+        ServerClient* client = &server->clients[i];
+        EncodedFrame* frame = client->needs_keyframe ? key : diff;
+        if (!frame && !client->needs_keyframe) {
+            // The diff failed to allocate. Later diffs are taken against
+            // this frame, so the client has to resync from a keyframe.
+            client->needs_keyframe = true;
+            frame = key;
+        }
+        if (!frame) {
+            continue;  // Allocation failed; retry on the next frame
+        }
+        client_enqueue(client, frame);
+        client->needs_keyframe = false;
+        if (client_flush(client) != 0) {
+            client_close(client);
+        }
+    }
+    compact_clients(server);
+
+    frame_unref(diff);
+    frame_unref(server->last_keyframe);
+    server->last_keyframe = key;  // Describes the new last frame; NULL if not needed
+
+    if (!server->last || server->last->width != fb->width || server->last->height != fb->height) {
+        framebuffer_destroy(server->last);
+        server->last = framebuffer_create(fb->width, fb->height);
+    }
+    if (server->last) {
+        framebuffer_copy(server->last, fb);
+    }
+    server->frames_published++;
+}
+
+int server_fill_pollfds(BroadcastServer* server, struct pollfd* fds, int max_fds) {
+    int n = 0;
+    if (n < max_fds) {
+        fds[n++] = (struct pollfd){.fd = server->listen_fd, .events = POLLIN};
+    }
+    for (int i = 0; i < server->client_count && n < max_fds; i++) {
+        short events = POLLIN;
+        if (server->clients[i].count > 0) {
+            events |= POLLOUT;
+        }
+        fds[n++] = (struct pollfd){.fd = server->clients[i].fd, .events = events};
+    }
+    return n;
+}
+
+static void accept_clients(BroadcastServer* server) {
+    for (;;) {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        if (server->client_count >= SERVER_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        ServerClient* client = &server->clients[server->client_count++];
+        memset(client, 0, sizeof(*client));
+        client->fd = fd;
+        client->needs_keyframe = true;
+
+        // Bring the viewer up to date with the last frame right away
+        if (server->last) {
+            if (!server->last_keyframe) {
+                server->last_keyframe = encode_frame(NULL, server->last, true);
+                if (server->last_keyframe) server->keyframes_encoded++;
+            }
+            if (server->last_keyframe) {
+                client_enqueue(client, server->last_keyframe);
+                client->needs_keyframe = false;
+                if (client_flush(client) != 0) {
+                    client_close(client);
+                }
+            }
+        }
+    }
+}
+
+bool server_handle_events(BroadcastServer* server, const struct pollfd* fds, int count) {
+    // fds[1..] map to clients in the order server_fill_pollfds produced them
+    for (int i = 1; i < count && i - 1 < server->client_count; i++) {
+        ServerClient* client = &server->clients[i - 1];
+        if (client->fd != fds[i].fd) {
+            continue;
+        }
+        if (fds[i].revents & (POLLERR | POLLHUP)) {
+            client_close(client);
+            continue;
+        }
+        if (fds[i].revents & POLLIN) {
+            // Viewers do not send anything meaningful; only watch for EOF
+            char scratch[256];
+            ssize_t n = recv(client->fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                client_close(client);
+                continue;
+            }
+        }
+        if ((fds[i].revents & POLLOUT) && client_flush(client) != 0) {
+            client_close(client);
+        }
+    }
+    compact_clients(server);
+
+    int before = server->client_count;
+    if (count > 0 && (fds[0].revents & POLLIN)) {
+        accept_clients(server);
+    }
+    return server->client_count > before;
+}
@@ -0,0 +1,225 @@
+#include "shadow_map.h"
+#include <math.h>
+
+#define SHADOW_MAP_STEPS 32
+#define SHADOW_MAP_BLOCK 8      // Texels along the side of the coarsest traced blocks
+#define SHADOW_MAP_LEAF  2      // and of the finest
+#define SHADOW_MAP_FAR   1e30f  // Depth of a texel nothing was hit in
+
+// Unnormalized direction from the light through continuous texel coordinates
+static Vec3 texel_direction(const ShadowMap* map, float fx, float fy) {
+    float texel = 2.0f * map->tan_half / (float)SHADOW_MAP_SIZE;
+    float u = fx * texel - map->tan_half;
+    float v = fy * texel - map->tan_half;
+    return vec3_add(map->forward, vec3_add(vec3_multiply(map->right, u), vec3_multiply(map->up, v)));
+}
+
+// Distance along dir to the first point within a cone of the surface, or
+// SHADOW_MAP_FAR if the ray leaves [t_start, t_end] first
+static float march_cone(const SdfInstance* object, Vec3 origin, Vec3 dir,
+                        float t_start, float t_end, float footprint) {
+    float t = t_start;
+    for (int i = 0; i < SHADOW_MAP_STEPS && t < t_end; i++) {
+        float dist = sdf_evaluate(object, vec3_add(origin, vec3_multiply(dir, t)));
+        if (dist < footprint * t) {
+            return t;
+        }
+        t += dist;
+    }
+    return SHADOW_MAP_FAR;
+}
+
+// Trace the size x size texels from (x, y) into map->depth. Each block is
+// traced first with one cone wide enough to hold every texel's; only those
+// it comes near the object in are split.
+static void trace_block(ShadowMap* map, const SdfInstance* object, int x, int y, int size,
+                        float t_start, float t_end) {
+    float texel = 2.0f * map->tan_half / (float)SHADOW_MAP_SIZE;
+    float half = 0.5f * (float)size;
+    Vec3 dir = vec3_normalize(texel_direction(map, (float)x + half, (float)y + half));
+    float footprint = (0.70711f * (float)(size - 1) + 0.5f) * texel;
+    float hit = march_cone(object, map->light, dir, t_start, t_end, footprint);
+    if (hit == SHADOW_MAP_FAR) {
+        return;  // Already cleared
+    }
+    if (size == SHADOW_MAP_LEAF) {
+        for (int ty = y; ty < y + size; ty++) {
+            for (int tx = x; tx < x + size; tx++) {
+                map->depth[ty * SHADOW_MAP_SIZE + tx] = hit;
+            }
+        }
+        return;
+    }
+    // The wider cone came up empty until hit, so the narrower ones inside it
+    // resume from there, backed off by its radius
+    int child = size / 2;
+    float resume = hit * (1.0f - footprint);
+    for (int i = 0; i < 4; i++) {
+        trace_block(map, object, x + (i & 1) * child, y + (i >> 1) * child, child, resume, t_end);
+    }
+}
+
+static float cross2(const float* o, const float* a, const float* b) {
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+// The plain cube needs no marching: its shadow is the convex hull of its
+// corners as seen from the light, filled a row of texels at a time. Every
+// texel takes the depth of the near side of the bound, which only has to
+// tell points behind the cube from points in front of it.
+static void rasterize_box(ShadowMap* map, const SdfInstance* box, float near) {
+    float h = box->half_extent;
+    float scale = 0.5f * (float)SHADOW_MAP_SIZE / map->tan_half;
+    float points[8][2];
+    for (int corner = 0; corner < 8; corner++) {
+        Vec3 local = {(corner & 1) ? h : -h, (corner & 2) ? h : -h, (corner & 4) ? h : -h};
+        Vec3 v = vec3_subtract(vec3_add(box->position, mat3_multiply_vec3(box->rotation, local)), map->light);
+        float z = vec3_dot(v, map->forward);
+        points[corner][0] = vec3_dot(v, map->right) / z * scale + 0.5f * (float)SHADOW_MAP_SIZE;
+        points[corner][1] = vec3_dot(v, map->up) / z * scale + 0.5f * (float)SHADOW_MAP_SIZE;
+    }
+
+    // Monotone chain: sort by x, then walk the lower and upper hulls
+    for (int i = 1; i < 8; i++) {
+        for (int j = i; j > 0 && (points[j][0] < points[j - 1][0] ||
+                                  (points[j][0] == points[j - 1][0] && points[j][1] < points[j - 1][1])); j--) {
+            float tx = points[j][0], ty = points[j][1];
+            points[j][0] = points[j - 1][0];
+            points[j][1] = points[j - 1][1];
+            points[j - 1][0] = tx;
+            points[j - 1][1] = ty;
+        }
+    }
+    const float* hull[16];
+    int count = 0;
+    for (int i = 0; i < 8; i++) {
+        while (count >= 2 && cross2(hull[count - 2], hull[count - 1], points[i]) <= 0.0f) count--;
+        hull[count++] = points[i];
+    }
+    for (int i = 6, lower = count + 1; i >= 0; i--) {
+        while (count >= lower && cross2(hull[count - 2], hull[count - 1], points[i]) <= 0.0f) count--;
+        hull[count++] = points[i];
+    }
+    count--;  // The last point repeats the first
+
+    // Each row's span between where its center line crosses the hull edges
+    for (int y = 0; y < SHADOW_MAP_SIZE; y++) {
+        float yc = (float)y + 0.5f;
+        float left = (float)SHADOW_MAP_SIZE, right = 0.0f;
+        for (int i = 0; i < count; i++) {
+            const float* a = hull[i];
+            const float* b = hull[(i + 1) % count];
+            if ((a[1] <= yc) == (b[1] <= yc)) continue;
+            float x = a[0] + (yc - a[1]) / (b[1] - a[1]) * (b[0] - a[0]);
+            left = fminf(left, x);
+            right = fmaxf(right, x);
+        }
+        int x0 = (int)fmaxf(ceilf(left - 0.5f), 0.0f);
+        int x1 = (int)fminf(floorf(right - 0.5f) + 1.0f, (float)SHADOW_MAP_SIZE);
+        for (int x = x0; x < x1; x++) {
+            map->depth[y * SHADOW_MAP_SIZE + x] = near;
+        }
+    }
+}
+
+void shadow_map_build(ShadowMap* map, const SdfInstance* object, float bound, Vec3 light) {
+    map->x0 = map->y0 = map->x1 = map->y1 = 0;
+    Vec3 to_center = vec3_subtract(object->position, light);
+    float center_distance = vec3_length(to_center);
+    map->valid = center_distance > bound * 1.01f;
+    if (!map->valid) {
+        return;
+    }
+
+    map->light = light;
+    map->forward = vec3_multiply(to_center, 1.0f / center_distance);
+    Vec3 helper = fabsf(map->forward.y) < 0.9f ? (Vec3){0, 1, 0} : (Vec3){1, 0, 0};
+    map->right = vec3_normalize(vec3_cross(map->forward, helper));
+    map->up = vec3_cross(map->right, map->forward);
+    map->tan_half = bound / sqrtf(center_distance * center_distance - bound * bound);
+
+    for (int i = 0; i < SHADOW_MAP_SIZE * SHADOW_MAP_SIZE; i++) {
+        map->depth[i] = SHADOW_MAP_FAR;
+    }
+    if (object->shape->kind == SDF_SHAPE_CUBE) {
+        rasterize_box(map, object, center_distance - bound);
+    } else {
+        for (int y = 0; y < SHADOW_MAP_SIZE; y += SHADOW_MAP_BLOCK) {
+            for (int x = 0; x < SHADOW_MAP_SIZE; x += SHADOW_MAP_BLOCK) {
+                trace_block(map, object, x, y, SHADOW_MAP_BLOCK,
+                            center_distance - bound, center_distance + bound);
+            }
+        }
+    }
+
+    // Texels the object covers, grown by a texel for the filter in lookups
+    int x0 = SHADOW_MAP_SIZE, y0 = SHADOW_MAP_SIZE, x1 = 0, y1 = 0;
+    for (int y = 0; y < SHADOW_MAP_SIZE; y++) {
+        for (int x = 0; x < SHADOW_MAP_SIZE; x++) {
+            if (map->depth[y * SHADOW_MAP_SIZE + x] < SHADOW_MAP_FAR) {
+                x0 = x < x0 ? x : x0;
+                y0 = y < y0 ? y : y0;
+                x1 = x + 1 > x1 ? x + 1 : x1;
+                y1 = y + 1;
+            }
+        }
+    }
+    if (x0 < x1) {
+        map->x0 = x0 > 0 ? x0 - 1 : 0;
+        map->y0 = y0 > 0 ? y0 - 1 : 0;
+        map->x1 = x1 < SHADOW_MAP_SIZE ? x1 + 1 : SHADOW_MAP_SIZE;
+        map->y1 = y1 < SHADOW_MAP_SIZE ? y1 + 1 : SHADOW_MAP_SIZE;
+    }
+}
+
+bool shadow_map_footprint(const ShadowMap* map, float ground_y, Vec3 corners[4]) {
+    for (int i = 0; i < 4; i++) {
+        float fx = (float)((i & 1) ? map->x1 : map->x0);
+        float fy = (float)((i & 2) ? map->y1 : map->y0);
+        Vec3 dir = texel_direction(map, fx, fy);
+        if (dir.y >= 0.0f) {
+            return false;  // Passes over the horizon
+        }
+        corners[i] = vec3_add(map->light, vec3_multiply(dir, (ground_y - map->light.y) / dir.y));
+    }
+    return true;
+}
+
+float shadow_map_lookup(const ShadowMap* map, Vec3 point) {
+    Vec3 v = vec3_subtract(point, map->light);
+    float z = vec3_dot(v, map->forward);
+    if (!map->valid || z <= 0.0f) {
+        return 0.0f;
+    }
+
+    // Continuous texel coordinates, texel centers at integer + 0.5
+    float scale = 0.5f * (float)SHADOW_MAP_SIZE / (z * map->tan_half);
+    float fx = vec3_dot(v, map->right) * scale + 0.5f * (float)SHADOW_MAP_SIZE - 0.5f;
+    float fy = vec3_dot(v, map->up) * scale + 0.5f * (float)SHADOW_MAP_SIZE - 0.5f;
+    if (fx <= (float)map->x0 - 1.0f || fy <= (float)map->y0 - 1.0f ||
+        fx >= (float)map->x1 || fy >= (float)map->y1) {
+        return 0.0f;
+    }
+
+    // Bilinear filter over whether each texel blocks the point, which
+    // softens the edge across a texel; texels outside the range are empty
+    int x0 = (int)floorf(fx);
+    int y0 = (int)floorf(fy);
+    float wx = fx - (float)x0;
+    float wy = fy - (float)y0;
+    float distance = vec3_length(v);
+    float shadow = 0.0f;
+    for (int dy = 0; dy <= 1; dy++) {
+        int y = y0 + dy;
+        if (y < map->y0 || y >= map->y1) continue;
+        for (int dx = 0; dx <= 1; dx++) {
+            int x = x0 + dx;
+            if (x < map->x0 || x >= map->x1) continue;
+            // Points in front of the object are not shadowed by it
+            if (distance > map->depth[y * SHADOW_MAP_SIZE + x]) {
+                shadow += (dx ? wx : 1.0f - wx) * (dy ? wy : 1.0f - wy);
+            }
+        }
+    }
+    return shadow;
+}
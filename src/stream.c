@@ -0,0 +1,483 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stream.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define Y4M_HEADER_MAX 1024
+
+static void notify(int fd) {
+    uint64_t one = 1;
+    ssize_t r = write(fd, &one, sizeof(one));
+    (void)r;
+}
+
+// Wait until fd has input. Returns false if the stream is being closed.
+static bool wait_input(FrameStream* stream) {
+    struct pollfd fds[2] = {
+        {.fd = stream->fd, .events = POLLIN},
+        {.fd = stream->stop_fd, .events = POLLIN}
+    };
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR) {
+            snprintf(stream->error, sizeof(stream->error), "poll: %s", strerror(errno));
+            return false;
+        }
+    }
+    stream->stopped = fds[1].revents & POLLIN;
+    return !stream->stopped;
+}
+
+// One read from fd into dst. Returns the bytes read, 0 at the end of the
+// input, -1 on an error or when the stream is being closed.
+static ssize_t read_some(FrameStream* stream, void* dst, size_t size) {
+    for (;;) {
+        if (!wait_input(stream)) {
+            return -1;
+        }
+        ssize_t n = read(stream->fd, dst, size);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno != EINTR && errno != EAGAIN) {
+            snprintf(stream->error, sizeof(stream->error), "read: %s", strerror(errno));
+            return -1;
+        }
+    }
+}
+
+// Next input byte, EOF at the end of the input, or -2 on failure
+static int next_byte(FrameStream* stream) {
+    if (stream->buffer_start == stream->buffer_end) {
+        ssize_t n = read_some(stream, stream->buffer, sizeof(stream->buffer));
+        if (n <= 0) {
+            return n == 0 ? EOF : -2;
+        }
+        stream->buffer_start = 0;
+        stream->buffer_end = (size_t)n;
+    }
+    return stream->buffer[stream->buffer_start++];
+}
+
+// Read exactly size bytes. Large reads bypass the buffer. Returns 0 on
+// success, -1 on failure or if the input ends first.
+static int read_exact(FrameStream* stream, unsigned char* dst, size_t size) {
+    size_t buffered = stream->buffer_end - stream->buffer_start;
+    size_t copied = buffered < size ? buffered : size;
+    memcpy(dst, stream->buffer + stream->buffer_start, copied);
+    stream->buffer_start += copied;
+    while (copied < size) {
+        if (size - copied < sizeof(stream->buffer)) {
+            ssize_t n = read_some(stream, stream->buffer, sizeof(stream->buffer));
+            if (n <= 0) {
+                break;
+            }
+            size_t take = (size_t)n < size - copied ? (size_t)n : size - copied;
+            memcpy(dst + copied, stream->buffer, take);
+            copied += take;
+            stream->buffer_start = take;
+            stream->buffer_end = (size_t)n;
+        } else {
+            ssize_t n = read_some(stream, dst + copied, size - copied);
+            if (n <= 0) {
+                break;
+            }
+            copied += (size_t)n;
+        }
+    }
+    if (copied < size) {
+        if (!stream->error[0] && !stream->stopped) {
+            snprintf(stream->error, sizeof(stream->error), "truncated frame %lu", stream->frames_read + 1);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Skip the bytes of a frame that are not kept
+static int skip_bytes(FrameStream* stream, size_t size) {
+    unsigned char scratch[4096];
+    while (size > 0) {
+        size_t chunk = size < sizeof(scratch) ? size : sizeof(scratch);
+        if (read_exact(stream, scratch, chunk) != 0) {
+            return -1;
+        }
+        size -= chunk;
+    }
+    return 0;
+}
+
+// A PNM header number, after whitespace and # comments; -1 if malformed
+static long pnm_number(FrameStream* stream) {
+    int c = next_byte(stream);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#') {
+        if (c == '#') {
+            while (c >= 0 && c != '\n') c = next_byte(stream);
+        }
+        c = next_byte(stream);
+    }
+    if (c < '0' || c > '9') {
+        return -1;
+    }
+    long value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        if (value > 1000000) {
+            return -1;
+        }
+        c = next_byte(stream);
+    }
+    // A single whitespace byte ends the number; it is consumed with it
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r') ? value : -1;
+}
+
+// Read one line of at most size - 1 bytes into line. Returns 0 on success.
+static int read_line(FrameStream* stream, char* line, size_t size) {
+    size_t length = 0;
+    for (;;) {
+        int c = next_byte(stream);
+        if (c < 0 || length + 1 >= size) {
+            return -1;
+        }
+        if (c == '\n') {
+            line[length] = '\0';
+            return 0;
+        }
+        line[length++] = (char)c;
+    }
+}
+
+// The YUV4MPEG2 stream header, after its first byte
+static int parse_y4m_header(FrameStream* stream) {
+    char line[Y4M_HEADER_MAX];
+    if (read_line(stream, line, sizeof(line)) != 0 || strncmp(line, "UV4MPEG2", 8) != 0) {
+        return -1;
+    }
+    const char* chroma = "420";
+    double fps = 0.0;
+    char* save = NULL;
+    for (char* token = strtok_r(line + 8, " ", &save); token; token = strtok_r(NULL, " ", &save)) {
+        if (token[0] == 'W') {
+            stream->y4m_width = atoi(token + 1);
+        } else if (token[0] == 'H') {
+            stream->y4m_height = atoi(token + 1);
+        } else if (token[0] == 'F') {
+            int num = 0, den = 0;
+            if (sscanf(token + 1, "%d:%d", &num, &den) == 2 && num > 0 && den > 0) {
+                fps = (double)num / (double)den;
+            }
+        } else if (token[0] == 'C') {
+            chroma = token + 1;
+        }
+    }
+    size_t w = (size_t)stream->y4m_width, h = (size_t)stream->y4m_height;
+    if (w == 0 || h == 0 || w > 16384 || h > 16384) {
+        return -1;
+    }
+    // Only 8-bit samples; deeper ones are tagged like 420p10
+    const char* depth = strchr(chroma, 'p');
+    if (depth && depth[1] >= '0' && depth[1] <= '9') {
+        snprintf(stream->error, sizeof(stream->error), "unsupported Y4M sample format C%s", chroma);
+        return -1;
+    }
+    size_t half_w = (w + 1) / 2, half_h = (h + 1) / 2;
+    if (strcmp(chroma, "mono") == 0) {
+        stream->y4m_chroma = 0;
+    } else if (strncmp(chroma, "444alpha", 8) == 0) {
+        stream->y4m_chroma = 3 * w * h;
+    } else if (strncmp(chroma, "444", 3) == 0) {
+        stream->y4m_chroma = 2 * w * h;
+    } else if (strncmp(chroma, "422", 3) == 0) {
+        stream->y4m_chroma = 2 * half_w * h;
+    } else if (strncmp(chroma, "411", 3) == 0) {
+        stream->y4m_chroma = 2 * ((w + 3) / 4) * h;
+    } else {
+        stream->y4m_chroma = 2 * half_w * half_h;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->fps = fps;
+    pthread_mutex_unlock(&stream->lock);
+    return 0;
+}
+
+static int reserve(StreamFrame* frame, size_t size) {
+    if (frame->capacity >= size) {
+        return 0;
+    }
+    unsigned char* pixels = realloc(frame->pixels, size);
+    if (!pixels) {
+        return -1;
+    }
+    frame->pixels = pixels;
+    frame->capacity = size;
+    return 0;
+}
+
+// Read the next frame into frame. Returns 1 if one was read, 0 at a clean
+// end of the input, -1 on failure.
+static int read_frame(FrameStream* stream, StreamFrame* frame, int first) {
+    if (stream->y4m) {
+        char line[Y4M_HEADER_MAX];
+        int c = first;
+        if (c == EOF) {
+            return 0;
+        }
+        if (c != 'F' || read_line(stream, line, sizeof(line)) != 0 || strncmp(line, "RAME", 4) != 0) {
+            return -1;
+        }
+        frame->width = stream->y4m_width;
+        frame->height = stream->y4m_height;
+        frame->channels = 1;
+        frame->maxval = 255;
+        size_t size = (size_t)frame->width * (size_t)frame->height;
+        if (reserve(frame, size) != 0) {
+            snprintf(stream->error, sizeof(stream->error), "out of memory");
+            return -1;
+        }
+        return read_exact(stream, frame->pixels, size) == 0 &&
+               skip_bytes(stream, stream->y4m_chroma) == 0 ? 1 : -1;
+    }
+
+    // PNM images may be separated by whitespace
+    int c = first;
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        c = next_byte(stream);
+    }
+    if (c == EOF) {
+        return 0;
+    }
+    int type = c == 'P' ? next_byte(stream) : -1;
+    if (type != '5' && type != '6') {
+        return -1;
+    }
+    long width = pnm_number(stream);
+    long height = pnm_number(stream);
+    long maxval = pnm_number(stream);
+    if (width <= 0 || height <= 0 || width > 16384 || height > 16384 || maxval <= 0) {
+        return -1;
+    }
+    if (maxval > 255) {
+        snprintf(stream->error, sizeof(stream->error), "16-bit PNM is not supported");
+        return -1;
+    }
+    frame->width = (int)width;
+    frame->height = (int)height;
+    frame->channels = type == '6' ? 3 : 1;
+    frame->maxval = (int)maxval;
+    size_t size = (size_t)width * (size_t)height * (size_t)frame->channels;
+    if (reserve(frame, size) != 0) {
+        snprintf(stream->error, sizeof(stream->error), "out of memory");
+        return -1;
+    }
+    return read_exact(stream, frame->pixels, size) == 0 ? 1 : -1;
+}
+
+static void* reader_main(void* arg) {
+    FrameStream* stream = arg;
+    int first = next_byte(stream);
+    if (first == 'Y') {
+        stream->y4m = true;
+        if (parse_y4m_header(stream) != 0) {
+            if (!stream->error[0] && !stream->stopped) {
+                snprintf(stream->error, sizeof(stream->error), "malformed Y4M header");
+            }
+            first = -2;
+        } else {
+            first = next_byte(stream);
+        }
+    }
+
+    while (first != -2) {
+        pthread_mutex_lock(&stream->lock);
+        StreamFrame* frame = &stream->slots[stream->fill];
+        while (frame->full && !stream->stopping) {
+            pthread_cond_wait(&stream->released, &stream->lock);
+        }
+        bool stopping = stream->stopping;
+        pthread_mutex_unlock(&stream->lock);
+        if (stopping) {
+            break;
+        }
+
+        // The slot is the reader's until it is marked full
+        int result = read_frame(stream, frame, first);
+        if (result <= 0) {
+            if (result < 0 && !stream->error[0] && !stream->stopped) {
+                snprintf(stream->error, sizeof(stream->error), "malformed frame %lu", stream->frames_read + 1);
+            }
+            break;
+        }
+        pthread_mutex_lock(&stream->lock);
+        frame->full = true;
+        stream->fill ^= 1;
+        stream->frames_read++;
+        pthread_mutex_unlock(&stream->lock);
+        notify(stream->event_fd);
+        first = next_byte(stream);
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->ended = true;
+    pthread_mutex_unlock(&stream->lock);
+    notify(stream->event_fd);
+    return NULL;
+}
+
+FrameStream* frame_stream_open(int fd) {
+    FrameStream* stream = calloc(1, sizeof(FrameStream));
+    if (!stream) return NULL;
+    stream->fd = fd;
+    stream->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stream->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stream->event_fd < 0 || stream->stop_fd < 0) {
+        if (stream->event_fd >= 0) close(stream->event_fd);
+        if (stream->stop_fd >= 0) close(stream->stop_fd);
+        free(stream);
+        return NULL;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->released, NULL);
+    if (pthread_create(&stream->reader, NULL, reader_main, stream) != 0) {
+        pthread_cond_destroy(&stream->released);
+        pthread_mutex_destroy(&stream->lock);
+        close(stream->event_fd);
+        close(stream->stop_fd);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void frame_stream_close(FrameStream* stream) {
+    if (!stream) return;
+    pthread_mutex_lock(&stream->lock);
+    stream->stopping = true;
+    pthread_cond_broadcast(&stream->released);
+    pthread_mutex_unlock(&stream->lock);
+    notify(stream->stop_fd);
+    pthread_join(stream->reader, NULL);
+
+    pthread_cond_destroy(&stream->released);
+    pthread_mutex_destroy(&stream->lock);
+    close(stream->event_fd);
+    close(stream->stop_fd);
+    free(stream->slots[0].pixels);
+    free(stream->slots[1].pixels);
+    free(stream->sums);
+    free(stream);
+}
+
+bool frame_stream_finished(FrameStream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    bool finished = stream->ended && !stream->slots[stream->take].full;
+    pthread_mutex_unlock(&stream->lock);
+    return finished;
+}
+
+double frame_stream_fps(FrameStream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    double fps = stream->fps;
+    pthread_mutex_unlock(&stream->lock);
+    return fps > 0.0 ? fps : STREAM_DEFAULT_FPS;
+}
+
+// Glyph for each average sample value of frames with this maxval
+static void update_levels(FrameStream* stream, const GlyphSet* glyphs, int maxval) {
+    if (stream->levels_glyphs == glyphs && stream->levels_maxval == maxval) {
+        return;
+    }
+    for (int v = 0; v < 256; v++) {
+        stream->levels[v] = intensity_to_char(glyphs, (float)v / (float)maxval, false);
+    }
+    stream->levels_glyphs = glyphs;
+    stream->levels_maxval = maxval;
+}
+
+// Add one source row into the column sums. Both loops are plain enough for
+// the compiler to vectorize; RGB is weighted to luma in 8.8 fixed point.
+static void accumulate_row(uint32_t* restrict sums, const unsigned char* restrict row, int width, int channels) {
+    if (channels == 1) {
+        for (int x = 0; x < width; x++) {
+            sums[x] += row[x];
+        }
+    } else {
+        for (int x = 0; x < width; x++) {
+            sums[x] += 77u * row[3 * x] + 150u * row[3 * x + 1] + 29u * row[3 * x + 2];
+        }
+    }
+}
+
+int frame_stream_draw(FrameStream* stream, Framebuffer* fb, const GlyphSet* glyphs) {
+    pthread_mutex_lock(&stream->lock);
+    const StreamFrame* frame = &stream->slots[stream->take];
+    bool ready = frame->full;
+    pthread_mutex_unlock(&stream->lock);
+    if (!ready) {
+        return 0;
+    }
+
+    // Fit the picture to the grid, taking cells as twice as tall as wide
+    int w = frame->width, h = frame->height;
+    int cols = fb->width;
+    int rows = (int)((double)cols * h / w * 0.5 + 0.5);
+    if (rows > fb->height) {
+        rows = fb->height;
+        cols = (int)((double)rows * w / h * 2.0 + 0.5);
+    }
+    cols = cols < 1 ? 1 : cols;
+    rows = rows < 1 ? 1 : rows;
+
+    int needed = w + cols + 1;
+    if (stream->sums_capacity < needed) {
+        uint32_t* sums = realloc(stream->sums, (size_t)needed * sizeof(uint32_t));
+        if (!sums) {
+            return -1;
+        }
+        stream->sums = sums;
+        stream->sums_capacity = needed;
+    }
+    uint32_t* sums = stream->sums;
+    uint32_t* edges = sums + w;  // First source column of each cell column
+    for (int cx = 0; cx <= cols; cx++) {
+        edges[cx] = (uint32_t)((int64_t)cx * w / cols);
+    }
+    update_levels(stream, glyphs, frame->maxval);
+    uint64_t scale = frame->channels == 3 ? 256 : 1;
+    size_t stride = (size_t)w * (size_t)frame->channels;
+
+    framebuffer_clear(fb);
+    int ox = (fb->width - cols) / 2;
+    int oy = (fb->height - rows) / 2;
+    for (int cy = 0; cy < rows; cy++) {
+        int y0 = (int)((int64_t)cy * h / rows);
+        int y1 = (int)((int64_t)(cy + 1) * h / rows);
+        y1 = y1 > y0 ? y1 : y0 + 1;
+        memset(sums, 0, (size_t)w * sizeof(uint32_t));
+        for (int y = y0; y < y1; y++) {
+            accumulate_row(sums, frame->pixels + (size_t)y * stride, w, frame->channels);
+        }
+
+        int row = (oy + cy) * fb->width + ox;
+        for (int cx = 0; cx < cols; cx++) {
+            uint32_t x0 = edges[cx];
+            uint32_t x1 = edges[cx + 1] > x0 ? edges[cx + 1] : x0 + 1;
+            uint64_t total = 0;
+            for (uint32_t x = x0; x < x1; x++) {
+                total += sums[x];
+            }
+            uint64_t average = total / ((uint64_t)(x1 - x0) * (uint64_t)(y1 - y0) * scale);
+            fb->chars[row + cx] = stream->levels[average > 255 ? 255 : average];
+        }
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    stream->slots[stream->take].full = false;
+    stream->take ^= 1;
+    pthread_cond_signal(&stream->released);
+    pthread_mutex_unlock(&stream->lock);
+    return 1;
+}
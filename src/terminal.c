@@ -15,6 +15,8 @@ int terminal_init(TerminalState* state) {
     // Enable basic mouse reporting (for scroll wheel volume control)
     // Use xterm button tracking + SGR extended coordinates.
     printf("\033[?1000h\033[?1006h");
+    // Focus reporting so rendering can pause while the terminal is unfocused
+    printf("\033[?1004h");
     fflush(stdout);
 
     return 0;
@@ -23,8 +25,8 @@ int terminal_init(TerminalState* state) {
 void terminal_restore(TerminalState* state) {
     tcsetattr(STDIN_FILENO, TCSAFLUSH, &state->orig_termios);
     terminal_show_cursor();
-    // Disable mouse reporting
-    printf("\033[?1000l\033[?1006l");
+    // Disable mouse and focus reporting
+    printf("\033[?1000l\033[?1006l\033[?1004l");
     fflush(stdout);
     terminal_clear();
 }
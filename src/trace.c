@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+#include "trace.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_CHUNK_EVENTS 4096
+
+typedef struct {
+    const char* name;
+    uint64_t time_ns;
+    char phase;                          // 'B' or 'E'
+} TraceEvent;
+
+// Events are appended by the owning thread and published through count,
+// so a reader sees whole events only
+typedef struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    _Atomic int count;
+    _Atomic(struct TraceChunk*) next;
+} TraceChunk;
+
+typedef struct TraceBuffer {
+    TraceChunk* first;
+    TraceChunk* last;                    // Only touched by the owner
+    _Atomic(const char*) thread_name;
+    int tid;
+    struct TraceBuffer* next;            // Registry link, fixed once published
+} TraceBuffer;
+
+static atomic_bool recording;
+static _Atomic(TraceBuffer*) registry;  // Push-only list of every thread's buffer
+static atomic_int thread_count;
+static uint64_t start_ns;
+static _Thread_local TraceBuffer* local_buffer;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static TraceChunk* chunk_create(void) {
+    TraceChunk* chunk = malloc(sizeof(TraceChunk));
+    if (chunk) {
+        atomic_init(&chunk->count, 0);
+        atomic_init(&chunk->next, NULL);
+    }
+    return chunk;
+}
+
+// The calling thread's buffer, created and pushed onto the registry on first use
+static TraceBuffer* thread_buffer(void) {
+    if (local_buffer) {
+        return local_buffer;
+    }
+    TraceBuffer* buffer = malloc(sizeof(TraceBuffer));
+    TraceChunk* chunk = chunk_create();
+    if (!buffer || !chunk) {
+        free(buffer);
+        free(chunk);
+        return NULL;
+    }
+    buffer->first = chunk;
+    buffer->last = chunk;
+    atomic_init(&buffer->thread_name, NULL);
+    buffer->tid = atomic_fetch_add(&thread_count, 1) + 1;
+    buffer->next = atomic_load_explicit(&registry, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&registry, &buffer->next, buffer,
+                                                  memory_order_release, memory_order_relaxed)) {
+    }
+    local_buffer = buffer;
+    return buffer;
+}
+
+// Events that cannot get a chunk are dropped; the viewer closes dangling spans
+static void record(const char* name, char phase) {
+    if (!atomic_load_explicit(&recording, memory_order_relaxed)) {
+        return;
+    }
+    TraceBuffer* buffer = thread_buffer();
+    if (!buffer) {
+        return;
+    }
+    TraceChunk* chunk = buffer->last;
+    int count = atomic_load_explicit(&chunk->count, memory_order_relaxed);
+    if (count == TRACE_CHUNK_EVENTS) {
+        TraceChunk* fresh = chunk_create();
+        if (!fresh) {
+            return;
+        }
+        atomic_store_explicit(&chunk->next, fresh, memory_order_release);
+        buffer->last = fresh;
+        chunk = fresh;
+        count = 0;
+    }
+    chunk->events[count] = (TraceEvent){.name = name, .time_ns = now_ns(), .phase = phase};
+    atomic_store_explicit(&chunk->count, count + 1, memory_order_release);
+}
+
+void trace_start(void) {
+    start_ns = now_ns();
+    atomic_store(&recording, true);
+}
+
+void trace_begin(const char* name) {
+    record(name, 'B');
+}
+
+void trace_end(const char* name) {
+    record(name, 'E');
+}
+
+void trace_thread_name(const char* name) {
+    if (!atomic_load_explicit(&recording, memory_order_relaxed)) {
+        return;
+    }
+    TraceBuffer* buffer = thread_buffer();
+    if (buffer) {
+        atomic_store_explicit(&buffer->thread_name, name, memory_order_release);
+    }
+}
+
+int trace_write(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    int pid = (int)getpid();
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (TraceBuffer* buffer = atomic_load_explicit(&registry, memory_order_acquire); buffer;
+         buffer = buffer->next) {
+        const char* thread_name = atomic_load_explicit(&buffer->thread_name, memory_order_acquire);
+        if (thread_name) {
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"name\":\"%s\"}}", first ? "" : ",", pid, buffer->tid, thread_name);
+            first = false;
+        }
+        for (TraceChunk* chunk = buffer->first; chunk;
+             chunk = atomic_load_explicit(&chunk->next, memory_order_acquire)) {
+            int count = atomic_load_explicit(&chunk->count, memory_order_acquire);
+            for (int i = 0; i < count; i++) {
+                const TraceEvent* event = &chunk->events[i];
+                double ts = (double)(event->time_ns - start_ns) / 1000.0;
+                fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                        first ? "" : ",", event->name, event->phase, ts, pid, buffer->tid);
+                first = false;
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    return ok ? 0 : -1;
+}
+
+void trace_stop(void) {
+    atomic_store(&recording, false);
+    TraceBuffer* buffer = atomic_exchange(&registry, NULL);
+    while (buffer) {
+        TraceBuffer* next_buffer = buffer->next;
+        TraceChunk* chunk = buffer->first;
+        while (chunk) {
+            TraceChunk* next_chunk = atomic_load(&chunk->next);
+            free(chunk);
+            chunk = next_chunk;
+        }
+        free(buffer);
+        buffer = next_buffer;
+    }
+    local_buffer = NULL;
+}
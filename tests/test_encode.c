@@ -0,0 +1,279 @@
+// Feeds encoder output to a small terminal emulator and checks the screen
+// ends up showing the encoded frame.
+
+#include "encode.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+// SGR parameters of each color code, in COLOR_* order
+static const char* const COLOR_PARAMS[COLOR_COUNT] = {
+    "0", "96", "38;5;240", "38;5;67", "93", "36", "38;5;226", "97", "38;5;236"
+};
+
+// What a terminal shows: one glyph and color per cell
+typedef struct {
+    int width;
+    int height;
+    wchar_t* chars;
+    unsigned char* colors;
+    int row;
+    int col;
+    unsigned char color;
+    int moves;     // Cursor positioning sequences seen
+    bool bad;      // Output a terminal would not take as intended
+} Screen;
+
+static Screen* screen_create(int width, int height) {
+    Screen* screen = calloc(1, sizeof(Screen));
+    screen->width = width;
+    screen->height = height;
+    screen->chars = calloc((size_t)width * height, sizeof(wchar_t));
+    screen->colors = calloc((size_t)width * height, 1);
+    return screen;
+}
+
+static void screen_destroy(Screen* screen) {
+    free(screen->chars);
+    free(screen->colors);
+    free(screen);
+}
+
+static void screen_put(Screen* screen, wchar_t wc) {
+    if (screen->row >= screen->height || screen->col >= screen->width) {
+        screen->bad = true;
+        return;
+    }
+    int idx = screen->row * screen->width + screen->col;
+    screen->chars[idx] = wc;
+    screen->colors[idx] = screen->color;
+    screen->col++;
+}
+
+static size_t screen_escape(Screen* screen, const char* data, size_t len) {
+    // data[0] is ESC; only CSI sequences are expected
+    if (len < 3 || data[1] != '[') {
+        screen->bad = true;
+        return 1;
+    }
+    size_t end = 2;
+    while (end < len && (data[end] < 0x40 || data[end] > 0x7e)) {
+        end++;
+    }
+    if (end == len) {
+        screen->bad = true;
+        return len;
+    }
+    char params[32] = {0};
+    size_t n = end - 2 < sizeof(params) - 1 ? end - 2 : sizeof(params) - 1;
+    memcpy(params, data + 2, n);
+
+    if (data[end] == 'H') {
+        int row = 1;
+        int col = 1;
+        if (n > 0 && sscanf(params, "%d;%d", &row, &col) != 2) {
+            screen->bad = true;
+        }
+        screen->row = row - 1;
+        screen->col = col - 1;
+        screen->moves++;
+    } else if (data[end] == 'm') {
+        bool known = false;
+        for (int c = 0; c < COLOR_COUNT; c++) {
+            if (strcmp(params, COLOR_PARAMS[c]) == 0) {
+                screen->color = (unsigned char)c;
+                known = true;
+            }
+        }
+        screen->bad |= !known;
+    } else {
+        screen->bad = true;
+    }
+    return end + 1;
+}
+
+static void screen_feed(Screen* screen, const ByteBuffer* buf) {
+    const unsigned char* data = (const unsigned char*)buf->data;
+    size_t i = 0;
+    while (i < buf->len) {
+        unsigned char c = data[i];
+        if (c == 0x1b) {
+            i += screen_escape(screen, buf->data + i, buf->len - i);
+        } else if (c == '\n') {
+            screen->row++;
+            screen->col = 0;
+            i++;
+        } else {
+            int extra = c < 0x80 ? 0 : c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+            uint32_t wc = extra == 0 ? c : c & (0x3F >> extra);
+            for (int k = 1; k <= extra && i + k < buf->len; k++) {
+                wc = (wc << 6) | (data[i + k] & 0x3F);
+            }
+            screen_put(screen, (wchar_t)wc);
+            i += 1 + extra;
+        }
+    }
+}
+
+static bool screen_shows(const Screen* screen, const Framebuffer* fb) {
+    size_t cells = (size_t)fb->width * fb->height;
+    return !screen->bad &&
+           memcmp(screen->chars, fb->chars, cells * sizeof(wchar_t)) == 0 &&
+           memcmp(screen->colors, fb->colors, cells) == 0;
+}
+
+// Glyphs of every UTF-8 length the renderer draws with, and some it might
+static const wchar_t GLYPHS[] = {L' ', L'.', L'#', L'@', L'é', L'░', L'█', L'⣿', L'◢', L'𝄞'};
+#define GLYPH_COUNT (int)(sizeof(GLYPHS) / sizeof(GLYPHS[0]))
+
+static uint32_t rng_state = 12345u;
+
+static uint32_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void fill_random(Framebuffer* fb) {
+    for (int i = 0; i < fb->width * fb->height; i++) {
+        fb->chars[i] = GLYPHS[rng_next() % GLYPH_COUNT];
+        fb->colors[i] = (unsigned char)(rng_next() % COLOR_COUNT);
+    }
+}
+
+// Screen after a keyframe of a and then the diff from a to b
+static Screen* replay(const Framebuffer* a, const Framebuffer* b, ByteBuffer* diff) {
+    ByteBuffer full;
+    byte_buffer_init(&full);
+    CHECK(frame_encode_full(a, &full) == 0);
+    Screen* screen = screen_create(b->width, b->height);
+    screen_feed(screen, &full);
+    CHECK(screen_shows(screen, a));
+    byte_buffer_free(&full);
+
+    CHECK(frame_encode_diff(a, b, diff) == 0);
+    screen->moves = 0;
+    screen_feed(screen, diff);
+    return screen;
+}
+
+static void test_random_changes(void) {
+    Framebuffer* a = framebuffer_create(37, 11);
+    Framebuffer* b = framebuffer_create(37, 11);
+    fill_random(a);
+    for (int round = 0; round < 50; round++) {
+        framebuffer_copy(b, a);
+        // From a single cell to most of the frame
+        int changes = 1 + (int)(rng_next() % (unsigned)(round * 8 + 1));
+        for (int k = 0; k < changes; k++) {
+            int idx = (int)(rng_next() % (unsigned)(b->width * b->height));
+            b->chars[idx] = GLYPHS[rng_next() % GLYPH_COUNT];
+            b->colors[idx] = (unsigned char)(rng_next() % COLOR_COUNT);
+        }
+        ByteBuffer diff;
+        byte_buffer_init(&diff);
+        Screen* screen = replay(a, b, &diff);
+        CHECK(screen_shows(screen, b));
+        screen_destroy(screen);
+        byte_buffer_free(&diff);
+        framebuffer_copy(a, b);
+    }
+    framebuffer_destroy(a);
+    framebuffer_destroy(b);
+}
+
+static void test_gap_merging(void) {
+    Framebuffer* a = framebuffer_create(20, 3);
+    Framebuffer* b = framebuffer_create(20, 3);
+    for (int i = 0; i < 60; i++) {
+        a->chars[i] = L'.';
+    }
+    framebuffer_copy(b, a);
+
+    // A short unchanged gap is re-sent as part of one run
+    b->chars[20 + 2] = L'█';
+    b->chars[20 + 5] = L'#';
+    b->colors[20 + 5] = COLOR_CUBE;
+    ByteBuffer diff;
+    byte_buffer_init(&diff);
+    Screen* screen = replay(a, b, &diff);
+    CHECK(screen_shows(screen, b));
+    CHECK(screen->moves == 1);
+    screen_destroy(screen);
+    byte_buffer_free(&diff);
+
+    // A long one is jumped over
+    b->chars[20 + 15] = L'𝄞';
+    byte_buffer_init(&diff);
+    screen = replay(a, b, &diff);
+    CHECK(screen_shows(screen, b));
+    CHECK(screen->moves == 2);
+    screen_destroy(screen);
+    byte_buffer_free(&diff);
+
+    // A change at the end of a row and the start of the next
+    framebuffer_copy(b, a);
+    b->chars[19] = L'é';
+    b->chars[20] = L'é';
+    byte_buffer_init(&diff);
+    screen = replay(a, b, &diff);
+    CHECK(screen_shows(screen, b));
+    screen_destroy(screen);
+    byte_buffer_free(&diff);
+
+    framebuffer_destroy(a);
+    framebuffer_destroy(b);
+}
+
+static void test_unchanged_and_resized(void) {
+    Framebuffer* a = framebuffer_create(16, 4);
+    Framebuffer* b = framebuffer_create(24, 6);
+    fill_random(a);
+    fill_random(b);
+
+    ByteBuffer diff;
+    byte_buffer_init(&diff);
+    CHECK(frame_encode_diff(a, a, &diff) == 0);
+    CHECK(diff.len == 0);
+
+    // Other dimensions, or no previous frame, send the whole frame
+    CHECK(frame_encode_diff(a, b, &diff) == 0);
+    Screen* screen = screen_create(b->width, b->height);
+    screen_feed(screen, &diff);
+    CHECK(screen_shows(screen, b));
+    screen_destroy(screen);
+
+    diff.len = 0;
+    CHECK(frame_encode_diff(NULL, b, &diff) == 0);
+    screen = screen_create(b->width, b->height);
+    screen_feed(screen, &diff);
+    CHECK(screen_shows(screen, b));
+    screen_destroy(screen);
+
+    byte_buffer_free(&diff);
+    framebuffer_destroy(a);
+    framebuffer_destroy(b);
+}
+
+int main(void) {
+    test_random_changes();
+    test_gap_merging();
+    test_unchanged_and_resized();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("encode: all checks passed\n");
+    return 0;
+}
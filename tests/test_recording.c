@@ -0,0 +1,243 @@
+// Records a generated session and checks the player gives back every frame,
+// stepping, seeking, without an index and from damaged files.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "recording.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define FRAMES        250    // One every 100 ms
+#define RESIZE_FRAME  120    // Grows the frame at 12 s
+#define REPEAT_FRAME  50     // Same as the frame before; not recorded
+// Keyframes at 0 s, 10 s, the resize at 12 s and 10 s after it
+#define KEYFRAMES     4
+
+typedef struct {
+    Framebuffer* fb;
+    uint32_t ms;
+} Expected;
+
+static Expected expected[FRAMES];
+static int expected_count = 0;
+
+// A frame of many distinct glyphs, so the palette has to grow, with a block
+// that moves every frame and a row of one glyph every seventh frame
+static void fill_frame(Framebuffer* fb, int n) {
+    int cells = fb->width * fb->height;
+    for (int i = 0; i < cells; i++) {
+        fb->chars[i] = (wchar_t)(0x2800 + (i * 37) % 300);
+        fb->colors[i] = (unsigned char)(i % COLOR_COUNT);
+    }
+    int frame = n == REPEAT_FRAME ? n - 1 : n;
+    for (int k = 0; k < 5; k++) {
+        int i = (frame * 13 + k) % cells;
+        fb->chars[i] = (wchar_t)('A' + frame % 26);
+        fb->colors[i] = COLOR_CUBE;
+    }
+    if (frame % 7 == 0) {
+        int row = frame % fb->height;
+        for (int x = 0; x < fb->width; x++) {
+            fb->chars[row * fb->width + x] = L'─';
+            fb->colors[row * fb->width + x] = COLOR_FPS;
+        }
+    }
+}
+
+static bool same_frame(const Framebuffer* a, const Framebuffer* b) {
+    size_t cells = (size_t)a->width * a->height;
+    return a->width == b->width && a->height == b->height &&
+           memcmp(a->chars, b->chars, cells * sizeof(wchar_t)) == 0 &&
+           memcmp(a->colors, b->colors, cells) == 0;
+}
+
+// Record the session to path, finishing the file (with its index) or not
+static void record_session(const char* path, bool finish) {
+    Recorder* recorder = recorder_create(path);
+    CHECK(recorder != NULL);
+    if (!recorder) return;
+    for (int n = 0; n < FRAMES; n++) {
+        Framebuffer* fb = n < RESIZE_FRAME ? framebuffer_create(20, 8) : framebuffer_create(24, 10);
+        fill_frame(fb, n);
+        CHECK(recorder_write(recorder, fb, n * 0.1) == 0);
+        framebuffer_destroy(fb);
+    }
+    if (finish) {
+        CHECK(recorder_finish(recorder) == 0);
+    }
+    recorder_destroy(recorder);
+}
+
+static void build_expected(void) {
+    for (int n = 0; n < FRAMES; n++) {
+        if (n == REPEAT_FRAME) {
+            continue;
+        }
+        Framebuffer* fb = n < RESIZE_FRAME ? framebuffer_create(20, 8) : framebuffer_create(24, 10);
+        fill_frame(fb, n);
+        expected[expected_count++] = (Expected){fb, (uint32_t)n * 100};
+    }
+}
+
+// Last expected frame shown at or before ms
+static const Expected* expected_at(uint32_t ms) {
+    const Expected* found = &expected[0];
+    for (int i = 0; i < expected_count && expected[i].ms <= ms; i++) {
+        found = &expected[i];
+    }
+    return found;
+}
+
+static void check_playback(const char* path) {
+    RecordingPlayer* player = recording_player_open(path);
+    CHECK(player != NULL);
+    if (!player) return;
+    CHECK(player->index_count == KEYFRAMES);
+    CHECK(player->frame_count == (uint32_t)expected_count);
+    CHECK(player->duration_ms == expected[expected_count - 1].ms);
+    CHECK(player->index[1].time_ms == 10000);
+    CHECK(player->index[2].time_ms == RESIZE_FRAME * 100);
+
+    for (int i = 0; i < expected_count; i++) {
+        CHECK(recording_player_next_time(player) == (int64_t)expected[i].ms);
+        CHECK(recording_player_step(player) == 1);
+        CHECK(player->time_ms == expected[i].ms);
+        CHECK(same_frame(player->frame, expected[i].fb));
+    }
+    CHECK(recording_player_next_time(player) == -1);
+    CHECK(recording_player_step(player) == 0);
+
+    // Backwards and forwards, onto keyframes, between frames and past the end
+    const uint32_t seeks[] = {24000, 0, 5050, 9999, 10000, 10100, 11950, 12000, 4900, 5000, 22000, 99999};
+    for (size_t k = 0; k < sizeof(seeks) / sizeof(seeks[0]); k++) {
+        CHECK(recording_player_seek(player, seeks[k]) == 0);
+        const Expected* want = expected_at(seeks[k]);
+        CHECK(player->time_ms == want->ms);
+        CHECK(same_frame(player->frame, want->fb));
+    }
+
+    // Stepping goes on from where a seek left off
+    CHECK(recording_player_seek(player, 9950) == 0);
+    CHECK(recording_player_step(player) == 1);
+    CHECK(same_frame(player->frame, expected_at(10000)->fb));
+    recording_player_close(player);
+}
+
+// Copy the first size bytes of src to dst, with byte at flip replaced by value
+static void write_damaged(const char* src, const char* dst, long size, long flip, int value) {
+    FILE* in = fopen(src, "rb");
+    FILE* out = fopen(dst, "wb");
+    for (long i = 0; i < size; i++) {
+        int c = fgetc(in);
+        if (c == EOF) break;
+        fputc(i == flip ? value : c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static long file_size(const char* path) {
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+static void check_damaged(const char* path, const char* scratch) {
+    long size = file_size(path);
+
+    // Cut inside the header or the first keyframe: nothing to play
+    write_damaged(path, scratch, 4, -1, 0);
+    CHECK(recording_player_open(scratch) == NULL);
+    write_damaged(path, scratch, (long)sizeof(RecordingHeader) + 3, -1, 0);
+    CHECK(recording_player_open(scratch) == NULL);
+
+    // Cut in the middle: the index is gone, and the frames before the cut
+    // play while the record it split is left out
+    write_damaged(path, scratch, size / 2, -1, 0);
+    RecordingPlayer* player = recording_player_open(scratch);
+    CHECK(player != NULL);
+    if (player) {
+        CHECK(player->frame_count > 0 && player->frame_count < (uint32_t)expected_count);
+        int decoded = 0;
+        while (recording_player_step(player) == 1) {
+            CHECK(same_frame(player->frame, expected[decoded].fb));
+            decoded++;
+        }
+        CHECK(decoded == (int)player->frame_count);
+        CHECK(recording_player_step(player) == 0);
+        recording_player_close(player);
+    }
+
+    // A record that is not a record is reported, not decoded
+    player = recording_player_open(path);
+    CHECK(player != NULL);
+    if (player) {
+        CHECK(recording_player_step(player) == 1);
+        long second = (long)player->next;
+        recording_player_close(player);
+        write_damaged(path, scratch, size, second, 'X');
+        player = recording_player_open(scratch);
+        CHECK(player != NULL);
+        if (player) {
+            CHECK(recording_player_step(player) == 1);
+            CHECK(recording_player_step(player) == -1);
+            recording_player_close(player);
+        }
+    }
+
+    // Not a recording at all
+    write_damaged(path, scratch, size, 0, 'Z');
+    CHECK(recording_player_open(scratch) == NULL);
+}
+
+static void make_path(char* path) {
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd >= 0) close(fd);
+}
+
+int main(void) {
+    char finished[] = "/tmp/test_recording_XXXXXX";
+    char unfinished[] = "/tmp/test_recording_XXXXXX";
+    char scratch[] = "/tmp/test_recording_XXXXXX";
+    make_path(finished);
+    make_path(unfinished);
+    make_path(scratch);
+
+    build_expected();
+    record_session(finished, true);
+    check_playback(finished);
+
+    // The recorder never finished: the player walks the records instead
+    record_session(unfinished, false);
+    CHECK(file_size(unfinished) < file_size(finished));
+    check_playback(unfinished);
+
+    check_damaged(finished, scratch);
+
+    unlink(finished);
+    unlink(unfinished);
+    unlink(scratch);
+    for (int i = 0; i < expected_count; i++) {
+        framebuffer_destroy(expected[i].fb);
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("recording: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+// Compiles scene sources and checks the error messages, distances against
+// closed forms, and that batched evaluation matches the single-point path.
+
+#include "sdf_program.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define EPSILON 1e-5f
+
+static void check_error(int line, const char* source, const char* message) {
+    char error[256] = "";
+    SdfProgram* program = sdf_program_compile(source, error, sizeof(error));
+    if (program || strcmp(error, message) != 0) {
+        fprintf(stderr, "%s:%d: expected \"%s\", got \"%s\"\n", __FILE__, line, message,
+                program ? "a program" : error);
+        failures++;
+    }
+    sdf_program_destroy(program);
+}
+
+#define CHECK_ERROR(source, message) check_error(__LINE__, source, message)
+
+// source nested count deep: open is repeated, then inner, then close
+static char* repeat(const char* open, const char* inner, const char* close, int count) {
+    size_t size = (strlen(open) + strlen(close)) * (size_t)count + strlen(inner) + 1;
+    char* text = malloc(size);
+    text[0] = '\0';
+    for (int i = 0; i < count; i++) strcat(text, open);
+    strcat(text, inner);
+    for (int i = 0; i < count; i++) strcat(text, close);
+    return text;
+}
+
+static void test_errors(void) {
+    CHECK_ERROR("", "line 1: scene is empty");
+    CHECK_ERROR("# only a comment\n\n", "line 3: scene is empty");
+    CHECK_ERROR("sphere 1\n\ncube 1\n", "line 3: unknown shape 'cube'");
+    CHECK_ERROR("union {\n}\n", "line 2: empty block");
+    CHECK_ERROR("union {\n  sphere 1\n", "line 3: expected '}' but found 'end of file'");
+    CHECK_ERROR("sphere 1\n}\n", "line 2: unexpected '}'");
+    CHECK_ERROR("translate 1 2 3\n  sphere 1\n", "line 2: expected '{' but found 'sphere'");
+    CHECK_ERROR("box 1 -1 1", "line 1: size must be positive");
+    CHECK_ERROR("sphere\n  big", "line 2: expected a number but found 'big'");
+    CHECK_ERROR("torus 2", "line 1: expected a number but found 'end of file'");
+    CHECK_ERROR("rotate w 90 { sphere 1 }", "line 1: expected rotation axis x, y or z");
+    CHECK_ERROR("smooth_union -1 { sphere 1 }", "line 1: smoothing must not be negative");
+
+    // Every level pushes a distance before the next opens
+    char* deep = repeat("union { sphere 1 ", "sphere 1", " }", SDF_PROGRAM_MAX_STACK);
+    CHECK_ERROR(deep, "line 1: scene is nested too deeply");
+    free(deep);
+    char* transforms = repeat("translate 0 0 1 {\n", "sphere 1\n", "}\n", SDF_PROGRAM_MAX_STACK + 1);
+    CHECK_ERROR(transforms, "line 33: too many nested transforms");
+    free(transforms);
+    char* blocks = repeat("union {\n", "sphere 1\n", "}\n", 65);
+    CHECK_ERROR(blocks, "line 65: scene is nested too deeply");
+    free(blocks);
+
+    // As deep as the stacks go still compiles
+    char* deepest = repeat("union { sphere 1 ", "sphere 1", " }", SDF_PROGRAM_MAX_STACK - 1);
+    char error[256] = "";
+    SdfProgram* program = sdf_program_compile(deepest, error, sizeof(error));
+    CHECK(program != NULL);
+    sdf_program_destroy(program);
+    free(deepest);
+
+    // A short buffer gets a truncated, terminated message
+    char small[12];
+    memset(small, 'x', sizeof(small));
+    CHECK(sdf_program_compile("cube", small, sizeof(small)) == NULL);
+    CHECK(strcmp(small, "line 1: unk") == 0);
+}
+
+static SdfProgram* compile(const char* source) {
+    char error[256] = "";
+    SdfProgram* program = sdf_program_compile(source, error, sizeof(error));
+    if (!program) {
+        fprintf(stderr, "failed to compile \"%s\": %s\n", source, error);
+        failures++;
+    }
+    return program;
+}
+
+static void check_distance(int line, const char* source, Vec3 p, float expected) {
+    SdfProgram* program = compile(source);
+    if (!program) return;
+    float d = sdf_program_eval(program, p);
+    if (fabsf(d - expected) > EPSILON) {
+        fprintf(stderr, "%s:%d: \"%s\" at (%g, %g, %g): expected %g, got %g\n", __FILE__, line,
+                source, p.x, p.y, p.z, expected, d);
+        failures++;
+    }
+    sdf_program_destroy(program);
+}
+
+#define CHECK_DISTANCE(source, x, y, z, expected) check_distance(__LINE__, source, (Vec3){x, y, z}, expected)
+
+static void test_distances(void) {
+    // Primitives
+    CHECK_DISTANCE("box 1 2 3", 3, 0, 0, 2);
+    CHECK_DISTANCE("box 1 2 3", 0, 0, 0, -1);
+    CHECK_DISTANCE("box 1 2 3", 0, -1.5f, 0, -0.5f);
+    CHECK_DISTANCE("box 1 2 3", 2, 3, 4, sqrtf(3));
+    CHECK_DISTANCE("sphere 2", 0, 3, 4, 3);
+    CHECK_DISTANCE("sphere 2", 0, 0, 0, -2);
+    CHECK_DISTANCE("torus 2 0.5", 2, 0, 0, -0.5f);
+    CHECK_DISTANCE("torus 2 0.5", 0, 1, 2, 0.5f);
+    CHECK_DISTANCE("torus 2 0.5", 5, 0, 0, 2.5f);
+    CHECK_DISTANCE("torus 2 0.5", 0, 0, 0, sqrtf(4) - 0.5f);
+
+    // Combinations
+    CHECK_DISTANCE("sphere 1 translate 4 0 0 { sphere 1 }", 2.5f, 0, 0, 0.5f);
+    CHECK_DISTANCE("union { sphere 1 translate 4 0 0 { sphere 1 } }", 1.5f, 0, 0, 0.5f);
+    CHECK_DISTANCE("intersect { box 1 1 1 sphere 1.2 }", 0, 0, 0, -1);
+    CHECK_DISTANCE("intersect { box 1 1 1 sphere 1.2 }", 1, 1, 1, sqrtf(3) - 1.2f);
+    CHECK_DISTANCE("subtract { box 1 1 1 sphere 0.5 }", 0, 0, 0, 0.5f);
+    CHECK_DISTANCE("subtract { box 1 1 1 sphere 0.5 }", 0.75f, 0, 0, -0.25f);
+    // Halfway between two spheres both distances are 0.5; the blend dips k / 4
+    CHECK_DISTANCE("smooth_union 0.5 { sphere 1 translate 3 0 0 { sphere 1 } }", 1.5f, 0, 0, 0.375f);
+    CHECK_DISTANCE("smooth_union 0 { sphere 1 translate 3 0 0 { sphere 1 } }", 1.5f, 0, 0, 0.5f);
+
+    // Transforms
+    CHECK_DISTANCE("translate 1 2 3 { sphere 1 }", 1, 2, 5, 1);
+    CHECK_DISTANCE("rotate z 90 { box 2 1 1 }", 0, 3, 0, 1);
+    CHECK_DISTANCE("rotate z 90 { box 2 1 1 }", 3, 0, 0, 2);
+    CHECK_DISTANCE("rotate x 90 { torus 2 0.5 }", 0, 2, 0, -0.5f);
+    CHECK_DISTANCE("scale 2 { sphere 1 }", 5, 0, 0, 3);
+    CHECK_DISTANCE("scale 0.5 { box 1 1 1 }", 0, 0, 0, -0.5f);
+    CHECK_DISTANCE("translate 1 0 0 { rotate y 90 { scale 2 { box 1 0.5 0.5 } } }", 1, 0, 3, 1);
+    CHECK_DISTANCE("translate 1 0 0 { rotate y 90 { scale 2 { box 1 0.5 0.5 } } }", 3, 0, 0, 1);
+    // The point is restored after a block, for the shapes that follow it
+    CHECK_DISTANCE("union { translate 10 0 0 { sphere 1 } sphere 1 }", 0, 0, 2, 1);
+
+    // The bound contains the surface
+    SdfProgram* program = compile("translate 3 0 0 { scale 2 { sphere 1 } }");
+    if (program) {
+        CHECK(program->bound >= 5.0f);
+        CHECK(sdf_program_eval(program, (Vec3){program->bound, 0, 0}) >= -EPSILON);
+        sdf_program_destroy(program);
+    }
+}
+
+static void test_batch(void) {
+    SdfProgram* program = compile(
+        "# Every opcode\n"
+        "smooth_union 0.3 {\n"
+        "  subtract { box 1 0.8 0.6 sphere 0.9 }\n"
+        "  translate 0.5 -0.2 0.1 { rotate x 30 { torus 0.7 0.2 } }\n"
+        "  intersect { scale 1.5 { sphere 0.5 } rotate y 45 { box 0.6 0.6 0.6 } }\n"
+        "}\n"
+        "translate 0 1.5 0 { sphere 0.3 }\n");
+    if (!program) return;
+
+    unsigned int seed = 7u;
+    for (int round = 0; round < 200; round++) {
+        int count = 1 + round % SDF_PROGRAM_BATCH;
+        Vec3 points[SDF_PROGRAM_BATCH];
+        for (int i = 0; i < count; i++) {
+            float v[3];
+            for (int a = 0; a < 3; a++) {
+                seed = seed * 1664525u + 1013904223u;
+                v[a] = ((float)(seed >> 8) / (float)(1u << 24)) * 5.0f - 2.5f;
+            }
+            points[i] = (Vec3){v[0], v[1], v[2]};
+        }
+        // Lanes past count must be left alone
+        float out[SDF_PROGRAM_BATCH + 1];
+        for (int i = 0; i <= SDF_PROGRAM_BATCH; i++) out[i] = -99.0f;
+        sdf_program_eval_batch(program, points, out, count);
+        for (int i = 0; i < count; i++) {
+            CHECK(fabsf(out[i] - sdf_program_eval(program, points[i])) <= EPSILON);
+        }
+        for (int i = count; i <= SDF_PROGRAM_BATCH; i++) {
+            CHECK(out[i] == -99.0f);
+        }
+    }
+    sdf_program_destroy(program);
+}
+
+int main(void) {
+    test_errors();
+    test_distances();
+    test_batch();
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("sdf_program: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,95 @@
+#define _POSIX_C_SOURCE 200809L
+
+// Minimal viewer for `ascii_cube --serve PATH`: connects to the socket and
+// copies the already-encoded terminal stream to stdout.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR && !stop_requested) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SOCKET_PATH\n", argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        return 2;
+    }
+    strcpy(addr.sun_path, argv[1]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // No SA_RESTART: a signal must interrupt the blocking read
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Keep typed keys from scribbling over the picture
+    struct termios orig;
+    int have_tty = tcgetattr(STDIN_FILENO, &orig) == 0;
+    if (have_tty) {
+        struct termios quiet = orig;
+        quiet.c_lflag &= ~(ECHO | ICANON);
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &quiet);
+    }
+
+    const char* enter = "\033[?25l\033[2J";
+    const char* leave = "\033[0m\033[2J\033[H\033[?25h";
+    write_all(STDOUT_FILENO, enter, strlen(enter));
+
+    char buf[65536];
+    while (!stop_requested) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        if (write_all(STDOUT_FILENO, buf, (size_t)n) != 0) {
+            break;
+        }
+    }
+
+    write_all(STDOUT_FILENO, leave, strlen(leave));
+    if (have_tty) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+    }
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+
+// Sample consumer for `ascii_cube --shm NAME`: maps the frame ring
+// read-only and follows published frames without copying or parsing them.
+//
+//   frame_ring_reader NAME [--print]
+//
+// Prints one summary line per frame; --print also dumps the newest frame as
+// plain text once on exit.
+
+#include "frame_ring.h"
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_handler(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static FrameRingHeader* map_ring(int fd, size_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameRingHeader)) {
+        return NULL;
+    }
+    void* addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return addr;
+}
+
+static void print_utf8(uint32_t c) {
+    char buf[4];
+    int n;
+    if (c < 0x80) {
+        buf[0] = (char)c; n = 1;
+    } else if (c < 0x800) {
+        buf[0] = (char)(0xC0 | (c >> 6)); buf[1] = (char)(0x80 | (c & 0x3F)); n = 2;
+    } else {
+        buf[0] = (char)(0xE0 | (c >> 12)); buf[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+        buf[2] = (char)(0x80 | (c & 0x3F)); n = 3;
+    }
+    fwrite(buf, 1, (size_t)n, stdout);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s NAME [--print]\n", argv[0]);
+        return 2;
+    }
+    int print_frame = argc > 2 && strcmp(argv[2], "--print") == 0;
+
+    int fd = shm_open(argv[1], O_RDONLY, 0);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    size_t size = 0;
+    FrameRingHeader* header = map_ring(fd, &size);
+    if (!header || header->magic != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION) {
+        fprintf(stderr, "%s is not a frame ring\n", argv[1]);
+        return 1;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    uint64_t seen = 0;
+    uint64_t last_frame = 0;
+    unsigned long frames = 0, retries = 0, skipped = 0;
+    const struct timespec nap = {0, 2000000};
+
+    while (!stop_requested) {
+        uint64_t layout = atomic_load_explicit(&header->layout, memory_order_acquire);
+        if (layout & 1) {
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        if (header->total_size > size) {
+            // The writer grew the ring; pick up the new geometry
+            munmap(header, size);
+            header = map_ring(fd, &size);
+            if (!header) return 1;
+            continue;
+        }
+
+        uint64_t published = atomic_load_explicit(&header->published, memory_order_acquire);
+        if (published == seen) {
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        FrameRingSlot* slot = frame_ring_slot(header, published - 1);
+        uint64_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (seq & 1) {
+            retries++;
+            continue;
+        }
+
+        // Work directly on the shared cells
+        uint64_t frame_number = slot->frame_number;
+        uint32_t width = slot->width;
+        uint32_t height = slot->height;
+        const FrameRingCell* cells = frame_ring_cells(slot);
+        unsigned long cube_cells = 0;
+        for (uint32_t i = 0; i < width * height && i < header->slot_capacity; i++) {
+            cube_cells += cells[i].color == COLOR_CUBE;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != seq ||
+            atomic_load_explicit(&header->layout, memory_order_relaxed) != layout) {
+            retries++;  // Overwritten while we looked at it
+            continue;
+        }
+
+        if (frames > 0 && frame_number > last_frame + 1) {
+            skipped += (unsigned long)(frame_number - last_frame - 1);
+        }
+        printf("frame %llu  %ux%u  cube cells %lu\n",
+               (unsigned long long)frame_number, width, height, cube_cells);
+        fflush(stdout);
+        seen = published;
+        last_frame = frame_number;
+        frames++;
+    }
+
+    if (print_frame && seen > 0) {
+        FrameRingSlot* slot = frame_ring_slot(header, seen - 1);
+        const FrameRingCell* cells = frame_ring_cells(slot);
+        for (uint32_t y = 0; y < slot->height; y++) {
+            for (uint32_t x = 0; x < slot->width; x++) {
+                print_utf8(cells[y * slot->width + x].codepoint);
+            }
+            putchar('\n');
+        }
+    }
+
+    fprintf(stderr, "%lu frames read, %lu skipped, %lu retries\n", frames, skipped, retries);
+    munmap(header, size);
+    close(fd);
+    return 0;
+}